@@ -58,6 +58,16 @@ varying vec4 vWorldPos;
 uniform float cTerrainNormalHeight;
 uniform float cTerrainDeformAmount;
 
+#ifdef GEOMORPH
+    // xyz: position on the parent's chunk, w: edge length of the chunk
+    #ifdef COMPILEVS
+        attribute vec4 iTexCoord2;
+    #endif
+
+    // x: subdivide distance per edge length, y-z: morph start and end
+    uniform vec3 cTerrainMorph;
+#endif
+
 vec4 textureEquirect(sampler2D tex, vec3 dir)
 {
     //vec2 dirFlat = normalize(dir.zx);
@@ -69,6 +79,17 @@ void VS()
     mat4 modelMatrix = iModelMatrix;
     vec3 worldPos = GetWorldPos(modelMatrix);
 
+    #ifdef GEOMORPH
+        // Blend towards the parent's shape as the chunk gets close to being
+        // replaced by it, see PlanetWrenderer::get_morph_parameters
+        float morphDist = length(worldPos - cCameraPos)
+                / (length(modelMatrix[0].xyz) * iTexCoord2.w * cTerrainMorph.x);
+        float morph = clamp((morphDist - cTerrainMorph.y)
+                / (cTerrainMorph.z - cTerrainMorph.y), 0.0, 1.0);
+        worldPos = (vec4(mix(iPos.xyz, iTexCoord2.xyz, morph), 1.0)
+                * modelMatrix).xyz;
+    #endif
+
     vNormal = GetWorldNormal(modelMatrix);
     vNormalLocal = iNormal;
 
@@ -0,0 +1,89 @@
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/OctreeQuery.h>
+#include <Urho3D/Scene/Node.h>
+
+#include "InstanceGroup.h"
+
+namespace osp
+{
+
+InstanceGroup::InstanceGroup(Context* context) : StaticModel(context),
+                                                    m_numWorldTransforms(0)
+{
+}
+
+void InstanceGroup::ProcessRayQuery(const RayOctreeQuery& query,
+                                    PODVector<RayQueryResult>& results)
+{
+}
+
+void InstanceGroup::UpdateBatches(const FrameInfo& frame)
+{
+    // Getting the world bounding box ensures the transforms are updated
+    const BoundingBox& worldBoundingBox = GetWorldBoundingBox();
+    distance_ = frame.camera_->GetDistance(worldBoundingBox.Center());
+
+    for (unsigned i = 0; i < batches_.Size(); i ++)
+    {
+        batches_[i].distance_ = distance_;
+        batches_[i].worldTransform_ = m_numWorldTransforms
+                                        ? &m_worldTransforms[0]
+                                        : &Matrix3x4::IDENTITY;
+        batches_[i].numWorldTransforms_ = m_numWorldTransforms;
+    }
+
+    const float scale = worldBoundingBox.Size().DotProduct(DOT_SCALE);
+    const float newLodDistance = frame.camera_->GetLodDistance(distance_,
+                                                               scale,
+                                                               lodBias_);
+
+    if (newLodDistance != lodDistance_)
+    {
+        lodDistance_ = newLodDistance;
+        CalculateLodLevels();
+    }
+}
+
+void InstanceGroup::OnWorldBoundingBoxUpdate()
+{
+    // Might be called from multiple worker threads at the same time, so
+    // m_worldTransforms is only written to here, never resized
+    BoundingBox worldBox;
+    unsigned index = 0;
+
+    const Matrix3x4& nodeTransform = node_->GetWorldTransform();
+    const unsigned blocks = get_block_count();
+
+    // Blocks might have changed since resize_instances, but never copy
+    // more than there's space for
+    for (unsigned b = 0; b < blocks; b ++)
+    {
+        unsigned count;
+        const Matrix3x4* block = get_block(b, count);
+
+        for (unsigned i = 0; i < count
+                             && index < m_worldTransforms.Size(); i ++)
+        {
+            const Matrix3x4 transform = nodeTransform * block[i];
+            m_worldTransforms[index] = transform;
+            worldBox.Merge(boundingBox_.Transformed(transform));
+            index ++;
+        }
+    }
+
+    worldBoundingBox_ = worldBox;
+
+    // Store how many were copied instead of resizing, same as
+    // StaticModelGroup
+    m_numWorldTransforms = index;
+}
+
+void InstanceGroup::resize_instances(unsigned count)
+{
+    m_worldTransforms.Resize(count);
+
+    // Transforms and bounding box are redone in OnWorldBoundingBoxUpdate
+    OnMarkedDirty(node_);
+}
+
+} // namespace osp
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Urho3D/Graphics/StaticModel.h>
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+/**
+ * Base for components that draw many copies of a single model and material.
+ * Works like StaticModelGroup, but instance transforms come straight from
+ * blocks kept by the subclass instead of from a Node each, so thousands of
+ * rocks don't need thousands of Nodes. With instancing enabled, they're all
+ * drawn with a single instanced draw call.
+ *
+ * Subclasses describe their blocks with get_block_count and get_block, and
+ * call resize_instances from the main thread when the total changes.
+ * Instances are only decoration, and can't be picked.
+ */
+class InstanceGroup : public StaticModel
+{
+    URHO3D_OBJECT(InstanceGroup, StaticModel)
+
+public:
+
+    InstanceGroup(Context* context);
+    ~InstanceGroup() = default;
+
+    // Overrides from StaticModel
+
+    void ProcessRayQuery(const RayOctreeQuery& query,
+                         PODVector<RayQueryResult>& results) override;
+
+    void UpdateBatches(const FrameInfo& frame) override;
+
+    unsigned GetNumOccluderTriangles() override { return 0; }
+
+protected:
+
+    void OnWorldBoundingBoxUpdate() override;
+
+    /**
+     * Make room for a number of instances, and redo the transforms and
+     * bounding box. Only call from the main thread, as the world transforms
+     * can't be resized while they're being updated in worker threads.
+     * @param count [in] Total number of instances in all blocks
+     */
+    void resize_instances(unsigned count);
+
+    /**
+     * @return Number of blocks of transforms. Might be called from worker
+     *         threads
+     */
+    virtual unsigned get_block_count() const = 0;
+
+    /**
+     * @param block [in] Index of block, less than get_block_count
+     * @param count [out] Number of transforms in the block
+     * @return First transform of the block, relative to the node
+     */
+    virtual const Matrix3x4* get_block(unsigned block,
+                                       unsigned& count) const = 0;
+
+private:
+
+    // Transforms of each instance, ready for drawing
+    PODVector<Matrix3x4> m_worldTransforms;
+
+    // How many of m_worldTransforms are in use
+    unsigned m_numWorldTransforms;
+};
+
+} // namespace osp
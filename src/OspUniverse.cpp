@@ -1,5 +1,7 @@
 #include <Urho3D/AngelScript/Script.h>
 #include <Urho3D/AngelScript/ScriptFile.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Timer.h>
 #include <Urho3D/Graphics/Material.h>
 #include <Urho3D/Graphics/StaticModel.h>
 #include <Urho3D/Graphics/Technique.h>
@@ -11,18 +13,32 @@
 #include <Urho3D/Resource/ResourceCache.h>
 
 #include "Satellites/ActiveArea.h"
+#include "Satellites/AsteroidBelt.h"
 #include "Satellites/AstronomicalBody.h"
 #include "Machines/MachineControl.h"
 #include "Machines/MachineRocket.h"
 #include "Satellites/NodeSat.h"
+#include "Satellites/SatellitePositions.h"
 #include "Terrain/PlanetTerrain.h"
+#include "Trajectories/SoiScheduler.h"
+#include "Trajectories/TrajectoryKepler.h"
+#include "Trajectories/TrajectoryNBody.h"
+#include "ParallelWork.h"
 #include "OspUniverse.h"
 
 namespace osp
 {
 
+static void gather_work(const WorkItem* item, unsigned threadIndex)
+{
+    static_cast<ActiveArea*>(item->aux_)->gather();
+}
+
 OspUniverse::OspUniverse(Context* context) : Object(context)
 {
+    // Before anything has a chance to move for this frame
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(OspUniverse, begin_frame));
+
     // Create the hidden scene, accesible through angelscript with
     // osp.hiddenScene
     m_hiddenScene = new Scene(context);
@@ -110,6 +126,79 @@ OspUniverse::OspUniverse(Context* context) : Object(context)
     }
 }
 
+void OspUniverse::add_trajectory(Trajectory* trajectory)
+{
+    m_trajectories.Push(SharedPtr<Trajectory>(trajectory));
+
+    SoiScheduler* scheduler = GetSubsystem<SoiScheduler>();
+
+    if (scheduler && trajectory->IsInstanceOf<TrajectoryKepler>())
+    {
+        scheduler->add_trajectory(static_cast<TrajectoryKepler*>(trajectory));
+    }
+}
+
+void OspUniverse::begin_frame(StringHash eventType, VariantMap& eventData)
+{
+    using namespace BeginFrame;
+
+    m_time += eventData[P_TIMESTEP].GetFloat();
+
+    // Move Satellites between spheres of influence before they're put on
+    // their new orbits
+    if (SoiScheduler* scheduler = GetSubsystem<SoiScheduler>())
+    {
+        scheduler->update(m_time);
+    }
+
+    // Satellites on rails move first, so the positions below include them
+    for (SharedPtr<Trajectory>& trajectory : m_trajectories)
+    {
+        trajectory->update(m_time);
+    }
+
+    SatellitePositions* positions = GetSubsystem<SatellitePositions>();
+
+    if (!positions)
+    {
+        return;
+    }
+
+    // Gathering only reads positions, so they have to be up to date first
+    positions->update();
+
+    // Forget about ActiveAreas that were deleted
+    for (unsigned i = 0; i < m_activeAreas.Size(); )
+    {
+        if (m_activeAreas[i].Expired())
+        {
+            m_activeAreas.EraseSwap(i);
+        }
+        else
+        {
+            i ++;
+        }
+    }
+
+    if (m_activeAreas.Empty())
+    {
+        return;
+    }
+
+    // Nothing modifies the universe until every ActiveArea is done, so they
+    // can all gather at once
+    for (WeakPtr<ActiveArea>& area : m_activeAreas)
+    {
+        SharedPtr<WorkItem> item(new WorkItem());
+        item->workFunction_ = gather_work;
+        item->aux_ = area.Get();
+
+        m_gatherItems.Push(item);
+    }
+
+    complete_work(GetSubsystem<WorkQueue>(), m_gatherItems);
+}
+
 void OspUniverse::debug_function(const StringHash which)
 {
     // Get scene
@@ -132,33 +221,90 @@ void OspUniverse::debug_function(const StringHash which)
     {
         URHO3D_LOGINFOF("Creating universe...");
 
-        // Destroy the universe first
+        // Destroy the universe first, along with what moved it
         m_bigUniverse = nullptr;
+        m_trajectories.Clear();
+
+        if (SoiScheduler* scheduler = GetSubsystem<SoiScheduler>())
+        {
+            scheduler->clear();
+        }
 
         // AstronomicalBody is currently hard-coded to default to a very dense
         // astroid-sized ridiculously spherical 4km radius bumpy ball
 
         // Set the root of the universe to a default astronomical body
-        m_bigUniverse = new AstronomicalBody(context_);
+        AstronomicalBody* root = new AstronomicalBody(context_);
+        root->set_id("DebugRoot");
+        m_bigUniverse = root;
+
+        if (SatellitePositions* positions
+                = GetSubsystem<SatellitePositions>())
+        {
+            positions->set_root(root);
+        }
+
+        // Low parts of the bumpy ball are underwater
+        root->set_sea_level(40.0f);
+
+        // Air like Earth's, squished 100 times thinner to fit the tiny
+        // planet, so the sky looks about as blue from the ground
+        AtmosphereProfile air;
+        air.m_height = 600.0f;
+        air.m_rayleighScattering = Vector3(5.8e-4f, 13.5e-4f, 33.1e-4f);
+        air.m_rayleighScaleHeight = 80.0f;
+        air.m_mieScattering = 21e-4f;
+        air.m_mieExtinction = 21e-4f / 0.9f;
+        air.m_mieScaleHeight = 12.0f;
+        root->set_atmosphere(air);
 
         // Add some more AstronomicalBody
 
         AstronomicalBody* moonA = new AstronomicalBody(context_);
+        moonA->set_id("DebugMoonA");
         moonA->set_position(LongVector3(1024 * 16000, 0, 0));
         m_bigUniverse->add_child(moonA);
 
         AstronomicalBody* moonB = new AstronomicalBody(context_);
+        moonB->set_id("DebugMoonB");
         moonB->set_position(LongVector3(-1024 * 16000, 0, 0));
         m_bigUniverse->add_child(moonB);
         
         AstronomicalBody* moonBA = new AstronomicalBody(context_);
+        moonBA->set_id("DebugMoonBA");
         moonBA->set_position(LongVector3(0, 0, 1024 * 16000));
         moonB->add_child(moonBA);
 
         AstronomicalBody* moonBAA = new AstronomicalBody(context_);
+        moonBAA->set_id("DebugMoonBAA");
         moonBAA->set_position(LongVector3(0, 0, 1024 * 16000));
         moonBA->add_child(moonBAA);
 
+        // Put moonA and moonB on opposite sides of a circular orbit, starting
+        // from where they are now. It's upright, in the plane where z = 0,
+        // so moonBA and moonBAA riding along with moonB never go near the
+        // root. Pulled by 9.81m/s^2 at the root's surface, 4km from its
+        // center.
+        const double gravParam = 9.81 * 4000.0 * 4000.0;
+        const double orbitRadius = 16000.0;
+        const double meanMotion = Sqrt(gravParam / (orbitRadius
+                                       * orbitRadius * orbitRadius));
+        const double halfPi = 0.5 * M_PI;
+
+        TrajectoryKepler* orbits = new TrajectoryKepler(context_);
+        orbits->set_center(root, gravParam);
+        orbits->add_orbit(moonA, orbitRadius, 0.0, halfPi, 0.0, 0.0,
+                          -meanMotion * m_time);
+        orbits->add_orbit(moonB, orbitRadius, 0.0, halfPi, 0.0, 0.0,
+                          M_PI - meanMotion * m_time);
+        add_trajectory(orbits);
+
+        // A belt of rocks around the root, between it and the moons. It's
+        // a single Satellite no matter how many rocks it has
+        AsteroidBelt* belt = new AsteroidBelt(context_);
+        m_bigUniverse->add_child(belt);
+        belt->set_shape(8000.0f, 12000.0f, 400.0f);
+
         // Creata a NodeSat to represent the player's craft
         NodeSat* subjectSat = new NodeSat(context_);
         subjectSat->set_node(scene->GetChild("Subject"));
@@ -181,10 +327,11 @@ void OspUniverse::debug_function(const StringHash which)
 
         // Universe tree should look like this:
         // * m_bigUniverse
-        //   * moonA
-        //   * moonB
+        //   * moonA (orbiting)
+        //   * moonB (orbiting)
         //     * moonBA
         //       * moonBAA
+        //   * belt
         //   * subjectSat
         //   * area
 
@@ -203,6 +350,115 @@ void OspUniverse::debug_function(const StringHash which)
         //moonBAA->load(area);
 
     }
+    else if(which == StringHash("terrain_stress"))
+    {
+        // Randomly subdivide and chunk a planet that isn't drawn, and check
+        // if anything breaks. Results are logged, along with the seed.
+        URHO3D_LOGINFOF("Stress testing terrain...");
+
+        PlanetWrenderer planet;
+        planet.initialize(context_, nullptr, 4000.0);
+        planet.debug_stress(2000000, 20, 50000, Time::GetSystemTime());
+    }
+    else if(which == StringHash("terrain_stamp"))
+    {
+        // Dig a crater into the nearest planet, right below the player's
+        // craft. It's saved, so it's still there when the planet reloads.
+        Node* subject = scene->GetChild("Subject");
+        PODVector<PlanetTerrain*> terrains;
+        scene->GetComponents<PlanetTerrain>(terrains, true);
+
+        if (!subject || terrains.Empty())
+        {
+            return;
+        }
+
+        const Vector3 subjectPos = subject->GetWorldPosition();
+        PlanetTerrain* nearest = terrains[0];
+
+        for (unsigned i = 1; i < terrains.Size(); i ++)
+        {
+            if ((terrains[i]->GetNode()->GetWorldPosition() - subjectPos)
+                        .LengthSquared()
+                    < (nearest->GetNode()->GetWorldPosition() - subjectPos)
+                        .LengthSquared())
+            {
+                nearest = terrains[i];
+            }
+        }
+
+        Node* planet = nearest->GetNode();
+
+        TerrainStamp stamp;
+        stamp.m_direction = (planet->GetWorldRotation().Inverse()
+                * (subjectPos - planet->GetWorldPosition())).Normalized();
+        stamp.m_radius = 20.0f;
+        stamp.m_falloff = 10.0f;
+        stamp.m_height = 8.0f;
+        stamp.m_type = StampType::CRATER;
+
+        if (!nearest->add_stamp(stamp))
+        {
+            URHO3D_LOGWARNING("Can't stamp this planet's terrain");
+        }
+    }
+    else if(which == StringHash("kepler_bench"))
+    {
+        // Time solving Kepler's equation for lots of orbits at once
+        SharedPtr<TrajectoryKepler> trajectory(new TrajectoryKepler(context_));
+        trajectory->debug_benchmark(10000, 100);
+        trajectory->debug_benchmark(100000, 20);
+    }
+    else if(which == StringHash("nbody_bench"))
+    {
+        // Time the Barnes-Hut octree against direct summation
+        SharedPtr<TrajectoryNBody> trajectory(new TrajectoryNBody(context_));
+        trajectory->debug_benchmark(1000);
+        trajectory->debug_benchmark(10000);
+        trajectory->debug_benchmark(100000);
+    }
+    else if(which == StringHash("satellite_bench"))
+    {
+        // Time calculating every satellite's position, once with all the
+        // same precision and once with a different precision on each planet
+        SatellitePositions* positions = GetSubsystem<SatellitePositions>();
+
+        if (!positions)
+        {
+            return;
+        }
+
+        for (int mixed = 0; mixed < 2; mixed ++)
+        {
+            URHO3D_LOGINFOF("Satellite positions, %s precisions:",
+                            mixed ? "mixed" : "same");
+
+            SharedPtr<Satellite> root(new NodeSat(context_));
+
+            // 64 planets with 1500 rocks each, a bit under 100000 total
+            for (int i = 0; i < 64; i ++)
+            {
+                NodeSat* planet = new NodeSat(context_);
+                planet->set_position(LongVector3(
+                        int64_t(Random(-1e9f, 1e9f)) * 1024,
+                        int64_t(Random(-1e9f, 1e9f)) * 1024, 0));
+                planet->set_precision(mixed ? 6 + i % 8 : 10);
+                root->add_child(planet);
+
+                for (int j = 0; j < 1500; j ++)
+                {
+                    NodeSat* rock = new NodeSat(context_);
+                    rock->set_position(LongVector3(
+                            int64_t(Random(-1e6f, 1e6f)) * 1024,
+                            int64_t(Random(-1e6f, 1e6f)) * 1024,
+                            int64_t(Random(-1e6f, 1e6f)) * 1024));
+                    planet->add_child(rock);
+                }
+            }
+
+            positions->debug_benchmark(root, 20);
+        }
+    }
 
 }
 
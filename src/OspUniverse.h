@@ -2,12 +2,14 @@
 
 #include <Urho3D/Container/RefCounted.h>
 #include <Urho3D/Container/Str.h>
+#include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/Scene/LogicComponent.h>
 
 #include "LongVector3.h"
 #include "Resource/GLTFFile.h"
 #include "Satellites/AstronomicalBody.h"
 #include "Terrain/PlanetWrenderer.h"
+#include "Trajectories/Trajectory.h"
 
 namespace osp
 {
@@ -30,6 +32,15 @@ class OspUniverse : public Object
     // List of ActiveAreas
     Urho3D::Vector<Urho3D::WeakPtr<ActiveArea>> m_activeAreas;
 
+    // Work items for ActiveAreas gathering on worker threads this frame
+    Urho3D::Vector<Urho3D::SharedPtr<Urho3D::WorkItem>> m_gatherItems;
+
+    // Everything that moves Satellites on rails, updated every frame
+    Urho3D::Vector<Urho3D::SharedPtr<Trajectory>> m_trajectories;
+
+    // Seconds since the universe was created
+    double m_time = 0.0;
+
     //HashMap<StringHash, SharedPtr<ObjectFactory> > m_machines;
 
     //Vector<OspPart>
@@ -43,6 +54,17 @@ public:
 
     Urho3D::Scene* get_hidden_scene() { return m_hiddenScene; }
 
+    /**
+     * Start updating a Trajectory every frame
+     * @param trajectory [in] Trajectory to update
+     */
+    void add_trajectory(Trajectory* trajectory);
+
+    /**
+     * @return Seconds since the universe was created
+     */
+    double get_time() const { return m_time; }
+
     /**
      * Various debug functions that can be called from AngelScript
      * @param which [in] Hash for which function to call
@@ -78,6 +100,13 @@ public:
     
 private:
 
+    /**
+     * Move Satellites on rails and update SatellitePositions, then have
+     * every ActiveArea gather what it needs to load at the same time.
+     * Nothing is loaded or moved until each ActiveArea's physics_update.
+     */
+    void begin_frame(StringHash eventType, VariantMap& eventData);
+
     /**
      * Recursive function used to scan through sturdy files
      * @param partRoot glTF root that should be passed on unchanged
@@ -0,0 +1,33 @@
+#include "ParallelWork.h"
+
+namespace osp
+{
+
+void complete_work(WorkQueue* queue, Vector< SharedPtr<WorkItem> >& items)
+{
+    if (!queue)
+    {
+        for (SharedPtr<WorkItem>& item : items)
+        {
+            item->workFunction_(item, 0);
+        }
+
+        items.Clear();
+        return;
+    }
+
+    for (SharedPtr<WorkItem>& item : items)
+    {
+        item->priority_ = M_MAX_UNSIGNED;
+        queue->AddWorkItem(item);
+    }
+
+    // Takes items off the queue on this thread too until there's none
+    // left, then waits for the workers to finish theirs. Nothing is left
+    // sitting in the queue while this thread waits.
+    queue->Complete(M_MAX_UNSIGNED);
+
+    items.Clear();
+}
+
+} // namespace osp
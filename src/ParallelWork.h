@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+/**
+ * Run work items on the WorkQueue's threads and this one at once, and wait
+ * until they're all done. They're added at the highest priority, so work
+ * queued in the background, like terrain being built, isn't waited for.
+ * @param queue [in] Queue to add to. If null, everything is done on this
+ *                   thread.
+ * @param items [ref] Items to run, with their workFunction_ set. Cleared
+ *                    once they're done.
+ */
+void complete_work(WorkQueue* queue, Vector< SharedPtr<WorkItem> >& items);
+
+} // namespace osp
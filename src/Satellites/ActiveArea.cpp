@@ -2,14 +2,36 @@
 #include <Urho3D/Physics/PhysicsEvents.h>
 #include <Urho3D/Physics/PhysicsWorld.h>
 #include <Urho3D/Physics/CollisionShape.h>
+#include <Urho3D/Physics/PhysicsUtils.h>
+#include <Urho3D/ThirdParty/Bullet/BulletDynamics/Dynamics/btRigidBody.h>
 
 #include "ActiveArea.h"
+#include "AstronomicalBody.h"
+#include "PositionMath.h"
+#include "SatellitePositions.h"
 #include "../Terrain/PlanetTerrain.h"
 
 using namespace osp;
 using namespace Urho3D;
 
 
+/**
+ * @param relative [in] Position that might have overflowed
+ * @param overflows [in] Carries of relative
+ * @return Squared length of relative, as a double
+ */
+static double distance_squared(const LongVector3& relative,
+                               const IntVector3& overflows)
+{
+    // A double has plenty of range for positions that overflowed too, and
+    // only the rough distance matters for anything that far away
+    const double x = carry_to_double(relative.x_, overflows.x_);
+    const double y = carry_to_double(relative.y_, overflows.y_);
+    const double z = carry_to_double(relative.z_, overflows.z_);
+
+    return x * x + y * y + z * z;
+}
+
 ActiveArea::ActiveArea(Context* context, Scene* scn)
  : ActiveArea(context)
 {
@@ -21,6 +43,11 @@ ActiveArea::ActiveArea(Context* context, Scene* scn)
     // load everything within a kilometer
     m_loadRadius = 1000 * 1024;
 
+    // Previews use their own node so they don't get moved with everything
+    // else when the origin shifts
+    Node* previewNode = scn->CreateChild("Previews", LOCAL);
+    m_previewDrawer = previewNode->CreateComponent<SatellitePreviews>();
+
     PhysicsWorld* world = scn->GetComponent<PhysicsWorld>();
 
     SubscribeToEvent(world, E_PHYSICSPRESTEP,
@@ -32,205 +59,592 @@ void ActiveArea::physics_update(StringHash eventType, VariantMap& eventData)
 
     const PhysicsWorld* pw = m_activeNode->GetComponent<PhysicsWorld>();
 
-    LongVector3 focusPosLong;
+    SatellitePositions* positions = GetSubsystem<SatellitePositions>();
 
-    // Traverse through all objects in the tree, while calculating relative
-    // positions simultaneously
+    // OspUniverse gathers for every ActiveArea at the start of the frame.
+    // Gather here if it didn't, if this is another physics step in the same
+    // frame, or if Satellites were removed since then.
+    if (!m_gathered || !positions
+            || positions->get_removals() != m_gatherRemovals)
+    {
+        gather();
+    }
 
-    // roughly based on calculate_relative_position in Satellite.cpp
+    m_gathered = false;
+    apply_gathered();
 
-    // TODO: account for differing precisions and integer over/underflows
-    // note: if the number of overflows is equal to the number of underflows,
-    //       then the result is correct? I feel this has some similarities to
-    //       the idea of "Parallel Universes" in Super Mario 64
+    // Position of m_focus in meters. Doubles, so a focus that isn't loaded
+    // can be followed from any distance
+    double focusX = 0.0;
+    double focusY = 0.0;
+    double focusZ = 0.0;
 
-    Satellite* satA = this;
-    LongVector3 d(0, 0, 0); // Relative position
-    IntVector3 overflows(0, 0, 0); // see note above
+    if (m_focus.NotNull() && m_focus->is_loaded())
+    {
+        const Vector3& focusPos = m_focus->get_active_node()->GetPosition();
+        focusX = focusPos.x_;
+        focusY = focusPos.y_;
+        focusZ = focusPos.z_;
+    }
+    else if (m_focus.NotNull() && m_parent.NotNull())
+    {
+        // Not in the scene, follow it through the universe instead
+        const int precision = m_parent->m_precision;
+        const LongVector3 focusRel
+                = calculate_relative_position(this, m_focus, precision);
+        focusX = std::ldexp(double(focusRel.x_), -precision);
+        focusY = std::ldexp(double(focusRel.y_), -precision);
+        focusZ = std::ldexp(double(focusRel.z_), -precision);
+    }
 
-    // Go up into the root node, adding up positions
-    // root has a depth of zero, so this loop will stop there
-    while (satA->get_depth())
+    // Compare squares, no need for a sqrt every update
+    if (focusX * focusX + focusY * focusY + focusZ * focusZ
+            > m_originThreshold * m_originThreshold)
+    {
+        // Round to whole meters, so the offset is exact in any precision
+        shift_origin(LongVector3(int64_t(std::floor(-focusX)),
+                                 int64_t(std::floor(-focusY)),
+                                 int64_t(std::floor(-focusZ))));
+    }
+
+    m_previewDrawer->update_previews();
+
+    //pw->SetGravity(Vector3::ZERO);
+
+    // some gravity for temporary fun
+    //float moon = 88200000;
+    //Vector3 gravity;
+    //float r = gravity.Length();
+    //gravity = gravity / r;
+    //gravity *= moon / (r * r);
+    //printf("gravity: (%f, %f, %f)\n", gravity.x_, gravity.y_, gravity.z_);
+    //pw->SetGravity(gravity);
+}
+
+void ActiveArea::gather()
+{
+    m_toLoad.Clear();
+    m_toLoadPositions.Clear();
+    m_toPreview.Clear();
+    m_toPreviewPositions.Clear();
+    m_loadedNear.Clear();
+    m_loadedFar.Clear();
+    m_gathered = true;
+
+    SatellitePositions* positions = GetSubsystem<SatellitePositions>();
+
+    if (!positions)
+    {
+        URHO3D_LOGERROR("ActiveArea needs the SatellitePositions subsystem");
+        return;
+    }
+
+    m_gatherRemovals = positions->get_removals();
+
+    // Go up into the root node, the only one without a parent
+    Satellite* satA = this;
+    while (satA->get_parent())
     {
-        d -= satA->get_position();
         satA = satA->get_parent();
     }
 
-    // satA should now be the root node, d being the position relative to this
-    // Now distance check and load root node
-    distance_check_then_load(satA, d, overflows);
+    // Positions are all in the root's units, and come with carries for
+    // anything too far away to fit in a LongVector3. This area's position is
+    // kept up to date when the origin moves, positions of everything else
+    // are from the start of this frame.
+
+    // Satellites already loaded aren't distance checked in the walk, see
+    // if they're far enough away to unload
+    IntVector3 overflows;
+    m_loadedNear.Resize(m_loaded.Size());
+    m_loadedFar.Resize(m_loaded.Size());
+
+    for (unsigned i = 0; i < m_loaded.Size(); i ++)
+    {
+        const Satellite* sat = m_loaded[i];
+        m_loadedNear[i] = false;
+        m_loadedFar[i] = false;
+
+        if (!sat)
+        {
+            continue;
+        }
+
+        const double magSqrRel = distance_squared(
+                    positions->get_relative(this, sat, overflows), overflows);
+        const double loadRad = get_load_distance(sat, positions);
+        const double unloadRad = loadRad * double(m_unloadMargin);
+
+        m_loadedNear[i] = loadRad * loadRad > magSqrRel;
+        m_loadedFar[i] = unloadRad * unloadRad <= magSqrRel;
+    }
+
+    // Now distance check the root node
+    LongVector3 d = positions->get_relative(this, satA, overflows);
+    distance_check(satA, d, overflows, positions);
 
-    // Recursive Loop through everything else in the tree
-    // while (Not on the last child of root)
-    while ((satA->get_depth() != 1)
-           || (satA->get_parent()->get_children().Size()
-                - satA->get_index() != 1))
+    // Walk down the tree, only into children that the SatelliteIndex says
+    // are close enough to load or preview, or have descendants that are
+    m_walkSats.Clear();
+    m_walkSats.Push(satA);
+
+    while (!m_walkSats.Empty())
     {
-        // Check if satA has children
-        if (satA->get_children().Size())
+        Satellite* parent = m_walkSats.Back();
+        m_walkSats.Pop();
+
+        const SatelliteIndex* index = parent->get_child_index();
+        if (!index)
+        {
+            continue;
+        }
+
+        // The index is in the parent's units. Clamping the center to what
+        // fits in a LongVector3 only brings it closer to the children.
+        const LongVector3 center = positions->to_units(
+                    positions->get_relative(parent, this, overflows),
+                    overflows, parent->m_precision);
+
+        uint64_t radius = m_loadRadius;
+        if (parent->m_precision != m_parent->m_precision)
         {
-            // This node has children, set satA to the first child
-            satA = satA->get_children()[0].Get();
-            //URHO3D_LOGINFOF("DOWN");
+            const double scaled = double(m_loadRadius)
+                    * positions->get_scale(m_parent->m_precision)
+                    / positions->get_scale(parent->m_precision);
+            radius = (scaled >= double(UINT64_MAX)) ? UINT64_MAX
+                                                    : uint64_t(scaled);
         }
-        else
+
+        m_candidates.Clear();
+        index->query(center, radius, m_candidates);
+
+        // All of them at once, straight out of SatellitePositions
+        positions->get_relative(this, m_candidates, m_candidatePositions,
+                                m_candidateOverflows);
+
+        for (unsigned i = 0; i < m_candidates.Size(); i ++)
         {
-            // satA has no children, move up to ancestor that has a next child
-            while (satA->get_parent()->get_children().Size()
-                   - satA->get_index() == 1)
+            Satellite* sat = m_candidates[i];
+            distance_check(sat, m_candidatePositions[i],
+                           m_candidateOverflows[i], positions);
+
+            if (sat->get_child_index())
             {
-                d -= satA->get_position();
-                satA = satA->get_parent();
-                //URHO3D_LOGINFOF("UP");
+                m_walkSats.Push(sat);
             }
+        }
+    }
+}
 
-            d -= satA->get_position();
+void ActiveArea::apply_gathered()
+{
+    m_updateCount ++;
 
-            // Move to next child
-            satA = satA->get_parent()
-                    ->get_children()[satA->get_index() + 1].Get();
+    // Backwards, as the last loaded Satellite is moved into unloaded ones'
+    // places
+    for (unsigned i = m_loaded.Size(); i -- > 0; )
+    {
+        Satellite* sat = m_loaded[i];
 
+        if (!sat || sat->m_activeArea.Get() != this)
+        {
+            // Deleted, or unloaded by something else
+            m_loaded.EraseSwap(i);
+            m_loadedLastNear.EraseSwap(i);
+        }
+        else if (i < m_loadedNear.Size() && m_loadedNear[i])
+        {
+            m_loadedLastNear[i] = m_updateCount;
+        }
+        else if (i < m_loadedFar.Size() && m_loadedFar[i] && sat != m_focus)
+        {
+            unload_at(i);
         }
+    }
+
+    for (unsigned i = 0; i < m_toLoad.Size(); i ++)
+    {
+        Satellite* sat = m_toLoad[i];
 
-        d += satA->get_position();
+        // Another ActiveArea might have loaded it first
+        if (sat->get_active_node())
+        {
+            continue;
+        }
+
+        URHO3D_LOGINFOF("ActiveArea Loading: %s", sat->get_name().CString());
 
-        // Do distance check and load
-        distance_check_then_load(satA, d, overflows);
+        // The real thing is about to replace the preview
+        remove_preview(sat);
 
-        //URHO3D_LOGINFOF("%s: %i %i %i",
-        //                satA->get_name().CString(), d.x_, d.y_, d.z_);
+        sat->load(this, m_toLoadPositions[i]);
+
+        if (sat->is_loaded())
+        {
+            m_loaded.Push(WeakPtr<Satellite>(sat));
+            m_loadedLastNear.Push(m_updateCount);
+        }
     }
 
-    // Position of m_focus in meters
-    Vector3 focusPos;
+    // Keep memory bounded if too many bodies are loaded. The ones that were
+    // needed the longest time ago are unloaded first, anything within its
+    // load distance right now stays.
+    unsigned bodies = 0;
+    for (const WeakPtr<Satellite>& sat : m_loaded)
+    {
+        if (sat->IsInstanceOf<AstronomicalBody>())
+        {
+            bodies ++;
+        }
+    }
 
-    if (m_focus.NotNull())
+    while (bodies > m_maxLoadedBodies)
     {
-        //focusPosLong = m_focus->get_long_position();
-        focusPos = m_focus->get_active_node()->GetPosition();
+        unsigned oldest = M_MAX_UNSIGNED;
 
-        //String fpostring = m_focus->calculate_position().ToString();
-        //URHO3D_LOGINFOF("Focus pos: %s", fpostring.CString());
+        for (unsigned i = 0; i < m_loaded.Size(); i ++)
+        {
+            if (m_loadedLastNear[i] != m_updateCount
+                    && m_loaded[i]->IsInstanceOf<AstronomicalBody>()
+                    && (oldest == M_MAX_UNSIGNED
+                        || m_loadedLastNear[i] < m_loadedLastNear[oldest]))
+            {
+                oldest = i;
+            }
+        }
+
+        if (oldest == M_MAX_UNSIGNED)
+        {
+            break;
+        }
+
+        unload_at(oldest);
+        bodies --;
     }
-    else
+
+    // Previews that aren't seen again this update are removed afterwards
+    for (unsigned i = 0; i < m_previewSeen.Size(); i ++)
+    {
+        m_previewSeen[i] = false;
+    }
+
+    for (unsigned i = 0; i < m_toPreview.Size(); i ++)
+    {
+        update_preview(m_toPreview[i], m_toPreviewPositions[i]);
+    }
+
+    // Remove previews of satellites that weren't near enough to be looked at.
+    // Backwards, as the last preview is moved into removed ones' places
+    for (unsigned i = m_previews.Size(); i -- > 0; )
+    {
+        if (!m_previewSeen[i])
+        {
+            remove_preview_at(i);
+        }
+    }
+}
+
+void ActiveArea::distance_check(Satellite* sat, const LongVector3& relative,
+                                const IntVector3& overflows,
+                                const SatellitePositions* positions)
+{
+    // Check if already loaded
+    // dont load self
+    if (sat->get_active_node() || sat == this)
     {
-        // TODO
+        return;
+    }
+
+    // No need to sqrt anything, just compare the squares instead
+    // These are really damn big numbers
+
+    double magSqrRel = distance_squared(relative, overflows);
+
+    double loadRad = get_load_distance(sat, positions);
+    double magSqrRad = loadRad * loadRad;
 
+    //URHO3D_LOGINFOF("(%i, %i, %i) mag: %f",
+    //                relative.x_, relative.y_, relative.z_, magSqrRel);
+
+    // Load if within radius
+    if (magSqrRad > magSqrRel)
+    {
+        m_toLoad.Push(sat);
+        m_toLoadPositions.Push(to_meters(relative, overflows,
+                                         positions->get_precision()));
+        return;
     }
 
-    const float originDistance = focusPos.Length();
-    const float threshold = 30.0f;
+    // Radii are in their parent's units, relative is in the root's
+    const double satScale = sat->m_parent.NotNull()
+            ? positions->get_scale(sat->m_parent->m_precision) : 1.0;
 
-    if (originDistance > threshold) {
+    double previewRad = double(sat->get_preview_radius()) * satScale;
 
-        // Distance to offset everything with
+    // Anything too far to be seen is left out, and loses its preview
+    if (previewRad * previewRad > magSqrRel)
+    {
+        // Previews don't need to be exact, a float is plenty
+        m_toPreview.Push(sat);
+        m_toPreviewPositions.Push(to_meters(relative, overflows,
+                                            positions->get_precision()));
+    }
+}
 
-        Vector3 offsetDist = -focusPos;
+void ActiveArea::shift_origin(const LongVector3& offset)
+{
+    URHO3D_LOGINFOF("Moving origin by %s", offset.ToString().CString());
 
-        // Round components for less precision loss
-        offsetDist.x_ = Floor(offsetDist.x_);
-        offsetDist.y_ = Floor(offsetDist.y_);
-        offsetDist.z_ = Floor(offsetDist.z_);
+    // Offsets are only as big as the scene, fine as floats
+    const Vector3 offsetMeters(float(offset.x_), float(offset.y_),
+                               float(offset.z_));
 
-        URHO3D_LOGINFOF("move! %s", offsetDist.ToString().CString());
+    // Each RigidBody normally copies its node's transform into Bullet and
+    // wakes up as soon as the node moves. Stop that, and move all of them
+    // at once afterwards.
+    PhysicsWorld* physicsWorld = m_activeNode->GetComponent<PhysicsWorld>();
 
-        // Translate all nodes to move the focus back to the center
+    if (physicsWorld)
+    {
+        physicsWorld->SetApplyingTransforms(true);
+    }
 
-        PODVector<Node*> rigidBodies;
+    // Translate all nodes to move the focus back to the center. Only the
+    // scene's direct children, their descendants come along with them.
+    m_shiftNodes.Clear();
+    m_activeNode->GetChildren(m_shiftNodes);
 
-        m_activeNode->GetChildren(rigidBodies);
+    Node* previewNode = m_previewDrawer->GetNode();
 
-        for (Node* rbNode : rigidBodies)
+    for (Node* node : m_shiftNodes)
+    {
+        // Previews are positioned every update anyways
+        if (node == previewNode)
         {
-            rbNode->Translate(offsetDist, TS_PARENT);
+            continue;
+        }
+
+        node->Translate(offsetMeters, TS_PARENT);
 
-            // Delete far away nodes that have a RemoveDistance var
-            // intended to be used for explosion debris or something
+        // Nodes that only set the var are still removed, but tag them so
+        // they're found like the rest. Most nodes don't have any vars.
+        if (!node->GetVars().Empty()
+                && !node->GetVar(gc_removeDistanceTag).IsEmpty()
+                && !node->HasTag(gc_removeDistanceTag))
+        {
+            URHO3D_LOGWARNINGF("Node \"%s\" has a %s var but not the tag, "
+                               "tagging it", node->GetName().CString(),
+                               gc_removeDistanceTag);
+            node->AddTag(gc_removeDistanceTag);
+        }
+    }
 
-            const VariantMap& vars = rbNode->GetVars();
-            Variant removeDistance;
+    if (physicsWorld)
+    {
+        physicsWorld->SetApplyingTransforms(false);
 
-            if (vars.TryGetValue("RemoveDistance", removeDistance))
+        // Warp every body by the same offset. Sleeping bodies stay asleep,
+        // nothing moved relative to anything else.
+        const btVector3 offsetBt = ToBtVector3(offsetMeters);
+
+        m_shiftBodies.Clear();
+        m_activeNode->GetComponents<RigidBody>(m_shiftBodies, true);
+
+        for (RigidBody* body : m_shiftBodies)
+        {
+            btRigidBody* bulletBody = body->GetBody();
+
+            if (!bulletBody)
             {
-                if (rbNode->GetPosition().Length() > removeDistance.GetFloat())
-                {
-                    rbNode->Remove();
-                    URHO3D_LOGINFO("Distant node removed");
-                }
+                continue;
             }
+
+            bulletBody->getWorldTransform().getOrigin() += offsetBt;
+
+            btTransform interpolated
+                    = bulletBody->getInterpolationWorldTransform();
+            interpolated.getOrigin() += offsetBt;
+            bulletBody->setInterpolationWorldTransform(interpolated);
         }
+    }
 
-        // convert offsetDist to this ActiveArea's parent space
-        offsetDist *= Pow(2.0f, float(m_parent->m_precision));
+    // Delete far away nodes that have a RemoveDistance var, intended to be
+    // used for explosion debris or something. They're found through the
+    // scene's tag index, so nothing else has its vars looked through.
+    m_shiftNodes.Clear();
+    m_activeNode->GetScene()->GetNodesWithTag(m_shiftNodes,
+                                              gc_removeDistanceTag);
 
-        // Move the ActiveArea to compensate
-        m_position -= LongVector3(offsetDist.x_, offsetDist.y_, offsetDist.z_);
+    for (Node*& node : m_shiftNodes)
+    {
+        // Only the scene's direct children, like before. Removing one also
+        // deletes its descendants, which might be further in the list.
+        if (node->GetParent() != m_activeNode)
+        {
+            node = nullptr;
+        }
     }
 
-    //pw->SetGravity(Vector3::ZERO);
+    for (Node* node : m_shiftNodes)
+    {
+        if (!node)
+        {
+            continue;
+        }
 
-    // some gravity for temporary fun
-    //float moon = 88200000;
-    //Vector3 gravity;
-    //float r = gravity.Length();
-    //gravity = gravity / r;
-    //gravity *= moon / (r * r);
-    //printf("gravity: (%f, %f, %f)\n", gravity.x_, gravity.y_, gravity.z_);
-    //pw->SetGravity(gravity);
+        const float removeDistance = node->GetVar(gc_removeDistanceTag)
+                                            .GetFloat();
+
+        if (node->GetPosition().LengthSquared()
+                > removeDistance * removeDistance)
+        {
+            node->Remove();
+            URHO3D_LOGINFO("Distant node removed");
+        }
+    }
+
+    // Convert offset to this ActiveArea's parent space. Doubles are exact
+    // for whole meters at any precision that fits in a LongVector3.
+    const int precision = m_parent->m_precision;
+    const LongVector3 offsetUnits(
+            int64_t(std::ldexp(double(offset.x_), precision)),
+            int64_t(std::ldexp(double(offset.y_), precision)),
+            int64_t(std::ldexp(double(offset.z_), precision)));
+
+    // Move the ActiveArea to compensate
+    set_position(m_position - offsetUnits);
 }
 
-void ActiveArea::distance_check_then_load(Satellite* sat,
-                                          LongVector3& relative,
-                                          IntVector3& overflowCount)
+double ActiveArea::get_load_distance(const Satellite* sat,
+                                     const SatellitePositions* positions) const
 {
-    // Check if already loaded
-    // make sure overflow count is all zero
-    // dont load self
-    if (sat->get_active_node()
-            || overflowCount.x_ || overflowCount.y_ || overflowCount.z_
-            || sat == this)
+    // Radii are in their parent's units, distances are in the root's
+    const double satScale = sat->m_parent.NotNull()
+            ? positions->get_scale(sat->m_parent->m_precision) : 1.0;
+    const double areaScale = positions->get_scale(m_parent->m_precision);
+
+    return double(sat->get_load_radius()) * satScale
+            + double(m_loadRadius) * areaScale;
+}
+
+void ActiveArea::unload_at(unsigned index)
+{
+    Satellite* sat = m_loaded[index];
+
+    URHO3D_LOGINFOF("ActiveArea Unloading: %s", sat->get_name().CString());
+
+    sat->unload();
+
+    m_loaded.EraseSwap(index);
+    m_loadedLastNear.EraseSwap(index);
+}
+
+void ActiveArea::update_preview(Satellite* sat, const Vector3& pos)
+{
+    Node* previewNode;
+    HashMap<Satellite*, unsigned>::ConstIterator it
+            = m_previewIndices.Find(sat);
+
+    if (it != m_previewIndices.End() && m_previews[it->second_] != sat)
     {
-        return;
+        // Left over from a removed satellite that had the same address
+        remove_preview_at(it->second_);
+        it = m_previewIndices.End();
     }
 
-    // TODO: Load preview should be here too somewhere
+    if (it == m_previewIndices.End())
+    {
+        previewNode = sat->load_preview(this);
 
-    // Get magnitude of relative. There's probably a better way to do this
-    // the highest possible value for any of these is exactly the float
-    // maximum of ~3.4*10^38
-    double xsq = Pow(float(relative.x_), 2.0f);
-    double ysq = Pow(float(relative.y_), 2.0f);
-    double zsq = Pow(float(relative.z_), 2.0f);
+        if (!previewNode)
+        {
+            return;
+        }
 
-    // No need to sqrt anything, just compare the squares instead
-    // These are really damn big numbers
+        m_previewIndices[sat] = m_previews.Size();
+        m_previews.Push(WeakPtr<Satellite>(sat));
+        m_previewNodes.Push(WeakPtr<Node>(previewNode));
+        m_previewSeen.Push(true);
+    }
+    else
+    {
+        previewNode = m_previewNodes[it->second_];
+        m_previewSeen[it->second_] = true;
+    }
 
-    double magSqrRel = xsq + ysq + zsq; // = Magnitude ^2
-    double magSqrRad = Pow(float(sat->get_load_radius()) + float(m_loadRadius),
-                           2.0f);
+    m_previewDrawer->set_position(previewNode, pos);
+}
 
-    //URHO3D_LOGINFOF("(%i, %i, %i) mag: %f",
-    //                relative.x_, relative.y_, relative.z_, magSqrRel);
+void ActiveArea::remove_preview(Satellite* sat)
+{
+    HashMap<Satellite*, unsigned>::ConstIterator it
+            = m_previewIndices.Find(sat);
 
-    // Load if within radius
-    if (magSqrRad > magSqrRel)
+    if (it != m_previewIndices.End())
     {
-        URHO3D_LOGINFOF("ActiveArea Loading: %s", sat->get_name().CString());
+        remove_preview_at(it->second_);
+    }
+}
+
+void ActiveArea::remove_preview_at(unsigned index)
+{
+    m_previewDrawer->remove_preview(m_previewNodes[index]);
+
+    HashMap<Satellite*, unsigned>::Iterator it = find_preview_key(index);
+    if (it != m_previewIndices.End())
+    {
+        m_previewIndices.Erase(it);
+    }
+
+    // Move the last preview into the empty space, keeping both parallel
+    // vectors in sync
+    const unsigned last = m_previews.Size() - 1;
+    if (index != last)
+    {
+        it = find_preview_key(last);
+        if (it != m_previewIndices.End())
+        {
+            it->second_ = index;
+        }
 
-        Vector3 floatPos(Vector3(relative.x_, relative.y_, relative.z_)
-                       / (1 << m_precision));
-        sat->load(this, floatPos);
+        m_previews[index] = m_previews.Back();
+        m_previewNodes[index] = m_previewNodes.Back();
+        m_previewSeen[index] = m_previewSeen.Back();
+    }
+    m_previews.Pop();
+    m_previewNodes.Pop();
+    m_previewSeen.Pop();
+}
+
+HashMap<Satellite*, unsigned>::Iterator ActiveArea::find_preview_key(
+        unsigned index)
+{
+    if (Satellite* sat = m_previews[index])
+    {
+        return m_previewIndices.Find(sat);
+    }
+
+    // Satellite was removed, its address is only left as a key. Rare enough
+    // to just look through all of them.
+    for (HashMap<Satellite*, unsigned>::Iterator it = m_previewIndices.Begin();
+         it != m_previewIndices.End(); ++ it)
+    {
+        if (it->second_ == index)
+        {
+            return it;
+        }
     }
+    return m_previewIndices.End();
 }
 
 Node* ActiveArea::load(ActiveArea* area, const Vector3& pos)
 {
-    URHO3D_LOGINFOF("hey");
-    // TODO:
+    // ActiveAreas can't be loaded into each other, their active node is
+    // their own scene
     return nullptr;
 }
 
 void ActiveArea::unload()
 {
-    URHO3D_LOGINFOF("hey");
+    // Never loaded, and the scene isn't removed along with it
 }
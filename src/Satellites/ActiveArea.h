@@ -1,19 +1,32 @@
 #pragma once
 
+#include <Urho3D/Physics/RigidBody.h>
 #include <Urho3D/Scene/Scene.h>
 
 #include "Satellite.h"
+#include "SatellitePreviews.h"
 
 using namespace Urho3D;
 
 namespace osp {
 
 class ActiveArea;
+class SatellitePositions;
+
+// Tag and var name for nodes that get deleted when the origin moves, if
+// they're further away from it than the var (float, in meters)
+static const char* const gc_removeDistanceTag = "RemoveDistance";
 
 
 /**
  * Turns an ordinary Urho3D scene into a window to the larger OSP universe
  * Loads and unloads Satellites, and handles floating origin
+ *
+ * Satellites are loaded once they're within their load distance, and only
+ * unloaded once they're m_unloadMargin times further than that, so they
+ * don't get loaded and unloaded over and over near the edge. At most
+ * m_maxLoadedBodies AstronomicalBodies stay loaded, the ones that were last
+ * within their load distance the longest time ago go first.
  */
 class ActiveArea : public Satellite
 {
@@ -28,12 +41,44 @@ public:
 
     void physics_update(StringHash eventType, VariantMap& eventData);
 
+    /**
+     * Find which Satellites are close enough to load or preview, and where
+     * they are, without changing anything. Safe to call for many
+     * ActiveAreas at once from worker threads, as long as nothing else is
+     * modifying the universe and SatellitePositions is up to date. The next
+     * physics_update loads and previews what was found.
+     */
+    void gather();
+
     //void relocate(AstronomicalBody* body, const LongVector3& localBodyPos);
 
     Satellite* get_focus() const;
 
     void set_focus(Satellite* sat);
 
+    /**
+     * @param margin [in] How many times further than its load distance a
+     *                    Satellite has to be to get unloaded, at least 1
+     */
+    void set_unload_margin(float margin);
+
+    /**
+     * @param count [in] Number of AstronomicalBodies that can be loaded at
+     *                   once, more are allowed if they're all close enough
+     */
+    void set_max_loaded_bodies(unsigned count);
+
+    /**
+     * @param distance [in] How far in meters the focus can get from the
+     *                      scene's origin before everything is moved back
+     */
+    void set_origin_threshold(double distance);
+
+    /**
+     * @return Component that draws the previews of distant Satellites
+     */
+    SatellitePreviews* get_previews() const;
+
     Node* load(ActiveArea* area, const Vector3& pos) override;
 
     Node* load_preview(ActiveArea* area) override;
@@ -43,16 +88,71 @@ public:
 private:
 
     /**
-     * See if m_loadRadius intersects another Satellite's m_radius, then load
-     * if they do. Relative position should already be calculated. Called in
-     * FixedUpdate when looping through all the Satellites.
-     * @param sat [in] Pointer to Satellite to load
-     * @param relative [in] Relative Position
-     * @param overflowCount [in] Count for how many times relative position
-     *                           overflowed or underflowed.
+     * See if m_loadRadius intersects another Satellite's m_radius, then add
+     * it to m_toLoad if they do, or m_toPreview if it's close enough to be
+     * seen. Relative position should already be calculated. Called in
+     * gather for each Satellite the SatelliteIndexes find nearby.
+     * @param sat [in] Pointer to Satellite to check
+     * @param relative [in] Relative Position, in the root's units
+     * @param overflows [in] Carries of relative, see PositionMath.h
+     * @param positions [in] Where relative came from
+     */
+    void distance_check(Satellite* sat, const LongVector3& relative,
+                        const IntVector3& overflows,
+                        const SatellitePositions* positions);
+
+    /**
+     * Load, unload and preview everything found by the last gather, then
+     * remove previews that weren't found
+     */
+    void apply_gathered();
+
+    /**
+     * @param sat [in] Any Satellite
+     * @param positions [in] Where positions come from
+     * @return Distance from this area that sat gets loaded within, in the
+     *         root's units
+     */
+    double get_load_distance(const Satellite* sat,
+                             const SatellitePositions* positions) const;
+
+    /**
+     * Move everything in the scene, and the ActiveArea the opposite way so
+     * nothing moves relative to the universe
+     * @param offset [in] Whole meters to move the scene's contents by
+     */
+    void shift_origin(const LongVector3& offset);
+
+    /**
+     * Unload a Satellite and stop keeping track of it
+     * @param index [in] Index of Satellite in m_loaded
+     */
+    void unload_at(unsigned index);
+
+    /**
+     * Create a preview for a Satellite, or move the one it already has
+     * @param sat [in] Satellite to preview
+     * @param pos [in] Position relative to this area, in meters
+     */
+    void update_preview(Satellite* sat, const Vector3& pos);
+
+    /**
+     * Remove a Satellite's preview from the scene, if it has one
+     * @param sat [in] Satellite to remove preview of
      */
-    void distance_check_then_load(Satellite* sat, LongVector3& relative,
-                                  IntVector3& overflowCount);
+    void remove_preview(Satellite* sat);
+
+    /**
+     * Remove a preview, even if its Satellite was removed from the universe
+     * @param index [in] Index of preview in m_previews
+     */
+    void remove_preview_at(unsigned index);
+
+    /**
+     * @param index [in] Index of preview in m_previews
+     * @return Entry of m_previewIndices that points to index
+     */
+    HashMap<Satellite*, unsigned>::Iterator find_preview_key(unsigned index);
 
     // The Satellite to follow around. ActiveArea will try keeping this
     // Satellite's active node at the scene's center by translating everything,
@@ -62,21 +162,94 @@ private:
     // Satellites that are currently loaded into the scene
     Vector< WeakPtr<Satellite> > m_loaded;
 
+    // Value of m_updateCount when each Satellite in m_loaded was last within
+    // its load distance. Parallel to m_loaded
+    PODVector<unsigned> m_loadedLastNear;
+
+    // Set by gather for Satellites in m_loaded that are within their load
+    // distance, and ones that are far enough to unload. Parallel to m_loaded
+    PODVector<bool> m_loadedNear;
+    PODVector<bool> m_loadedFar;
+
+    // Number of times apply_gathered was called, used as a clock for
+    // m_loadedLastNear
+    unsigned m_updateCount = 0;
+
+    float m_unloadMargin = 1.5f;
+    unsigned m_maxLoadedBodies = 2;
+
+    // Moving the origin touches every node in the scene, so it's done as
+    // rarely as floats allow. At 1km, they're still accurate to well under
+    // a millimeter.
+    double m_originThreshold = 1000.0;
+
+    // Nodes being moved or removed by shift_origin, and the RigidBodies
+    // being warped, kept around so they don't need to be allocated every
+    // shift
+    PODVector<Node*> m_shiftNodes;
+    PODVector<RigidBody*> m_shiftBodies;
+
     // Satellites that have previews loaded into the scene.
     Vector< WeakPtr<Satellite> > m_previews;
 
     // Nodes associated with the previewed satellites above
     // This vector is parallel to m_previews.
     // eg. m_previewNodes[3] should be associated with m_previews[3]
-    Vector< WeakPtr<Satellite> > m_previewNodes;
+    Vector< WeakPtr<Node> > m_previewNodes;
+
+    // Set for previews that were updated in this physics_update, anything
+    // still false afterwards is too far and gets removed. Parallel to
+    // m_previews too
+    PODVector<bool> m_previewSeen;
+
+    // Maps previewed satellites to indices in m_previews
+    HashMap<Satellite*, unsigned> m_previewIndices;
+
+    // Satellites whose children are left to look at in gather. Kept
+    // around so it doesn't need to be allocated every update
+    PODVector<Satellite*> m_walkSats;
+
+    // Children found by a SatelliteIndex query in gather, and their
+    // positions relative to this area
+    PODVector<Satellite*> m_candidates;
+    PODVector<LongVector3> m_candidatePositions;
+    PODVector<IntVector3> m_candidateOverflows;
+
+    // Satellites gather found close enough to load, and their positions in
+    // meters
+    PODVector<Satellite*> m_toLoad;
+    PODVector<Vector3> m_toLoadPositions;
+
+    // Satellites gather found close enough to preview, and their positions
+    // in meters
+    PODVector<Satellite*> m_toPreview;
+    PODVector<Vector3> m_toPreviewPositions;
+
+    // Set once gather is done, cleared when physics_update uses what it
+    // found
+    bool m_gathered = false;
+
+    // SatellitePositions::get_removals when gather was done. Anything
+    // gathered is thrown away if it changed, as it might have been deleted.
+    unsigned m_gatherRemovals = 0;
+
+    // Draws all the previews. Lives on a child node of the scene, which is
+    // left alone when the floating origin moves
+    WeakPtr<SatellitePreviews> m_previewDrawer;
 
 };
 
 inline Node* ActiveArea::load_preview(ActiveArea *area)
 {
+    // ActiveAreas are invisible
     return nullptr;
 }
 
+inline SatellitePreviews* ActiveArea::get_previews() const
+{
+    return m_previewDrawer;
+}
+
 inline Satellite* ActiveArea::get_focus() const
 {
     return m_focus;
@@ -87,4 +260,19 @@ inline void ActiveArea::set_focus(Satellite* sat)
     m_focus = sat;
 }
 
+inline void ActiveArea::set_unload_margin(float margin)
+{
+    m_unloadMargin = Max(margin, 1.0f);
+}
+
+inline void ActiveArea::set_max_loaded_bodies(unsigned count)
+{
+    m_maxLoadedBodies = count;
+}
+
+inline void ActiveArea::set_origin_threshold(double distance)
+{
+    m_originThreshold = distance;
+}
+
 } // namespace osp
@@ -0,0 +1,207 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+#include <cmath>
+
+#include "ActiveArea.h"
+#include "AsteroidBelt.h"
+#include "AsteroidField.h"
+
+namespace osp
+{
+
+// Number of quads around the band. It's see-through and usually far away,
+// so it doesn't need to be very round
+static constexpr unsigned sc_bandSegments = 64;
+
+// Fraction of the belt's width at each edge where it thins out
+static constexpr float sc_edgeFade = 0.2f;
+
+void AsteroidBelt::set_shape(float inner, float outer, float thickness)
+{
+    m_innerRadius = inner;
+    m_outerRadius = outer;
+    m_thickness = thickness;
+
+    // Radii are in the parent's units, like m_position. Before being added
+    // to one, assume it uses the default precision, same as this Satellite
+    const int precision = m_parent.NotNull() ? m_parent->get_precision()
+                                             : m_precision;
+
+    // Load when the ActiveArea gets anywhere near the band. The AsteroidField
+    // only makes rocks around the camera, so being loaded is cheap
+    m_loadRadius = uint64_t(std::ldexp(double(outer), precision));
+
+    // Dim enough to not be seen from much further
+    m_previewRadius = uint64_t(std::ldexp(double(outer) * 10.0, precision));
+
+    radius_changed();
+}
+
+void AsteroidBelt::set_rocks(float cellSize, unsigned count, float scaleMin,
+                             float scaleMax)
+{
+    m_cellSize = cellSize;
+    m_rockCount = count;
+    m_scaleMin = scaleMin;
+    m_scaleMax = scaleMax;
+}
+
+float AsteroidBelt::get_density(const Vector3& pos) const
+{
+    const float halfThickness = m_thickness * 0.5f;
+    const float radius = Sqrt(pos.x_ * pos.x_ + pos.z_ * pos.z_);
+
+    if (radius <= m_innerRadius || radius >= m_outerRadius
+            || Abs(pos.y_) >= halfThickness)
+    {
+        return 0.0f;
+    }
+
+    // 0.0 at both edges, 0.5 in the middle
+    const float across = (radius - m_innerRadius)
+                            / (m_outerRadius - m_innerRadius);
+    const float radial = SmoothStep(0.0f, sc_edgeFade,
+                                    Min(across, 1.0f - across));
+
+    // Thickest in the plane of the belt
+    const float height = pos.y_ / halfThickness;
+    const float vertical = 1.0f - height * height;
+
+    return radial * vertical;
+}
+
+Node* AsteroidBelt::load(ActiveArea* area, const Vector3& pos)
+{
+    Satellite::load(area, pos);
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    Node* scene = area->get_active_node();
+
+    m_activeNode = scene->CreateChild(m_name);
+    m_activeNode->SetPosition(pos);
+
+    // The whole belt is still drawn as a band, rocks only show up near the
+    // camera. The band is on its own node, as it's scaled up
+    Node* bandNode = m_activeNode->CreateChild("Band");
+    bandNode->SetScale(m_outerRadius);
+
+    StaticModel* band = bandNode->CreateComponent<StaticModel>();
+    band->SetModel(get_band_model(context_, m_innerRadius / m_outerRadius));
+    band->SetMaterial(cache->GetResource<Material>(m_bandMaterial));
+    band->SetCastShadows(false);
+
+    AsteroidField* field = m_activeNode->CreateComponent<AsteroidField>();
+    field->SetModel(cache->GetResource<Model>(m_rockModel));
+    field->SetMaterial(cache->GetResource<Material>(m_rockMaterial));
+    field->SetCastShadows(false);
+    field->initialize(this);
+
+    return m_activeNode.Get();
+}
+
+Node* AsteroidBelt::load_preview(ActiveArea* area)
+{
+    Material* material = GetSubsystem<ResourceCache>()
+                            ->GetResource<Material>(m_bandMaterial);
+
+    return area->get_previews()->add_preview(
+                get_band_model(context_, m_innerRadius / m_outerRadius),
+                material, m_outerRadius);
+}
+
+Model* AsteroidBelt::get_band_model(Context* context, float innerRatio)
+{
+    ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+
+    // Belts with about the same proportions share a model
+    const int percent = Clamp(RoundToInt(innerRatio * 100.0f), 0, 99);
+    const String name = "Models/AsteroidBand" + String(percent) + ".mdl";
+
+    if (Model* existing = cache->GetExistingResource<Model>(name))
+    {
+        return existing;
+    }
+
+    const float inner = percent / 100.0f;
+
+    // Inner and outer vertex for each segment, all facing up. The material
+    // draws both sides
+    PODVector<float> vertData(sc_bandSegments * 2 * 6);
+    PODVector<unsigned short> indData(sc_bandSegments * 6);
+
+    for (unsigned i = 0; i < sc_bandSegments; i ++)
+    {
+        const float angle = 360.0f * i / sc_bandSegments;
+        const Vector3 dir(Cos(angle), 0.0f, Sin(angle));
+        const Vector3 verts[2] = {dir * inner, dir};
+
+        for (unsigned j = 0; j < 2; j ++)
+        {
+            float* vert = vertData.Buffer() + (i * 2 + j) * 6;
+            memcpy(vert + 0, verts[j].Data(), 3 * sizeof(float));
+            memcpy(vert + 3, Vector3::UP.Data(), 3 * sizeof(float));
+        }
+
+        // Quad between this segment and the next
+        const unsigned short a = static_cast<unsigned short>(i * 2);
+        const unsigned short b = static_cast<unsigned short>(
+                                    ((i + 1) % sc_bandSegments) * 2);
+        unsigned short* quad = indData.Buffer() + i * 6;
+        quad[0] = a;
+        quad[1] = a + 1;
+        quad[2] = b + 1;
+        quad[3] = a;
+        quad[4] = b + 1;
+        quad[5] = b;
+    }
+
+    SharedPtr<VertexBuffer> vertBuf(new VertexBuffer(context));
+    SharedPtr<IndexBuffer> indBuf(new IndexBuffer(context));
+    SharedPtr<Geometry> geometry(new Geometry(context));
+
+    PODVector<VertexElement> elements;
+    elements.Push(VertexElement(TYPE_VECTOR3, SEM_POSITION));
+    elements.Push(VertexElement(TYPE_VECTOR3, SEM_NORMAL));
+
+    vertBuf->SetShadowed(true);
+    vertBuf->SetSize(sc_bandSegments * 2, elements);
+    vertBuf->SetData(vertData.Buffer());
+
+    indBuf->SetShadowed(true);
+    indBuf->SetSize(indData.Size(), false);
+    indBuf->SetData(indData.Buffer());
+
+    geometry->SetVertexBuffer(0, vertBuf);
+    geometry->SetIndexBuffer(indBuf);
+    geometry->SetDrawRange(TRIANGLE_LIST, 0, indData.Size());
+
+    Model* model = new Model(context);
+    model->SetName(name);
+    model->SetNumGeometries(1);
+    model->SetGeometry(0, 0, geometry);
+    model->SetBoundingBox(BoundingBox(Vector3(-1.0f, 0.0f, -1.0f),
+                                      Vector3(1.0f, 0.0f, 1.0f)));
+
+    Vector< SharedPtr<VertexBuffer> > vrtBufs;
+    Vector< SharedPtr<IndexBuffer> > indBufs;
+    vrtBufs.Push(vertBuf);
+    indBufs.Push(indBuf);
+    PODVector<unsigned> morphRangeStarts;
+    PODVector<unsigned> morphRangeCounts;
+    morphRangeStarts.Push(0);
+    morphRangeCounts.Push(0);
+    model->SetVertexBuffers(vrtBufs, morphRangeStarts, morphRangeCounts);
+    model->SetIndexBuffers(indBufs);
+
+    // The cache now owns the model
+    cache->AddManualResource(model);
+
+    return model;
+}
+
+} // namespace osp
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <Urho3D/Graphics/Model.h>
+
+#include "Satellite.h"
+
+namespace osp
+{
+
+/**
+ * A belt or ring of rocks around its parent, described by a distribution
+ * instead of a Satellite for every rock.
+ *
+ * The belt is a flat annulus on the parent's XZ plane, from m_innerRadius to
+ * m_outerRadius and m_thickness tall. get_density describes how crowded it
+ * is anywhere inside. When loaded, an AsteroidField generates rocks only in
+ * cells around the camera, and the rest of the belt is a translucent band.
+ * From further away, the band is drawn as a preview.
+ */
+class AsteroidBelt : public Satellite
+{
+    URHO3D_OBJECT(AsteroidBelt, Satellite)
+
+public:
+    AsteroidBelt(Context* context);
+    ~AsteroidBelt() = default;
+
+    /**
+     * Set size of the belt. Changes take effect the next time it's loaded.
+     * Load and preview radii are converted to the parent's precision, call
+     * this again after adding the belt to a parent with another precision.
+     * @param inner [in] Distance from the center to the inner edge in meters
+     * @param outer [in] Distance from the center to the outer edge in meters
+     * @param thickness [in] Height of the belt in meters
+     */
+    void set_shape(float inner, float outer, float thickness);
+
+    /**
+     * Set how rocks are generated near the camera
+     * @param cellSize [in] Width of the cubes rocks are generated in
+     * @param count [in] Most rocks a cell can have, where density is 1.0
+     * @param scaleMin [in] Smallest rock scale
+     * @param scaleMax [in] Largest rock scale
+     */
+    void set_rocks(float cellSize, unsigned count, float scaleMin,
+                   float scaleMax);
+
+    /**
+     * Set a seed to make this belt's rocks different from other belts
+     * @param seed [in] Any number
+     */
+    void set_seed(uint32_t seed) { m_seed = seed; }
+
+    /**
+     * How crowded the belt is at a point. Thins out towards the edges, and
+     * is zero outside of the belt.
+     * @param pos [in] Position relative to the belt's center in meters
+     * @return 0.0 for empty, to 1.0 for a full cell
+     */
+    float get_density(const Vector3& pos) const;
+
+    float get_inner_radius() const { return m_innerRadius; }
+    float get_outer_radius() const { return m_outerRadius; }
+    float get_thickness() const { return m_thickness; }
+
+    float get_cell_size() const { return m_cellSize; }
+    unsigned get_rock_count() const { return m_rockCount; }
+    float get_scale_min() const { return m_scaleMin; }
+    float get_scale_max() const { return m_scaleMax; }
+    uint32_t get_seed() const { return m_seed; }
+
+    Node* load(ActiveArea* area, const Vector3& pos) override;
+
+    Node* load_preview(ActiveArea* area) override;
+
+    void unload() override;
+
+    /**
+     * Get a flat ring shared by all belts with the same proportions. It's
+     * created the first time this is called, and kept in the ResourceCache.
+     * @param context [in] Context to create the Model with
+     * @param innerRatio [in] Inner radius divided by outer radius
+     * @return Ring model with an outer radius of 1
+     */
+    static Model* get_band_model(Context* context, float innerRatio);
+
+private:
+
+    float m_innerRadius;
+    float m_outerRadius;
+    float m_thickness;
+
+    float m_cellSize;
+    unsigned m_rockCount;
+    float m_scaleMin;
+    float m_scaleMax;
+    uint32_t m_seed;
+
+    String m_rockModel;
+    String m_rockMaterial;
+
+    // Material for the band, both when previewed and loaded
+    String m_bandMaterial;
+};
+
+inline AsteroidBelt::AsteroidBelt(Context* context)
+ : Satellite(context)
+{
+    m_name = "Untitled Belt";
+    m_rockModel = "Models/Icosphere.mdl";
+    m_rockMaterial = "Materials/Stone.xml";
+    m_bandMaterial = "Materials/AsteroidBand.xml";
+    m_seed = 0;
+
+    set_shape(8000.0f, 12000.0f, 400.0f);
+    set_rocks(100.0f, 24, 1.0f, 8.0f);
+}
+
+inline void AsteroidBelt::unload()
+{
+    if (m_activeNode.NotNull())
+    {
+        m_activeNode->Remove();
+    }
+
+    Satellite::unload();
+}
+
+} // namespace osp
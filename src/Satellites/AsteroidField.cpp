@@ -0,0 +1,233 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Renderer.h>
+#include <Urho3D/Graphics/Viewport.h>
+#include <Urho3D/Scene/Node.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include "../SplitMix.h"
+#include "AsteroidField.h"
+
+namespace osp
+{
+
+AsteroidField::AsteroidField(Context* context) : InstanceGroup(context),
+                                                    m_cellRange(2),
+                                                    m_centerKnown(false),
+                                                    m_rockTotal(0)
+{
+}
+
+void AsteroidField::RegisterObject(Context* context)
+{
+    context->RegisterFactory<AsteroidField>("AsteroidField");
+}
+
+void AsteroidField::initialize(AsteroidBelt* belt)
+{
+    m_belt = belt;
+
+    // Enough blocks for every cell in range of the camera. Never resized
+    // after this, as worker threads read from it
+    const unsigned side = unsigned(m_cellRange * 2 + 1);
+    m_rocks.Resize(side * side * side * belt->get_rock_count());
+    m_cells.Reserve(side * side * side);
+
+    SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(AsteroidField, cell_update));
+}
+
+void AsteroidField::cell_update(StringHash eventType, VariantMap& eventData)
+{
+    if (m_belt.Null() || !node_)
+    {
+        return;
+    }
+
+    // Only fields in the scene seen by the main viewport are updated
+    Viewport* viewport = GetSubsystem<Renderer>()->GetViewport(0);
+
+    if (!viewport || !viewport->GetCamera()
+            || viewport->GetScene() != GetScene())
+    {
+        return;
+    }
+
+    // Camera position relative to the belt's center
+    const Vector3 camera = node_->GetWorldTransform().Inverse()
+                * viewport->GetCamera()->GetNode()->GetWorldPosition();
+
+    const float cellSize = m_belt->get_cell_size();
+    const IntVector3 center(FloorToInt(camera.x_ / cellSize),
+                            FloorToInt(camera.y_ / cellSize),
+                            FloorToInt(camera.z_ / cellSize));
+
+    if (m_centerKnown && center == m_center)
+    {
+        // Nothing new came into range
+        return;
+    }
+
+    m_center = center;
+    m_centerKnown = true;
+
+    // Remove cells that went out of range. Going backwards means cells
+    // swapped into the removed one's place were already checked
+    for (unsigned i = m_cells.Size(); i -- > 0; )
+    {
+        const IntVector3& coords = m_cells[i].m_coords;
+
+        if (Abs(coords.x_ - center.x_) > m_cellRange
+                || Abs(coords.y_ - center.y_) > m_cellRange
+                || Abs(coords.z_ - center.z_) > m_cellRange)
+        {
+            cell_remove(i);
+        }
+    }
+
+    // Mark which of the cells in range already have rocks
+    const int side = m_cellRange * 2 + 1;
+    PODVector<bool> existing(side * side * side);
+
+    for (unsigned i = 0; i < existing.Size(); i ++)
+    {
+        existing[i] = false;
+    }
+
+    for (const Cell& cell : m_cells)
+    {
+        const IntVector3 offset = cell.m_coords - center
+                + IntVector3(m_cellRange, m_cellRange, m_cellRange);
+        existing[(offset.z_ * side + offset.y_) * side + offset.x_] = true;
+    }
+
+    // Add the rest
+    for (int z = 0; z < side; z ++)
+    {
+        for (int y = 0; y < side; y ++)
+        {
+            for (int x = 0; x < side; x ++)
+            {
+                if (!existing[(z * side + y) * side + x])
+                {
+                    cell_add(center + IntVector3(x, y, z)
+                        - IntVector3(m_cellRange, m_cellRange, m_cellRange));
+                }
+            }
+        }
+    }
+
+    resize_instances(m_rockTotal);
+}
+
+void AsteroidField::cell_add(const IntVector3& coords)
+{
+    const unsigned count = m_belt->get_rock_count();
+    const float cellSize = m_belt->get_cell_size();
+
+    Cell cell;
+    cell.m_coords = coords;
+    cell.m_count = 0;
+
+    if (cell_in_belt(coords))
+    {
+        Matrix3x4* rocks = m_rocks.Buffer() + m_cells.Size() * count;
+
+        // Seed made from the coordinates, so a cell always has the same rocks
+        uint64_t state = m_belt->get_seed();
+        state = next_random(state) ^ uint32_t(coords.x_);
+        state = next_random(state) ^ uint32_t(coords.y_);
+        state = next_random(state) ^ uint32_t(coords.z_);
+
+        for (unsigned i = 0; i < count; i ++)
+        {
+            // Every number is taken even for rocks that aren't kept, so the
+            // rest of the cell doesn't change if the density does
+            const float x = next_random_float(state);
+            const float y = next_random_float(state);
+            const float z = next_random_float(state);
+            const float keep = next_random_float(state);
+            const float pitch = next_random_float(state) * 360.0f;
+            const float yaw = next_random_float(state) * 360.0f;
+            const float roll = next_random_float(state) * 360.0f;
+            const float scale = Lerp(m_belt->get_scale_min(),
+                                     m_belt->get_scale_max(),
+                                     next_random_float(state));
+
+            const Vector3 pos = Vector3(coords.x_ + x, coords.y_ + y,
+                                        coords.z_ + z) * cellSize;
+
+            // Denser parts of the belt keep more of their rocks
+            if (keep >= m_belt->get_density(pos))
+            {
+                continue;
+            }
+
+            rocks[cell.m_count] = Matrix3x4(pos, Quaternion(pitch, yaw, roll),
+                                            scale);
+            cell.m_count ++;
+        }
+    }
+
+    m_cells.Push(cell);
+    m_rockTotal += cell.m_count;
+}
+
+void AsteroidField::cell_remove(unsigned cell)
+{
+    const unsigned count = m_belt->get_rock_count();
+    const unsigned last = m_cells.Size() - 1;
+
+    m_rockTotal -= m_cells[cell].m_count;
+
+    // Move the last block into the removed one's place, same as ScatterPool
+    if (cell != last)
+    {
+        Matrix3x4* rocks = m_rocks.Buffer();
+
+        for (unsigned i = 0; i < m_cells[last].m_count; i ++)
+        {
+            rocks[cell * count + i] = rocks[last * count + i];
+        }
+
+        m_cells[cell] = m_cells[last];
+    }
+
+    m_cells.Pop();
+}
+
+bool AsteroidField::cell_in_belt(const IntVector3& coords) const
+{
+    const float cellSize = m_belt->get_cell_size();
+    const Vector3 min = Vector3(coords.x_, coords.y_, coords.z_) * cellSize;
+    const Vector3 max = min + Vector3::ONE * cellSize;
+    const float halfThickness = m_belt->get_thickness() * 0.5f;
+
+    if (max.y_ <= -halfThickness || min.y_ >= halfThickness)
+    {
+        return false;
+    }
+
+    // Closest and furthest distances from the center on the belt's plane
+    const float nearX = Clamp(0.0f, min.x_, max.x_);
+    const float nearZ = Clamp(0.0f, min.z_, max.z_);
+    const float farX = Max(Abs(min.x_), Abs(max.x_));
+    const float farZ = Max(Abs(min.z_), Abs(max.z_));
+
+    return Sqrt(nearX * nearX + nearZ * nearZ) < m_belt->get_outer_radius()
+            && Sqrt(farX * farX + farZ * farZ) > m_belt->get_inner_radius();
+}
+
+unsigned AsteroidField::get_block_count() const
+{
+    return m_belt.NotNull() ? m_cells.Size() : 0;
+}
+
+const Matrix3x4* AsteroidField::get_block(unsigned block,
+                                          unsigned& count) const
+{
+    count = m_cells[block].m_count;
+    return m_rocks.Buffer() + block * m_belt->get_rock_count();
+}
+
+} // namespace osp
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "../InstanceGroup.h"
+#include "AsteroidBelt.h"
+
+namespace osp
+{
+
+/**
+ * Draws the rocks of an AsteroidBelt that are near the camera, with a single
+ * model and material. Created when the belt is loaded, on its active node.
+ *
+ * Space around the belt is split into cubes m_cellSize wide. Only cells
+ * within m_cellRange of the camera's cell have rocks, and the rocks of a
+ * cell are generated from a seed made from its coordinates, so they're
+ * always the same when the camera comes back. Each cell is a block of
+ * instances, see InstanceGroup.
+ */
+class AsteroidField : public InstanceGroup
+{
+    URHO3D_OBJECT(AsteroidField, InstanceGroup)
+
+    struct Cell
+    {
+        IntVector3 m_coords;
+
+        // Number of rocks used in this cell's block
+        unsigned m_count;
+    };
+
+public:
+    // For Urho3D
+    static void RegisterObject(Context* context);
+
+    AsteroidField(Context* context);
+    ~AsteroidField() = default;
+
+    /**
+     * Start generating rocks for a belt around the camera every update
+     * @param belt [in] Belt to get the shape and rocks from
+     */
+    void initialize(AsteroidBelt* belt);
+
+    /**
+     * Generate cells that came within range of the camera, and remove the
+     * ones that went out of range
+     * @param eventType
+     * @param eventData
+     */
+    void cell_update(StringHash eventType, VariantMap& eventData);
+
+    unsigned get_cell_count() const { return m_cells.Size(); }
+
+protected:
+
+    unsigned get_block_count() const override;
+
+    const Matrix3x4* get_block(unsigned block,
+                               unsigned& count) const override;
+
+private:
+
+    /**
+     * Generate rocks for a cell into the next unused block
+     * @param coords [in] Coordinates of the cell
+     */
+    void cell_add(const IntVector3& coords);
+
+    /**
+     * Remove a cell, replacing it with the last cell
+     * @param cell [in] Index of cell to remove
+     */
+    void cell_remove(unsigned cell);
+
+    /**
+     * @return true if any part of a cell is within the belt's bounds
+     */
+    bool cell_in_belt(const IntVector3& coords) const;
+
+    WeakPtr<AsteroidBelt> m_belt;
+
+    // Cells that currently have rocks
+    PODVector<Cell> m_cells;
+
+    // Rock transforms relative to the belt's center, m_belt->get_rock_count()
+    // for each cell, in the same order as m_cells
+    PODVector<Matrix3x4> m_rocks;
+
+    // Cells this far from the camera's cell in any axis have rocks
+    int m_cellRange;
+
+    // Cell the camera was in the last time cells were updated
+    IntVector3 m_center;
+    bool m_centerKnown;
+
+    // Total number of rocks in m_cells
+    unsigned m_rockTotal;
+};
+
+} // namespace osp
@@ -1,8 +1,11 @@
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Resource/ResourceCache.h>
 
 #include "ActiveArea.h"
 #include "AstronomicalBody.h"
+#include "PositionMath.h"
+#include "SatellitePositions.h"
 #include "../Terrain/PlanetTerrain.h"
 
 namespace osp
@@ -18,14 +21,40 @@ Node* AstronomicalBody::load(ActiveArea* area, const Vector3& pos)
     PlanetTerrain* terrain = m_activeNode->CreateComponent<PlanetTerrain>();
     terrain->initialize(this);
 
-    LongVector3 relativePos = Satellite::calculate_relative_position(
-                                        area, this, m_precision);
-
+    if (m_hasAtmosphere)
+    {
+        // Only made again if the atmosphere changed since the last load
+        if (m_atmosphereTables.Null()
+                || !(m_atmosphereTables->get_profile() == m_atmosphere))
+        {
+            m_atmosphereTables = new AtmosphereTables(context_);
+            m_atmosphereTables->initialize(m_atmosphere);
+        }
+    }
 
+    // Same as Satellite::calculate_relative_position, without walking the
+    // tree when there's SatellitePositions
+    SatellitePositions* positions = GetSubsystem<SatellitePositions>();
+    IntVector3 overflows;
     Vector3 floatPos;
-    floatPos.x_ = float(relativePos.x_) / (1 << m_precision);
-    floatPos.y_ = float(relativePos.y_) / (1 << m_precision);
-    floatPos.z_ = float(relativePos.z_) / (1 << m_precision);
+
+    if (positions)
+    {
+        const LongVector3 relativePos = positions->get_relative(area, this,
+                                                                overflows);
+        floatPos = to_meters(relativePos, overflows,
+                             positions->get_precision());
+    }
+    else
+    {
+        // Relative to the area, so in the precision of the area's parent
+        const int precision = area->get_parent()->get_precision();
+        const LongVector3 relativePos
+                = Satellite::calculate_relative_position(area, this,
+                                                         precision,
+                                                         overflows);
+        floatPos = to_meters(relativePos, overflows, precision);
+    }
 
     URHO3D_LOGINFOF("Center at: %f %f %f", floatPos.x_,
                     floatPos.y_, floatPos.z_);
@@ -35,4 +64,17 @@ Node* AstronomicalBody::load(ActiveArea* area, const Vector3& pos)
     return m_activeNode.Get();
 }
 
+Node* AstronomicalBody::load_preview(ActiveArea* area)
+{
+    SatellitePreviews* previews = area->get_previews();
+
+    Material* material = GetSubsystem<ResourceCache>()
+                            ->GetResource<Material>(m_previewMaterial);
+
+    // Previews of planets are just spheres
+    return previews->add_preview(
+                SatellitePreviews::get_sphere_model(context_), material,
+                m_radius);
+}
+
 } // namespace osp
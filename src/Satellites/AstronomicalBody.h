@@ -1,5 +1,6 @@
 #pragma once
 
+#include "AtmosphereTables.h"
 #include "Satellite.h"
 
 namespace osp
@@ -20,6 +21,91 @@ public:
 
     constexpr float get_radius();
 
+    /**
+     * @return Name that stays the same between sessions, unique among
+     *         bodies. Changes made to the terrain are saved under it, empty
+     *         to not save them.
+     */
+    const String& get_id() const { return m_id; }
+
+    /**
+     * @param id [in] Name that's different from every other body's
+     */
+    void set_id(const String& id) { m_id = id; }
+
+    /**
+     * @return Resource name of a HeightPyramid file to use for terrain, or
+     *         empty to use the default height texture
+     */
+    const String& get_height_data() const { return m_heightData; }
+
+    /**
+     * Set elevation data used when terrain is loaded. See HeightPyramid.
+     * @param resourceName [in] Resource name of a HeightPyramid file
+     */
+    void set_height_data(const String& resourceName)
+    {
+        m_heightData = resourceName;
+    }
+
+    /**
+     * @return true if the body has an ocean
+     */
+    bool has_ocean() const { return m_hasOcean; }
+
+    /**
+     * @return Height of sea level above the radius
+     */
+    float get_sea_level() const { return m_seaLevel; }
+
+    /**
+     * Give the body an ocean. Takes effect the next time terrain is loaded.
+     * @param height [in] Height of sea level above the radius
+     */
+    void set_sea_level(float height)
+    {
+        m_hasOcean = true;
+        m_seaLevel = height;
+    }
+
+    /**
+     * @return true if the body has an atmosphere
+     */
+    bool has_atmosphere() const { return m_hasAtmosphere; }
+
+    /**
+     * @return Description of the atmosphere, if there is one
+     */
+    const AtmosphereProfile& get_atmosphere() const { return m_atmosphere; }
+
+    /**
+     * Give the body an atmosphere. Scattering tables for it are loaded or
+     * computed the next time the body is loaded.
+     * @param profile [in] Description of the atmosphere. m_radius is ignored,
+     *                     the body's radius is used instead
+     */
+    void set_atmosphere(const AtmosphereProfile& profile)
+    {
+        m_hasAtmosphere = true;
+        m_atmosphere = profile;
+        m_atmosphere.m_radius = m_radius;
+    }
+
+    /**
+     * @return Scattering tables for the atmosphere, or nullptr if the body
+     *         has no atmosphere or hasn't been loaded yet. Check is_ready
+     *         before using them.
+     */
+    AtmosphereTables* get_atmosphere_tables() const
+    {
+        return m_atmosphereTables.Get();
+    }
+
+    /**
+     * @return Resource name of the material previews are drawn with
+     */
+    const String& get_preview_material() const { return m_previewMaterial; }
+
     Node* load(ActiveArea* area, const Vector3& pos) override;
 
     Node* load_preview(ActiveArea* area) override;
@@ -31,6 +117,26 @@ private:
 
     // Minimum height, for now
     float m_radius;
+
+    // Unique name, see get_id
+    String m_id;
+
+    // HeightPyramid file for terrain, empty if there isn't one
+    String m_heightData;
+
+    // Terrain below this height above m_radius is underwater
+    float m_seaLevel;
+    bool m_hasOcean;
+
+    AtmosphereProfile m_atmosphere;
+    bool m_hasAtmosphere;
+
+    // Kept after unloading, so loading again doesn't need to read the cache
+    SharedPtr<AtmosphereTables> m_atmosphereTables;
+
+    // Material used to draw the preview sphere. Shared by every body that
+    // uses the same one, so they can be drawn together
+    String m_previewMaterial;
 };
 
 inline AstronomicalBody::AstronomicalBody(Context* context)
@@ -38,18 +144,25 @@ inline AstronomicalBody::AstronomicalBody(Context* context)
 {
     m_loadRadius = 5000 * 1024;
     m_radius = 4000.0f;
+    m_seaLevel = 0.0f;
+    m_hasOcean = false;
+    m_hasAtmosphere = false;
     m_name = "Untitled Moon?";
-}
+    m_previewMaterial = "Materials/PlanetPreview.xml";
 
-inline Node* AstronomicalBody::load_preview(ActiveArea *area)
-{
-    // TODO
-    return nullptr;
+    // Planets are big, they can be seen from anywhere
+    m_previewRadius = UINT64_MAX;
 }
 
 inline void AstronomicalBody::unload()
 {
-    m_activeNode->Remove();
+    // Takes the PlanetTerrain and all of its buffers along with it
+    if (m_activeNode.NotNull())
+    {
+        m_activeNode->Remove();
+    }
+
+    Satellite::unload();
 }
 
 constexpr float AstronomicalBody::get_radius()
@@ -0,0 +1,523 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Graphics/Graphics.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+
+#include "AtmosphereTables.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace osp
+{
+
+static constexpr char sc_magic[4] = {'O', 'S', 'P', 'A'};
+
+// Change this whenever the way tables are computed changes, so old cache
+// files are ignored
+static constexpr uint32_t sc_version = 1;
+
+// Magic, version, 5 table sizes, then the profile
+static constexpr unsigned sc_headerSize = 4 + 4 + 5 * 4
+                                            + sizeof(AtmosphereProfile);
+
+// Steps taken along each ray when integrating
+static constexpr unsigned sc_transmittanceSteps = 256;
+static constexpr unsigned sc_scatteringSteps = 64;
+
+static constexpr uint32_t sc_sizes[5] = {
+    AtmosphereTables::sc_transmittanceMu,
+    AtmosphereTables::sc_transmittanceHeight,
+    AtmosphereTables::sc_scatteringMu,
+    AtmosphereTables::sc_scatteringMuS,
+    AtmosphereTables::sc_scatteringHeight
+};
+
+/**
+ * @return Height above the ground for a table coordinate from 0.0 to 1.0
+ */
+static double coord_to_height(float u, float top)
+{
+    return double(u) * u * top;
+}
+
+/**
+ * @return Table coordinate from 0.0 to 1.0 for a height above the ground
+ */
+static float height_to_coord(float height, float top)
+{
+    return Sqrt(Clamp(height / top, 0.0f, 1.0f));
+}
+
+/**
+ * @return true if a ray from a distance r from the center going in a
+ *         direction with cosine mu from straight up hits the ground
+ */
+static bool hits_ground(double r, double mu, double radius)
+{
+    return mu < 0.0 && r * r * (mu * mu - 1.0) + radius * radius >= 0.0;
+}
+
+/**
+ * @return Distance along a ray to where it enters a sphere, for rays that
+ *         start outside of it
+ */
+static double distance_in(double r, double mu, double radius)
+{
+    const double disc = r * r * (mu * mu - 1.0) + radius * radius;
+    return Max(0.0, -r * mu - std::sqrt(Max(disc, 0.0)));
+}
+
+/**
+ * @return Distance along a ray to where it leaves a sphere, for rays that
+ *         start inside of it
+ */
+static double distance_out(double r, double mu, double radius)
+{
+    const double disc = r * r * (mu * mu - 1.0) + radius * radius;
+    return Max(0.0, -r * mu + std::sqrt(Max(disc, 0.0)));
+}
+
+/**
+ * @return Extinction per meter for red, green and blue at a height
+ */
+static Vector3 extinction(const AtmosphereProfile& profile, double height)
+{
+    const float rayleigh = float(std::exp(-height
+                                          / profile.m_rayleighScaleHeight));
+    const float mie = float(std::exp(-height / profile.m_mieScaleHeight));
+
+    return profile.m_rayleighScattering * rayleigh
+            + Vector3::ONE * (profile.m_mieExtinction * mie);
+}
+
+/**
+ * Work function for filling part of the transmittance table
+ * @param item [in] Item with an AtmosphereTables as aux_, and a range of
+ *                  texels as start_ and end_
+ * @param threadIndex [in] Unused
+ */
+static void transmittance_work(const WorkItem* item, unsigned threadIndex)
+{
+    static_cast<AtmosphereTables*>(item->aux_)->compute_transmittance(
+                static_cast<Vector4*>(item->start_),
+                static_cast<Vector4*>(item->end_));
+}
+
+/**
+ * Work function for filling part of the scattering table
+ * @param item [in] Item with an AtmosphereTables as aux_, and a range of
+ *                  texels as start_ and end_
+ * @param threadIndex [in] Unused
+ */
+static void scattering_work(const WorkItem* item, unsigned threadIndex)
+{
+    static_cast<AtmosphereTables*>(item->aux_)->compute_scattering(
+                static_cast<Vector4*>(item->start_),
+                static_cast<Vector4*>(item->end_));
+}
+
+AtmosphereTables::AtmosphereTables(Context* context) : Object(context),
+                                                        m_pending(0),
+                                                        m_ready(false)
+{
+}
+
+AtmosphereTables::~AtmosphereTables()
+{
+    // Workers might still be writing into the tables
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+
+    for (SharedPtr<WorkItem>& item : m_items)
+    {
+        if (!queue->RemoveWorkItem(item))
+        {
+            while (!item->completed_)
+            {
+                Time::Sleep(1);
+            }
+        }
+    }
+}
+
+void AtmosphereTables::initialize(const AtmosphereProfile& profile)
+{
+    m_profile = profile;
+    m_cachePath = get_cache_path(profile);
+
+    if (!m_cachePath.Empty() && load_cache())
+    {
+        URHO3D_LOGINFOF("Loaded atmosphere tables from %s",
+                        m_cachePath.CString());
+        create_textures();
+        m_ready = true;
+        return;
+    }
+
+    m_timer.Reset();
+
+    SubscribeToEvent(E_WORKITEMCOMPLETED,
+                     URHO3D_HANDLER(AtmosphereTables, work_finished));
+
+    // Scattering is started once this is done, as it reads transmittance
+    m_transmittance.Resize(sc_transmittanceMu * sc_transmittanceHeight);
+    queue_work(m_transmittance, sc_transmittanceMu, transmittance_work);
+}
+
+void AtmosphereTables::work_finished(StringHash eventType,
+                                     VariantMap& eventData)
+{
+    using namespace WorkItemCompleted;
+
+    const WorkItem* item = static_cast<const WorkItem*>(
+                                eventData[P_ITEM].GetVoidPtr());
+
+    if (item->aux_ != this)
+    {
+        // Someone else's work item
+        return;
+    }
+
+    m_pending --;
+    if (m_pending != 0)
+    {
+        return;
+    }
+
+    m_items.Clear();
+
+    if (m_scattering.Empty())
+    {
+        // Transmittance is done, a work item for each height of scattering
+        m_scattering.Resize(sc_scatteringMu * sc_scatteringMuS
+                            * sc_scatteringHeight);
+        queue_work(m_scattering, sc_scatteringMu * sc_scatteringMuS,
+                   scattering_work);
+        return;
+    }
+
+    UnsubscribeFromEvent(E_WORKITEMCOMPLETED);
+
+    URHO3D_LOGINFOF("Computed atmosphere tables in %lld us",
+                    m_timer.GetUSec(false));
+
+    save_cache();
+    create_textures();
+    m_ready = true;
+}
+
+Vector3 AtmosphereTables::get_transmittance(float height, float mu) const
+{
+    if (m_transmittance.Empty())
+    {
+        return Vector3::ONE;
+    }
+
+    const float x = Clamp((mu + 1.0f) * 0.5f, 0.0f, 1.0f)
+                        * (sc_transmittanceMu - 1);
+    const float y = height_to_coord(height, m_profile.m_height)
+                        * (sc_transmittanceHeight - 1);
+
+    const unsigned x0 = Min(unsigned(x), sc_transmittanceMu - 2);
+    const unsigned y0 = Min(unsigned(y), sc_transmittanceHeight - 2);
+
+    const Vector4* texel = m_transmittance.Buffer()
+                            + y0 * sc_transmittanceMu + x0;
+
+    const Vector4 bottom = texel[0].Lerp(texel[1], x - x0);
+    const Vector4 top = texel[sc_transmittanceMu].Lerp(
+                            texel[sc_transmittanceMu + 1], x - x0);
+    const Vector4 result = bottom.Lerp(top, y - y0);
+
+    return Vector3(result.x_, result.y_, result.z_);
+}
+
+String AtmosphereTables::get_cache_path(
+        const AtmosphereProfile& profile) const
+{
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    if (!fileSystem)
+    {
+        return String::EMPTY;
+    }
+
+    const String dir = fileSystem->GetAppPreferencesDir("OpenSpaceProgram",
+                                                        "Cache");
+    if (dir.Empty())
+    {
+        return String::EMPTY;
+    }
+
+    // Key made from everything that affects the tables. The whole profile is
+    // in the file too, in case two profiles hash to the same thing
+    unsigned hash = sc_version;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(
+                                    &profile);
+
+    for (unsigned i = 0; i < sizeof(AtmosphereProfile); i ++)
+    {
+        hash = SDBMHash(hash, bytes[i]);
+    }
+
+    for (uint32_t size : sc_sizes)
+    {
+        hash = SDBMHash(hash, static_cast<unsigned char>(size));
+    }
+
+    return dir + "Atmosphere" + ToStringHex(hash) + ".bin";
+}
+
+void AtmosphereTables::compute_transmittance(Vector4* begin,
+                                             Vector4* end) const
+{
+    const double radius = m_profile.m_radius;
+    const double top = radius + m_profile.m_height;
+
+    for (Vector4* texel = begin; texel != end; texel ++)
+    {
+        const unsigned i = unsigned(texel - m_transmittance.Buffer());
+        const unsigned x = i % sc_transmittanceMu;
+        const unsigned y = i / sc_transmittanceMu;
+
+        const double mu = float(x) / (sc_transmittanceMu - 1) * 2.0f - 1.0f;
+        const double r = radius + coord_to_height(
+                                    float(y) / (sc_transmittanceHeight - 1),
+                                    m_profile.m_height);
+
+        if (hits_ground(r, mu, radius))
+        {
+            // Nothing gets through the planet
+            *texel = Vector4(0.0f, 0.0f, 0.0f, 1.0f);
+            continue;
+        }
+
+        // Optical depth all the way to the top, midpoint rule
+        const double step = distance_out(r, mu, top) / sc_transmittanceSteps;
+        Vector3 depth = Vector3::ZERO;
+
+        for (unsigned k = 0; k < sc_transmittanceSteps; k ++)
+        {
+            const double d = (k + 0.5) * step;
+            const double rd = std::sqrt(r * r + d * d + 2.0 * r * mu * d);
+            depth += extinction(m_profile, rd - radius) * float(step);
+        }
+
+        *texel = Vector4(std::exp(-depth.x_), std::exp(-depth.y_),
+                         std::exp(-depth.z_), 1.0f);
+    }
+}
+
+void AtmosphereTables::compute_scattering(Vector4* begin,
+                                          Vector4* end) const
+{
+    const double radius = m_profile.m_radius;
+    const double top = radius + m_profile.m_height;
+
+    for (Vector4* texel = begin; texel != end; texel ++)
+    {
+        const unsigned i = unsigned(texel - m_scattering.Buffer());
+        const unsigned x = i % sc_scatteringMu;
+        const unsigned y = (i / sc_scatteringMu) % sc_scatteringMuS;
+        const unsigned z = i / (sc_scatteringMu * sc_scatteringMuS);
+
+        const double mu = float(x) / (sc_scatteringMu - 1) * 2.0f - 1.0f;
+        const double muS = float(y) / (sc_scatteringMuS - 1) * 2.0f - 1.0f;
+        const double r = radius + coord_to_height(
+                                    float(z) / (sc_scatteringHeight - 1),
+                                    m_profile.m_height);
+
+        // Cosine of the angle between the view and the sun, averaged over
+        // every direction the sun could be around the view ray
+        const double nu = mu * muS;
+
+        const double distance = hits_ground(r, mu, radius)
+                                    ? distance_in(r, mu, radius)
+                                    : distance_out(r, mu, top);
+        const double step = distance / sc_scatteringSteps;
+
+        Vector3 rayleigh = Vector3::ZERO;
+        Vector3 mie = Vector3::ZERO;
+
+        // Optical depth from the start of the ray
+        Vector3 depth = Vector3::ZERO;
+
+        for (unsigned k = 0; k < sc_scatteringSteps; k ++)
+        {
+            const double d = (k + 0.5) * step;
+            const double rd = std::sqrt(r * r + d * d + 2.0 * r * mu * d);
+            const double height = rd - radius;
+
+            const Vector3 stepDepth = extinction(m_profile, height)
+                                        * float(step);
+            const Vector3 middle = depth + stepDepth * 0.5f;
+            depth += stepDepth;
+
+            // Light that comes in from the sun, then makes it to the start
+            const float muSd = float(Clamp((r * muS + d * nu) / rd,
+                                           -1.0, 1.0));
+            const Vector3 sun = get_transmittance(float(height), muSd);
+            const Vector3 path = sun * Vector3(std::exp(-middle.x_),
+                                               std::exp(-middle.y_),
+                                               std::exp(-middle.z_));
+
+            rayleigh += path * float(std::exp(
+                            -height / m_profile.m_rayleighScaleHeight) * step);
+            mie += path * float(std::exp(
+                            -height / m_profile.m_mieScaleHeight) * step);
+        }
+
+        rayleigh = rayleigh * m_profile.m_rayleighScattering;
+        *texel = Vector4(rayleigh, mie.x_ * m_profile.m_mieScattering);
+    }
+}
+
+void AtmosphereTables::queue_work(PODVector<Vector4>& table, unsigned rowSize,
+                                  void (*function)(const WorkItem*, unsigned))
+{
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+
+    for (unsigned i = 0; i < table.Size(); i += rowSize)
+    {
+        SharedPtr<WorkItem> item(new WorkItem());
+        item->workFunction_ = function;
+        item->start_ = table.Buffer() + i;
+        item->end_ = table.Buffer() + Min(i + rowSize, table.Size());
+        item->aux_ = this;
+        item->sendEvent_ = true;
+
+        m_items.Push(item);
+        m_pending ++;
+
+        queue->AddWorkItem(item);
+    }
+}
+
+bool AtmosphereTables::load_cache()
+{
+    FILE* file = fopen(m_cachePath.CString(), "rb");
+    if (!file)
+    {
+        // Not cached yet
+        return false;
+    }
+
+    uint8_t header[sc_headerSize];
+    uint8_t expected[sc_headerSize];
+    memcpy(expected + 0,  sc_magic,    4);
+    memcpy(expected + 4,  &sc_version, 4);
+    memcpy(expected + 8,  sc_sizes,    sizeof(sc_sizes));
+    memcpy(expected + 28, &m_profile,  sizeof(AtmosphereProfile));
+
+    m_transmittance.Resize(sc_transmittanceMu * sc_transmittanceHeight);
+    m_scattering.Resize(sc_scatteringMu * sc_scatteringMuS
+                        * sc_scatteringHeight);
+
+    const bool success
+            = fread(header, sc_headerSize, 1, file) == 1
+                && memcmp(header, expected, sc_headerSize) == 0
+                && fread(m_transmittance.Buffer(), sizeof(Vector4),
+                         m_transmittance.Size(), file)
+                        == m_transmittance.Size()
+                && fread(m_scattering.Buffer(), sizeof(Vector4),
+                         m_scattering.Size(), file)
+                        == m_scattering.Size();
+
+    fclose(file);
+
+    if (!success)
+    {
+        URHO3D_LOGWARNINGF("Ignoring old or invalid atmosphere cache: %s",
+                           m_cachePath.CString());
+        m_transmittance.Clear();
+        m_scattering.Clear();
+    }
+
+    return success;
+}
+
+void AtmosphereTables::save_cache() const
+{
+    if (m_cachePath.Empty())
+    {
+        return;
+    }
+
+    // Written to a different file first, so a file that's only partly
+    // written is never loaded
+    const String tempPath = m_cachePath + ".tmp";
+
+    FILE* file = fopen(tempPath.CString(), "wb");
+    if (!file)
+    {
+        URHO3D_LOGERRORF("Can't write atmosphere cache: %s",
+                         tempPath.CString());
+        return;
+    }
+
+    uint8_t header[sc_headerSize];
+    memcpy(header + 0,  sc_magic,    4);
+    memcpy(header + 4,  &sc_version, 4);
+    memcpy(header + 8,  sc_sizes,    sizeof(sc_sizes));
+    memcpy(header + 28, &m_profile,  sizeof(AtmosphereProfile));
+
+    bool success = fwrite(header, sc_headerSize, 1, file) == 1;
+    success &= fwrite(m_transmittance.Buffer(), sizeof(Vector4),
+                      m_transmittance.Size(), file) == m_transmittance.Size();
+    success &= fwrite(m_scattering.Buffer(), sizeof(Vector4),
+                      m_scattering.Size(), file) == m_scattering.Size();
+    success &= fclose(file) == 0;
+
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+
+    if (success)
+    {
+        // Replace an invalid one, if there was one
+        fileSystem->Delete(m_cachePath);
+        success = fileSystem->Rename(tempPath, m_cachePath);
+    }
+
+    if (!success)
+    {
+        URHO3D_LOGERRORF("Error writing atmosphere cache: %s",
+                         m_cachePath.CString());
+        fileSystem->Delete(tempPath);
+    }
+}
+
+void AtmosphereTables::create_textures()
+{
+    if (!GetSubsystem<Graphics>())
+    {
+        // Headless
+        return;
+    }
+
+    const unsigned format = Graphics::GetRGBAFloat32Format();
+
+    m_transmittanceTexture = new Texture2D(context_);
+    m_transmittanceTexture->SetNumLevels(1);
+    m_transmittanceTexture->SetFilterMode(FILTER_BILINEAR);
+    m_transmittanceTexture->SetAddressMode(COORD_U, ADDRESS_CLAMP);
+    m_transmittanceTexture->SetAddressMode(COORD_V, ADDRESS_CLAMP);
+    m_transmittanceTexture->SetSize(sc_transmittanceMu,
+                                    sc_transmittanceHeight, format);
+    m_transmittanceTexture->SetData(0, 0, 0, sc_transmittanceMu,
+                                    sc_transmittanceHeight,
+                                    m_transmittance.Buffer());
+
+    m_scatteringTexture = new Texture3D(context_);
+    m_scatteringTexture->SetNumLevels(1);
+    m_scatteringTexture->SetFilterMode(FILTER_BILINEAR);
+    m_scatteringTexture->SetAddressMode(COORD_U, ADDRESS_CLAMP);
+    m_scatteringTexture->SetAddressMode(COORD_V, ADDRESS_CLAMP);
+    m_scatteringTexture->SetAddressMode(COORD_W, ADDRESS_CLAMP);
+    m_scatteringTexture->SetSize(sc_scatteringMu, sc_scatteringMuS,
+                                 sc_scatteringHeight, format);
+    m_scatteringTexture->SetData(0, 0, 0, 0, sc_scatteringMu,
+                                 sc_scatteringMuS, sc_scatteringHeight,
+                                 m_scattering.Buffer());
+}
+
+} // namespace osp
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Graphics/Texture2D.h>
+#include <Urho3D/Graphics/Texture3D.h>
+#include <Urho3D/Math/Vector4.h>
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+/**
+ * Describes the air of an AstronomicalBody. Everything that affects the
+ * scattering tables is in here, so it's also used as the key for caching
+ * them. Only floats, so there's no padding to worry about when hashing.
+ */
+struct AtmosphereProfile
+{
+    // Radius of the ground, filled in by the AstronomicalBody
+    float m_radius;
+
+    // Height of the top of the atmosphere above m_radius
+    float m_height;
+
+    // Rayleigh scattering per meter at the ground for red, green and blue,
+    // and the height over which it falls off by e
+    Vector3 m_rayleighScattering;
+    float m_rayleighScaleHeight;
+
+    // Mie scattering and extinction (scattering + absorption) per meter at
+    // the ground, same for every colour
+    float m_mieScattering;
+    float m_mieExtinction;
+    float m_mieScaleHeight;
+
+    bool operator==(const AtmosphereProfile& other) const
+    {
+        return m_radius == other.m_radius
+                && m_height == other.m_height
+                && m_rayleighScattering == other.m_rayleighScattering
+                && m_rayleighScaleHeight == other.m_rayleighScaleHeight
+                && m_mieScattering == other.m_mieScattering
+                && m_mieExtinction == other.m_mieExtinction
+                && m_mieScaleHeight == other.m_mieScaleHeight;
+    }
+};
+
+/**
+ * Precomputed lookup tables for drawing an atmosphere, so that shaders only
+ * need a few texture reads instead of marching through the air per pixel.
+ *
+ * Transmittance [2D]: how much light gets through from a point to the top of
+ * the atmosphere, by height and cosine of the view zenith angle. 0 if the
+ * ray hits the ground.
+ *
+ * Scattering [3D]: single scattered light reaching a point along a view ray
+ * with the sun at unit intensity, by height, view zenith and sun zenith.
+ * Phase functions are left for the shader. The angle between the view and
+ * the sun is averaged out instead of being a 4th dimension, as in Elek's
+ * "Rendering Parametrizable Planetary Atmospheres". RGB is Rayleigh, and
+ * alpha is only the red channel of Mie, the rest can be approximated from
+ * the ratio to Rayleigh like in Bruneton and Neyret.
+ *
+ * Computing them takes a while, so it's spread over the WorkQueue's worker
+ * threads, and the results are saved to a cache file keyed by the profile.
+ * Loading a body whose atmosphere has been seen before only reads the file.
+ *
+ * Heights are stored as sqrt(height / top) for more detail near the ground,
+ * and angle cosines as (cos + 1) / 2. Texel i of n is at i / (n - 1), so the
+ * shader has to map coordinates to (u * (n - 1) + 0.5) / n.
+ */
+class AtmosphereTables : public Object
+{
+    URHO3D_OBJECT(AtmosphereTables, Object)
+
+public:
+
+    static constexpr unsigned sc_transmittanceMu = 128;
+    static constexpr unsigned sc_transmittanceHeight = 32;
+
+    static constexpr unsigned sc_scatteringMu = 64;
+    static constexpr unsigned sc_scatteringMuS = 32;
+    static constexpr unsigned sc_scatteringHeight = 16;
+
+    AtmosphereTables(Context* context);
+    ~AtmosphereTables();
+
+    /**
+     * Load the tables for a profile from the cache, or start computing them
+     * on worker threads if they aren't cached. Call only once.
+     * @param profile [in] Atmosphere to make tables for
+     */
+    void initialize(const AtmosphereProfile& profile);
+
+    /**
+     * Called when a work item is completed. Starts the scattering table
+     * once transmittance is done, and saves both once that's done too.
+     * @param eventType
+     * @param eventData
+     */
+    void work_finished(StringHash eventType, VariantMap& eventData);
+
+    /**
+     * @return true if both tables are done and can be used
+     */
+    bool is_ready() const { return m_ready; }
+
+    const AtmosphereProfile& get_profile() const { return m_profile; }
+
+    /**
+     * Look up transmittance from the table, with bilinear filtering
+     * @param height [in] Height above the ground
+     * @param mu [in] Cosine of the angle between the ray and straight up
+     * @return Fraction of red, green and blue light that makes it through
+     */
+    Vector3 get_transmittance(float height, float mu) const;
+
+    /**
+     * @return Transmittance table as a float texture, or nullptr if not
+     *         ready or running without graphics
+     */
+    Texture2D* get_transmittance_texture() const
+    {
+        return m_transmittanceTexture.Get();
+    }
+
+    /**
+     * @return Scattering table as a float texture, or nullptr if not ready
+     *         or running without graphics
+     */
+    Texture3D* get_scattering_texture() const
+    {
+        return m_scatteringTexture.Get();
+    }
+
+    /**
+     * Fill part of the transmittance table. Called from worker threads
+     * @param begin [out] First texel to fill
+     * @param end [out] One past the last texel to fill
+     */
+    void compute_transmittance(Vector4* begin, Vector4* end) const;
+
+    /**
+     * Fill part of the scattering table. Needs the whole transmittance table
+     * @param begin [out] First texel to fill
+     * @param end [out] One past the last texel to fill
+     */
+    void compute_scattering(Vector4* begin, Vector4* end) const;
+
+    /**
+     * @return Path of the cache file for a profile, or empty if there's
+     *         nowhere to put it
+     */
+    String get_cache_path(const AtmosphereProfile& profile) const;
+
+private:
+
+    /**
+     * Split a table into work items and add them to the WorkQueue
+     * @param table [in] Table to fill, already the right size
+     * @param rowSize [in] Texels for each work item to fill
+     * @param function [in] Work function that fills a range of texels
+     */
+    void queue_work(PODVector<Vector4>& table, unsigned rowSize,
+                    void (*function)(const WorkItem*, unsigned));
+
+    /**
+     * Read both tables from m_cachePath
+     * @return true if the file exists and matches m_profile
+     */
+    bool load_cache();
+
+    /**
+     * Write both tables to m_cachePath. Errors are logged, but otherwise
+     * ignored, as the tables can always be computed again.
+     */
+    void save_cache() const;
+
+    /**
+     * Upload both tables to textures, if there's graphics
+     */
+    void create_textures();
+
+    AtmosphereProfile m_profile;
+
+    // Where the tables are cached, empty to not cache
+    String m_cachePath;
+
+    // sc_transmittanceMu wide, sc_transmittanceHeight high
+    PODVector<Vector4> m_transmittance;
+
+    // sc_scatteringMu wide, sc_scatteringMuS high, sc_scatteringHeight deep
+    PODVector<Vector4> m_scattering;
+
+    // Work items that haven't completed yet. Both tables aren't resized while
+    // these are running, as workers write straight into them
+    Vector< SharedPtr<WorkItem> > m_items;
+    unsigned m_pending;
+
+    bool m_ready;
+
+    // Time since computing started
+    HiresTimer m_timer;
+
+    SharedPtr<Texture2D> m_transmittanceTexture;
+    SharedPtr<Texture3D> m_scatteringTexture;
+};
+
+} // namespace osp
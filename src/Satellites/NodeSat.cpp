@@ -15,12 +15,34 @@ Node* NodeSat::load(ActiveArea* area, const Vector3& pos)
         return nullptr;
     }
 
-    // Move the node into the ActiveArea scene
+    // Move the node into the ActiveArea scene, wherever the origin is now
     m_node->SetParent(area->get_active_node());
+    m_node->SetPosition(pos);
 
     m_activeNode = m_node;
 
     return m_node.Get();
 }
 
+void NodeSat::unload()
+{
+    if (m_activeNode.NotNull())
+    {
+        // Keep the position it moved to while loaded
+        calculate_position();
+
+        // Only taken out of the scene, m_node keeps it around for the next
+        // time it's loaded
+        m_node->Remove();
+    }
+
+    Satellite::unload();
+}
+
+Node* NodeSat::load_preview(ActiveArea* area)
+{
+    // Too small to be seen as anything but a dot
+    return area->get_previews()->add_flare();
+}
+
 } // namespace osp
@@ -42,15 +42,10 @@ inline NodeSat::NodeSat(Context* context)
  : Satellite(context)
 {
     m_name = "Probably a rocket";
-}
 
-inline Node* NodeSat::load_preview(ActiveArea* area)
-{
-    // TODO:
-    return nullptr;
+    // Show a flare within 100km
+    m_previewRadius = 100000ull * 1024;
 }
 
-inline void NodeSat::unload()
-{ }
 
 } // namespace osp
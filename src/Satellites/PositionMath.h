@@ -0,0 +1,209 @@
+#pragma once
+
+#include <Urho3D/Math/Vector3.h>
+
+#include "../LongVector3.h"
+
+#include <climits>
+#include <cmath>
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+// Positions too big for a LongVector3 are kept as the LongVector3 wrapped
+// around, plus the number of times each component wrapped (carries). The
+// actual value is position + carries * 2^64. Carries are almost always zero,
+// and checking for overflow is the only thing it costs when they are.
+
+// 2^64, value of a single carry
+static constexpr double gc_carryValue = 18446744073709551616.0;
+
+// Shifting further than this would lose everything anyways
+static constexpr int gc_maxShift = 62;
+
+/**
+ * Add to a single component, counting overflows into a carry
+ * @param value [ref] Component to add to
+ * @param carry [ref] Carry of value, incremented or decremented if the sum
+ *                    wraps around
+ * @param add [in] Amount to add
+ */
+inline void add_carry(int64_t& value, int& carry, int64_t add)
+{
+    // Wrap around without undefined behaviour
+    const int64_t sum = int64_t(uint64_t(value) + uint64_t(add));
+
+    // Overflow only happens when both have the same sign, and the sum
+    // doesn't
+    if (((value ^ sum) & (add ^ sum)) < 0)
+    {
+        carry += (add < 0) ? -1 : 1;
+    }
+    value = sum;
+}
+
+/**
+ * Subtract from a single component, counting overflows into a carry
+ * @param value [ref] Component to subtract from
+ * @param carry [ref] Carry of value
+ * @param sub [in] Amount to subtract
+ */
+inline void sub_carry(int64_t& value, int& carry, int64_t sub)
+{
+    const int64_t diff = int64_t(uint64_t(value) - uint64_t(sub));
+
+    if (((value ^ sub) & (value ^ diff)) < 0)
+    {
+        carry += (sub < 0) ? 1 : -1;
+    }
+    value = diff;
+}
+
+/**
+ * Add two positions that might overflow
+ * @param pos [ref] Position to add to
+ * @param carries [ref] Carries of pos
+ * @param add [in] Position to add
+ */
+inline void add_carry(LongVector3& pos, IntVector3& carries,
+                      const LongVector3& add)
+{
+    add_carry(pos.x_, carries.x_, add.x_);
+    add_carry(pos.y_, carries.y_, add.y_);
+    add_carry(pos.z_, carries.z_, add.z_);
+}
+
+/**
+ * Subtract two positions that might overflow
+ * @param pos [ref] Position to subtract from
+ * @param carries [ref] Carries of pos
+ * @param sub [in] Position to subtract
+ */
+inline void sub_carry(LongVector3& pos, IntVector3& carries,
+                      const LongVector3& sub)
+{
+    sub_carry(pos.x_, carries.x_, sub.x_);
+    sub_carry(pos.y_, carries.y_, sub.y_);
+    sub_carry(pos.z_, carries.z_, sub.z_);
+}
+
+/**
+ * @return Carry clamped into an int, carries that big are meaningless
+ *         anyways
+ */
+inline int clamp_carry(int64_t carry)
+{
+    return int(Clamp<int64_t>(carry, INT_MIN, INT_MAX));
+}
+
+/**
+ * Multiply a single component and its carry by 2^shift
+ * @param value [ref] Component to shift
+ * @param carry [ref] Carry of value
+ * @param shift [in] Power of two to multiply by, negative to divide.
+ *                   Division rounds towards negative infinity.
+ */
+inline void shift_carry(int64_t& value, int& carry, int shift)
+{
+    if (shift > 0)
+    {
+        const int s = Min(shift, gc_maxShift);
+
+        // Bits shifted out of the top go into the carry
+        const int64_t high = value >> (64 - s);
+        const int64_t low = int64_t(uint64_t(value) << s);
+
+        // Carries shifted this far don't fit in an int anyways
+        const int64_t carryHigh = (carry && s >= 32)
+                ? ((carry > 0) ? INT_MAX : INT_MIN)
+                : int64_t(carry) * (int64_t(1) << s);
+
+        // low is signed, so the top bit of the unsigned result counts as
+        // one more carry
+        carry = clamp_carry(carryHigh + high + ((low < 0) ? 1 : 0));
+        value = low;
+    }
+    else if (shift < 0)
+    {
+        const int s = Min(-shift, gc_maxShift);
+
+        // carry * 2^64 / 2^s, split into whole carries and the remainder
+        // that lands in the bottom 64 bits
+        const int64_t carryHigh = int64_t(carry) >> s;
+        const int64_t remainder = int64_t(carry)
+                                    - carryHigh * (int64_t(1) << s);
+        const uint64_t carryLow = uint64_t(remainder) << (64 - s);
+
+        // Unsigned value with the top bit set counts as a carry when read as
+        // signed
+        int64_t result = int64_t(carryLow);
+        int resultCarry = clamp_carry(carryHigh + ((result < 0) ? 1 : 0));
+
+        add_carry(result, resultCarry, value >> s);
+
+        value = result;
+        carry = resultCarry;
+    }
+}
+
+/**
+ * Multiply a position and its carries by 2^shift
+ * @param pos [ref] Position to shift
+ * @param carries [ref] Carries of pos
+ * @param shift [in] Power of two to multiply by, negative to divide
+ */
+inline void shift_carry(LongVector3& pos, IntVector3& carries, int shift)
+{
+    // Precisions are almost always the same
+    if (shift == 0)
+    {
+        return;
+    }
+
+    shift_carry(pos.x_, carries.x_, shift);
+    shift_carry(pos.y_, carries.y_, shift);
+    shift_carry(pos.z_, carries.z_, shift);
+}
+
+/**
+ * @param pos [in] Position that might have overflowed
+ * @param carries [in] Carries of pos
+ * @return pos clamped to what fits in a LongVector3
+ */
+inline LongVector3 saturate_carry(const LongVector3& pos,
+                                  const IntVector3& carries)
+{
+    return LongVector3(
+            carries.x_ ? ((carries.x_ > 0) ? INT64_MAX : INT64_MIN) : pos.x_,
+            carries.y_ ? ((carries.y_ > 0) ? INT64_MAX : INT64_MIN) : pos.y_,
+            carries.z_ ? ((carries.z_ > 0) ? INT64_MAX : INT64_MIN) : pos.z_);
+}
+
+/**
+ * @param value [in] Component that might have overflowed
+ * @param carry [in] Carry of value
+ * @return Actual value of the component, as close as a double gets
+ */
+inline double carry_to_double(int64_t value, int carry)
+{
+    return double(value) + double(carry) * gc_carryValue;
+}
+
+/**
+ * @param pos [in] Position that might have overflowed
+ * @param carries [in] Carries of pos
+ * @param precision [in] Precision of pos, 2^precision units per meter
+ * @return pos in meters
+ */
+inline Vector3 to_meters(const LongVector3& pos, const IntVector3& carries,
+                         int precision)
+{
+    const double scale = std::ldexp(1.0, -precision);
+    return Vector3(float(carry_to_double(pos.x_, carries.x_) * scale),
+                   float(carry_to_double(pos.y_, carries.y_) * scale),
+                   float(carry_to_double(pos.z_, carries.z_) * scale));
+}
+
+} // namespace osp
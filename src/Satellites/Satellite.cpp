@@ -1,7 +1,11 @@
 #include <Urho3D/IO/Log.h>
 
 #include "ActiveArea.h"
+#include "PositionMath.h"
 #include "Satellite.h"
+#include "SatellitePositions.h"
+
+#include <cmath>
 
 namespace osp
 {
@@ -18,59 +22,293 @@ Satellite::~Satellite()
 
 void Satellite::add_child(Satellite *newChild)
 {
+    if (newChild->m_parent == this)
+    {
+        return;
+    }
+
     if (newChild->m_parent.NotNull())
     {
-        // TODO: move old parent's UniquePtr child to this satellite
+        // Same place in the universe, relative to this satellite instead
+        IntVector3 overflows;
+        const LongVector3 pos = saturate_carry(
+                    calculate_relative_position(this, newChild, m_precision,
+                                                overflows),
+                    overflows);
+
+        newChild->m_position = pos;
+
+        newChild->m_parent->detach_child(newChild);
     }
+
     newChild->m_index = m_children.Size();
-    newChild->m_depth = m_depth + 1;
     newChild->m_parent = this;
     m_children.Push(UniquePtr<Satellite>(newChild));
+
+    if (m_childIndex.Null())
+    {
+        m_childIndex.Reset(new SatelliteIndex);
+    }
+
+    // Inserts it into the index, as it isn't in there yet
+    child_moved(newChild);
+
+    if (SatellitePositions* positions = GetSubsystem<SatellitePositions>())
+    {
+        positions->moved(newChild);
+    }
+}
+
+void Satellite::remove_child(Satellite* child)
+{
+    if (child->m_parent != this)
+    {
+        return;
+    }
+
+    delete detach_child(child);
+}
+
+Satellite* Satellite::detach_child(Satellite* child)
+{
+    const unsigned index = child->m_index;
+    Satellite* detached = m_children[index].Detach();
+
+    // Move the last child into the empty space
+    if (index != m_children.Size() - 1)
+    {
+        m_children[index] = std::move(m_children.Back());
+        m_children[index]->m_index = index;
+    }
+    m_children.Pop();
+
+    const bool seenAnywhere = is_seen_anywhere();
+    m_childIndex->remove(child);
+    child->m_parent = nullptr;
+
+    // Might not need to be returned by every query of the parent's index
+    // anymore
+    if (is_seen_anywhere() != seenAnywhere && m_parent.NotNull())
+    {
+        m_parent->child_moved(this);
+    }
+
+    // Every descendant's position changes or is about to be deleted along
+    // with it, not just the child's
+    if (SatellitePositions* positions = GetSubsystem<SatellitePositions>())
+    {
+        PODVector<Satellite*> subtree;
+        subtree.Push(child);
+
+        while (!subtree.Empty())
+        {
+            Satellite* sat = subtree.Back();
+            subtree.Pop();
+            positions->removed(sat);
+
+            for (UniquePtr<Satellite>& grandchild : sat->m_children)
+            {
+                subtree.Push(grandchild.Get());
+            }
+        }
+    }
+
+    return detached;
+}
+
+unsigned Satellite::get_depth() const
+{
+    unsigned depth = 0;
+
+    for (const Satellite* sat = m_parent; sat; sat = sat->m_parent)
+    {
+        depth ++;
+    }
+
+    return depth;
+}
+
+void Satellite::set_position(const LongVector3& pos)
+{
+    m_position = pos;
+
+    if (m_parent.NotNull())
+    {
+        m_parent->child_moved(this);
+    }
+
+    if (SatellitePositions* positions = GetSubsystem<SatellitePositions>())
+    {
+        positions->moved(this);
+    }
+}
+
+/**
+ * Convert a radius to a different precision, rounding up so it still
+ * covers everything it did
+ * @param radius [in] Radius to convert, UINT64_MAX if it doesn't fit
+ * @param shift [in] Precision to convert to, minus the current precision
+ * @return Converted radius, UINT64_MAX if it doesn't fit
+ */
+static uint64_t shift_radius(uint64_t radius, int shift)
+{
+    if (radius == 0 || radius == UINT64_MAX || shift == 0)
+    {
+        return radius;
+    }
+
+    if (shift > 0)
+    {
+        return (shift >= 64 || radius > (UINT64_MAX >> shift))
+                ? UINT64_MAX : radius << shift;
+    }
+
+    if (shift <= -64)
+    {
+        return 1;
+    }
+
+    const uint64_t lost = radius & ((uint64_t(1) << -shift) - 1);
+    return (radius >> -shift) + (lost ? 1 : 0);
+}
+
+uint64_t Satellite::get_index_radius() const
+{
+    // Children are in this Satellite's precision, the rest in the parent's
+    const uint64_t subtree = m_parent.Null() ? m_subtreeRadius
+            : shift_radius(m_subtreeRadius,
+                           m_parent->m_precision - m_precision);
+
+    // Seen from anywhere is handled by is_seen_anywhere, every radius up
+    // the tree would get stuck at UINT64_MAX otherwise
+    const uint64_t preview = (m_previewRadius == UINT64_MAX) ? 0
+                                                             : m_previewRadius;
+
+    return Max(subtree, Max(m_loadRadius, preview));
+}
+
+bool Satellite::is_seen_anywhere() const
+{
+    return m_previewRadius == UINT64_MAX
+            || (m_childIndex.NotNull() && m_childIndex->has_everywhere());
+}
+
+void Satellite::radius_changed()
+{
+    if (m_parent.NotNull())
+    {
+        m_parent->child_moved(this);
+    }
+}
+
+void Satellite::child_moved(Satellite* child)
+{
+    const bool seenAnywhere = is_seen_anywhere();
+    m_childIndex->update(child);
+
+    // Furthest the child reaches from this satellite's center
+    const double x = double(child->m_position.x_);
+    const double y = double(child->m_position.y_);
+    const double z = double(child->m_position.z_);
+    const double reach = Sqrt(x * x + y * y + z * z)
+                            + double(child->get_index_radius());
+
+    // UINT64_MAX rounds up to 2^64 as a double, anything at least that big
+    // doesn't fit
+    const uint64_t extent = (reach >= double(UINT64_MAX)) ? UINT64_MAX
+                                                          : uint64_t(reach) + 1;
+
+    const uint64_t before = get_index_radius();
+    m_subtreeRadius = Max(m_subtreeRadius, extent);
+
+    if (m_parent.NotNull() && (get_index_radius() != before
+                               || is_seen_anywhere() != seenAnywhere))
+    {
+        m_parent->child_moved(this);
+    }
+}
+
+/**
+ * Add a child's position to a sum in a different precision
+ * @param sum [ref] Position to add to
+ * @param carries [ref] Carries of sum
+ * @param child [in] Satellite with a parent, position is added
+ * @param precision [in] Precision of sum
+ */
+static void add_position(LongVector3& sum, IntVector3& carries,
+                         const Satellite* child, int precision)
+{
+    LongVector3 pos = child->get_position();
+    IntVector3 posCarries;
+    shift_carry(pos, posCarries,
+                precision - child->get_parent()->get_precision());
+
+    add_carry(sum, carries, pos);
+    carries += posCarries;
 }
 
 LongVector3 Satellite::calculate_relative_position(Satellite const* from,
                                                    Satellite const* to,
                                                    int precision)
 {
+    IntVector3 overflows;
+    const LongVector3 relative = calculate_relative_position(from, to,
+                                                             precision,
+                                                             overflows);
+    return saturate_carry(relative, overflows);
+}
+
+LongVector3 Satellite::calculate_relative_position(Satellite const* from,
+                                                   Satellite const* to,
+                                                   int precision,
+                                                   IntVector3& overflows)
+{
+    overflows = IntVector3::ZERO;
+
     // Distance to self will never be greater than or less than zero.
     if (from == to)
     {
         //URHO3D_LOGERRORF("Satellite calculating own position");
         return LongVector3::ZERO;
     }
-    
-    // Special case where their parents are the same
-    //if (from->m_parent == to->m_parent)
-    //{
-    //    
-    //}
-    
+
     // Relative position for satellites with different parents
     // Similar to "N-ary Tree Least Common Ancestor"
-    // TODO: account for differing m_unitsPerMeter and integer over/underflows
-    
+    // Each position is converted from its parent's precision as it's added
+
     const Satellite* satA = from;
     const Satellite* satB = to;
 
+    // Depths aren't stored, so reparenting doesn't touch every descendant.
+    // Counting them costs about as much as the climb below.
+    unsigned depthA = from->get_depth();
+    unsigned depthB = to->get_depth();
+
     LongVector3 posA;
     LongVector3 posB;
+    IntVector3 carriesA;
 
     while (satA != satB)
     {
-        if (satA->m_depth <= satB->m_depth)
+        if (depthA <= depthB)
         {
-            posB += satB->m_position;
+            add_position(posB, overflows, satB, precision);
             satB = satB->m_parent;
+            depthB --;
         }
         else
         {
-            posA += satA->m_position;
+            add_position(posA, carriesA, satA, precision);
             satA = satA->m_parent;
+            depthA --;
         }
-        
+
     }
-    
-    return posB - posA;
+
+    sub_carry(posB, overflows, posA);
+    overflows -= carriesA;
+
+    return posB;
 }
 
 LongVector3 Satellite::calculate_position()
@@ -78,33 +316,27 @@ LongVector3 Satellite::calculate_position()
     // If loaded
     if (is_loaded() && !m_trajectoryOverride)
     {
-        // Set position to the current ActiveArea's position
-        //m_position = m_activeArea->get_position();
-        // Add the float position
-        //m_position += m_activeArea->m_unit
-
-        // TODO: account for m_precision
-
         // Note: ActiveArea's center is its Scene origin
 
-        // Position relative to ActiveArea in meters
-        Vector3 floatPos = m_activeNode->GetPosition();
-
-        // How much the active area moved while this satellite was loaded
-        LongVector3 activeAreaDisplacement = m_activeArea->get_position()
-                - m_activeAreaLoadedPos;
-
-        // Scale to m_parent's position
-        floatPos *= (1 << m_parent->m_precision);
+        // Where the ActiveArea is now, in m_parent's units
+        IntVector3 overflows;
+        const LongVector3 areaPos = saturate_carry(
+                    calculate_relative_position(m_parent, m_activeArea,
+                                                m_parent->m_precision,
+                                                overflows),
+                    overflows);
 
-        // Long position relative to ActiveArea
-        LongVector3 longPos(floatPos.x_, floatPos.y_, floatPos.z_);
+        // Position relative to ActiveArea in meters, scaled to m_parent's
+        const Vector3 floatPos = m_activeNode->GetPosition();
+        const double scale = std::ldexp(1.0, m_parent->m_precision);
 
-        m_position = m_positionLoaded + activeAreaDisplacement + longPos;
+        set_position(areaPos + LongVector3(int64_t(floatPos.x_ * scale),
+                                           int64_t(floatPos.y_ * scale),
+                                           int64_t(floatPos.z_ * scale)));
     }
     else
     {
-        // TODO: call upon m_trajectory for a new position
+        // On rails, m_position is already set by a Trajectory every frame
     }
 
     return m_position;
@@ -112,12 +344,16 @@ LongVector3 Satellite::calculate_position()
 
 Node* Satellite::load(ActiveArea *area, Vector3 const& pos)
 {
-    m_activeAreaLoadedPos = area->get_position();
     m_activeArea = area;
 
-    m_positionLoaded = m_position;
     // TODO:
     return nullptr;
 }
 
+void Satellite::unload()
+{
+    m_activeNode = nullptr;
+    m_activeArea = nullptr;
+}
+
 } // namespace osp
@@ -5,6 +5,7 @@
 #include <Urho3D/Container/RefCounted.h>
 
 #include "../LongVector3.h"
+#include "SatelliteIndex.h"
 
 using namespace Urho3D;
 
@@ -16,11 +17,21 @@ class AstronomicalBody;
 class ActiveArea;
 
 /**
- * Base class for any physical object in the large universe
+ * Base class for any physical object in the large universe.
+ *
+ * Satellites are individual Objects in a tree, each one owning its children
+ * through UniquePtrs in m_children. There is no dense array of Satellites or
+ * handles to them; use a WeakPtr to keep one that might be deleted, and
+ * SatellitePositions for the positions of many at once. Moving a Satellite
+ * to another parent doesn't touch its siblings or its descendants.
  */
 class Satellite : public Object
 {
     friend class ActiveArea;
+    friend class SatelliteIndex;
+    friend class SatellitePositions;
+    friend class TrajectoryKepler;
+    friend class TrajectoryNBody;
 
     URHO3D_OBJECT(Satellite, Object)
 
@@ -36,18 +47,42 @@ public:
      * @param from [in] Reference frame
      * @param to [in] Satellite to calculate position for
      * @param precision [in] Desired precision of return value
-     * @return Position of 'to' relative to 'from'
+     * @return Position of 'to' relative to 'from', clamped if it doesn't fit
      */
     static LongVector3 calculate_relative_position(const Satellite* from,
                                                    const Satellite* to,
                                                    int precision);
+
+    /**
+     * Same as above, but keeps positions too big for a LongVector3. See
+     * PositionMath.h
+     * @param from [in] Reference frame
+     * @param to [in] Satellite to calculate position for
+     * @param precision [in] Desired precision of return value
+     * @param overflows [out] Carries of the return value
+     * @return Position of 'to' relative to 'from', wrapped around if it
+     *         doesn't fit
+     */
+    static LongVector3 calculate_relative_position(const Satellite* from,
+                                                   const Satellite* to,
+                                                   int precision,
+                                                   IntVector3& overflows);
     
     /**
-     * Add a child Satellite
-     * @param newChild [in] Pointer to Satellite to add as child
+     * Add a child Satellite. If it already has a parent, it's moved over
+     * and keeps the same position in the universe, like when changing
+     * sphere of influence.
+     * @param newChild [in] Pointer to Satellite to add as child, can't be
+     *                      an ancestor of this one
      */
     void add_child(Satellite* newChild);
 
+    /**
+     * Remove and destroy a child, along with all of its descendants
+     * @param child [in] Child to remove
+     */
+    void remove_child(Satellite* child);
+
     /**
      * Returns current position. This only returns the previously stored value
      * for position, but does not calculate a new one. Consider calling
@@ -59,13 +94,50 @@ public:
     LongVector3 get_position() const;
 
     /**
-     * Set position relative to parent. This function is probably dangerous
+     * Set position relative to parent. This function is probably dangerous.
+     * Keeps the parent's SatelliteIndex and SatellitePositions up to date.
      * @param pos [in] Desired value
      */
     void set_position(const LongVector3& pos);
 
+    /**
+     * @return Precision of children's positions, see m_precision
+     */
+    int get_precision() const;
+
+    /**
+     * Set precision of children's positions. Positions of children that
+     * were already added aren't converted.
+     * @param precision [in] Units per meter as a power of two
+     */
+    void set_precision(int precision);
+
     uint64_t get_load_radius() const;
 
+    uint64_t get_preview_radius() const;
+
+    /**
+     * @return Radius of a sphere around this Satellite that covers its load
+     *         and preview spheres, and all of its descendants'. Used to find
+     *         it in the parent's SatelliteIndex. In the same units as
+     *         m_position. Previews seen from anywhere aren't included, see
+     *         is_seen_anywhere.
+     */
+    uint64_t get_index_radius() const;
+
+    /**
+     * @return true if this Satellite has a preview that can be seen from
+     *         anywhere, or has a child that its SatelliteIndex returns for
+     *         every query. Kept out of the parent's SatelliteIndex grid, and
+     *         returned for every query instead.
+     */
+    bool is_seen_anywhere() const;
+
+    /**
+     * @return Index of children by position, null if there are no children
+     */
+    const SatelliteIndex* get_child_index() const;
+
     /**
      * @return Pointer to the active node. Null if not loaded
      */
@@ -77,6 +149,10 @@ public:
 
     Satellite* get_parent() const;
 
+    /**
+     * @return Number of ancestors, 0 for the root. Counted by walking up
+     *         the tree, as it changes whenever an ancestor is reparented.
+     */
     unsigned get_depth() const;
 
     unsigned get_index() const;
@@ -120,18 +196,43 @@ public:
 
     /**
      * Unload the Satellite
-     * Usually called when leaving an ActiveArea (player gets far enough)
+     * Usually called when leaving an ActiveArea (player gets far enough).
+     * Overrides remove what load added to the scene, then call this.
      */
-    virtual void unload() = 0;
+    virtual void unload();
 
 protected:
 
+    /**
+     * Update the SatelliteIndex after a child moved, and grow
+     * m_subtreeRadius to fit it. Passed on to the parent if this
+     * Satellite's own index radius grew.
+     * @param child [in] Child that moved or changed size
+     */
+    void child_moved(Satellite* child);
+
+    /**
+     * Call after changing m_loadRadius or m_previewRadius, so the parent's
+     * SatelliteIndex finds this Satellite with its new size
+     */
+    void radius_changed();
+
+    /**
+     * Take a child out of m_children without destroying it. The last child
+     * is moved into its place, so this doesn't depend on the number of
+     * children. SatellitePositions is told the child and all of its
+     * descendants were removed.
+     * @param child [in] Child to detach
+     * @return child, which now has no parent and has to be deleted or
+     *         added to another parent by the caller
+     */
+    Satellite* detach_child(Satellite* child);
+
     String m_name;
 
     // Position relative to parent
     LongVector3 m_position;
 
-    // Only partially implemented
     // Scale for how many LongVector3 units is equal to a meter. This only
     // applies to this Satellite's children.
     //
@@ -151,7 +252,13 @@ protected:
 
     // A sphere around this Satellite. When this intersects an ActiveArea's
     // sphere, then the ActiveArea will try to load this satellite.
-    uint64_t m_loadRadius;
+    // Same units as m_position, along with m_previewRadius
+    uint64_t m_loadRadius = 0;
+
+    // A sphere around this Satellite. When an ActiveArea is inside it, but too
+    // far to load, then the ActiveArea will call load_preview instead.
+    // Zero means never previewed, UINT64_MAX means seen from anywhere
+    uint64_t m_previewRadius = 0;
 
     // Position will be relative to this
     // Will be null for the root
@@ -160,12 +267,25 @@ protected:
     // Pointers to Children that shouldn't spontaneously deallocate
     Vector< UniquePtr<Satellite> > m_children;
     
-    // Index in parent's m_children
+    // Index in parent's m_children, changes when a sibling is removed
     unsigned m_index;
 
-    // How deep this satellite is in the tree, or number of direct ancestors
-    // Root Satellite will be 0
-    unsigned m_depth = 0;
+    // Children by position, for ActiveAreas to only look at the children
+    // near them. Made when the first child is added
+    UniquePtr<SatelliteIndex> m_childIndex;
+
+    // Covers every child's position plus its get_index_radius. In this
+    // Satellite's own precision, like its children's positions. Only ever
+    // grows, a loose bound is still correct and moving children don't have
+    // to look at their siblings.
+    uint64_t m_subtreeRadius = 0;
+
+    // Cell in the parent's m_childIndex, level is -1 if not in one
+    int m_indexLevel = -1;
+    LongVector3 m_indexCoords;
+
+    // Where this Satellite's position is in SatellitePositions
+    unsigned m_positionSlot = M_MAX_UNSIGNED;
 
     // Associated node when loaded by an ActiveArea
     // Can only be loaded into one ActiveArea at a time
@@ -175,13 +295,6 @@ protected:
     // ActiveArea loaded into
     WeakPtr<ActiveArea> m_activeArea;
 
-    // Position of the ActiveArea above the moment its loaded. Used to
-    // calculate m_position quickly
-    LongVector3 m_activeAreaLoadedPos;
-
-    // Capture of m_position taken on load
-    LongVector3 m_positionLoaded;
-
     // Allow Trajectory to control the position of the ActiveNode
     // aka: on rails
     // maybe set this to false when the active node gets nudged
@@ -191,8 +304,8 @@ protected:
     // change in its velocity
     bool m_nudged;
 
-    // orbital stuff goes here. something like:
-    // Trajectory m_trajectory;
+    // Satellites on rails are moved by a Trajectory, which keeps track of
+    // which Satellites it moves
 
 };
 
@@ -201,9 +314,14 @@ inline LongVector3 Satellite::get_position() const
     return m_position;
 }
 
-inline void Satellite::set_position(const LongVector3& pos)
+inline int Satellite::get_precision() const
 {
-    m_position = pos;
+    return m_precision;
+}
+
+inline void Satellite::set_precision(int precision)
+{
+    m_precision = precision;
 }
 
 inline uint64_t Satellite::get_load_radius() const
@@ -211,6 +329,16 @@ inline uint64_t Satellite::get_load_radius() const
     return m_loadRadius;
 }
 
+inline uint64_t Satellite::get_preview_radius() const
+{
+    return m_previewRadius;
+}
+
+inline const SatelliteIndex* Satellite::get_child_index() const
+{
+    return m_childIndex.Get();
+}
+
 inline Node* Satellite::get_active_node() const
 {
     return m_activeNode.Get();
@@ -231,11 +359,6 @@ inline Satellite* Satellite::get_parent() const
     return m_parent;
 }
 
-inline unsigned Satellite::get_depth() const
-{
-    return m_depth;
-}
-
 inline unsigned Satellite::get_index() const
 {
     return m_index;
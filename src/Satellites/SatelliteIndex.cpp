@@ -0,0 +1,252 @@
+#include "SatelliteIndex.h"
+#include "Satellite.h"
+
+namespace osp
+{
+
+/**
+ * Add without wrapping around, sticking to the limits instead
+ */
+static int64_t saturate_add(int64_t a, int64_t b)
+{
+    if (b > 0 && a > INT64_MAX - b)
+    {
+        return INT64_MAX;
+    }
+    if (b < 0 && a < INT64_MIN - b)
+    {
+        return INT64_MIN;
+    }
+    return a + b;
+}
+
+/**
+ * Move each component of a vector towards or away from zero by the same
+ * amount, without wrapping around
+ */
+static LongVector3 saturate_add(const LongVector3& a, int64_t b)
+{
+    return LongVector3(saturate_add(a.x_, b), saturate_add(a.y_, b),
+                       saturate_add(a.z_, b));
+}
+
+SatelliteIndex::SatelliteIndex() : m_size(0)
+{
+    for (unsigned& count : m_levelCounts)
+    {
+        count = 0;
+    }
+}
+
+int SatelliteIndex::get_level(const Satellite* sat)
+{
+    const uint64_t radius = sat->get_index_radius();
+
+    // A child can reach half a cell past its own, the biggest cells can't
+    // fit anything bigger than that
+    if (sat->is_seen_anywhere()
+            || radius > (uint64_t(1) << (sc_maxLevel - 1)))
+    {
+        return sc_everywhere;
+    }
+
+    int level = sc_minLevel;
+    while ((uint64_t(1) << (level - 1)) < radius)
+    {
+        level ++;
+    }
+    return level;
+}
+
+LongVector3 SatelliteIndex::get_coords(const LongVector3& pos, int level)
+{
+    // Shifting rounds towards negative infinity, so cells don't get
+    // stretched over zero
+    return LongVector3(pos.x_ >> level, pos.y_ >> level, pos.z_ >> level);
+}
+
+void SatelliteIndex::insert(Satellite* sat)
+{
+    const int level = get_level(sat);
+    m_size ++;
+
+    if (level == sc_everywhere)
+    {
+        m_everywhere.Push(sat);
+        sat->m_indexLevel = level;
+        return;
+    }
+
+    const LongVector3 coords = get_coords(sat->get_position(), level);
+
+    m_cells[CellKey{coords, level}].Push(sat);
+    m_levelCounts[level] ++;
+
+    sat->m_indexLevel = level;
+    sat->m_indexCoords = coords;
+}
+
+void SatelliteIndex::remove(Satellite* sat)
+{
+    if (sat->m_indexLevel < 0)
+    {
+        return;
+    }
+
+    if (sat->m_indexLevel == sc_everywhere)
+    {
+        // Only a few planets are usually in here
+        if (m_everywhere.RemoveSwap(sat))
+        {
+            m_size --;
+        }
+
+        sat->m_indexLevel = -1;
+        return;
+    }
+
+    const CellKey key{sat->m_indexCoords, sat->m_indexLevel};
+    CellMap::Iterator it = m_cells.Find(key);
+
+    if (it != m_cells.End())
+    {
+        PODVector<Satellite*>& cell = it->second_;
+
+        for (unsigned i = 0; i < cell.Size(); i ++)
+        {
+            if (cell[i] == sat)
+            {
+                // Order doesn't matter, move the last one in its place
+                cell[i] = cell.Back();
+                cell.Pop();
+
+                m_levelCounts[key.m_level] --;
+                m_size --;
+                break;
+            }
+        }
+
+        if (cell.Empty())
+        {
+            m_cells.Erase(it);
+        }
+    }
+
+    sat->m_indexLevel = -1;
+}
+
+void SatelliteIndex::update(Satellite* sat)
+{
+    const int level = get_level(sat);
+
+    if (level == sc_everywhere && sat->m_indexLevel == sc_everywhere)
+    {
+        // Position doesn't matter, it's found from anywhere
+        return;
+    }
+
+    const LongVector3 coords = get_coords(sat->get_position(), level);
+
+    if (level == sat->m_indexLevel && coords == sat->m_indexCoords)
+    {
+        // Still in the same cell, which is almost always the case
+        return;
+    }
+
+    remove(sat);
+    insert(sat);
+}
+
+void SatelliteIndex::query(const LongVector3& center, uint64_t radius,
+                           PODVector<Satellite*>& results) const
+{
+    results.Push(m_everywhere);
+
+    if (m_size == m_everywhere.Size())
+    {
+        return;
+    }
+
+    const int64_t r = (radius > uint64_t(INT64_MAX)) ? INT64_MAX
+                                                      : int64_t(radius);
+    const LongVector3 lo = saturate_add(center, -r);
+    const LongVector3 hi = saturate_add(center, r);
+
+    // Range of cells to look at on each level, for levels that are scanned
+    LongVector3 firsts[sc_maxLevel + 1];
+    LongVector3 lasts[sc_maxLevel + 1];
+    uint64_t scanLevels = 0;
+
+    for (int level = sc_minLevel; level <= sc_maxLevel; level ++)
+    {
+        if (!m_levelCounts[level])
+        {
+            continue;
+        }
+
+        // Children reach up to half a cell past their own cell
+        const int64_t half = int64_t(1) << (level - 1);
+        const LongVector3 first = get_coords(saturate_add(lo, -half), level);
+        const LongVector3 last = get_coords(saturate_add(hi, half), level);
+
+        // Ranges can be way too big for an integer when the sphere is much
+        // bigger than the cells
+        const double cells = (double(last.x_) - double(first.x_) + 1.0)
+                                * (double(last.y_) - double(first.y_) + 1.0)
+                                * (double(last.z_) - double(first.z_) + 1.0);
+
+        if (cells > double(sc_maxQueryCells))
+        {
+            firsts[level] = first;
+            lasts[level] = last;
+            scanLevels |= uint64_t(1) << level;
+            continue;
+        }
+
+        for (int64_t z = first.z_; z <= last.z_; z ++)
+        {
+            for (int64_t y = first.y_; y <= last.y_; y ++)
+            {
+                for (int64_t x = first.x_; x <= last.x_; x ++)
+                {
+                    CellMap::ConstIterator it = m_cells.Find(
+                                CellKey{LongVector3(x, y, z), level});
+
+                    if (it != m_cells.End())
+                    {
+                        results.Push(it->second_);
+                    }
+                }
+            }
+        }
+    }
+
+    if (!scanLevels)
+    {
+        return;
+    }
+
+    // Look at every cell of the levels that would need too many lookups.
+    // Done in one pass for all of them
+    for (const CellMap::KeyValue& cell : m_cells)
+    {
+        const CellKey& key = cell.first_;
+
+        if (!(scanLevels & (uint64_t(1) << key.m_level)))
+        {
+            continue;
+        }
+
+        const LongVector3& first = firsts[key.m_level];
+        const LongVector3& last = lasts[key.m_level];
+
+        if (key.m_coords.x_ >= first.x_ && key.m_coords.x_ <= last.x_
+                && key.m_coords.y_ >= first.y_ && key.m_coords.y_ <= last.y_
+                && key.m_coords.z_ >= first.z_ && key.m_coords.z_ <= last.z_)
+        {
+            results.Push(cell.second_);
+        }
+    }
+}
+
+} // namespace osp
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Vector.h>
+
+#include "../LongVector3.h"
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+class Satellite;
+
+/**
+ * Loose grid over the children of a Satellite, for finding the ones that
+ * could be close enough to an ActiveArea to load or preview without looking
+ * at all of them.
+ *
+ * Cells at level L are 2^L units wide. Each child goes in the cell its
+ * position is in, at the smallest level where half a cell is at least its
+ * get_index_radius. A child never reaches past the neighbouring half cells,
+ * so a query only has to look at cells near the query sphere on each level.
+ * Levels below sc_minLevel aren't used, as cells that much smaller than an
+ * ActiveArea would only make queries look at more of them.
+ *
+ * Children that are seen from anywhere, see Satellite::is_seen_anywhere,
+ * and children too big for even the biggest cells are kept in a separate
+ * list instead, and every query returns them.
+ *
+ * Positions are in the parent's units, like Satellite::get_position.
+ * Children have to call update whenever they move or their radius changes,
+ * which Satellite::set_position already does.
+ */
+class SatelliteIndex
+{
+public:
+
+    // About a kilometer with the default precision, close to an
+    // ActiveArea's load radius
+    static constexpr int sc_minLevel = 20;
+
+    // Cells this big cover the whole range of a LongVector3 in 4 cells
+    static constexpr int sc_maxLevel = 62;
+
+    // Levels that need more cells than this for one query are scanned
+    // instead, looking at every cell in the level
+    static constexpr unsigned sc_maxQueryCells = 512;
+
+    // Level of children in m_everywhere
+    static constexpr int sc_everywhere = sc_maxLevel + 1;
+
+    SatelliteIndex();
+    ~SatelliteIndex() = default;
+
+    /**
+     * Add a child to the index
+     * @param sat [in] Child to add, not already in the index
+     */
+    void insert(Satellite* sat);
+
+    /**
+     * Remove a child from the index
+     * @param sat [in] Child to remove
+     */
+    void remove(Satellite* sat);
+
+    /**
+     * Move a child to a different cell if it moved out of its own, or if its
+     * radius changed enough to need a different level. Inserts it if it
+     * isn't in the index yet.
+     * @param sat [in] Child that moved
+     */
+    void update(Satellite* sat);
+
+    /**
+     * Find every child whose get_index_radius might intersect a sphere.
+     * Children further away can be returned too, the caller still has to
+     * check the actual distance.
+     * @param center [in] Center of sphere, in the parent's units
+     * @param radius [in] Radius of sphere
+     * @param results [out] Children found are added to this
+     */
+    void query(const LongVector3& center, uint64_t radius,
+               PODVector<Satellite*>& results) const;
+
+    /**
+     * @return Number of children in the index
+     */
+    unsigned size() const { return m_size; }
+
+    /**
+     * @return true if any child is returned by every query
+     */
+    bool has_everywhere() const { return !m_everywhere.Empty(); }
+
+private:
+
+    struct CellKey
+    {
+        LongVector3 m_coords;
+        int m_level;
+
+        bool operator==(const CellKey& other) const
+        {
+            return m_level == other.m_level && m_coords == other.m_coords;
+        }
+
+        unsigned ToHash() const
+        {
+            return m_coords.ToHash() * 31 + unsigned(m_level);
+        }
+    };
+
+    using CellMap = HashMap<CellKey, PODVector<Satellite*> >;
+
+    /**
+     * @param sat [in] Child to put in the index
+     * @return Level to put it in, sc_everywhere if it's seen from anywhere
+     *         or too big for any level
+     */
+    static int get_level(const Satellite* sat);
+
+    /**
+     * @param pos [in] Position in the parent's units
+     * @param level [in] Level of the cell
+     * @return Coordinates of the cell pos is in
+     */
+    static LongVector3 get_coords(const LongVector3& pos, int level);
+
+    CellMap m_cells;
+
+    // Children returned by every query, in no particular order
+    PODVector<Satellite*> m_everywhere;
+
+    // Number of children in each level
+    unsigned m_levelCounts[sc_maxLevel + 1];
+
+    unsigned m_size;
+};
+
+} // namespace osp
@@ -0,0 +1,320 @@
+#include <Urho3D/Core/Thread.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+
+#include "PositionMath.h"
+#include "Satellite.h"
+#include "SatellitePositions.h"
+
+#include <cassert>
+
+namespace osp
+{
+
+SatellitePositions::SatellitePositions(Context* context) : Object(context),
+        m_precision(10),
+        m_dirty(true),
+        m_removals(0)
+{
+
+}
+
+void SatellitePositions::set_root(Satellite* root)
+{
+    assert(Thread::IsMainThread());
+
+    m_root = root;
+
+    // Slots are from the old tree, which might be deleted by now
+    clear();
+    m_dirty = true;
+}
+
+void SatellitePositions::update()
+{
+    assert(Thread::IsMainThread());
+
+    if (m_dirty)
+    {
+        rebuild();
+    }
+}
+
+void SatellitePositions::rebuild()
+{
+    clear();
+    m_dirty = false;
+
+    if (m_root.Null())
+    {
+        return;
+    }
+
+    m_precision = m_root->m_precision;
+
+    // Depth first, so each Satellite's descendants are in the slots right
+    // after it. Parents are always added before their children, so their
+    // positions are already known.
+    m_stack.Clear();
+    m_stack.Push(m_root.Get());
+
+    while (!m_stack.Empty())
+    {
+        Satellite* sat = m_stack.Back();
+        m_stack.Pop();
+
+        const unsigned slot = m_satellites.Size();
+        LongVector3 pos;
+        IntVector3 overflows;
+        unsigned parentSlot = 0;
+
+        if (slot != 0)
+        {
+            parentSlot = sat->m_parent->m_positionSlot;
+            pos = m_absolute[parentSlot];
+            overflows = m_overflows[parentSlot];
+            add_position(pos, overflows, sat);
+        }
+
+        sat->m_positionSlot = slot;
+        m_satellites.Push(sat);
+        m_parents.Push(parentSlot);
+        m_ends.Push(slot + 1);
+        m_absolute.Push(pos);
+        m_overflows.Push(overflows);
+
+        // Backwards, so they're popped in order
+        for (unsigned i = sat->m_children.Size(); i -- > 0; )
+        {
+            m_stack.Push(sat->m_children[i].Get());
+        }
+    }
+
+    // Each subtree ends where its last descendant's does. Backwards, so
+    // every Satellite's end is known before its parent's.
+    for (unsigned i = m_satellites.Size(); i -- > 1; )
+    {
+        unsigned& parentEnd = m_ends[m_parents[i]];
+        parentEnd = Max(parentEnd, m_ends[i]);
+    }
+}
+
+void SatellitePositions::clear()
+{
+    m_satellites.Clear();
+    m_parents.Clear();
+    m_ends.Clear();
+    m_absolute.Clear();
+    m_overflows.Clear();
+}
+
+void SatellitePositions::moved(Satellite* sat)
+{
+    assert(Thread::IsMainThread());
+
+    if (!is_cached(sat))
+    {
+        // New, it gets a slot in the next update. Until then its position
+        // is added up from its nearest ancestor that has one.
+        m_dirty = true;
+        return;
+    }
+
+    // Its descendants move along with it, and are in the slots right after
+    // it. Removed ones are skipped, anything added since the last update
+    // isn't in here at all.
+    const unsigned slot = sat->m_positionSlot;
+
+    for (unsigned i = Max(slot, 1u); i < m_ends[slot]; i ++)
+    {
+        const Satellite* moving = m_satellites[i];
+
+        if (!moving)
+        {
+            continue;
+        }
+
+        LongVector3 pos = m_absolute[m_parents[i]];
+        IntVector3 overflows = m_overflows[m_parents[i]];
+        add_position(pos, overflows, moving);
+
+        m_absolute[i] = pos;
+        m_overflows[i] = overflows;
+    }
+}
+
+void SatellitePositions::removed(Satellite* sat)
+{
+    assert(Thread::IsMainThread());
+
+    // Its slot is no good anymore, and sat might be deleted then a new
+    // Satellite allocated at the same address
+    if (is_cached(sat))
+    {
+        m_satellites[sat->m_positionSlot] = nullptr;
+    }
+
+    m_dirty = true;
+    m_removals ++;
+}
+
+bool SatellitePositions::is_cached(const Satellite* sat) const
+{
+    return sat && sat->m_positionSlot < m_satellites.Size()
+            && m_satellites[sat->m_positionSlot] == sat;
+}
+
+LongVector3 SatellitePositions::get_absolute(const Satellite* sat,
+                                             IntVector3& overflows) const
+{
+    // Worker threads only read positions right after update, while nothing
+    // can add, remove or move Satellites
+    assert(!m_dirty || Thread::IsMainThread());
+
+    if (is_cached(sat))
+    {
+        overflows = m_overflows[sat->m_positionSlot];
+        return m_absolute[sat->m_positionSlot];
+    }
+
+    // Added since the last update, or not under the root. Add up positions
+    // until an ancestor that has one, or the top of whatever tree it's in.
+    LongVector3 pos;
+    overflows = IntVector3::ZERO;
+    while (sat->m_parent.NotNull() && !is_cached(sat))
+    {
+        add_position(pos, overflows, sat);
+        sat = sat->m_parent;
+    }
+
+    if (is_cached(sat))
+    {
+        add_carry(pos, overflows, m_absolute[sat->m_positionSlot]);
+        overflows += m_overflows[sat->m_positionSlot];
+    }
+    return pos;
+}
+
+LongVector3 SatellitePositions::get_relative(const Satellite* frame,
+                                             const Satellite* sat,
+                                             IntVector3& overflows) const
+{
+    IntVector3 frameOverflows;
+    const LongVector3 framePos = get_absolute(frame, frameOverflows);
+
+    LongVector3 pos = get_absolute(sat, overflows);
+    sub_carry(pos, overflows, framePos);
+    overflows -= frameOverflows;
+
+    return pos;
+}
+
+void SatellitePositions::get_relative(const Satellite* frame,
+                                      const PODVector<Satellite*>& sats,
+                                      PODVector<LongVector3>& results,
+                                      PODVector<IntVector3>& overflows) const
+{
+    IntVector3 frameOverflows;
+    const LongVector3 framePos = get_absolute(frame, frameOverflows);
+
+    results.Resize(sats.Size());
+    overflows.Resize(sats.Size());
+
+    for (unsigned i = 0; i < sats.Size(); i ++)
+    {
+        const Satellite* sat = sats[i];
+
+        if (is_cached(sat))
+        {
+            results[i] = m_absolute[sat->m_positionSlot];
+            overflows[i] = m_overflows[sat->m_positionSlot];
+        }
+        else
+        {
+            results[i] = get_absolute(sat, overflows[i]);
+        }
+
+        sub_carry(results[i], overflows[i], framePos);
+        overflows[i] -= frameOverflows;
+    }
+}
+
+LongVector3 SatellitePositions::to_units(const LongVector3& pos,
+                                         const IntVector3& overflows,
+                                         int precision) const
+{
+    LongVector3 result = pos;
+    IntVector3 resultOverflows = overflows;
+    shift_carry(result, resultOverflows, precision - m_precision);
+
+    return saturate_carry(result, resultOverflows);
+}
+
+double SatellitePositions::get_scale(int precision) const
+{
+    return std::ldexp(1.0, m_precision - precision);
+}
+
+void SatellitePositions::debug_benchmark(Satellite* root, unsigned repeats)
+{
+    WeakPtr<Satellite> universe = m_root;
+    m_root = root;
+
+    // Get the arrays allocated before timing anything
+    rebuild();
+
+    HiresTimer timer;
+
+    for (unsigned i = 0; i < repeats; i ++)
+    {
+        rebuild();
+    }
+
+    const long long updateTime = timer.GetUSec(true);
+
+    // Same tree breadth first, with nothing but plain additions
+    for (unsigned i = 0; i < repeats; i ++)
+    {
+        m_satellites.Clear();
+        m_absolute.Clear();
+        m_satellites.Push(root);
+        m_absolute.Push(LongVector3::ZERO);
+
+        for (unsigned j = 0; j < m_satellites.Size(); j ++)
+        {
+            const LongVector3 parentPos = m_absolute[j];
+
+            for (const UniquePtr<Satellite>& child
+                    : m_satellites[j]->m_children)
+            {
+                m_satellites.Push(child.Get());
+                m_absolute.Push(parentPos + child->m_position);
+            }
+        }
+    }
+
+    const long long plainTime = timer.GetUSec(true);
+
+    const double count = double(m_satellites.Size()) * double(repeats);
+    URHO3D_LOGINFOF("SatellitePositions: %u satellites, %.1fns each, "
+                    "%.1fns each without precisions or overflows",
+                    m_satellites.Size(), double(updateTime) * 1000.0 / count,
+                    double(plainTime) * 1000.0 / count);
+
+    // Back to the actual universe, the benchmark's tree is deleted soon
+    set_root(universe);
+}
+
+void SatellitePositions::add_position(LongVector3& sum,
+                                      IntVector3& overflows,
+                                      const Satellite* child) const
+{
+    LongVector3 pos = child->m_position;
+    IntVector3 posOverflows;
+    shift_carry(pos, posOverflows, m_precision - child->m_parent->m_precision);
+
+    add_carry(sum, overflows, pos);
+    overflows += posOverflows;
+}
+
+} // namespace osp
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include "../LongVector3.h"
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+class Satellite;
+
+/**
+ * Positions of every Satellite in the universe relative to the root, kept
+ * in one flat array. Calculated once at the start of each frame, so that
+ * ActiveAreas, the map view and targeting can get any number of relative
+ * positions without each walking up the tree for every Satellite.
+ *
+ * Positions are in the root's units, 2^precision per meter, where the
+ * precision is the root's m_precision. Children of Satellites with a
+ * different m_precision are scaled to match. Positions too far away for a
+ * LongVector3 come with carries, see PositionMath.h.
+ *
+ * Satellites are stored depth first, so the descendants of each one are in
+ * the slots right after it. Satellite::set_position keeps the array up to
+ * date by calculating the positions of just the Satellite that moved and
+ * its descendants. Satellites added or removed only get their slots
+ * changed in the next update, so the whole array is calculated at most
+ * once a frame. Until then, a new Satellite's position is added up from
+ * its nearest ancestor that has one.
+ *
+ * Registered as a subsystem. OspUniverse sets the root, and calls update at
+ * the start of each frame. Getting positions never modifies anything, so
+ * ActiveAreas can read them from worker threads right after update, while
+ * nothing is moving. Everything that modifies the array asserts it's on the
+ * main thread, and getting a position off it asserts nothing was added or
+ * removed since update.
+ */
+class SatellitePositions : public Object
+{
+    URHO3D_OBJECT(SatellitePositions, Object)
+
+public:
+
+    SatellitePositions(Context* context);
+    ~SatellitePositions() = default;
+
+    /**
+     * Set the Satellite that all positions are relative to
+     * @param root [in] Root of the universe, can be null
+     */
+    void set_root(Satellite* root);
+
+    Satellite* get_root() const { return m_root; }
+
+    /**
+     * @return Precision of positions, same as the root's m_precision
+     */
+    int get_precision() const { return m_precision; }
+
+    /**
+     * @return Number of Satellites with a calculated position
+     */
+    unsigned size() const { return m_satellites.Size(); }
+
+    /**
+     * Calculate the position of every Satellite under the root again, if
+     * any were added or removed since the last time. Already done by
+     * OspUniverse every frame, but can be called to get it done right away.
+     */
+    void update();
+
+    /**
+     * Called by a Satellite after its position changed, or it was added to
+     * a parent
+     * @param sat [in] Satellite that moved
+     */
+    void moved(Satellite* sat);
+
+    /**
+     * Called by a Satellite after one of its children was taken out of it,
+     * once for the child and once for each of its descendants
+     * @param sat [in] Satellite that was removed, might be deleted soon
+     */
+    void removed(Satellite* sat);
+
+    /**
+     * @return Number of Satellites removed from their parents so far. Any
+     *         Satellite pointers kept from before it changed might be
+     *         dangling.
+     */
+    unsigned get_removals() const { return m_removals; }
+
+    /**
+     * @param sat [in] Any Satellite
+     * @param overflows [out] Carries of the return value, see PositionMath.h
+     * @return Position of sat relative to the root
+     */
+    LongVector3 get_absolute(const Satellite* sat,
+                             IntVector3& overflows) const;
+
+    /**
+     * @param frame [in] Reference frame
+     * @param sat [in] Satellite to get the position of
+     * @param overflows [out] Carries of the return value
+     * @return Position of sat relative to frame
+     */
+    LongVector3 get_relative(const Satellite* frame, const Satellite* sat,
+                             IntVector3& overflows) const;
+
+    /**
+     * Get the positions of many Satellites relative to the same frame
+     * @param frame [in] Reference frame
+     * @param sats [in] Satellites to get positions of
+     * @param results [out] Positions relative to frame, parallel to sats
+     * @param overflows [out] Carries of results, parallel to sats
+     */
+    void get_relative(const Satellite* frame,
+                      const PODVector<Satellite*>& sats,
+                      PODVector<LongVector3>& results,
+                      PODVector<IntVector3>& overflows) const;
+
+    /**
+     * Convert a position from the root's units to a different precision
+     * @param pos [in] Position in the root's units
+     * @param overflows [in] Carries of pos
+     * @param precision [in] Desired precision
+     * @return Position in units of the desired precision, clamped if it
+     *         doesn't fit
+     */
+    LongVector3 to_units(const LongVector3& pos, const IntVector3& overflows,
+                         int precision) const;
+
+    /**
+     * @param precision [in] Any precision
+     * @return How many of the root's units one unit of precision is
+     */
+    double get_scale(int precision) const;
+
+    /**
+     * Time update on a tree of Satellites, and compare it to adding up the
+     * same positions without converting precisions or checking for
+     * overflows. Results are logged.
+     * @param root [in] Root of the tree to time, not the universe's
+     * @param repeats [in] Number of times to update
+     */
+    void debug_benchmark(Satellite* root, unsigned repeats);
+
+private:
+
+    /**
+     * Calculate the position of every Satellite under the root
+     */
+    void rebuild();
+
+    void clear();
+
+    /**
+     * @param sat [in] Any Satellite
+     * @return true if sat has a position in m_absolute
+     */
+    bool is_cached(const Satellite* sat) const;
+
+    /**
+     * Add a child's position to a position in the root's units
+     * @param sum [ref] Position to add to
+     * @param overflows [ref] Carries of sum
+     * @param child [in] Satellite with a parent
+     */
+    void add_position(LongVector3& sum, IntVector3& overflows,
+                      const Satellite* child) const;
+
+    WeakPtr<Satellite> m_root;
+
+    // Every Satellite under the root, depth first. Null for ones removed
+    // since the last update.
+    PODVector<Satellite*> m_satellites;
+
+    // Slot of each Satellite's parent, parallel to m_satellites
+    PODVector<unsigned> m_parents;
+
+    // One past the slot of each Satellite's last descendant, parallel to
+    // m_satellites
+    PODVector<unsigned> m_ends;
+
+    // Position relative to the root, parallel to m_satellites
+    PODVector<LongVector3> m_absolute;
+
+    // Carries of m_absolute, nearly always zero
+    PODVector<IntVector3> m_overflows;
+
+    int m_precision;
+
+    // Satellites were added or removed, so slots have to be given out again
+    bool m_dirty;
+
+    // Satellites left to add in rebuild. Kept around so it doesn't need to
+    // be allocated every time
+    PODVector<Satellite*> m_stack;
+
+    // Incremented whenever a Satellite is removed from its parent
+    unsigned m_removals;
+};
+
+} // namespace osp
@@ -0,0 +1,340 @@
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/Graphics.h>
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Renderer.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/Graphics/Viewport.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+#include "SatellitePreviews.h"
+
+namespace osp
+{
+
+// Name of the shared preview sphere in the ResourceCache
+static char const* const sc_sphereModelName = "Models/PlanetPreview.mdl";
+
+// How many times the preview icosahedron is subdivided
+// 2 -> 320 triangles, which looks round enough for something a few hundred
+// pixels wide, and is still nothing to draw a few hundred times
+static constexpr int sc_sphereSubdivisions = 2;
+
+SatellitePreviews::SatellitePreviews(Context* context) : Component(context)
+{
+
+}
+
+void SatellitePreviews::RegisterObject(Context* context)
+{
+    context->RegisterFactory<SatellitePreviews>();
+}
+
+void SatellitePreviews::OnNodeSet(Node* node)
+{
+    if (!node)
+    {
+        return;
+    }
+
+    // All billboards are drawn by this single BillboardSet
+    m_billboards = node->CreateComponent<BillboardSet>();
+    m_billboards->SetMaterial(GetSubsystem<ResourceCache>()
+                    ->GetResource<Material>("Materials/PreviewFlare.xml"));
+    m_billboards->SetRelative(false);
+    m_billboards->SetSorted(false);
+    m_billboards->SetFixedScreenSize(true);
+    m_billboards->SetCastShadows(false);
+}
+
+Node* SatellitePreviews::add_preview(Model* model, Material* material,
+                                     float radius)
+{
+    return add(get_group(model, material), radius);
+}
+
+Node* SatellitePreviews::add_flare()
+{
+    return add(nullptr, 0.0f);
+}
+
+Node* SatellitePreviews::add(StaticModelGroup* group, float radius)
+{
+    Preview preview;
+    preview.m_node = node_->CreateChild("Preview", LOCAL);
+    preview.m_group = group;
+    preview.m_radius = radius;
+
+    // Start as a billboard, update_previews will switch it to a model if it
+    // turns out to be big enough
+    preview.m_billboard = true;
+
+    m_previewIndices[preview.m_node.Get()] = m_previews.Size();
+    m_previews.Push(preview);
+    m_countChanged = true;
+
+    return preview.m_node.Get();
+}
+
+void SatellitePreviews::remove_preview(Node* node)
+{
+    HashMap<Node*, unsigned>::Iterator it = m_previewIndices.Find(node);
+
+    if (it == m_previewIndices.End())
+    {
+        URHO3D_LOGERROR("Removing a preview that doesn't exist");
+        return;
+    }
+
+    unsigned index = it->second_;
+    Preview& preview = m_previews[index];
+
+    if (!preview.m_billboard && preview.m_group.NotNull())
+    {
+        preview.m_group->RemoveInstanceNode(node);
+    }
+
+    m_previewIndices.Erase(it);
+    node->Remove();
+
+    // Move the last preview into the empty space
+    if (index != m_previews.Size() - 1)
+    {
+        m_previews[index] = m_previews.Back();
+        m_previewIndices[m_previews[index].m_node.Get()] = index;
+    }
+    m_previews.Pop();
+    m_countChanged = true;
+}
+
+void SatellitePreviews::set_position(Node* node, const Vector3& pos)
+{
+    HashMap<Node*, unsigned>::ConstIterator it = m_previewIndices.Find(node);
+
+    if (it != m_previewIndices.End())
+    {
+        m_previews[it->second_].m_position = pos;
+    }
+}
+
+void SatellitePreviews::update_previews()
+{
+    // Figure out how many pixels a radian is, and how far away things can be
+    // drawn using the main viewport's camera
+    float fov = 45.0f;
+    float farClip = 1000.0f;
+    float screenHeight = 720.0f;
+
+    if (Renderer* renderer = GetSubsystem<Renderer>())
+    {
+        Viewport* viewport = renderer->GetViewport(0);
+        if (viewport && viewport->GetCamera())
+        {
+            fov = viewport->GetCamera()->GetFov();
+            farClip = viewport->GetCamera()->GetFarClip();
+        }
+    }
+
+    if (Graphics* graphics = GetSubsystem<Graphics>())
+    {
+        screenHeight = float(graphics->GetHeight());
+    }
+
+    const float pixelsPerRadian = screenHeight / (2.0f * Tan(fov / 2.0f));
+
+    // Leave some space so that previews don't get clipped
+    const float maxDistance = farClip * 0.8f;
+
+    if (m_countChanged)
+    {
+        m_billboards->SetNumBillboards(m_previews.Size());
+        m_countChanged = false;
+    }
+
+    for (unsigned i = 0; i < m_previews.Size(); i ++)
+    {
+        Preview& preview = m_previews[i];
+        Billboard* flare = m_billboards->GetBillboard(i);
+
+        const float distance = preview.m_position.Length();
+
+        // Pull far away previews closer, and shrink them by the same factor
+        const float scale = (distance > maxDistance)
+                          ? maxDistance / distance : 1.0f;
+        const Vector3 drawPos = preview.m_position * scale;
+
+        // Approximate size on screen, in pixels
+        const float pixels = (distance > 0.0f)
+                ? preview.m_radius * 2.0f / distance * pixelsPerRadian
+                : M_LARGE_VALUE;
+
+        const bool billboard = preview.m_group.Null()
+                                || pixels < m_pixelThreshold;
+
+        if (billboard != preview.m_billboard)
+        {
+            // Swap between being drawn as a model or a billboard
+            if (billboard)
+            {
+                preview.m_group->RemoveInstanceNode(preview.m_node);
+            }
+            else
+            {
+                preview.m_group->AddInstanceNode(preview.m_node);
+            }
+            preview.m_billboard = billboard;
+        }
+
+        if (billboard)
+        {
+            flare->position_ = drawPos;
+            flare->size_ = Vector2(m_flareSize, m_flareSize);
+            flare->color_ = Color::WHITE;
+            flare->enabled_ = true;
+        }
+        else
+        {
+            flare->enabled_ = false;
+            preview.m_node->SetPosition(drawPos);
+            preview.m_node->SetScale(preview.m_radius * scale);
+        }
+    }
+
+    m_billboards->Commit();
+}
+
+StaticModelGroup* SatellitePreviews::get_group(Model* model,
+                                               Material* material)
+{
+    for (WeakPtr<StaticModelGroup> const& group : m_groups)
+    {
+        if (group->GetModel() == model && group->GetMaterial() == material)
+        {
+            return group.Get();
+        }
+    }
+
+    StaticModelGroup* group = node_->CreateComponent<StaticModelGroup>();
+    group->SetModel(model);
+    group->SetMaterial(material);
+    group->SetCastShadows(false);
+    m_groups.Push(WeakPtr<StaticModelGroup>(group));
+
+    return group;
+}
+
+Model* SatellitePreviews::get_sphere_model(Context* context)
+{
+    ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+
+    if (Model* existing = cache->GetExistingResource<Model>(sc_sphereModelName))
+    {
+        return existing;
+    }
+
+    // Start with a unit icosahedron, golden ratio style
+    const float t = (1.0f + Sqrt(5.0f)) / 2.0f;
+    const Vector3 icoVerts[12] = {
+        Vector3(-1,  t,  0), Vector3( 1,  t,  0), Vector3(-1, -t,  0),
+        Vector3( 1, -t,  0), Vector3( 0, -1,  t), Vector3( 0,  1,  t),
+        Vector3( 0, -1, -t), Vector3( 0,  1, -t), Vector3( t,  0, -1),
+        Vector3( t,  0,  1), Vector3(-t,  0, -1), Vector3(-t,  0,  1)
+    };
+    static constexpr uint8_t icoTris[20 * 3] = {
+        0, 11,  5,   0,  5,  1,   0,  1,  7,   0,  7, 10,   0, 10, 11,
+        1,  5,  9,   5, 11,  4,  11, 10,  2,  10,  7,  6,   7,  1,  8,
+        3,  9,  4,   3,  4,  2,   3,  2,  6,   3,  6,  8,   3,  8,  9,
+        4,  9,  5,   2,  4, 11,   6,  2, 10,   8,  6,  7,   9,  8,  1
+    };
+
+    PODVector<Vector3> tris;
+    tris.Reserve(20 * 3);
+    for (int i = 0; i < 20 * 3; i ++)
+    {
+        tris.Push(icoVerts[icoTris[i]].Normalized());
+    }
+
+    // Split each triangle into 4. Vertices aren't shared between triangles,
+    // they end up in the same place anyways
+    for (int s = 0; s < sc_sphereSubdivisions; s ++)
+    {
+        PODVector<Vector3> subdivided;
+        subdivided.Reserve(tris.Size() * 4);
+        for (unsigned i = 0; i < tris.Size(); i += 3)
+        {
+            const Vector3& a = tris[i + 0];
+            const Vector3& b = tris[i + 1];
+            const Vector3& c = tris[i + 2];
+            const Vector3 ab = (a + b).Normalized();
+            const Vector3 bc = (b + c).Normalized();
+            const Vector3 ca = (c + a).Normalized();
+
+            // Winding order stays the same as the parent's
+            const Vector3 split[12] = {a, ab, ca,  b, bc, ab,
+                                       c, ca, bc,  ab, bc, ca};
+            for (const Vector3& vert : split)
+            {
+                subdivided.Push(vert);
+            }
+        }
+        tris = subdivided;
+    }
+
+    // Position and normal, which happen to be the same for a unit sphere
+    PODVector<float> vertData(tris.Size() * 6);
+    PODVector<unsigned short> indData(tris.Size());
+    for (unsigned i = 0; i < tris.Size(); i ++)
+    {
+        memcpy(vertData.Buffer() + i * 6 + 0, tris[i].Data(),
+               3 * sizeof(float));
+        memcpy(vertData.Buffer() + i * 6 + 3, tris[i].Data(),
+               3 * sizeof(float));
+        indData[i] = static_cast<unsigned short>(i);
+    }
+
+    SharedPtr<VertexBuffer> vertBuf(new VertexBuffer(context));
+    SharedPtr<IndexBuffer> indBuf(new IndexBuffer(context));
+    SharedPtr<Geometry> geometry(new Geometry(context));
+
+    PODVector<VertexElement> elements;
+    elements.Push(VertexElement(TYPE_VECTOR3, SEM_POSITION));
+    elements.Push(VertexElement(TYPE_VECTOR3, SEM_NORMAL));
+
+    vertBuf->SetShadowed(true);
+    vertBuf->SetSize(tris.Size(), elements);
+    vertBuf->SetData(vertData.Buffer());
+
+    indBuf->SetShadowed(true);
+    indBuf->SetSize(indData.Size(), false);
+    indBuf->SetData(indData.Buffer());
+
+    geometry->SetVertexBuffer(0, vertBuf);
+    geometry->SetIndexBuffer(indBuf);
+    geometry->SetDrawRange(TRIANGLE_LIST, 0, indData.Size());
+
+    Model* model = new Model(context);
+    model->SetName(sc_sphereModelName);
+    model->SetNumGeometries(1);
+    model->SetGeometry(0, 0, geometry);
+    model->SetBoundingBox(BoundingBox(-1.0f, 1.0f));
+
+    Vector< SharedPtr<VertexBuffer> > vrtBufs;
+    Vector< SharedPtr<IndexBuffer> > indBufs;
+    vrtBufs.Push(vertBuf);
+    indBufs.Push(indBuf);
+    PODVector<unsigned> morphRangeStarts;
+    PODVector<unsigned> morphRangeCounts;
+    morphRangeStarts.Push(0);
+    morphRangeCounts.Push(0);
+    model->SetVertexBuffers(vrtBufs, morphRangeStarts, morphRangeCounts);
+    model->SetIndexBuffers(indBufs);
+
+    // The cache now owns the model
+    cache->AddManualResource(model);
+
+    return model;
+}
+
+} // namespace osp
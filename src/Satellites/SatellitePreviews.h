@@ -0,0 +1,147 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Graphics/BillboardSet.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/StaticModelGroup.h>
+#include <Urho3D/Scene/Component.h>
+#include <Urho3D/Scene/Node.h>
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+/**
+ * Draws cheap stand-ins for Satellites that can be seen from an ActiveArea,
+ * but are too far away to be loaded. See Satellite::load_preview.
+ *
+ * All previews that share a Model and Material are instances of a single
+ * StaticModelGroup, and anything that gets smaller than m_pixelThreshold on
+ * screen is drawn by a single BillboardSet instead. A preview costs an empty
+ * Node and a few floats, so a whole solar system can be visible at once.
+ *
+ * Previews further away than the camera's far clip are pulled closer and
+ * scaled down by the same amount, so they still look the same size.
+ */
+class SatellitePreviews : public Component
+{
+    URHO3D_OBJECT(SatellitePreviews, Component)
+
+    struct Preview
+    {
+        WeakPtr<Node> m_node;
+
+        // Group that draws this preview as a model. Null for flares, which
+        // are always drawn as billboards
+        WeakPtr<StaticModelGroup> m_group;
+
+        // Position relative to the scene origin, before being pulled closer
+        Vector3 m_position;
+
+        // Radius in meters
+        float m_radius;
+
+        // True if currently drawn by the BillboardSet instead of m_group
+        bool m_billboard;
+    };
+
+public:
+    // For Urho3D
+    static void RegisterObject(Context* context);
+
+    SatellitePreviews(Context* context);
+    ~SatellitePreviews() = default;
+
+    /**
+     * Add a preview drawn as a scaled instance of a shared model
+     * @param model [in] Shared model with a radius of 1, see get_sphere_model
+     * @param material [in] Material shared by every preview of the same type
+     * @param radius [in] Radius of the previewed object in meters
+     * @return Node representing the new preview
+     */
+    Node* add_preview(Model* model, Material* material, float radius);
+
+    /**
+     * Add a preview that is only ever drawn as a billboard flare, for things
+     * that are too small to ever need a model
+     * @return Node representing the new preview
+     */
+    Node* add_flare();
+
+    /**
+     * Remove a preview added by add_preview or add_flare
+     * @param node [in] Node returned by add_preview or add_flare
+     */
+    void remove_preview(Node* node);
+
+    /**
+     * Set position of a preview. Nothing visible changes until
+     * update_previews is called.
+     * @param node [in] Node returned by add_preview or add_flare
+     * @param pos [in] Position relative to the scene origin in meters
+     */
+    void set_position(Node* node, const Vector3& pos);
+
+    /**
+     * Place every preview, swap between models and billboards depending on
+     * how large they are on screen, and commit the billboards. Call once after
+     * positions have been set.
+     */
+    void update_previews();
+
+    /**
+     * Get the low-poly sphere shared by all spherical previews. It's created
+     * the first time this is called, and kept in the ResourceCache.
+     * @param context [in] Context to create the Model with
+     * @return Sphere model with a radius of 1
+     */
+    static Model* get_sphere_model(Context* context);
+
+    unsigned get_preview_count() const { return m_previews.Size(); }
+
+    /**
+     * Set how many pixels tall a preview can be before it stops being a
+     * billboard and is drawn as a model
+     * @param pixels [in] Size in pixels
+     */
+    void set_pixel_threshold(float pixels) { m_pixelThreshold = pixels; }
+
+protected:
+
+    void OnNodeSet(Node* node) override;
+
+private:
+
+    /**
+     * Find a group that draws a model and material, or make a new one
+     * @return Group that draws model with material
+     */
+    StaticModelGroup* get_group(Model* model, Material* material);
+
+    Node* add(StaticModelGroup* group, float radius);
+
+    // All the previews. Indices match up with billboards in m_billboards
+    Vector<Preview> m_previews;
+
+    // Maps preview nodes to indices in m_previews
+    HashMap<Node*, unsigned> m_previewIndices;
+
+    // One group per Model and Material combination
+    Vector< WeakPtr<StaticModelGroup> > m_groups;
+
+    WeakPtr<BillboardSet> m_billboards;
+
+    // Previews smaller than this on screen are drawn as billboards
+    float m_pixelThreshold = 4.0f;
+
+    // Size of billboards on screen in pixels
+    float m_flareSize = 3.0f;
+
+    // True when previews were added or removed since the last update
+    bool m_countChanged = false;
+};
+
+} // namespace osp
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+namespace osp
+{
+
+/**
+ * Scramble bits of a 64-bit number, used as a tiny random number generator
+ * that doesn't touch Urho3D::Rand's global state. Scattered terrain objects
+ * and asteroids use it to get the same objects from the same seed every
+ * time. (SplitMix64)
+ * @param state [ref] Advanced each call
+ * @return Random number
+ */
+inline uint64_t next_random(uint64_t& state)
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @param state [ref] Advanced each call
+ * @return Random float from 0.0 to 1.0
+ */
+inline float next_random_float(uint64_t& state)
+{
+    return float(next_random(state) >> 40) / float(1 << 24);
+}
+
+} // namespace osp
@@ -0,0 +1,673 @@
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Math/MathDefs.h>
+
+#include "HeightPyramid.h"
+
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace osp
+{
+
+static constexpr char sc_magic[4] = {'O', 'S', 'P', 'H'};
+static constexpr uint32_t sc_version = 1;
+
+static constexpr unsigned sc_headerSize = 32;
+static constexpr unsigned sc_levelInfoSize = 24;
+
+// Levels are aligned to this, a common page size
+static constexpr uint64_t sc_alignment = 4096;
+
+// Width and height of tiles made by convert_raw
+static constexpr unsigned sc_tileSize = 256;
+
+// Anything more than this can't be a real file
+static constexpr unsigned sc_maxLevels = 32;
+
+static uint64_t align_up(uint64_t value)
+{
+    return (value + sc_alignment - 1) / sc_alignment * sc_alignment;
+}
+
+// Urho3D's File only seeks up to 4GB, which real DEMs easily go past
+static bool seek_64(FILE* file, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+HeightPyramid::~HeightPyramid()
+{
+    close();
+}
+
+bool HeightPyramid::open(const Urho3D::String& path)
+{
+    close();
+
+    uint64_t size = 0;
+    const uint8_t* data = nullptr;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(Urho3D::WString(path).CString(), GENERIC_READ,
+                              FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        URHO3D_LOGERRORF("Can't open height pyramid: %s", path.CString());
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+    size = uint64_t(fileSize.QuadPart);
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY,
+                                        0, 0, nullptr);
+    if (mapping)
+    {
+        data = static_cast<const uint8_t*>(
+                    MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+
+    m_fileHandle = file;
+    m_mappingHandle = mapping;
+#else
+    int file = ::open(path.CString(), O_RDONLY);
+    if (file < 0)
+    {
+        URHO3D_LOGERRORF("Can't open height pyramid: %s", path.CString());
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        size = uint64_t(fileStat.st_size);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, file, 0);
+        if (mapped != MAP_FAILED)
+        {
+            data = static_cast<const uint8_t*>(mapped);
+        }
+    }
+
+    // The mapping stays valid after the file is closed
+    ::close(file);
+#endif
+
+    m_data = data;
+    m_size = size;
+
+    if (!m_data)
+    {
+        URHO3D_LOGERRORF("Can't map height pyramid: %s", path.CString());
+        close();
+        return false;
+    }
+
+    // Read header
+    uint32_t version, width, height, tileSize, levelCount;
+
+    if (m_size < sc_headerSize
+            || memcmp(m_data, sc_magic, sizeof(sc_magic)) != 0)
+    {
+        URHO3D_LOGERRORF("Not a height pyramid: %s", path.CString());
+        close();
+        return false;
+    }
+
+    memcpy(&version,     m_data + 4,  4);
+    memcpy(&width,       m_data + 8,  4);
+    memcpy(&height,      m_data + 12, 4);
+    memcpy(&tileSize,    m_data + 16, 4);
+    memcpy(&levelCount,  m_data + 20, 4);
+    memcpy(&m_minHeight, m_data + 24, 4);
+    memcpy(&m_maxHeight, m_data + 28, 4);
+
+    if (version != sc_version || tileSize == 0 || levelCount == 0
+            || levelCount > sc_maxLevels
+            || m_size < sc_headerSize + sc_levelInfoSize * levelCount)
+    {
+        URHO3D_LOGERRORF("Unsupported or broken height pyramid: %s",
+                         path.CString());
+        close();
+        return false;
+    }
+
+    m_tileSize = tileSize;
+
+    // Read level table, and make sure every tile is actually in the file
+    const uint64_t tileBytes = uint64_t(tileSize) * tileSize
+                                * sizeof(uint16_t);
+
+    for (unsigned i = 0; i < levelCount; i ++)
+    {
+        const uint8_t* info = m_data + sc_headerSize + i * sc_levelInfoSize;
+
+        Level level;
+        memcpy(&level.m_width,  info + 0,  4);
+        memcpy(&level.m_height, info + 4,  4);
+        memcpy(&level.m_tilesX, info + 8,  4);
+        memcpy(&level.m_tilesY, info + 12, 4);
+        memcpy(&level.m_offset, info + 16, 8);
+
+        const uint64_t end = level.m_offset
+                + uint64_t(level.m_tilesX) * level.m_tilesY * tileBytes;
+
+        if (level.m_width == 0 || level.m_height == 0
+                || uint64_t(level.m_tilesX) * tileSize < level.m_width
+                || uint64_t(level.m_tilesY) * tileSize < level.m_height
+                || end > m_size)
+        {
+            URHO3D_LOGERRORF("Height pyramid is truncated or broken: %s",
+                             path.CString());
+            close();
+            return false;
+        }
+
+        m_levels.Push(level);
+    }
+
+    URHO3D_LOGINFOF("Mapped height pyramid %s: %ux%u, %u levels, %.1fMB",
+                    path.CString(), width, height, levelCount,
+                    double(m_size) / 1000000.0);
+
+    return true;
+}
+
+void HeightPyramid::close()
+{
+#ifdef _WIN32
+    if (m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mappingHandle)
+    {
+        CloseHandle(m_mappingHandle);
+        m_mappingHandle = nullptr;
+    }
+    if (m_fileHandle)
+    {
+        CloseHandle(m_fileHandle);
+        m_fileHandle = nullptr;
+    }
+#else
+    if (m_data)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+    m_levels.Clear();
+}
+
+float HeightPyramid::sample(const Urho3D::Vector3& normal, float spacing,
+                            float planetRadius) const
+{
+    if (!m_data)
+    {
+        return 0.0f;
+    }
+
+    // Pick the level with texels about as big as the spacing. Texel size
+    // doubles each level, measured at the equator
+    float texelSize = 2.0f * Urho3D::M_PI * planetRadius
+                        / float(m_levels[0].m_width);
+    unsigned level = 0;
+
+    while (level + 1 < m_levels.Size() && texelSize * 2.0f <= spacing)
+    {
+        texelSize *= 2.0f;
+        level ++;
+    }
+
+    // Same mapping as textureEquirect in PlanetLit.glsl
+    // Urho3D's trig functions work in degrees
+    float u = Urho3D::Atan2(normal.z_, normal.x_) / 360.0f;
+    if (u < 0.0f)
+    {
+        u += 1.0f;
+    }
+    float v = Urho3D::Acos(Urho3D::Clamp(normal.y_, -1.0f, 1.0f)) / 180.0f;
+
+    return sample_level(m_levels[level], u, v);
+}
+
+uint16_t HeightPyramid::get_texel(const Level& level, int x, int y) const
+{
+    // Wrap around horizontally, clamp vertically at the poles
+    const int width = int(level.m_width);
+    x %= width;
+    if (x < 0)
+    {
+        x += width;
+    }
+    y = Urho3D::Clamp(y, 0, int(level.m_height) - 1);
+
+    const unsigned tileX = unsigned(x) / m_tileSize;
+    const unsigned tileY = unsigned(y) / m_tileSize;
+    const unsigned localX = unsigned(x) % m_tileSize;
+    const unsigned localY = unsigned(y) % m_tileSize;
+
+    const uint64_t tileTexels = uint64_t(m_tileSize) * m_tileSize;
+    const uint64_t texel = (uint64_t(tileY) * level.m_tilesX + tileX)
+                            * tileTexels + localY * m_tileSize + localX;
+
+    // Touching this is what pages the tile in
+    uint16_t value;
+    memcpy(&value, m_data + level.m_offset + texel * sizeof(uint16_t),
+           sizeof(uint16_t));
+    return value;
+}
+
+float HeightPyramid::sample_level(const Level& level, float u, float v) const
+{
+    // Texel centers are at +0.5
+    const float x = u * float(level.m_width) - 0.5f;
+    const float y = v * float(level.m_height) - 0.5f;
+
+    const int x0 = int(Urho3D::Floor(x));
+    const int y0 = int(Urho3D::Floor(y));
+    const float fx = x - float(x0);
+    const float fy = y - float(y0);
+
+    const float top = Urho3D::Lerp(float(get_texel(level, x0, y0)),
+                                   float(get_texel(level, x0 + 1, y0)), fx);
+    const float bottom = Urho3D::Lerp(float(get_texel(level, x0, y0 + 1)),
+                                      float(get_texel(level, x0 + 1, y0 + 1)),
+                                      fx);
+    const float quantized = Urho3D::Lerp(top, bottom, fy);
+
+    return m_minHeight + quantized / 65535.0f * (m_maxHeight - m_minHeight);
+}
+
+uint64_t HeightPyramid::calculate_levels(unsigned width, unsigned height,
+                                         unsigned tileSize,
+                                         Urho3D::PODVector<Level>& levels)
+{
+    levels.Clear();
+
+    // Halve until everything fits in a single tile
+    while (true)
+    {
+        Level level;
+        level.m_width = width;
+        level.m_height = height;
+        level.m_tilesX = (width + tileSize - 1) / tileSize;
+        level.m_tilesY = (height + tileSize - 1) / tileSize;
+        level.m_offset = 0;
+        levels.Push(level);
+
+        if (width <= tileSize && height <= tileSize)
+        {
+            break;
+        }
+
+        width = Urho3D::Max(1u, (width + 1) / 2);
+        height = Urho3D::Max(1u, (height + 1) / 2);
+    }
+
+    // Tiles go after the header and level table
+    const uint64_t tileBytes = uint64_t(tileSize) * tileSize
+                                * sizeof(uint16_t);
+    uint64_t offset = align_up(sc_headerSize
+                               + sc_levelInfoSize * levels.Size());
+
+    for (Level& level : levels)
+    {
+        level.m_offset = offset;
+        offset = align_up(offset + uint64_t(level.m_tilesX) * level.m_tilesY
+                                    * tileBytes);
+    }
+
+    return offset;
+}
+
+bool HeightPyramid::write_band(FILE* file, const Level& level,
+                               unsigned tileY,
+                               const Urho3D::PODVector<uint16_t>& band,
+                               Urho3D::PODVector<uint16_t>& tile)
+{
+    const unsigned tileSize = sc_tileSize;
+    const uint64_t tileTexels = uint64_t(tileSize) * tileSize;
+    const unsigned bandWidth = level.m_tilesX * tileSize;
+
+    if (!seek_64(file, level.m_offset + uint64_t(tileY) * level.m_tilesX
+                        * tileTexels * sizeof(uint16_t)))
+    {
+        return false;
+    }
+
+    // Cut the band into tiles, left to right
+    for (unsigned tileX = 0; tileX < level.m_tilesX; tileX ++)
+    {
+        for (unsigned y = 0; y < tileSize; y ++)
+        {
+            memcpy(tile.Buffer() + y * tileSize,
+                   band.Buffer() + y * bandWidth + tileX * tileSize,
+                   tileSize * sizeof(uint16_t));
+        }
+
+        if (fwrite(tile.Buffer(), sizeof(uint16_t), tileTexels, file)
+                != tileTexels)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Read a single sample from a raw DEM
+ * @param data [in] Pointer to the sample
+ * @param format [in] Type of sample
+ * @param bigEndian [in] true to swap bytes
+ * @return Sample converted to float
+ */
+static float read_raw_sample(const uint8_t* data,
+                             HeightPyramid::RawFormat format, bool bigEndian)
+{
+    uint8_t bytes[4];
+    const unsigned size = (format == HeightPyramid::RawFormat::FLOAT32) ? 4 : 2;
+
+    for (unsigned i = 0; i < size; i ++)
+    {
+        bytes[i] = bigEndian ? data[size - 1 - i] : data[i];
+    }
+
+    switch (format)
+    {
+    case HeightPyramid::RawFormat::INT16:
+    {
+        int16_t value;
+        memcpy(&value, bytes, 2);
+        return float(value);
+    }
+    case HeightPyramid::RawFormat::UINT16:
+    {
+        uint16_t value;
+        memcpy(&value, bytes, 2);
+        return float(value);
+    }
+    case HeightPyramid::RawFormat::FLOAT32:
+    default:
+    {
+        float value;
+        memcpy(&value, bytes, 4);
+
+        // No-data values are sometimes stored as NaN
+        return (value == value) ? value : 0.0f;
+    }
+    }
+}
+
+bool HeightPyramid::convert_raw(const Urho3D::String& inPath,
+                                const Urho3D::String& outPath,
+                                unsigned width, unsigned height,
+                                RawFormat format, bool bigEndian, float scale)
+{
+    if (width == 0 || height == 0)
+    {
+        URHO3D_LOGERROR("DEM conversion: width and height can't be zero");
+        return false;
+    }
+
+    FILE* input = fopen(inPath.CString(), "rb");
+    if (!input)
+    {
+        URHO3D_LOGERRORF("DEM conversion: can't open %s", inPath.CString());
+        return false;
+    }
+
+    const unsigned sampleSize = (format == RawFormat::FLOAT32) ? 4 : 2;
+    const unsigned tileSize = sc_tileSize;
+    const uint64_t tileTexels = uint64_t(tileSize) * tileSize;
+
+    Urho3D::PODVector<uint8_t> rowRaw(width * sampleSize);
+
+    // First pass: find height range for quantizing
+    float minHeight = Urho3D::M_INFINITY;
+    float maxHeight = -Urho3D::M_INFINITY;
+
+    for (unsigned y = 0; y < height; y ++)
+    {
+        if (fread(rowRaw.Buffer(), sampleSize, width, input) != width)
+        {
+            URHO3D_LOGERRORF("DEM conversion: %s is smaller than %ux%u",
+                             inPath.CString(), width, height);
+            fclose(input);
+            return false;
+        }
+
+        for (unsigned x = 0; x < width; x ++)
+        {
+            const float h = read_raw_sample(rowRaw.Buffer() + x * sampleSize,
+                                            format, bigEndian) * scale;
+            minHeight = Urho3D::Min(minHeight, h);
+            maxHeight = Urho3D::Max(maxHeight, h);
+        }
+    }
+
+    URHO3D_LOGINFOF("DEM conversion: heights from %.1fm to %.1fm",
+                    minHeight, maxHeight);
+
+    const float range = Urho3D::Max(maxHeight - minHeight,
+                                    Urho3D::M_EPSILON);
+
+    Urho3D::PODVector<Level> levels;
+    const uint64_t totalSize = calculate_levels(width, height, tileSize,
+                                                levels);
+
+    // Read back previous levels to make the next, so open for update
+    FILE* output = fopen(outPath.CString(), "w+b");
+    if (!output)
+    {
+        URHO3D_LOGERRORF("DEM conversion: can't write %s", outPath.CString());
+        fclose(input);
+        return false;
+    }
+
+    bool success = true;
+
+    // Write header and level table
+    {
+        const uint32_t levelCount = levels.Size();
+        uint8_t header[sc_headerSize];
+        memcpy(header + 0,  sc_magic,    4);
+        memcpy(header + 4,  &sc_version, 4);
+        memcpy(header + 8,  &width,      4);
+        memcpy(header + 12, &height,     4);
+        memcpy(header + 16, &tileSize,   4);
+        memcpy(header + 20, &levelCount, 4);
+        memcpy(header + 24, &minHeight,  4);
+        memcpy(header + 28, &maxHeight,  4);
+        success &= fwrite(header, sc_headerSize, 1, output) == 1;
+
+        for (const Level& level : levels)
+        {
+            uint8_t info[sc_levelInfoSize];
+            memcpy(info + 0,  &level.m_width,  4);
+            memcpy(info + 4,  &level.m_height, 4);
+            memcpy(info + 8,  &level.m_tilesX, 4);
+            memcpy(info + 12, &level.m_tilesY, 4);
+            memcpy(info + 16, &level.m_offset, 8);
+            success &= fwrite(info, sc_levelInfoSize, 1, output) == 1;
+        }
+    }
+
+    // A row of tiles, stored as rows of texels the width of the level
+    // (padded to a multiple of tileSize)
+    Urho3D::PODVector<uint16_t> band;
+    Urho3D::PODVector<uint16_t> tile;
+    tile.Resize(unsigned(tileTexels));
+
+    // Second pass: quantize input into level 0, one row of tiles at a time
+    {
+        const Level& level = levels[0];
+        const unsigned bandWidth = level.m_tilesX * tileSize;
+        band.Resize(bandWidth * tileSize);
+
+        rewind(input);
+
+        unsigned y = 0;
+        for (unsigned tileY = 0; tileY < level.m_tilesY && success; tileY ++)
+        {
+            for (unsigned row = 0; row < tileSize; row ++, y ++)
+            {
+                uint16_t* bandRow = band.Buffer() + row * bandWidth;
+
+                if (y >= height)
+                {
+                    // Past the bottom, repeat the last row
+                    memcpy(bandRow, bandRow - bandWidth,
+                           bandWidth * sizeof(uint16_t));
+                    continue;
+                }
+
+                if (fread(rowRaw.Buffer(), sampleSize, width, input) != width)
+                {
+                    success = false;
+                    break;
+                }
+
+                for (unsigned x = 0; x < bandWidth; x ++)
+                {
+                    // Past the right edge, repeat the last column
+                    const unsigned srcX = Urho3D::Min(x, width - 1);
+                    const float h = read_raw_sample(
+                                rowRaw.Buffer() + srcX * sampleSize,
+                                format, bigEndian) * scale;
+                    bandRow[x] = uint16_t(Urho3D::Clamp(
+                                (h - minHeight) / range * 65535.0f + 0.5f,
+                                0.0f, 65535.0f));
+                }
+            }
+
+            success = success && write_band(output, level, tileY, band,
+                                                   tile);
+        }
+    }
+
+    fclose(input);
+
+    // Make each next level by averaging 2x2 texels of the one before, read
+    // back from the file two rows of tiles at a time
+    Urho3D::PODVector<uint16_t> source;
+
+    for (unsigned i = 1; i < levels.Size() && success; i ++)
+    {
+        const Level& prev = levels[i - 1];
+        const Level& level = levels[i];
+        const unsigned prevBandWidth = prev.m_tilesX * tileSize;
+        const unsigned bandWidth = level.m_tilesX * tileSize;
+
+        source.Resize(prevBandWidth * tileSize * 2);
+        band.Resize(bandWidth * tileSize);
+
+        URHO3D_LOGINFOF("DEM conversion: level %u, %ux%u", i,
+                        level.m_width, level.m_height);
+
+        for (unsigned tileY = 0; tileY < level.m_tilesY && success; tileY ++)
+        {
+            // Load two rows of tiles from the previous level
+            for (unsigned half = 0; half < 2; half ++)
+            {
+                const unsigned prevTileY = Urho3D::Min(tileY * 2 + half,
+                                                       prev.m_tilesY - 1);
+                success &= seek_64(output, prev.m_offset + uint64_t(prevTileY)
+                            * prev.m_tilesX * tileTexels * sizeof(uint16_t));
+
+                for (unsigned tileX = 0; tileX < prev.m_tilesX; tileX ++)
+                {
+                    success &= fread(tile.Buffer(), sizeof(uint16_t),
+                                     tileTexels, output) == tileTexels;
+
+                    for (unsigned y = 0; y < tileSize; y ++)
+                    {
+                        memcpy(source.Buffer()
+                                    + (half * tileSize + y) * prevBandWidth
+                                    + tileX * tileSize,
+                               tile.Buffer() + y * tileSize,
+                               tileSize * sizeof(uint16_t));
+                    }
+                }
+            }
+
+            // Average down, clamping to the edges of the previous level
+            for (unsigned y = 0; y < tileSize; y ++)
+            {
+                const unsigned globalY = Urho3D::Min(tileY * tileSize + y,
+                                                     level.m_height - 1);
+                const unsigned srcY0 = Urho3D::Min(globalY * 2,
+                                                   prev.m_height - 1);
+                const unsigned srcY1 = Urho3D::Min(globalY * 2 + 1,
+                                                   prev.m_height - 1);
+
+                // Rows relative to the loaded source band
+                const unsigned bandY0 = srcY0 - tileY * 2 * tileSize;
+                const unsigned bandY1 = srcY1 - tileY * 2 * tileSize;
+
+                for (unsigned x = 0; x < bandWidth; x ++)
+                {
+                    const unsigned globalX = Urho3D::Min(x, level.m_width - 1);
+                    const unsigned srcX0 = Urho3D::Min(globalX * 2,
+                                                       prev.m_width - 1);
+                    const unsigned srcX1 = Urho3D::Min(globalX * 2 + 1,
+                                                       prev.m_width - 1);
+
+                    const unsigned sum
+                            = source[bandY0 * prevBandWidth + srcX0]
+                            + source[bandY0 * prevBandWidth + srcX1]
+                            + source[bandY1 * prevBandWidth + srcX0]
+                            + source[bandY1 * prevBandWidth + srcX1];
+
+                    band[y * bandWidth + x] = uint16_t((sum + 2) / 4);
+                }
+            }
+
+            success = success && write_band(output, level, tileY, band,
+                                                   tile);
+        }
+    }
+
+    // Pad the end so the last level is page aligned too
+    if (success)
+    {
+        success = seek_64(output, totalSize - 1)
+                && fputc(0, output) != EOF;
+    }
+
+    fclose(output);
+
+    if (!success)
+    {
+        URHO3D_LOGERRORF("DEM conversion: failed reading %s or writing %s",
+                         inPath.CString(), outPath.CString());
+        return false;
+    }
+
+    URHO3D_LOGINFOF("DEM conversion: wrote %s, %u levels, %.1fMB",
+                    outPath.CString(), levels.Size(),
+                    double(totalSize) / 1000000.0);
+    return true;
+}
+
+} // namespace osp
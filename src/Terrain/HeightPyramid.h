@@ -0,0 +1,182 @@
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/RefCounted.h>
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include <cstdint>
+#include <cstdio>
+
+namespace osp
+{
+
+/**
+ * Elevation data for a whole planet, stored as a tiled and mip-mapped
+ * equirectangular pyramid in a single file.
+ *
+ * The file is memory-mapped instead of loaded, so the OS only pages in the
+ * tiles that are actually sampled. Planets with gigabytes of height data only
+ * cost as much memory as the terrain that's currently around the camera.
+ *
+ * File layout (little endian):
+ *
+ *     Header      [32 bytes]
+ *     Level table [24 bytes per level]
+ *     Level 0 tiles, row by row
+ *     Level 1 tiles, row by row
+ *     ...
+ *
+ * Level 0 is full resolution, and each level after is half the size of the
+ * previous, until one fits in a single tile. Each tile is tileSize * tileSize
+ * heights quantized to uint16 between the min and max height in the header.
+ * Tiles on the right and bottom edges are padded by repeating the last
+ * column and row. Levels start on a page boundary, so tiles line up with
+ * pages too.
+ *
+ * Use convert_raw to make one from a raw DEM.
+ */
+class HeightPyramid : public Urho3D::RefCounted
+{
+public:
+
+    // Sample formats that convert_raw can read
+    enum class RawFormat
+    {
+        INT16,
+        UINT16,
+        FLOAT32
+    };
+
+    HeightPyramid() = default;
+    ~HeightPyramid();
+
+    /**
+     * Memory-map a height pyramid file. Nothing is read other than the
+     * header until heights are sampled.
+     * @param path [in] Absolute path to file
+     * @return true if the file is a valid height pyramid
+     */
+    bool open(const Urho3D::String& path);
+
+    /**
+     * Unmap the file. Done automatically when destroyed.
+     */
+    void close();
+
+    bool is_open() const { return m_data != nullptr; }
+
+    /**
+     * Sample height at a direction from the planet's center, using the level
+     * with the closest resolution to spacing
+     * @param normal [in] Normalized direction from the planet's center
+     * @param spacing [in] Distance in meters between samples on a sphere of
+     *                     planetRadius, used to pick a level
+     * @param planetRadius [in] Radius of planet in meters
+     * @return Height in meters, relative to planetRadius
+     */
+    float sample(const Urho3D::Vector3& normal, float spacing,
+                 float planetRadius) const;
+
+    unsigned get_level_count() const { return m_levels.Size(); }
+
+    /**
+     * @return Size of the mapped file in bytes. Only the parts touched by
+     *         sample are actually in memory
+     */
+    uint64_t get_mapped_size() const { return m_size; }
+
+    /**
+     * Convert a raw equirectangular DEM into a height pyramid file. The input
+     * is streamed a band of rows at a time, so it can be much larger than
+     * available memory.
+     *
+     * Other formats, like GeoTIFF, can be converted to raw with GDAL first:
+     *     gdal_translate -of ENVI -ot Int16 input.tif output.raw
+     *
+     * @param inPath [in] Path to raw input, rows from north to south
+     * @param outPath [in] Path to write height pyramid to
+     * @param width [in] Width of the input in samples
+     * @param height [in] Height of the input in samples
+     * @param format [in] Type of each sample
+     * @param bigEndian [in] true if the input samples are big endian
+     * @param scale [in] Multiplied with each sample to get meters
+     * @return true if successful, errors are logged
+     */
+    static bool convert_raw(const Urho3D::String& inPath,
+                            const Urho3D::String& outPath,
+                            unsigned width, unsigned height, RawFormat format,
+                            bool bigEndian, float scale = 1.0f);
+
+private:
+
+    struct Level
+    {
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_tilesX;
+        uint32_t m_tilesY;
+
+        // Offset to the first tile from the beginning of the file
+        uint64_t m_offset;
+    };
+
+    /**
+     * Fill in the level table for a pyramid of a certain size
+     * @param width [in] Width of level 0
+     * @param height [in] Height of level 0
+     * @param tileSize [in] Width and height of each tile
+     * @param levels [out] Levels to fill
+     * @return Total file size needed
+     */
+    static uint64_t calculate_levels(unsigned width, unsigned height,
+                                     unsigned tileSize,
+                                     Urho3D::PODVector<Level>& levels);
+
+    /**
+     * Write a band of texels into a file as a row of tiles
+     * @param file [in] File to write to
+     * @param level [in] Level the band belongs to
+     * @param tileY [in] Which row of tiles the band is
+     * @param band [in] tileSize rows of texels, (m_tilesX * tileSize) wide
+     * @param tile [out] Space for a single tile, used as scratch
+     * @return true if successful
+     */
+    static bool write_band(FILE* file, const Level& level, unsigned tileY,
+                           const Urho3D::PODVector<uint16_t>& band,
+                           Urho3D::PODVector<uint16_t>& tile);
+
+    /**
+     * Get a single height from a level, in quantized form
+     * @param level [in] Level to read from
+     * @param x [in] Column, wraps around
+     * @param y [in] Row, clamped
+     */
+    uint16_t get_texel(const Level& level, int x, int y) const;
+
+    /**
+     * Bilinearly sample a level
+     * @param level [in] Level to read from
+     * @param u [in] 0.0 to 1.0, west to east, wraps around
+     * @param v [in] 0.0 to 1.0, north to south
+     * @return Height in meters
+     */
+    float sample_level(const Level& level, float u, float v) const;
+
+    Urho3D::PODVector<Level> m_levels;
+
+    uint32_t m_tileSize = 0;
+    float m_minHeight = 0.0f;
+    float m_maxHeight = 0.0f;
+
+    const uint8_t* m_data = nullptr;
+    uint64_t m_size = 0;
+
+#ifdef _WIN32
+    void* m_fileHandle = nullptr;
+    void* m_mappingHandle = nullptr;
+#endif
+};
+
+} // namespace osp
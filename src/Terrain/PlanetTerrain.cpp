@@ -1,20 +1,150 @@
 #include "PlanetTerrain.h"
+#include "TerrainManager.h"
+#include "../Satellites/ActiveArea.h"
+#include "../Satellites/SatellitePreviews.h"
 
 #include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/StringUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Renderer.h>
+#include <Urho3D/Graphics/Viewport.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/Physics/PhysicsWorld.h>
 
 namespace osp
 {
 
+// Height map used by the planet material's DISPLACE shader, and by
+// PlanetWrenderer when stamps need displacing on the CPU
+static const char* const sc_heightMap = "Textures/EquirectangularHeight.png";
+
 PlanetTerrain::PlanetTerrain(Context* context) : StaticModel(context),
+                                                    m_shaderDisplaced(false),
+                                                    m_updateTime(0),
+                                                    m_cameraKnown(false),
                                                     m_first(false)
 {
     //SetUpdateEventMask(USE_UPDATE);
     //SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(PlanetTerrain, UpdatePlanet));
 }
 
+PlanetTerrain::~PlanetTerrain()
+{
+    // A worker might still be building m_planet
+    if (m_buildItem.NotNull()
+            && !GetSubsystem<WorkQueue>()->RemoveWorkItem(m_buildItem))
+    {
+        while (!m_buildItem->completed_)
+        {
+            Time::Sleep(1);
+        }
+    }
+}
+
+/**
+ * Work function for building a PlanetWrenderer's initial chunks
+ * @param item [in] Item with a PlanetWrenderer as aux_
+ * @param threadIndex [in] Unused
+ */
+static void build_initial_work(const WorkItem* item, unsigned threadIndex)
+{
+    static_cast<PlanetWrenderer*>(item->aux_)->build_initial();
+}
+
 void PlanetTerrain::lod_update(StringHash eventType, VariantMap& eventData)
 {
+    if (!m_planet.is_ready() || !node_)
+    {
+        return;
+    }
+
+    // Only planets in the scene seen by the main viewport are updated
+    Viewport* viewport = GetSubsystem<Renderer>()->GetViewport(0);
+
+    if (!viewport || !viewport->GetCamera()
+            || viewport->GetScene() != GetScene())
+    {
+        return;
+    }
+
+    HiresTimer timer;
 
+    // Camera position relative to the planet's center
+    Vector3 camera = node_->GetWorldTransform().Inverse()
+                * viewport->GetCamera()->GetNode()->GetWorldPosition();
+
+    // Estimate how fast the camera is moving relative to the planet, for
+    // loading terrain ahead of it
+    const float timeStep = eventData[Update::P_TIMESTEP].GetFloat();
+
+    if (m_cameraKnown && timeStep > 0.0f)
+    {
+        // Smoothed out, so a single jump doesn't send prefetching off
+        // somewhere the camera isn't going
+        Vector3 velocity = (camera - m_cameraLast) / timeStep;
+        m_cameraVelocity = m_cameraVelocity.Lerp(velocity, 0.2f);
+    }
+
+    m_cameraLast = camera;
+    m_cameraKnown = true;
+
+    // The camera follows the focus around, so the focus's own path is a
+    // better guess of where it's going. The camera's is only used when
+    // there's no focus moved by physics.
+    Vector3 velocity = m_cameraVelocity;
+    Vector3 acceleration;
+    get_focus_motion(velocity, acceleration);
+
+    m_planet.update(camera, velocity, acceleration);
+
+    // Threshold scale might have been changed by the TerrainManager
+    m_material->SetShaderParameter("TerrainMorph",
+                                   m_planet.get_morph_parameters());
+
+    // Chunks added or removed might have changed the scatter
+    for (TerrainScatter* scatter : m_scatter)
+    {
+        if (scatter)
+        {
+            scatter->update_instances();
+        }
+    }
+
+    m_updateTime = timer.GetUSec(false);
+}
+
+bool PlanetTerrain::get_focus_motion(Vector3& velocity,
+                                     Vector3& acceleration) const
+{
+    Scene* scene = GetScene();
+    const ActiveArea* area = reinterpret_cast<ActiveArea*>(
+                                scene->GetVar("ActiveArea").GetPtr());
+
+    if (!area || !area->get_focus() || !area->get_focus()->is_loaded())
+    {
+        return false;
+    }
+
+    const RigidBody* body = area->get_focus()->get_active_node()
+                                ->GetComponent<RigidBody>();
+
+    if (!body)
+    {
+        return false;
+    }
+
+    // Planets stay put in the scene, so the body's velocity is already
+    // relative to the planet. Only the rotation is left.
+    const Quaternion toPlanet = node_->GetWorldRotation().Inverse();
+    velocity = toPlanet * body->GetLinearVelocity();
+
+    const PhysicsWorld* world = scene->GetComponent<PhysicsWorld>();
+    acceleration = (world && body->GetUseGravity())
+                    ? toPlanet * world->GetGravity() : Vector3::ZERO;
+
+    return true;
 }
 
 void PlanetTerrain::set_lod_update_enabled(bool enable)
@@ -37,17 +167,267 @@ void PlanetTerrain::set_lod_update_enabled(bool enable)
 
 void PlanetTerrain::initialize(AstronomicalBody* body)
 {
-    Image* heightMap = GetSubsystem<ResourceCache>()
-                    ->GetResource<Image>("Textures/EquirectangularHeight.png");
-    m_planet.initialize(context_, heightMap, body->get_radius());
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+
+    m_body = body;
+
+    // Each planet has its own copy, as geomorphing parameters depend on the
+    // planet's detail
+    m_material = cache->GetResource<Material>("Materials/Planet.xml")
+                    ->Clone();
+
+    // Use real elevation data if the body has any. It's memory-mapped, so
+    // only the parts that get sampled are ever loaded.
+    bool hasHeights = false;
+
+    if (!body->get_height_data().Empty())
+    {
+        String path = cache->GetResourceFileName(body->get_height_data());
+        SharedPtr<HeightPyramid> heights(new HeightPyramid);
+
+        if (!path.Empty() && heights->open(path))
+        {
+            m_planet.set_height_data(heights);
+            hasHeights = true;
+
+            // Vertices are already displaced, so the shader shouldn't do it
+            // a second time. Still geomorphed like any other planet.
+            m_material->SetVertexShaderDefines("GEOMORPH");
+        }
+        else
+        {
+            URHO3D_LOGERRORF("Can't load height data %s, using default",
+                             body->get_height_data().CString());
+        }
+    }
+
+    // Stamps from earlier sessions, applied on top of the heights
+    m_modifiers = new TerrainModifiers(body->get_radius());
+    m_stampsPath = get_stamps_path();
+
+    if (!m_stampsPath.Empty()
+            && GetSubsystem<FileSystem>()->FileExists(m_stampsPath)
+            && m_modifiers->load(m_stampsPath))
+    {
+        URHO3D_LOGINFOF("Loaded %u terrain stamps from %s",
+                        m_modifiers->get_stamps().Size(),
+                        m_stampsPath.CString());
+    }
+
+    if (hasHeights)
+    {
+        m_planet.set_modifiers(m_modifiers);
+    }
+    else
+    {
+        // The shader displaces the terrain, which stamps can't change. Only
+        // planets with stamps pay for doing it on the CPU.
+        m_shaderDisplaced = true;
+
+        if (!m_modifiers->get_stamps().Empty())
+        {
+            displace_on_cpu();
+        }
+    }
+
+    if (body->has_ocean())
+    {
+        m_planet.set_sea_level(body->get_sea_level());
+    }
+
+    // Chunks blend towards their parent's level, so nothing pops. Shared
+    // topology is left off, as it costs more memory than it saves.
+    m_planet.set_geomorph(true);
+
+    Image* heightMap = cache->GetResource<Image>(sc_heightMap);
+    m_planet.begin_initialize(context_, heightMap, body->get_radius());
+
+    // Look the same as the preview did until the terrain is ready
+    Node* placeholderNode = node_->CreateChild("Placeholder", LOCAL);
+    placeholderNode->SetScale(body->get_radius());
+
+    StaticModel* placeholder = placeholderNode->CreateComponent<StaticModel>();
+    placeholder->SetModel(SatellitePreviews::get_sphere_model(context_));
+    placeholder->SetMaterial(cache->GetResource<Material>(
+                                body->get_preview_material()));
+    placeholder->SetCastShadows(false);
+
+    m_placeholder = placeholderNode;
+
+    // Chunking the initial triangles is the slow part, do it on a worker.
+    // Nothing else touches m_planet until build_finished
+    m_buildItem = new WorkItem();
+    m_buildItem->workFunction_ = build_initial_work;
+    m_buildItem->aux_ = &m_planet;
+    m_buildItem->sendEvent_ = true;
+
+    SubscribeToEvent(E_WORKITEMCOMPLETED,
+                     URHO3D_HANDLER(PlanetTerrain, build_finished));
+
+    GetSubsystem<WorkQueue>()->AddWorkItem(m_buildItem);
+}
+
+void PlanetTerrain::build_finished(StringHash eventType,
+                                   VariantMap& eventData)
+{
+    using namespace WorkItemCompleted;
+
+    if (eventData[P_ITEM].GetVoidPtr() != m_buildItem.Get())
+    {
+        // Someone else's work item
+        return;
+    }
+
+    UnsubscribeFromEvent(E_WORKITEMCOMPLETED);
+    m_buildItem.Reset();
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+
+    m_planet.finish_initialize();
 
-    Material* planetMaterial = GetSubsystem<ResourceCache>()
-                            ->GetResource<Material>("Materials/Planet.xml");
     SetModel(m_planet.get_model());
     //m->SetCullMode(CULL_NONE);
     //m->SetFillMode(FILL_WIREFRAME);
-    SetMaterial(planetMaterial);
+    SetMaterial(m_material);
+
+    if (m_planet.has_ocean())
+    {
+        SetMaterial(PlanetWrenderer::get_ocean_geometry(),
+                    cache->GetResource<Material>("Materials/Ocean.xml"));
+    }
+
     SetCastShadows(false);
+
+    // Small rocks everywhere, and a few boulders further apart
+    SharedPtr<ScatterPool> rocks(new ScatterPool);
+    rocks->set_cell_size(64.0f);
+    rocks->set_count(48);
+    rocks->set_scale(0.3f, 1.2f);
+    rocks->set_seed(1);
+    add_scatter("Models/Icosphere.mdl", "Materials/Stone.xml", rocks);
+
+    SharedPtr<ScatterPool> boulders(new ScatterPool);
+    boulders->set_cell_size(256.0f);
+    boulders->set_count(8);
+    boulders->set_scale(2.0f, 5.0f);
+    boulders->set_seed(2);
+    add_scatter("Models/Icosphere.mdl", "Materials/Stone.xml", boulders);
+
+    // Detail is limited by the manager's triangle budget, shared with all
+    // the other planets
+    if (TerrainManager* manager = GetSubsystem<TerrainManager>())
+    {
+        manager->add_terrain(this);
+    }
+
+    set_lod_update_enabled(true);
+
+    if (m_placeholder.NotNull())
+    {
+        m_placeholder->Remove();
+    }
+}
+
+bool PlanetTerrain::add_stamp(const TerrainStamp& stamp)
+{
+    if (!m_planet.is_ready() || m_modifiers.Null())
+    {
+        return false;
+    }
+
+    m_modifiers->add(stamp);
+
+    unsigned remade;
+
+    if (m_shaderDisplaced)
+    {
+        // First stamp on a planet displaced by the shader. Switch to doing
+        // it on the CPU, which means making every chunk again, once.
+        displace_on_cpu();
+        remade = m_planet.invalidate(stamp.m_direction, 2.0f);
+    }
+    else
+    {
+        remade = m_planet.invalidate(stamp.m_direction,
+                                     m_modifiers->get_reach(stamp));
+    }
+
+    // Remade chunks have new scatter
+    for (TerrainScatter* scatter : m_scatter)
+    {
+        if (scatter)
+        {
+            scatter->update_instances();
+        }
+    }
+
+    URHO3D_LOGINFOF("Terrain stamp remade %u chunks", remade);
+
+    if (!m_stampsPath.Empty())
+    {
+        m_modifiers->save(m_stampsPath);
+    }
+
+    return true;
+}
+
+String PlanetTerrain::get_stamps_path() const
+{
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    if (!fileSystem || m_body.Null())
+    {
+        return String::EMPTY;
+    }
+
+    const String dir = fileSystem->GetAppPreferencesDir("OpenSpaceProgram",
+                                                        "Terrain");
+    if (dir.Empty())
+    {
+        return String::EMPTY;
+    }
+
+    // Stamps belong to the body they were made on. Its id tells apart
+    // bodies that look the same, and the height data and radius keep stamps
+    // from landing on different terrain if the body changes. Hashed, as
+    // resource names have slashes and such.
+    if (m_body->get_id().Empty())
+    {
+        return String::EMPTY;
+    }
+
+    const String key = m_body->get_id() + "@" + m_body->get_height_data()
+                        + "@" + String(m_body->get_radius());
+    const unsigned hash = StringHash(key).Value();
+    return dir + "Stamps_" + ToStringHex(hash) + ".bin";
+}
+
+void PlanetTerrain::displace_on_cpu()
+{
+    Image* heightMap = GetSubsystem<ResourceCache>()
+                            ->GetResource<Image>(sc_heightMap);
+    const float scale = m_material->GetShaderParameter("TerrainDeformAmount")
+                            .GetFloat();
+
+    m_planet.set_height_map(heightMap, scale);
+    m_planet.set_modifiers(m_modifiers);
+    m_material->SetVertexShaderDefines("GEOMORPH");
+    m_shaderDisplaced = false;
+}
+
+void PlanetTerrain::add_scatter(const String& model, const String& material,
+                                ScatterPool* pool)
+{
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+
+    m_planet.add_scatter(pool);
+
+    TerrainScatter* scatter = node_->CreateComponent<TerrainScatter>();
+    scatter->SetModel(cache->GetResource<Model>(model));
+    scatter->SetMaterial(cache->GetResource<Material>(material));
+    scatter->SetCastShadows(false);
+    scatter->set_pool(pool);
+
+    m_scatter.Push(WeakPtr<TerrainScatter>(scatter));
 }
 
 void PlanetTerrain::RegisterObject(Context* context)
@@ -1,10 +1,12 @@
 #pragma once
 
+#include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/Graphics/StaticModel.h>
 #include <Urho3D/Physics/RigidBody.h>
 
 #include "../Satellites/AstronomicalBody.h"
 #include "PlanetWrenderer.h"
+#include "TerrainScatter.h"
 
 namespace osp
 {
@@ -22,10 +24,11 @@ public:
     static void RegisterObject(Context* context);
 
     PlanetTerrain(Urho3D::Context* context);
+    ~PlanetTerrain();
 
     /**
      * Subdivide/Unsubdivide, and chunk/unchunk depending on how far the
-     * ActiveArea's m_focus is from the planet
+     * ActiveArea's m_focus is from the planet, and where it's heading
      * @param eventType
      * @param eventData
      */
@@ -38,23 +41,122 @@ public:
     void set_lod_update_enabled(bool enable);
 
     /**
-     * Generate preview model
+     * Start building the terrain on a worker thread. A sphere that looks like
+     * the body's preview is drawn until the terrain is ready, so this can be
+     * called in the middle of a physics step without holding it up.
      * @param [in] AstronomicalBody to get parameters from
      */
     void initialize(AstronomicalBody* body);
 
+    /**
+     * Called when a work item is completed. Attaches the terrain once the
+     * worker is done building it, and removes the placeholder.
+     * @param eventType
+     * @param eventData
+     */
+    void build_finished(Urho3D::StringHash eventType, VariantMap& eventData);
+
     PlanetWrenderer* get_planet();
 
+    /**
+     * Change the terrain around a point, like digging a crater or flattening
+     * a launch site. Only the chunks it touches are made again. The stamp is
+     * saved, so it's still there the next time the body is loaded.
+     *
+     * Bodies without height data are displaced by the shader, which stamps
+     * can't change. Their first stamp has every chunk made again, displaced
+     * on the CPU from then on.
+     *
+     * @param stamp [in] Change to make
+     * @return false if the terrain isn't ready yet or can't be changed
+     */
+    bool add_stamp(const TerrainStamp& stamp);
+
+    /**
+     * @return Time spent in the last lod_update, in microseconds
+     */
+    long long get_update_time() const { return m_updateTime; }
+
 private:
+
+    /**
+     * Scatter things over the terrain, drawn by a new TerrainScatter
+     * @param model [in] Resource name of model to scatter
+     * @param material [in] Resource name of material for model
+     * @param pool [in] Pool set up with how to place things
+     */
+    void add_scatter(const String& model, const String& material,
+                     ScatterPool* pool);
+
+    /**
+     * Get how the ActiveArea's focus is moving relative to the planet, from
+     * its RigidBody. Works out where the camera following it is headed.
+     * @param velocity [out] Velocity in meters per second, left as is if
+     *                       there's nothing to follow
+     * @param acceleration [out] Gravity pulling the focus, in meters per
+     *                           second squared. Left as is too.
+     * @return false if the focus isn't loaded or has no RigidBody
+     */
+    bool get_focus_motion(Vector3& velocity, Vector3& acceleration) const;
+
+    /**
+     * @return Path of the file the body's stamps are saved in, or empty if
+     *         there's nowhere to put it
+     */
+    String get_stamps_path() const;
+
+    /**
+     * Displace a planet without height data on the CPU instead of in the
+     * shader, so stamps can change it. Only affects chunks made after this
+     * is called.
+     */
+    void displace_on_cpu();
+
     // Used to generate the planet model
     PlanetWrenderer m_planet;
 
+    // Material for the terrain. A copy of the planet material, if it needed
+    // changes for this planet
+    Urho3D::SharedPtr<Material> m_material;
+
+    // Changes made to the terrain, null if it can't be changed
+    Urho3D::SharedPtr<TerrainModifiers> m_modifiers;
+
+    // Where m_modifiers is saved, empty to not save
+    String m_stampsPath;
+
+    // true while the shader displaces the terrain, and m_modifiers isn't
+    // applied yet
+    bool m_shaderDisplaced;
+
+    // Work item building the terrain, null when not building
+    Urho3D::SharedPtr<Urho3D::WorkItem> m_buildItem;
+
+    // Drawn in place of the terrain while it's being built
+    Urho3D::WeakPtr<Node> m_placeholder;
+
+    // Rocks and boulders drawn on the terrain, on the same node
+    Urho3D::Vector<Urho3D::WeakPtr<TerrainScatter> > m_scatter;
+
     // Not yet used
     Urho3D::WeakPtr<RigidBody> m_collider;
 
     // Associated AstronomicalBody
     Urho3D::WeakPtr<AstronomicalBody> m_body;
 
+    // Time spent in the last lod_update, for TerrainManager
+    long long m_updateTime;
+
+    // Camera position relative to the planet in the last lod_update
+    Vector3 m_cameraLast;
+
+    // Smoothed camera velocity relative to the planet, for prefetching when
+    // there's no focus to follow
+    Vector3 m_cameraVelocity;
+
+    // false until m_cameraLast is set
+    bool m_cameraKnown;
+
     bool m_first;
 };
 
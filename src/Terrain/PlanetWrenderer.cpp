@@ -1,6 +1,7 @@
 // "PlanetRenderer is a little too boring" -- Capital Asterisk, 2018
 
 #include "PlanetWrenderer.h"
+#include "../ParallelWork.h"
 
 namespace osp
 {
@@ -125,6 +126,8 @@ void IcoSphereTree::initialize()
                             sc_icoTemplateneighbours[i * 3 + 1],
                             sc_icoTemplateneighbours[i * 3 + 2]);
 
+        tri.m_parent = gc_invalidTri;
+        tri.m_children = gc_invalidTri;
         tri.m_bitmask = 0;
         tri.m_depth = 0;
         calculate_center(tri);
@@ -167,18 +170,84 @@ int IcoSphereTree::neighbour_side(const SubTriangle& tri,
     return 255;
 }
 
+PlanetWrenderer::~PlanetWrenderer()
+{
+    // Chunks still in use are owned here, not by any snapshot
+    for (chindex i = 0; i < m_chunkCount; i ++)
+    {
+        delete m_chunkSnapshots[i];
+    }
+}
+
+/**
+ * Write to a vertex or index buffer. If pending isn't null, only the shadow
+ * data is written, and the range written is added to pending so it can be
+ * sent to the GPU later from the main thread.
+ * @param buffer [in] Vertex or index buffer, must be shadowed
+ * @param elementSize [in] Size of a vertex or index in bytes
+ * @param pending [ref] Range to add to, or nullptr to write to the GPU now
+ * @param data [in] Data to write
+ * @param start [in] First vertex or index to write
+ * @param count [in] Number of vertices or indices to write
+ */
+template<class BUFFER_T>
+static void write_range(BUFFER_T* buffer, unsigned elementSize,
+                        UpdateRange* pending, const void* data,
+                        unsigned start, unsigned count)
+{
+    if (!pending)
+    {
+        buffer->SetDataRange(data, start, count);
+        return;
+    }
+
+    memcpy(buffer->GetShadowData() + start * elementSize, data,
+           count * elementSize);
+
+    pending->m_start = Urho3D::Min(pending->m_start, start);
+    pending->m_end = Urho3D::Max(pending->m_end, start + count);
+}
+
+/**
+ * Send a range of shadow data written by write_range to the GPU
+ * @param buffer [in] Vertex or index buffer, must be shadowed
+ * @param elementSize [in] Size of a vertex or index in bytes
+ * @param pending [ref] Range to send, reset afterwards
+ */
+template<class BUFFER_T>
+static void upload_range(BUFFER_T* buffer, unsigned elementSize,
+                         UpdateRange& pending)
+{
+    if (pending.m_start < pending.m_end)
+    {
+        buffer->SetDataRange(buffer->GetShadowData()
+                                + pending.m_start * elementSize,
+                             pending.m_start, pending.m_end - pending.m_start);
+    }
+
+    pending = UpdateRange();
+}
+
 void PlanetWrenderer::initialize(Urho3D::Context* context,
                                  Urho3D::Image* heightMap, double size)
 {
+    begin_initialize(context, heightMap, size);
+    build_initial();
+    finish_initialize();
+}
+
+void PlanetWrenderer::begin_initialize(Urho3D::Context* context,
+                                       Urho3D::Image* heightMap, double size)
+{
 
     // Set preferences to some magic numbers
     // TODO: implement a planet config file or something
 
-    m_subdivAreaThreshold = 0.02f;
+    // Geomorphing hides levels switching, so triangles can be bigger
+    m_subdivAreaThreshold = m_geomorph ? 0.04f : 0.02f;
     m_chunkMaxVertShared = 10000;
     m_maxChunks = 300;
 
-    m_chunkAreaThreshold = 0.04f;
     m_chunkResolution = 31;
     m_chunkVertsPerSide = m_chunkResolution - 1;
 
@@ -187,8 +256,10 @@ void PlanetWrenderer::initialize(Urho3D::Context* context,
     m_icoTree = Urho3D::SharedPtr<IcoSphereTree>(new IcoSphereTree());
     m_icoTree->m_radius = size;
 
+    m_workQueue = context->GetSubsystem<Urho3D::WorkQueue>();
+
     m_model = new Urho3D::Model(context);
-    m_model->SetNumGeometries(1);
+    m_model->SetNumGeometries(m_oceanEnabled ? 2 : 1);
 
     // Set bounding box to a sphere centered in the middle of the model with a
     // diameter of (radius * 2)
@@ -196,8 +267,6 @@ void PlanetWrenderer::initialize(Urho3D::Context* context,
                                 Urho3D::Sphere(Urho3D::Vector3::ZERO,
                                        float(size) * 2.0f)));
 
-    m_icoTree->initialize();
-
     // Chunks
     {
         m_chunkCount = 0;
@@ -208,9 +277,17 @@ void PlanetWrenderer::initialize(Urho3D::Context* context,
         m_chunkSizeInd = Urho3D::Pow(m_chunkVertsPerSide, 2u);
         m_chunkSharedCount = m_chunkVertsPerSide * 3;
 
-
-        m_chunkMaxVert = m_chunkMaxVertShared
-                        + m_maxChunks * (m_chunkSize - m_chunkSharedCount);
+        if (m_sharedTopology)
+        {
+            // Every chunk has all of its vertices to itself
+            m_chunkMaxVertShared = 0;
+            m_chunkMaxVert = m_maxChunks * m_chunkSize;
+        }
+        else
+        {
+            m_chunkMaxVert = m_chunkMaxVertShared
+                            + m_maxChunks * (m_chunkSize - m_chunkSharedCount);
+        }
 
         m_chunkVertCountShared = 0;
 
@@ -219,6 +296,7 @@ void PlanetWrenderer::initialize(Urho3D::Context* context,
         m_chunkVertBuf = new Urho3D::VertexBuffer(context);
         m_geometryChunk = new Urho3D::Geometry(context);
         m_chunkIndDomain.Resize(m_maxChunks);
+        m_chunkSnapshots.Resize(m_maxChunks);
         m_chunkVertUsers.Resize(m_chunkMaxVertShared);
 
         // Say that each vertex has position, normal, and tangent data
@@ -230,10 +308,19 @@ void PlanetWrenderer::initialize(Urho3D::Context* context,
         //elements.Push(VertexElement(TYPE_VECTOR3, SEM_TEXCOORD));
         //elements.Push(VertexElement(TYPE_VECTOR3, SEM_COLOR));
 
+        if (m_geomorph)
+        {
+            // Morph target and edge length, iTexCoord2 in shaders
+            elements.Push(Urho3D::VertexElement(Urho3D::TYPE_VECTOR4,
+                                                Urho3D::SEM_TEXCOORD, 2));
+        }
+
         m_chunkVertBuf->SetSize(m_chunkMaxVert, elements);
         m_chunkVertBuf->SetShadowed(true);
 
-        m_indBufChunk->SetSize(m_maxChunks * m_chunkSizeInd * 3, true, true);
+        // The index template is never changed after finish_initialize
+        m_indBufChunk->SetSize(m_maxChunks * m_chunkSizeInd * 3, true,
+                               !m_sharedTopology);
         m_indBufChunk->SetShadowed(true);
 
         // Create the geometry, urho3d specific
@@ -325,6 +412,46 @@ void PlanetWrenderer::initialize(Urho3D::Context* context,
 
     }
 
+    // Ocean
+    if (m_oceanEnabled)
+    {
+        m_oceanCount = 0;
+
+        m_oceanVertBuf = new Urho3D::VertexBuffer(context);
+        m_geometryOcean = new Urho3D::Geometry(context);
+        m_chunkOcean.Resize(m_maxChunks);
+        m_oceanChunks.Resize(m_maxChunks);
+
+        // Same vertex format as chunks without morph targets, but ocean
+        // chunks don't share any vertices with each other
+        Urho3D::PODVector<Urho3D::VertexElement> elements
+                = m_chunkVertBuf->GetElements();
+        elements.Resize(2);
+
+        m_oceanVertBuf->SetSize(m_maxChunks * m_chunkSize, elements);
+        m_oceanVertBuf->SetShadowed(true);
+
+        if (m_sharedTopology)
+        {
+            // Ocean chunks are laid out the same way as chunks with shared
+            // topology, so they can draw with the same index buffer
+            m_oceanIndBuf = m_indBufChunk;
+        }
+        else
+        {
+            m_oceanIndBuf = new Urho3D::IndexBuffer(context);
+            m_oceanIndBuf->SetSize(m_maxChunks * m_chunkSizeInd * 3, true);
+            m_oceanIndBuf->SetShadowed(true);
+        }
+
+        m_geometryOcean->SetNumVertexBuffers(1);
+        m_geometryOcean->SetVertexBuffer(0, m_oceanVertBuf);
+        m_geometryOcean->SetIndexBuffer(m_oceanIndBuf);
+        m_geometryOcean->SetDrawRange(Urho3D::TRIANGLE_LIST, 0, 0);
+
+        m_model->SetGeometry(get_ocean_geometry(), 0, m_geometryOcean);
+    }
+
     // Not sure what this is doing, urho3d specific
     Urho3D::Vector<Urho3D::SharedPtr<Urho3D::VertexBuffer> > vrtBufs;
     Urho3D::Vector<Urho3D::SharedPtr<Urho3D::IndexBuffer> > indBufs;
@@ -334,22 +461,81 @@ void PlanetWrenderer::initialize(Urho3D::Context* context,
     Urho3D::PODVector<unsigned> morphRangeCounts;
     morphRangeStarts.Push(0);
     morphRangeCounts.Push(0);
+
+    if (m_oceanEnabled)
+    {
+        vrtBufs.Push(m_oceanVertBuf);
+        if (!m_sharedTopology)
+        {
+            indBufs.Push(m_oceanIndBuf);
+        }
+        morphRangeStarts.Push(0);
+        morphRangeCounts.Push(0);
+    }
     m_model->SetVertexBuffers(vrtBufs, morphRangeStarts, morphRangeCounts);
     m_model->SetIndexBuffers(indBufs);
 
-    m_ready = true;
+    // Buffers are only written to in their shadow data until
+    // finish_initialize
+    m_building = true;
+}
+
+void PlanetWrenderer::build_initial()
+{
+    m_icoTree->initialize();
+
+    // Ocean chunks always sit at the same place in the vertex buffer as
+    // their index data in the index buffer, so the index buffer never has
+    // to change. Same for chunks with shared topology. Fill it all in now,
+    // it's uploaded in finish_initialize.
+    if (m_sharedTopology)
+    {
+        fill_template_indices(reinterpret_cast<unsigned*>(
+                                    m_indBufChunk->GetShadowData()));
+    }
+    else if (m_oceanEnabled)
+    {
+        fill_template_indices(reinterpret_cast<unsigned*>(
+                                    m_oceanIndBuf->GetShadowData()));
+    }
 
-    // don't mind this debug code
-    // this part just chunks all the initial triangles
+    // Chunk all the initial triangles
+    for (trindex i = 0; i < gc_icosahedronFaceCount; i ++)
+    {
+        chunk_add(i, &m_buildVert, &m_buildInd);
+    }
+}
 
-    //m_icoTree->subdivide_add(0);
-    //chunk_add(0);
+void PlanetWrenderer::finish_initialize()
+{
+    // Send everything build_initial wrote to the GPU
+    upload_range(m_chunkVertBuf.Get(), m_chunkVertBuf->GetVertexSize(),
+                 m_buildVert);
+    if (m_sharedTopology)
+    {
+        m_indBufChunk->SetData(m_indBufChunk->GetShadowData());
+    }
+    else
+    {
+        upload_range(m_indBufChunk.Get(), m_indBufChunk->GetIndexSize(),
+                     m_buildInd);
+    }
 
-    for (trindex i = 0; i < 20; i ++)
+    if (m_oceanEnabled)
     {
-        chunk_add(i);
+        if (!m_sharedTopology)
+        {
+            m_oceanIndBuf->SetData(m_oceanIndBuf->GetShadowData());
+        }
+        upload_range(m_oceanVertBuf.Get(), m_oceanVertBuf->GetVertexSize(),
+                     m_buildOcean);
     }
 
+    m_building = false;
+    m_ready = true;
+
+    publish_snapshot();
+
     log_stats();
 }
 
@@ -361,6 +547,12 @@ void IcoSphereTree::subdivide_add(trindex t)
 
     SubTriangle* tri = get_triangle(t);
 
+    if (tri->m_bitmask & gc_triangleMaskSubdivided)
+    {
+        // Already subdivided
+        return;
+    }
+
     // Add the 4 new triangles
     // Top Left Right Center
     unsigned freeSize = m_trianglesFree.Size();
@@ -406,6 +598,15 @@ void IcoSphereTree::subdivide_add(trindex t)
     set_neighbours(children[3], tri->m_children + 0,
                                 tri->m_children + 1, tri->m_children + 2);
 
+    children[0].m_parent = children[1].m_parent
+                         = children[2].m_parent
+                         = children[3].m_parent
+                         = t;
+    children[0].m_children = children[1].m_children
+                           = children[2].m_children
+                           = children[3].m_children
+                           = gc_invalidTri;
+
     // Inherit m_depth
     children[0].m_depth = children[1].m_depth
                         = children[2].m_depth
@@ -436,6 +637,12 @@ void IcoSphereTree::subdivide_add(trindex t)
             if (m_vertFree.Size() == 0) {
                 tri->m_midVerts[i] = m_vertCount;
                 m_vertCount ++;
+
+                // Make more space if the vertex buffer is full
+                if (m_vertCount * m_vertCompCount > m_vertBuf.Size())
+                {
+                    m_vertBuf.Resize(m_vertBuf.Size() * 2);
+                }
             } else {
                 tri->m_midVerts[i] = m_vertFree[m_vertFree.Size() - 1];
                 m_vertFree.Pop();
@@ -547,12 +754,6 @@ void IcoSphereTree::subdivide_remove(trindex t)
         {
             subdivide_remove(tri->m_children + i);
         }
-        else
-        {
-            //find_refs(m_triangles[tri->m_children + i]);
-        }
-
-        //chunk_remove(tri->m_children + i);
     }
 
 
@@ -584,7 +785,7 @@ void IcoSphereTree::subdivide_remove(trindex t)
     m_trianglesFree.Push(tri->m_children);
 
     tri->m_bitmask ^= gc_triangleMaskSubdivided;
-    tri->m_children = unsigned(-1);
+    tri->m_children = gc_invalidTri;
 }
 
 void IcoSphereTree::calculate_center(SubTriangle &tri)
@@ -604,6 +805,27 @@ void IcoSphereTree::calculate_center(SubTriangle &tri)
     //printf("Center: %s\n", tri.m_center.ToString().CString());
 }
 
+uint64_t IcoSphereTree::get_path(trindex t) const
+{
+    uint64_t path = 0;
+    unsigned shift = 0;
+
+    // Two bits for which child the triangle is at each depth, going up
+    const SubTriangle* tri = get_triangle(t);
+    while (tri->m_parent != gc_invalidTri)
+    {
+        const SubTriangle* parent = get_triangle(tri->m_parent);
+        path |= uint64_t(t - parent->m_children) << shift;
+        shift += 2;
+
+        t = tri->m_parent;
+        tri = parent;
+    }
+
+    // Then which of the 20 base triangles it's in
+    return path | (uint64_t(t) << shift);
+}
+
 /**
  * Set a neighbour of a triangle, and apply for all of it's children's
  * @param tri [ref] Reference to triangle
@@ -621,11 +843,43 @@ void IcoSphereTree::set_side_recurse(SubTriangle& tri, int side, trindex to)
     }
 }
 
-void PlanetWrenderer::update(const Urho3D::Vector3& camera)
+/**
+ * Work function for working out the vertices of queued chunks
+ * @param item [in] Item with a PlanetWrenderer as aux_, and a range of its
+ *                  m_chunkQueue as start_ and end_
+ * @param threadIndex [in] Unused
+ */
+static void chunk_vertices_work(const Urho3D::WorkItem* item,
+                                unsigned threadIndex)
+{
+    static_cast<PlanetWrenderer*>(item->aux_)->chunk_vertices_range(
+                static_cast<const trindex*>(item->start_),
+                static_cast<const trindex*>(item->end_));
+}
+
+void PlanetWrenderer::update(const Urho3D::Vector3& camera,
+                             const Urho3D::Vector3& velocity,
+                             const Urho3D::Vector3& acceleration)
 {
     m_camera = camera;
     m_cameraDist = camera.Length();
 
+    // Sample points along where the camera is heading. Skipped if there's
+    // no space for extra chunks
+    m_cameraPredicted.Clear();
+
+    if ((velocity != Urho3D::Vector3::ZERO
+                || acceleration != Urho3D::Vector3::ZERO)
+            && get_chunk_load() < m_prefetchMaxLoad)
+    {
+        for (unsigned i = 1; i <= m_prefetchSamples; i ++)
+        {
+            float seconds = m_prefetchTime * float(i) / m_prefetchSamples;
+            m_cameraPredicted.Push(camera + velocity * seconds
+                        + acceleration * (0.5f * seconds * seconds));
+        }
+    }
+
     // size/distance is equal to the dot product between the camera position
     // vector, and the surface normal at the viewd edge of a perfect sphere
     // 0.45f is added because the triangles at the edge of the spehere are
@@ -638,10 +892,181 @@ void PlanetWrenderer::update(const Urho3D::Vector3& camera)
         sub_recurse(i);
     }
 
+    chunk_add_queued();
+
+    // Let other threads see the new chunks
+    if (m_snapshotDirty)
+    {
+        publish_snapshot();
+    }
+
     //URHO3D_LOGINFOF("Memory Usage: %fMb",
     //                float(get_memory_usage()) / 1000000.0f);
+}
+
+void PlanetWrenderer::publish_snapshot()
+{
+    TerrainSnapshot* snapshot = new TerrainSnapshot;
 
-    assert(m_icoTree->m_triangles.Size() < m_icoTree->m_maxTriangles);
+    snapshot->m_version = ++ m_snapshotVersion;
+    snapshot->m_chunkResolution = m_chunkResolution;
+
+    // Only pointers are copied, chunks that didn't change are shared with
+    // the previous snapshot
+    snapshot->m_chunks.Resize(m_chunkCount);
+    for (chindex i = 0; i < m_chunkCount; i ++)
+    {
+        snapshot->m_chunks[i] = m_chunkSnapshots[i];
+    }
+
+    m_snapshots.publish(snapshot);
+    m_snapshotDirty = false;
+}
+
+void PlanetWrenderer::ocean_add(chindex c)
+{
+    const ChunkSnapshot& chunk = *m_chunkSnapshots[c];
+    const float seaRadius = float(m_icoTree->m_radius) + m_seaLevel;
+
+    m_chunkOcean[c] = gc_invalidOcean;
+
+    // Skip chunks that are entirely above sea level
+    bool underwater = false;
+    for (const Urho3D::Vector3& pos : chunk.m_positions)
+    {
+        if (pos.LengthSquared() < seaRadius * seaRadius)
+        {
+            underwater = true;
+            break;
+        }
+    }
+
+    if (!underwater)
+    {
+        return;
+    }
+
+    const uint32_t ocean = m_oceanCount;
+
+    // Same grid as the chunk, but all on the sea level sphere
+    const Urho3D::Vector3* corners = chunk.m_corners;
+    const Urho3D::Vector3 dirRight = (corners[2] - corners[1])
+                                     / m_chunkVertsPerSide;
+    const Urho3D::Vector3 dirDown = (corners[1] - corners[0])
+                                    / m_chunkVertsPerSide;
+
+    // Position and normal for each vertex
+    Urho3D::PODVector<Urho3D::Vector3> vertData(m_chunkSize * 2);
+
+    for (int y = 0; y < int(m_chunkResolution); y ++)
+    {
+        for (int x = 0; x <= y; x ++)
+        {
+            const Urho3D::Vector3 normal = (corners[0] + dirRight * x
+                                            + dirDown * y).Normalized();
+            const unsigned index = get_index(x, y) * 2;
+
+            vertData[index + 0] = normal * seaRadius;
+            vertData[index + 1] = normal;
+        }
+    }
+
+    write_range(m_oceanVertBuf.Get(), m_oceanVertBuf->GetVertexSize(),
+                m_building ? &m_buildOcean : nullptr, vertData.Buffer(),
+                ocean * m_chunkSize, m_chunkSize);
+
+    m_chunkOcean[c] = ocean;
+    m_oceanChunks[ocean] = c;
+    m_oceanCount ++;
+
+    m_geometryOcean->SetDrawRange(Urho3D::TRIANGLE_LIST, 0,
+                                  m_oceanCount * m_chunkSizeInd * 3);
+}
+
+void PlanetWrenderer::ocean_remove(chindex c)
+{
+    const uint32_t ocean = m_chunkOcean[c];
+
+    if (ocean == gc_invalidOcean)
+    {
+        return;
+    }
+
+    m_chunkOcean[c] = gc_invalidOcean;
+    m_oceanCount --;
+
+    // Move the last ocean chunk into the removed one's place. Index data
+    // doesn't need to change, only vertices.
+    const uint32_t last = m_oceanCount;
+    if (ocean != last)
+    {
+        const unsigned char* lastVertData = m_oceanVertBuf->GetShadowData()
+                + last * m_chunkSize * m_oceanVertBuf->GetVertexSize();
+        m_oceanVertBuf->SetDataRange(lastVertData, ocean * m_chunkSize,
+                                     m_chunkSize);
+
+        m_oceanChunks[ocean] = m_oceanChunks[last];
+        m_chunkOcean[m_oceanChunks[ocean]] = ocean;
+    }
+
+    m_geometryOcean->SetDrawRange(Urho3D::TRIANGLE_LIST, 0,
+                                  m_oceanCount * m_chunkSizeInd * 3);
+}
+
+void PlanetWrenderer::add_scatter(ScatterPool* pool)
+{
+    // Pick the depth where triangle edges are closest to the cell size.
+    // See sub_recurse for the edge length equation.
+    float edgeLength = float(4.0 * m_icoTree->m_radius)
+                       / Urho3D::Sqrt(10.0f + 2.0f * Urho3D::Sqrt(5.0f));
+    unsigned depth = 0;
+
+    while (edgeLength > pool->get_cell_size() * 1.5f
+           && depth < m_icoTree->m_maxDepth)
+    {
+        edgeLength /= 2.0f;
+        depth ++;
+    }
+
+    pool->initialize(m_maxChunks, depth);
+    m_scatter.Push(Urho3D::SharedPtr<ScatterPool>(pool));
+
+    for (chindex c = 0; c < m_chunkCount; c ++)
+    {
+        scatter_add(*pool, c);
+    }
+}
+
+void PlanetWrenderer::scatter_add(ScatterPool& pool, chindex c)
+{
+    trindex cell = m_chunkIndDomain[c];
+    const ChunkSnapshot& chunk = *m_chunkSnapshots[c];
+
+    if (chunk.m_depth < pool.get_cell_depth())
+    {
+        // Too far away to see anything, but still needs an empty block
+        pool.chunk_add(chunk, m_chunkResolution, nullptr, 0);
+        return;
+    }
+
+    // Walk up to the cell the chunk is in
+    while (m_icoTree->get_triangle(cell)->m_depth > pool.get_cell_depth())
+    {
+        cell = m_icoTree->get_triangle(cell)->m_parent;
+    }
+
+    const float* vertData = m_icoTree->m_vertBuf.Buffer();
+    const SubTriangle* cellTri = m_icoTree->get_triangle(cell);
+    Urho3D::Vector3 corners[3];
+
+    for (int i = 0; i < 3; i ++)
+    {
+        corners[i] = *reinterpret_cast<const Urho3D::Vector3*>(vertData
+                        + m_icoTree->m_vertCompCount * cellTri->m_corners[i]);
+    }
+
+    pool.chunk_add(chunk, m_chunkResolution, corners,
+                   m_icoTree->get_path(cell));
 }
 
 void PlanetWrenderer::sub_recurse(trindex t)
@@ -650,19 +1075,9 @@ void PlanetWrenderer::sub_recurse(trindex t)
 
     bool shouldSubdivide, shouldChunk;
 
-    // Icosahedron edge length equations
-    // let r = radius of circumscribed sphere
-    // let a = edge length
-    // from this equation: r = (a / 4) * sqrt(10 + 2 * sqrt(5))
-    // arrange to this:    a = 4r / sqrt(10 + 2 * sqrt(5))
-    // this equation now calculates edge length from radius
-    // divide by 2^depth because the edge has been subdivided in powers of two
-
     // close enough approximation
     // (should be a bit higher because it's spherical)
-    float edgeLength = float(4.0 * m_icoTree->m_radius)
-                       / Urho3D::Sqrt(10.0f + 2.0f * Urho3D::Sqrt(5.0f))
-                       / Urho3D::Pow(2, int(tri->m_depth));
+    float edgeLength = get_edge_length(tri->m_depth);
 
     // Approximation of the triangle's area
     // (Area of equalateral triangle)
@@ -671,16 +1086,25 @@ void PlanetWrenderer::sub_recurse(trindex t)
     // Distance squared from viewer
     float distanceSquared = (tri->m_center - m_camera).LengthSquared();
 
+    // Places the camera is about to be count too, but appear further away
+    // so that they don't get as much detail
+    for (const Urho3D::Vector3& predicted : m_cameraPredicted)
+    {
+        distanceSquared = Urho3D::Min(distanceSquared,
+                (tri->m_center - predicted).LengthSquared()
+                    * m_prefetchAreaScale);
+    }
+
     // How much space this triangle takes up on screen using inverse square law
     // InverseSquareDistance * Area -> area / distancesquared
     // 0.2 is magic number to nicely fit things on screen
     float screenArea = triArea / (distanceSquared * 0.2f);
 
     // Maximum screen area a triangle can take before it's subdivided
-    shouldSubdivide = screenArea > m_subdivAreaThreshold;
+    shouldSubdivide = screenArea > m_subdivAreaThreshold * m_thresholdScale;
 
     // Same but for chunks
-    shouldChunk = screenArea > m_chunkAreaThreshold;
+    shouldChunk = screenArea > m_chunkAreaThreshold * m_thresholdScale;
 
 
     //chunk_add(t);
@@ -704,6 +1128,8 @@ void PlanetWrenderer::sub_recurse(trindex t)
         }
         else if (tri->m_depth > m_icoTree->m_minDepth)
         {
+            // Children are about to be deleted, so get rid of their chunks
+            chunk_remove_recurse(t);
             m_icoTree->subdivide_remove(t);
         }
     }
@@ -713,6 +1139,8 @@ void PlanetWrenderer::sub_recurse(trindex t)
         {
             if (tri->m_depth < m_icoTree->m_maxDepth)
             {
+                // Children will be chunked instead
+                chunk_remove(t);
                 m_icoTree->subdivide_add(t);
                 return;
             }
@@ -720,7 +1148,11 @@ void PlanetWrenderer::sub_recurse(trindex t)
 
         if (shouldChunk)
         {
-            chunk_add(t);
+            // Added after every triangle is looked at, see chunk_add_queued
+            if (!(tri->m_bitmask & gc_triangleMaskChunked))
+            {
+                m_chunkQueue.Push(t);
+            }
         }
         else
         {
@@ -730,6 +1162,59 @@ void PlanetWrenderer::sub_recurse(trindex t)
     }
 }
 
+float PlanetWrenderer::get_edge_length(unsigned depth) const
+{
+    // Icosahedron edge length equations
+    // let r = radius of circumscribed sphere
+    // let a = edge length
+    // from this equation: r = (a / 4) * sqrt(10 + 2 * sqrt(5))
+    // arrange to this:    a = 4r / sqrt(10 + 2 * sqrt(5))
+    // this equation now calculates edge length from radius
+    // divide by 2^depth because the edge has been subdivided in powers of two
+    return float(4.0 * m_icoTree->m_radius)
+            / Urho3D::Sqrt(10.0f + 2.0f * Urho3D::Sqrt(5.0f))
+            / Urho3D::Pow(2, int(depth));
+}
+
+Urho3D::Vector3 PlanetWrenderer::get_morph_parameters() const
+{
+    // Solve for distance in sub_recurse's screen area equation:
+    // sqrt(3) / 4 * edge^2 / (distance^2 * 0.2) = threshold
+    const float distance = Urho3D::Sqrt(Urho3D::Sqrt(3.0f)
+                / (0.8f * m_subdivAreaThreshold * m_thresholdScale));
+
+    return Urho3D::Vector3(distance, m_morphStart, m_morphEnd);
+}
+
+Urho3D::Vector3 PlanetWrenderer::get_morph_target(
+        const Urho3D::Vector3* coarse, int x, int y) const
+{
+    // Vertices with both even are on the parent's grid. The rest are in the
+    // middle of an edge between two that are.
+    if (!(x % 2) && !(y % 2))
+    {
+        return coarse[get_index(x, y)];
+    }
+    else if (!(y % 2))
+    {
+        // Between left and right
+        return (coarse[get_index(x - 1, y)]
+                + coarse[get_index(x + 1, y)]) * 0.5f;
+    }
+    else if (!(x % 2))
+    {
+        // Between up and down
+        return (coarse[get_index(x, y - 1)]
+                + coarse[get_index(x, y + 1)]) * 0.5f;
+    }
+    else
+    {
+        // Diagonal
+        return (coarse[get_index(x - 1, y - 1)]
+                + coarse[get_index(x + 1, y + 1)]) * 0.5f;
+    }
+}
+
 unsigned PlanetWrenderer::get_index_ringed(unsigned x, unsigned y) const
 {
     // || (x == y) ||
@@ -758,7 +1243,7 @@ unsigned PlanetWrenderer::get_index_ringed(unsigned x, unsigned y) const
 
 bool PlanetWrenderer::get_shared_from_tri(buindex* sharedIndex,
                                           const SubTriangle& tri,
-                                          unsigned side, float pos) const
+                                          unsigned side, unsigned pos) const
 {
 
     if (tri.m_bitmask & gc_triangleMaskChunked)
@@ -781,8 +1266,7 @@ bool PlanetWrenderer::get_shared_from_tri(buindex* sharedIndex,
         // if resolution is 4 (4 vertices per edge), then localIndex is
         // a number from 0 to 8
 
-        buindex localIndex = side * m_chunkVertsPerSide
-                                + int(pos * float(m_chunkResolution));
+        buindex localIndex = side * m_chunkVertsPerSide + pos;
 
         // Loop around when value gets too high, because it's a triangle
         localIndex %= m_chunkSharedCount;
@@ -793,8 +1277,26 @@ bool PlanetWrenderer::get_shared_from_tri(buindex* sharedIndex,
     else if (tri.m_bitmask & gc_triangleMaskSubdivided)
     {
         // Children might be chunked, recurse into child
-        *sharedIndex = 0;
-        return true;
+        // Each side is split between two children, (side + 1) % 3 has the
+        // first half, and (side + 2) % 3 has the second half. Children have
+        // twice as many vertices per length, so every vertex on tri's side
+        // can be found on one of them.
+        pos *= 2;
+
+        if (pos < m_chunkVertsPerSide)
+        {
+            return get_shared_from_tri(sharedIndex,
+                        *m_icoTree->get_triangle(tri.m_children
+                                                 + (side + 1) % 3),
+                        side, pos);
+        }
+        else
+        {
+            return get_shared_from_tri(sharedIndex,
+                        *m_icoTree->get_triangle(tri.m_children
+                                                 + (side + 2) % 3),
+                        side, pos - m_chunkVertsPerSide);
+        }
     }
     else
     {
@@ -802,20 +1304,64 @@ bool PlanetWrenderer::get_shared_from_tri(buindex* sharedIndex,
     }
 };
 
+void PlanetWrenderer::fill_template_indices(unsigned* indData) const
+{
+    unsigned i = 0;
+
+    for (unsigned c = 0; c < m_maxChunks; c ++)
+    {
+        const unsigned offset = c * m_chunkSize;
+
+        // Same triangles as chunk_add, but vertices aren't ringed
+        for (int y = 0; y < int(m_chunkVertsPerSide); y ++)
+        {
+            for (int x = 0; x < y * 2 + 1; x ++)
+            {
+                if (x % 2)
+                {
+                    // upside down triangle
+                    indData[i + 0] = offset + get_index(x / 2 + 1, y + 1);
+                    indData[i + 1] = offset + get_index(x / 2 + 1, y);
+                    indData[i + 2] = offset + get_index(x / 2, y);
+                }
+                else
+                {
+                    // up pointing triangle
+                    indData[i + 0] = offset + get_index(x / 2, y);
+                    indData[i + 1] = offset + get_index(x / 2, y + 1);
+                    indData[i + 2] = offset + get_index(x / 2 + 1, y + 1);
+                }
+                i += 3;
+            }
+        }
+    }
+}
+
 void PlanetWrenderer::chunk_add(trindex t, UpdateRange* gpuVertChunk,
-                                UpdateRange* gpuVertInd)
+                                UpdateRange* gpuVertInd,
+                                const float* vertices)
 {
     SubTriangle* tri = m_icoTree->get_triangle(t);
 
+    if (tri->m_bitmask & (gc_triangleMaskChunked | gc_triangleMaskSubdivided))
+    {
+        // return if already chunked, or is subdivided
+        return;
+    }
+
     if (m_chunkCount >= m_maxChunks)
     {
         URHO3D_LOGERRORF("Chunk limit reached");
         return;
     }
 
-    if (tri->m_bitmask & (gc_triangleMaskChunked | gc_triangleMaskSubdivided))
+    // Check for space before anything is changed, assuming the worst case of
+    // no vertices being shared with neighbours
+    if (!m_sharedTopology
+            && m_chunkVertCountShared + m_chunkSharedCount
+                > m_chunkMaxVertShared)
     {
-        // return if already chunked, or is subdivided
+        URHO3D_LOGERROR("Max Shared Vertices for Chunk");
         return;
     }
 
@@ -847,10 +1393,15 @@ void PlanetWrenderer::chunk_add(trindex t, UpdateRange* gpuVertChunk,
                         + m_icoTree->m_vertCompCount * tri->m_corners[2]))
     };
 
-    const Urho3D::Vector3 dirRight = (verts[2] - verts[1])
-                                     / m_chunkVertsPerSide;
-    const Urho3D::Vector3 dirDown = (verts[1] - verts[0])
-                                    / m_chunkVertsPerSide;
+    // Vertex data in get_index order, worked out here unless it already was
+    Urho3D::PODVector<float> ownVertices;
+
+    if (!vertices)
+    {
+        ownVertices.Resize(m_chunkSize * sc_chunkVertFloats);
+        chunk_vertices(t, ownVertices.Buffer());
+        vertices = ownVertices.Buffer();
+    }
 
     // Loop through neighbours and see which ones are already chunked to share
     // vertices with
@@ -862,14 +1413,29 @@ void PlanetWrenderer::chunk_add(trindex t, UpdateRange* gpuVertChunk,
     for (int i = 0; i < 3; i ++)
     {
         neighbours[i] = m_icoTree->get_triangle(tri->m_neighbours[i]);
-        neighbourSide[i] = m_icoTree->neighbour_side(*neighbours[i], t);
+
+        // Only neighbours of the same depth can be shared with. A shallower
+        // neighbour doesn't have tri on any of its sides.
+        if (neighbours[i]->m_depth == tri->m_depth)
+        {
+            neighbourSide[i] = m_icoTree->neighbour_side(*neighbours[i], t);
+        }
+        else
+        {
+            neighbours[i] = nullptr;
+        }
         //neighbourDepths[i] = (triB->m_bitmask & gc_triangleMaskChunked);
     }
 
     // Take the space at the end of the chunk buffer
     tri->m_chunk = m_chunkCount;
 
-    if (m_chunkVertFree.Size() == 0) {
+    if (m_sharedTopology)
+    {
+        // Vertices always sit where the index template expects them
+        tri->m_chunkVerts = m_chunkCount * m_chunkSize;
+    }
+    else if (m_chunkVertFree.Size() == 0) {
         //
         tri->m_chunkVerts = m_chunkMaxVertShared + m_chunkCount
                             * (m_chunkSize - m_chunkSharedCount);
@@ -894,6 +1460,14 @@ void PlanetWrenderer::chunk_add(trindex t, UpdateRange* gpuVertChunk,
         {
             unsigned vertIndex;
             unsigned localIndex = get_index_ringed(x, y);
+            bool shared = false;
+
+            if (m_sharedTopology)
+            {
+                // Every chunk has all of its own vertices, where the index
+                // template expects them
+                vertIndex = tri->m_chunkVerts + get_index(x, y);
+            }
 
             if (localIndex < m_chunkSharedCount)
             {
@@ -905,25 +1479,38 @@ void PlanetWrenderer::chunk_add(trindex t, UpdateRange* gpuVertChunk,
                 // side 1: Right
                 // side 2: Left
 
-                float pos = 1.0f - float(sideInd + 1) / float(m_chunkResolution);
+                // The neighbour goes around the same side in the opposite
+                // direction
+                unsigned pos = m_chunkVertsPerSide - sideInd;
 
                 // Take a vertex from a neighbour, if possible
-                if (get_shared_from_tri(&vertIndex, *neighbours[side],
-                                        neighbourSide[side], pos))
+                buindex sharedIndex;
+                if (neighbours[side]
+                        && get_shared_from_tri(&sharedIndex, *neighbours[side],
+                                               neighbourSide[side], pos))
                 {
-                    // increment number of users and stuff
-
+                    if (m_sharedTopology)
+                    {
+                        // Copy it instead, so the edges still line up
+                        // exactly
+                        write_range(m_chunkVertBuf.Get(), vertSizeChunk,
+                                    gpuVertChunk,
+                                    vertDataChunk + sharedIndex * vertSizeChunk,
+                                    vertIndex, 1);
+                    }
+                    else
+                    {
+                        // increment number of users and stuff
+                        vertIndex = sharedIndex;
+                        m_chunkVertUsers[vertIndex] ++;
+                    }
+                    shared = true;
                 }
-                else
+                else if (!m_sharedTopology)
                 {
                     // If not, Make a new shared vertex
 
                     // Indices from 0 to m_chunkMaxVertShared
-                    if (m_chunkVertCountShared + 1 >= m_chunkMaxVertShared)
-                    {
-                        URHO3D_LOGERROR("Max Shared Vertices for Chunk");
-                        return;
-                    }
                     if (m_chunkVertFreeShared.Size() == 0) {
                         vertIndex = m_chunkVertCountShared;
                     }
@@ -937,7 +1524,7 @@ void PlanetWrenderer::chunk_add(trindex t, UpdateRange* gpuVertChunk,
                     m_chunkVertUsers[vertIndex] = 1;
                 }
             }
-            else
+            else if (!m_sharedTopology)
             {
                 // Use a vertex from the space defined earler
                 vertIndex = tri->m_chunkVerts + middleIndex;
@@ -946,99 +1533,289 @@ void PlanetWrenderer::chunk_add(trindex t, UpdateRange* gpuVertChunk,
                 middleIndex ++;
             }
 
-            Urho3D::Vector3 pos = verts[0] + (dirRight * x + dirDown * y);
-            Urho3D::Vector3 normal = pos.Normalized();
-
-            pos = normal * float(m_icoTree->m_radius);
-
-            // Position and normal
-            Urho3D::Vector3 vertM[2] = {pos, normal};
+            indices[localIndex] = vertIndex;
+            i ++;
 
-            if (gpuVertChunk)
+            if (shared)
             {
-                // Copy vertex data to shadow buffer, then set min/max update
-                // range for sending to the gpu later
-                // Intended to reduce buffer update calls to the gpu
+                // Vertex data was already written by whoever made it
+                continue;
+            }
 
-                memcpy(vertDataChunk + vertIndex * vertSizeChunk,
-                       vertM, vertSizeChunk);
+            // If gpuVertChunk is set, data only goes to the shadow buffer
+            // and is sent to the gpu later, reducing buffer update calls.
+            // Otherwise, the gpu buffer is updated right away. Only as much
+            // as the vertex size is written.
+            write_range(m_chunkVertBuf.Get(), vertSizeChunk, gpuVertChunk,
+                        vertices + get_index(x, y) * sc_chunkVertFloats,
+                        vertIndex, 1);
+        }
+    }
 
-                //gpuVertChunk->m_start =
-                //      Min(gpuVertChunk->m_start, vertSizeChunk);
-                //gpuVertChunk->m_end =
-                //      Max(gpuVertChunk->m_start, (tri->m_midVerts[i] + 1));
-            }
-            else
-            {
-                // Update gpu buffers right away
-                m_chunkVertBuf->SetDataRange(vertM, vertIndex, 1);
-            }
+    // Keep track of which part of the index buffer refers to which triangle
+    m_chunkIndDomain[m_chunkCount] = t;
 
+    // Copy positions for snapshots, now that all the shared vertices are
+    // known and in the shadow buffer
+    ChunkSnapshot* snapshot = new ChunkSnapshot;
+    snapshot->m_triangle = t;
+    snapshot->m_depth = tri->m_depth;
+    snapshot->m_corners[0] = verts[0];
+    snapshot->m_corners[1] = verts[1];
+    snapshot->m_corners[2] = verts[2];
+    snapshot->m_positions.Resize(m_chunkSize);
 
-            indices[localIndex] = vertIndex;
-            i ++;
+    for (int y = 0; y < int(m_chunkResolution); y ++)
+    {
+        for (int x = 0; x <= y; x ++)
+        {
+            const unsigned vertIndex = indices[get_index_ringed(x, y)];
+            snapshot->m_positions[get_index(x, y)]
+                    = *reinterpret_cast<const Urho3D::Vector3*>(
+                            vertDataChunk + vertIndex * vertSizeChunk);
         }
     }
 
-    // The data that will be pushed directly into the chunk index buffer
-    // * 3 because there are 3 indices in a triangle
-    Urho3D::PODVector<unsigned> chunkIndData(m_chunkSizeInd * 3);
+    m_chunkSnapshots[m_chunkCount] = snapshot;
+    m_snapshotDirty = true;
+
+    for (ScatterPool* pool : m_scatter)
+    {
+        scatter_add(*pool, m_chunkCount);
+    }
+
+    if (m_oceanEnabled)
+    {
+        ocean_add(m_chunkCount);
+    }
+
+    // Put the index data at the end of the buffer. With shared topology,
+    // it's already there.
+    tri->m_chunkIndex = m_chunkCount * m_chunkSizeInd * 3;
 
-    i = 0;
-    // indices array is now populated, connect the dots!
-    for (int y = 0; y < int(m_chunkVertsPerSide); y ++)
+    if (!m_sharedTopology)
     {
-        for (int x = 0; x < y * 2 + 1; x ++)
+        // The data that will be pushed directly into the chunk index buffer
+        // * 3 because there are 3 indices in a triangle
+        Urho3D::PODVector<unsigned> chunkIndData(m_chunkSizeInd * 3);
+
+        i = 0;
+        // indices array is now populated, connect the dots!
+        for (int y = 0; y < int(m_chunkVertsPerSide); y ++)
         {
-            // alternate between true and false
-            if (x % 2)
-            {
-                // upside down triangle
-                // top, left, right
-                chunkIndData[i + 0]
-                        = indices[get_index_ringed(x / 2 + 1, y + 1)];
-                chunkIndData[i + 1]
-                        = indices[get_index_ringed(x / 2 + 1, y)];
-                chunkIndData[i + 2]
-                        = indices[get_index_ringed(x / 2, y)];
-            }
-            else
+            for (int x = 0; x < y * 2 + 1; x ++)
             {
-                // up pointing triangle
-                // top, left, right
-                chunkIndData[i + 0]
-                        = indices[get_index_ringed(x / 2, y)];
-                chunkIndData[i + 1]
-                        = indices[get_index_ringed(x / 2, y + 1)];
-                chunkIndData[i + 2]
-                        = indices[get_index_ringed(x / 2 + 1, y + 1)];
-
-                //URHO3D_LOGINFOF("Triangle: %u %u %u", chunkIndData[i + 0],
-                //chunkIndData[i + 1], chunkIndData[i + 2]);
+                // alternate between true and false
+                if (x % 2)
+                {
+                    // upside down triangle
+                    // top, left, right
+                    chunkIndData[i + 0]
+                            = indices[get_index_ringed(x / 2 + 1, y + 1)];
+                    chunkIndData[i + 1]
+                            = indices[get_index_ringed(x / 2 + 1, y)];
+                    chunkIndData[i + 2]
+                            = indices[get_index_ringed(x / 2, y)];
+                }
+                else
+                {
+                    // up pointing triangle
+                    // top, left, right
+                    chunkIndData[i + 0]
+                            = indices[get_index_ringed(x / 2, y)];
+                    chunkIndData[i + 1]
+                            = indices[get_index_ringed(x / 2, y + 1)];
+                    chunkIndData[i + 2]
+                            = indices[get_index_ringed(x / 2 + 1, y + 1)];
+
+                    //URHO3D_LOGINFOF("Triangle: %u %u %u", chunkIndData[i + 0],
+                    //chunkIndData[i + 1], chunkIndData[i + 2]);
+                }
+                //URHO3D_LOGINFOF("I: %i", i / 3);
+                i += 3;
             }
-            //URHO3D_LOGINFOF("I: %i", i / 3);
-            i += 3;
         }
-    }
-
-    // Keep track of which part of the index buffer refers to which triangle
-    m_chunkIndDomain[m_chunkCount] = t;
 
-    // Put the index data at the end of the buffer
-    tri->m_chunkIndex = m_chunkCount * chunkIndData.Size();
-    m_indBufChunk->SetDataRange(chunkIndData.Buffer(), tri->m_chunkIndex,
-                                m_chunkSizeInd * 3);
+        write_range(m_indBufChunk.Get(), m_indBufChunk->GetIndexSize(),
+                    gpuVertInd, chunkIndData.Buffer(), tri->m_chunkIndex,
+                    m_chunkSizeInd * 3);
+    }
 
     m_chunkCount ++;
 
     m_geometryChunk->SetDrawRange(Urho3D::TRIANGLE_LIST, 0,
-                                  m_chunkCount * chunkIndData.Size());
+                                  m_chunkCount * m_chunkSizeInd * 3);
 
     // The triangle is now chunked
     tri->m_bitmask ^= gc_triangleMaskChunked;
 
 }
 
+void PlanetWrenderer::chunk_add_queued()
+{
+    const unsigned count = m_chunkQueue.Size();
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    const unsigned stride = m_chunkSize * sc_chunkVertFloats;
+    m_queuedVerts.Resize(count * stride);
+
+    // Vertices are the slow part of making a chunk, and only depend on the
+    // chunk's own triangle. Work them all out at once, nothing changes the
+    // IcoSphereTree until they're done.
+    const trindex* queued = m_chunkQueue.Buffer();
+    const unsigned slices = m_workQueue.NotNull()
+            ? Urho3D::Min(m_workQueue->GetNumThreads() + 1, count) : 1;
+    const unsigned perSlice = (count + slices - 1) / slices;
+
+    if (slices == 1)
+    {
+        chunk_vertices_range(queued, queued + count);
+    }
+    else
+    {
+        for (unsigned i = 0; i < slices; i ++)
+        {
+            const unsigned first = Urho3D::Min(i * perSlice, count);
+
+            Urho3D::SharedPtr<Urho3D::WorkItem> item(new Urho3D::WorkItem());
+            item->workFunction_ = chunk_vertices_work;
+            item->aux_ = this;
+            item->start_ = const_cast<trindex*>(queued + first);
+            item->end_ = const_cast<trindex*>(queued
+                            + Urho3D::Min(first + perSlice, count));
+
+            m_chunkItems.Push(item);
+        }
+
+        complete_work(m_workQueue, m_chunkItems);
+    }
+
+    // Added one at a time, as each chunk takes vertices from the neighbours
+    // added before it
+    for (unsigned i = 0; i < count; i ++)
+    {
+        chunk_add(queued[i], nullptr, nullptr,
+                  m_queuedVerts.Buffer() + i * stride);
+    }
+
+    m_chunkQueue.Clear();
+}
+
+void PlanetWrenderer::chunk_vertices_range(const trindex* first,
+                                           const trindex* last)
+{
+    const unsigned stride = m_chunkSize * sc_chunkVertFloats;
+
+    // Each slice writes to its own part of m_queuedVerts
+    float* vertData = m_queuedVerts.Buffer()
+                        + (first - m_chunkQueue.Buffer()) * stride;
+
+    for (const trindex* t = first; t != last; t ++)
+    {
+        chunk_vertices(*t, vertData);
+        vertData += stride;
+    }
+}
+
+void PlanetWrenderer::chunk_vertices(trindex t, float* vertData) const
+{
+    const SubTriangle* tri = m_icoTree->get_triangle(t);
+    const float* icoVerts = m_icoTree->m_vertBuf.Buffer();
+
+    // top, left, and right vertices of triangle from IcoSphereTree
+    const Urho3D::Vector3 verts[3] = {
+        (*reinterpret_cast<const Urho3D::Vector3*>(icoVerts
+                        + m_icoTree->m_vertCompCount * tri->m_corners[0])),
+        (*reinterpret_cast<const Urho3D::Vector3*>(icoVerts
+                        + m_icoTree->m_vertCompCount * tri->m_corners[1])),
+        (*reinterpret_cast<const Urho3D::Vector3*>(icoVerts
+                        + m_icoTree->m_vertCompCount * tri->m_corners[2]))
+    };
+
+    const Urho3D::Vector3 dirRight = (verts[2] - verts[1])
+                                     / m_chunkVertsPerSide;
+    const Urho3D::Vector3 dirDown = (verts[1] - verts[0])
+                                    / m_chunkVertsPerSide;
+
+    // Distance between vertices, for picking a level of height data
+    const float spacing = dirRight.Length();
+
+    // Where vertices on the parent's grid are, for morph targets
+    const float edgeLength = get_edge_length(tri->m_depth);
+    Urho3D::PODVector<Urho3D::Vector3> coarse;
+
+    if (m_geomorph)
+    {
+        coarse.Resize(m_chunkSize);
+
+        for (int y = 0; y < int(m_chunkResolution); y += 2)
+        {
+            for (int x = 0; x <= y; x += 2)
+            {
+                const Urho3D::Vector3 pos = verts[0]
+                                            + (dirRight * x + dirDown * y);
+                coarse[get_index(x, y)]
+                        = is_displaced()
+                            ? displace(pos, spacing * 2.0f)
+                            : pos.Normalized() * float(m_icoTree->m_radius);
+            }
+        }
+    }
+
+    for (int y = 0; y < int(m_chunkResolution); y ++)
+    {
+        for (int x = 0; x <= y; x ++)
+        {
+            Urho3D::Vector3 pos = verts[0] + (dirRight * x + dirDown * y);
+            Urho3D::Vector3 normal = pos.Normalized();
+
+            if (is_displaced())
+            {
+                // Find the surface's normal using the displaced positions of
+                // two vertices next to this one
+                const Urho3D::Vector3 right = displace(pos + dirRight, spacing);
+                const Urho3D::Vector3 down = displace(pos + dirDown, spacing);
+                pos = displace(pos, spacing);
+
+                const Urho3D::Vector3 up = normal;
+                normal = (down - pos).CrossProduct(right - pos).Normalized();
+                if (normal.DotProduct(up) < 0.0f)
+                {
+                    normal = -normal;
+                }
+            }
+            else
+            {
+                pos = normal * float(m_icoTree->m_radius);
+            }
+
+            // Position and normal, then the morph target and edge length
+            // if geomorphing
+            Urho3D::Vector3 target;
+            if (m_geomorph)
+            {
+                target = get_morph_target(coarse.Buffer(), x, y);
+            }
+
+            float* vert = vertData + get_index(x, y) * sc_chunkVertFloats;
+            vert[0] = pos.x_;
+            vert[1] = pos.y_;
+            vert[2] = pos.z_;
+            vert[3] = normal.x_;
+            vert[4] = normal.y_;
+            vert[5] = normal.z_;
+            vert[6] = target.x_;
+            vert[7] = target.y_;
+            vert[8] = target.z_;
+            vert[9] = edgeLength;
+        }
+    }
+}
+
 void PlanetWrenderer::chunk_remove(trindex t, UpdateRange* gpuVertChunk,
                                    UpdateRange* gpuVertInd)
 {
@@ -1072,43 +1849,90 @@ void PlanetWrenderer::chunk_remove(trindex t, UpdateRange* gpuVertChunk,
     // Replace tri's domain location with lastTriangle
     m_chunkIndDomain[tri->m_chunk] = m_chunkIndDomain[m_chunkCount];
 
-    // Change lastTriangle's chunk index to tri's
-    lastTriangle->m_chunkIndex = tri->m_chunkIndex;
-    lastTriangle->m_chunk = tri->m_chunk;
-
+    // Same with the snapshot. Older snapshots might still be reading it, so
+    // it's deleted later.
+    m_snapshots.retire(m_chunkSnapshots[tri->m_chunk]);
+    m_chunkSnapshots[tri->m_chunk] = m_chunkSnapshots[m_chunkCount];
+    m_snapshotDirty = true;
 
-    // Delete Verticies
+    for (ScatterPool* pool : m_scatter)
+    {
+        pool->chunk_remove(tri->m_chunk);
+    }
 
-    // Mark middle vertices for replacement
-    m_chunkVertFree.Push(tri->m_chunkVerts);
+    if (m_oceanEnabled)
+    {
+        ocean_remove(tri->m_chunk);
 
-    // Now delete shared vertices
+        // The last chunk's ocean chunk now belongs to tri's chunk index
+        const uint32_t ocean = m_chunkOcean[m_chunkCount];
+        m_chunkOcean[tri->m_chunk] = ocean;
+        if (ocean != gc_invalidOcean)
+        {
+            m_oceanChunks[ocean] = tri->m_chunk;
+        }
+    }
 
-    unsigned* triIndData = reinterpret_cast<unsigned*>(
-                            m_indBufChunk->GetShadowData())
-                            + tri->m_chunkIndex;
+    if (m_sharedTopology)
+    {
+        // Move the last chunk's vertices into tri's place, same as
+        // ocean_remove. Nothing is shared, and index data never changes.
+        if (lastTriangle != tri)
+        {
+            const unsigned char* lastVertData = m_chunkVertBuf->GetShadowData()
+                    + lastTriangle->m_chunkVerts
+                        * m_chunkVertBuf->GetVertexSize();
+            m_chunkVertBuf->SetDataRange(lastVertData, tri->m_chunkVerts,
+                                         m_chunkSize);
+        }
 
-    for (unsigned i = 0; i < m_chunkSharedCount; i ++)
+        lastTriangle->m_chunkIndex = tri->m_chunkIndex;
+        lastTriangle->m_chunkVerts = tri->m_chunkVerts;
+        lastTriangle->m_chunk = tri->m_chunk;
+    }
+    else
     {
-        buindex sharedIndex = *(triIndData + m_chunkSharedIndices[i]);
+        // Change lastTriangle's chunk index to tri's
+        lastTriangle->m_chunkIndex = tri->m_chunkIndex;
+        lastTriangle->m_chunk = tri->m_chunk;
+
 
-        // Decrease number of users
-        m_chunkVertUsers[sharedIndex] --;
+        // Delete Verticies
 
-        if (m_chunkVertUsers[sharedIndex] == 0)
+        // Mark middle vertices for replacement
+        m_chunkVertFree.Push(tri->m_chunkVerts);
+
+        // Now delete shared vertices
+
+        unsigned* triIndData = reinterpret_cast<unsigned*>(
+                                m_indBufChunk->GetShadowData())
+                                + tri->m_chunkIndex;
+
+        for (unsigned i = 0; i < m_chunkSharedCount; i ++)
         {
-            // If users is zero, then delete
-            m_chunkVertFreeShared.Push(sharedIndex);
-            m_chunkVertCountShared --;
+            buindex sharedIndex = *(triIndData + m_chunkSharedIndices[i]);
+
+            // Decrease number of users
+            m_chunkVertUsers[sharedIndex] --;
+
+            if (m_chunkVertUsers[sharedIndex] == 0)
+            {
+                // If users is zero, then delete
+                m_chunkVertFreeShared.Push(sharedIndex);
+                m_chunkVertCountShared --;
+            }
         }
-    }
 
 
-    // Setting index data
+        // Setting index data
 
-    // Move lastTri's index data to replace tri's data
-    m_indBufChunk->SetDataRange(lastTriIndData, tri->m_chunkIndex,
-                                m_chunkSizeInd * 3);
+        // Move lastTri's index data to replace tri's data
+        if (lastTriangle != tri)
+        {
+            m_indBufChunk->SetDataRange(lastTriIndData, tri->m_chunkIndex,
+                                        m_chunkSizeInd * 3);
+        }
+    }
 
     // Update draw range
     m_geometryChunk->SetDrawRange(Urho3D::TRIANGLE_LIST, 0,
@@ -1118,6 +1942,137 @@ void PlanetWrenderer::chunk_remove(trindex t, UpdateRange* gpuVertChunk,
     tri->m_bitmask ^= gc_triangleMaskChunked;
 }
 
+void PlanetWrenderer::chunk_remove_recurse(trindex t)
+{
+    SubTriangle* tri = m_icoTree->get_triangle(t);
+
+    if (tri->m_bitmask & gc_triangleMaskSubdivided)
+    {
+        trindex childs = tri->m_children;
+        chunk_remove_recurse(childs + 0);
+        chunk_remove_recurse(childs + 1);
+        chunk_remove_recurse(childs + 2);
+        chunk_remove_recurse(childs + 3);
+    }
+    else
+    {
+        chunk_remove(t);
+    }
+}
+
+unsigned PlanetWrenderer::invalidate(const Urho3D::Vector3& direction,
+                                     float reach)
+{
+    if (!m_ready)
+    {
+        return 0;
+    }
+
+    const float* vertData = m_icoTree->m_vertBuf.Buffer();
+
+    // Walk down from the base triangles, only into triangles that overlap
+    Urho3D::PODVector<trindex> stack;
+    Urho3D::PODVector<trindex> chunks;
+
+    for (trindex i = 0; i < gc_icosahedronFaceCount; i ++)
+    {
+        stack.Push(i);
+    }
+
+    while (!stack.Empty())
+    {
+        const trindex t = stack.Back();
+        stack.Pop();
+
+        const SubTriangle* tri = m_icoTree->get_triangle(t);
+
+        // Bounding circle of the triangle's directions. A vertex is added to
+        // the radius, as normals and morph targets look at positions next
+        // to each vertex.
+        const Urho3D::Vector3 center = tri->m_center.Normalized();
+        float triReach = 0.0f;
+        for (int i = 0; i < 3; i ++)
+        {
+            const Urho3D::Vector3& corner
+                    = *reinterpret_cast<const Urho3D::Vector3*>(vertData
+                        + m_icoTree->m_vertCompCount * tri->m_corners[i]);
+            triReach = Urho3D::Max(triReach,
+                                   (corner.Normalized() - center).Length());
+        }
+        triReach *= 1.0f + 4.0f / float(m_chunkVertsPerSide);
+
+        if ((center - direction).Length() > triReach + reach)
+        {
+            continue;
+        }
+
+        if (tri->m_bitmask & gc_triangleMaskSubdivided)
+        {
+            for (trindex c = 0; c < 4; c ++)
+            {
+                stack.Push(tri->m_children + c);
+            }
+        }
+        else if (tri->m_bitmask & gc_triangleMaskChunked)
+        {
+            chunks.Push(t);
+        }
+    }
+
+    // Remove all of them before adding any back, so none of them share old
+    // edge vertices with each other. Edges shared with chunks that aren't
+    // made again are out of reach, so they didn't change.
+    for (trindex t : chunks)
+    {
+        chunk_remove(t);
+    }
+
+    for (trindex t : chunks)
+    {
+        chunk_add(t);
+    }
+
+    if (m_snapshotDirty)
+    {
+        publish_snapshot();
+    }
+
+    return chunks.Size();
+}
+
+Urho3D::Vector3 PlanetWrenderer::displace(const Urho3D::Vector3& pos,
+                                          float spacing) const
+{
+    const Urho3D::Vector3 normal = pos.Normalized();
+    float height = 0.0f;
+
+    if (m_heights.NotNull())
+    {
+        height = m_heights->sample(normal, spacing,
+                                   float(m_icoTree->m_radius));
+    }
+    else if (m_heightMap.NotNull())
+    {
+        // Same lookup as textureEquirect in PlanetLit.glsl
+        float u = Urho3D::Atan2(normal.z_, normal.x_) / 360.0f;
+        if (u < 0.0f)
+        {
+            u += 1.0f;
+        }
+        const float v = Urho3D::Acos(Urho3D::Clamp(normal.y_, -1.0f, 1.0f))
+                            / 180.0f;
+
+        height = m_heightMap->GetPixelBilinear(u, v).r_ * m_heightMapScale;
+    }
+
+    if (m_modifiers.NotNull())
+    {
+        height = m_modifiers->apply(normal, height);
+    }
+
+    return normal * (float(m_icoTree->m_radius) + height);
+}
+
 uint64_t PlanetWrenderer::get_memory_usage() const
 {
     uint64_t total = sizeof(PlanetWrenderer);
@@ -1141,6 +2096,14 @@ uint64_t PlanetWrenderer::get_memory_usage() const
         //total += m_chunkFree.Capacity() * sizeof(buindex);
         total += m_chunkIndDomain.Capacity() * sizeof(trindex);
         total += m_chunkVertFreeShared.Capacity() * sizeof(buindex);
+
+        total += m_chunkOcean.Capacity() * sizeof(uint32_t);
+        total += m_oceanChunks.Capacity() * sizeof(chindex);
+
+        // Snapshot copies of chunks in use, not counting old snapshots
+        total += m_chunkSnapshots.Capacity() * sizeof(ChunkSnapshot*);
+        total += m_chunkCount * (sizeof(ChunkSnapshot)
+                                 + m_chunkSize * sizeof(Urho3D::Vector3));
     }
     return total;
 }
@@ -1154,12 +2117,14 @@ void PlanetWrenderer::log_stats() const
             "Chunk Info\n"
             " - Chunks:       [%u/%u, %u free]\n"
             " - Shared Vert:  [%u/%u, %u free]\n"
-            " - Total Vert:   [%u/%u]",
+            " - Total Vert:   [%u/%u]\n"
+            " - Ocean Chunks: [%u/%u]",
             m_icoTree->m_vertCount, m_icoTree->m_maxVertice, m_icoTree->m_vertFree.Size(),
             m_icoTree->m_triangles.Size(), m_icoTree->m_maxTriangles, m_icoTree->m_trianglesFree.Size(),
             m_chunkCount, m_maxChunks, m_chunkVertFree.Size(),
             m_chunkVertCountShared, m_chunkMaxVertShared, m_chunkVertFreeShared.Size(),
-            m_chunkVertCountShared + m_chunkCount * m_chunkSize, m_chunkMaxVert);
+            m_chunkVertCountShared + m_chunkCount * m_chunkSize, m_chunkMaxVert,
+            m_oceanCount, m_oceanEnabled ? m_maxChunks : 0);
 }
 
 } // namespace osp
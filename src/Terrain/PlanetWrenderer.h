@@ -8,6 +8,7 @@
 #include <Urho3D/Graphics/Renderer.h>
 #include <Urho3D/Graphics/VertexBuffer.h>
 
+#include <Urho3D/Resource/Image.h>
 #include <Urho3D/Resource/ResourceCache.h>
 
 #include <Urho3D/Container/Ptr.h>
@@ -15,12 +16,20 @@
 #include <Urho3D/IO/Log.h>
 
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/WorkQueue.h>
 
 #include <cstdint>
 
+#include "HeightPyramid.h"
+#include "ScatterPool.h"
+#include "TerrainModifiers.h"
+#include "TerrainSnapshot.h"
+
 namespace osp
 {
 
+class TerrainDump;
+
 // The 20 faces of the icosahedron (Top, Left, Right)
 // Each number pointing to a vertex
 static constexpr uint8_t sc_icoTemplateTris[20 * 3] {
@@ -55,6 +64,13 @@ using chindex = unsigned int; // TODO: Why use 'unsigned' instead of uint32_t?
 // Index to a buffer
 using buindex = uint32_t;
 
+// Used in place of a triangle index when there is no triangle, such as the
+// parent of the 20 base triangles, or children of unsubdivided triangles
+static constexpr trindex gc_invalidTri = UINT32_MAX;
+
+// Used in place of an ocean chunk index for chunks without any ocean
+static constexpr uint32_t gc_invalidOcean = UINT32_MAX;
+
 struct UpdateRange
 {
     // initialize with maximum buindex value for start (2^32),
@@ -167,6 +183,34 @@ public:
      */
     void calculate_center(SubTriangle& tri);
 
+    /**
+     * Get a number describing where a triangle is, made from which of the 20
+     * base triangles it's in, and which child it is at each depth. Unlike
+     * triangle indices, this stays the same when a triangle is deleted and
+     * made again. Together with m_depth, it's unique to each triangle.
+     * @param t [in] Index of triangle
+     * @return Path of triangle
+     */
+    uint64_t get_path(trindex t) const;
+
+    /**
+     * For debugging only: search for triangles that still reference a
+     * triangle that has been deleted. Anything found is logged as an error.
+     * @param t [in] Index of deleted triangle
+     * @return Number of references found
+     */
+    unsigned find_refs(trindex t) const;
+
+    /**
+     * For debugging only: check that the whole tree is consistent. Verifies
+     * parent/child links, that neighbours point back at each other, that
+     * shared middle vertices match, and that the triangle and vertex free
+     * lists don't overlap with anything still in use. Problems are logged as
+     * errors.
+     * @return Number of problems found, 0 if everything is fine
+     */
+    unsigned debug_verify() const;
+
 private:
 
 
@@ -201,14 +245,89 @@ class PlanetWrenderer
 {
 
     Urho3D::SharedPtr<IcoSphereTree> m_icoTree;
+
+    // Optional elevation data. Without it, terrain is a perfect sphere
+    Urho3D::SharedPtr<HeightPyramid> m_heights;
+
+    // Optional changes on top of m_heights, like craters and flattened
+    // launch sites
+    Urho3D::SharedPtr<TerrainModifiers> m_modifiers;
+
+    // Optional equirectangular height map used instead of m_heights, the
+    // same way the DISPLACE shader uses it. Lets stamps be applied to
+    // planets that would otherwise be displaced by the shader.
+    Urho3D::SharedPtr<Urho3D::Image> m_heightMap;
+    float m_heightMapScale = 0.0f;
     Urho3D::SharedPtr<Urho3D::IndexBuffer> m_indBufChunk;
     Urho3D::SharedPtr<Urho3D::VertexBuffer> m_chunkVertBuf;
 
     Urho3D::Vector3 m_offset;
     Urho3D::Vector3 m_camera;
+
+    // Where the camera is expected to be in the next few seconds, see update
+    Urho3D::PODVector<Urho3D::Vector3> m_cameraPredicted;
+
+    // Floats of vertex data worked out for each chunk vertex, the most a
+    // vertex in m_chunkVertBuf can have. See chunk_vertices
+    static constexpr unsigned sc_chunkVertFloats = 10;
+
+    // Triangles to chunk once update is done looking at all of them, and
+    // their vertex data, m_chunkSize * sc_chunkVertFloats floats each
+    Urho3D::PODVector<trindex> m_chunkQueue;
+    Urho3D::PODVector<float> m_queuedVerts;
+
+    // Works out the vertices of queued chunks, null to do it all on the
+    // main thread
+    Urho3D::WeakPtr<Urho3D::WorkQueue> m_workQueue;
+    Urho3D::Vector< Urho3D::SharedPtr<Urho3D::WorkItem> > m_chunkItems;
     chindex m_chunkCount; // How many chunks there are right now
 
     Urho3D::PODVector<trindex> m_chunkIndDomain; // Maps chunks to triangles
+
+    // Read-only copy of each chunk, same order as m_chunkIndDomain
+    Urho3D::PODVector<ChunkSnapshot*> m_chunkSnapshots;
+
+    // Versions of the terrain for other threads to read, see update
+    TerrainSnapshots m_snapshots;
+    uint64_t m_snapshotVersion = 0;
+
+    // Set when chunks are added or removed since the last snapshot
+    bool m_snapshotDirty = false;
+
+    // Rocks and such placed on chunks, see add_scatter
+    Urho3D::Vector<Urho3D::SharedPtr<ScatterPool> > m_scatter;
+
+    // Ocean, drawn as a second geometry using chunks of its own. Ocean
+    // chunks are made and removed along with terrain chunks, but only where
+    // some of the terrain is below sea level.
+    bool m_oceanEnabled = false;
+    float m_seaLevel = 0.0f; // Height above radius
+
+    Urho3D::SharedPtr<Urho3D::IndexBuffer> m_oceanIndBuf;
+    Urho3D::SharedPtr<Urho3D::VertexBuffer> m_oceanVertBuf;
+    Urho3D::Geometry* m_geometryOcean;
+
+    unsigned m_oceanCount = 0; // How many ocean chunks there are right now
+
+    // Maps chunks to ocean chunks, or gc_invalidOcean if it has none
+    Urho3D::PODVector<uint32_t> m_chunkOcean;
+
+    // Maps ocean chunks back to chunks
+    Urho3D::PODVector<chindex> m_oceanChunks;
+
+    // All chunks are drawn with one index template instead of each having
+    // index data of their own. See set_shared_topology.
+    bool m_sharedTopology = false;
+
+    // Chunk vertices also store where they'd be on their parent's chunk, so
+    // shaders can blend between levels. See set_geomorph.
+    bool m_geomorph = false;
+
+    // Fractions of the distance a chunk is subdivided at where morphing
+    // towards the parent starts and ends. The parent takes over at 2.0.
+    float m_morphStart = 1.4f;
+    float m_morphEnd = 1.8f;
+
     // Spots in the index buffer that want to die
     //Urho3D::PODVector<chindex> m_chunkIndDeleteMe;
     // List of deleted chunk data to overwrite
@@ -227,7 +346,7 @@ class PlanetWrenderer
     // can be obtained from a chunk
     Urho3D::PODVector<buindex> m_chunkSharedIndices;
 
-    Urho3D::Model* m_model;
+    Urho3D::SharedPtr<Urho3D::Model> m_model;
     Urho3D::Geometry* m_geometryChunk; // Geometry for chunks
 
 
@@ -237,7 +356,7 @@ class PlanetWrenderer
     float m_threshold;
 
     // Approx. screen area a triangle can take before it should be subdivided
-    float m_subdivAreaThreshold = 0.02f;
+    float m_subdivAreaThreshold = 0.04f;
 
     // Preferred total size of chunk vertex buffer (m_chunkVertBuf)
     buindex m_chunkMaxVert;
@@ -245,8 +364,31 @@ class PlanetWrenderer
     buindex m_chunkMaxVertShared;
     chindex m_maxChunks; // Max number of chunks
 
-    // How much screen area a triangle can take before it should be chunked
-    float m_chunkAreaThreshold = 0.04f;
+    // How much screen area a triangle can take before it should be chunked.
+    // Has to be well below m_subdivAreaThreshold, or else triangles too small
+    // to subdivide would also be too small to chunk and leave holes. Anything
+    // smaller is far away or beyond the horizon, and isn't drawn.
+    float m_chunkAreaThreshold = 0.004f;
+
+    // Multiplies both area thresholds above. Raised to use less triangles,
+    // lowered for more detail. Set by TerrainManager to fit a global budget.
+    float m_thresholdScale = 1.0f;
+
+    // How many seconds ahead to subdivide and chunk for a moving camera
+    float m_prefetchTime = 4.0f;
+
+    // Number of points along the predicted path to check distances against
+    unsigned m_prefetchSamples = 4;
+
+    // Triangles near a predicted point are treated as if they were this many
+    // times smaller on screen, so the path ahead is loaded a level or so
+    // coarser than what's under the camera. Screen area goes down by 4 with
+    // each subdivision.
+    float m_prefetchAreaScale = 4.0f;
+
+    // Stop prefetching when chunk buffers are fuller than this, what's
+    // currently on screen is more important. See get_chunk_load.
+    float m_prefetchMaxLoad = 0.75f;
     unsigned m_chunkResolution = 31; // How many vertices wide each chunk is
     unsigned m_chunkVertsPerSide; // = m_chunkResolution - 1
     unsigned m_chunkSharedCount; // How many shared verticies per chunk
@@ -259,6 +401,15 @@ class PlanetWrenderer
 
     bool m_ready = false;
 
+    // True between begin_initialize and finish_initialize, while GPU
+    // buffers can't be written to directly
+    bool m_building = false;
+
+    // Parts of buffers written to while building, to upload afterwards
+    UpdateRange m_buildVert;
+    UpdateRange m_buildInd;
+    UpdateRange m_buildOcean;
+
     // Vertex buffer data is divided unevenly for chunks
     // In m_chunkVertBuf:
     // [shared vertex data, shared vertices]
@@ -274,25 +425,74 @@ class PlanetWrenderer
 
 public:
     PlanetWrenderer() = default;
-    ~PlanetWrenderer() = default;
+    ~PlanetWrenderer();
 
     constexpr bool is_ready() const;
 
     /**
      * Calculate initial icosahedron and initialize buffers.
-     * Call before drawing
+     * Call before drawing. Same as calling begin_initialize, build_initial,
+     * then finish_initialize.
      * @param context [in] Context used to initialize Urho3D objects
      * @param size [in] Minimum height of planet, or radius
      */
     void initialize(Urho3D::Context* context, Urho3D::Image* heightMap,
                     double size);
 
+    /**
+     * First step of initializing: create the model and GPU buffers. Call
+     * from the main thread.
+     * @param context [in] Context used to initialize Urho3D objects
+     * @param size [in] Minimum height of planet, or radius
+     */
+    void begin_initialize(Urho3D::Context* context, Urho3D::Image* heightMap,
+                          double size);
+
+    /**
+     * Second step of initializing: calculate the initial icosahedron and
+     * chunk it. Only writes to the shadow data of the GPU buffers, so it can
+     * be called from a worker thread, as long as nothing else touches this
+     * PlanetWrenderer until it's done.
+     */
+    void build_initial();
+
+    /**
+     * Last step of initializing: send what build_initial made to the GPU and
+     * publish the first snapshot. Call from the main thread.
+     */
+    void finish_initialize();
+
     /**
      * Recalculates camera positiona and sub_recurses the main 20 triangles.
      * Call this when the camera moves.
+     *
+     * If the camera is moving, terrain along its path for the next
+     * m_prefetchTime seconds is subdivided and chunked ahead of time, so
+     * that it's ready by the time the camera gets there.
+     *
+     * If any chunks changed, a new TerrainSnapshot is published afterwards.
+     *
+     * Chunks are added once every triangle was looked at, with their
+     * vertices worked out on the WorkQueue's threads all at once.
+     *
      * @param camera [in] Position of camera center
+     * @param velocity [in] Velocity of camera in meters per second
+     * @param acceleration [in] Acceleration of camera, like gravity, in
+     *                          meters per second squared
      */
-    void update(Urho3D::Vector3 const& camera);
+    void update(Urho3D::Vector3 const& camera,
+                Urho3D::Vector3 const& velocity = Urho3D::Vector3::ZERO,
+                Urho3D::Vector3 const& acceleration = Urho3D::Vector3::ZERO);
+
+    /**
+     * Work out the vertices of some of the chunks queued by update, into
+     * m_queuedVerts. Only reads the IcoSphereTree and height data, and
+     * writes to the range's own part of m_queuedVerts, so it's called from
+     * many worker threads at once.
+     * @param first [in] First of a range of m_chunkQueue
+     * @param last [in] End of the range
+     */
+    void chunk_vertices_range(const trindex* first, const trindex* last);
 
 
     /**
@@ -300,8 +500,196 @@ public:
      */
     void log_stats() const;
 
+    /**
+     * For debugging only: check the IcoSphereTree, and that chunks, the chunk
+     * index buffer, and shared vertex user counts agree with each other.
+     * Problems are logged as errors.
+     * @return Number of problems found, 0 if everything is fine
+     */
+    unsigned debug_verify() const;
+
+    /**
+     * For debugging only: hammer the IcoSphereTree and chunks with random
+     * subdivide, unsubdivide, chunk and unchunk operations, and run
+     * debug_verify every once in a while. Stops at the first verify that
+     * finds a problem. Logs how many operations per second were done, not
+     * counting time spent verifying.
+     *
+     * Call right after initialize, on a PlanetWrenderer not used for drawing.
+     *
+     * @param operations [in] Number of random operations to do
+     * @param maxDepth [in] Deepest triangles can be subdivided to
+     * @param verifyInterval [in] Operations between each debug_verify
+     * @param seed [in] Random seed, for repeating a failed run
+     * @return Number of problems found, 0 if everything is fine
+     */
+    unsigned debug_stress(unsigned operations, unsigned maxDepth,
+                          unsigned verifyInterval, unsigned seed);
+
+    /**
+     * For debugging only: copy which triangles are subdivided, and the
+     * vertices of every chunk into a TerrainDump. Vertices are read through
+     * the chunk index buffer, so mistakes in either buffer show up.
+     * @param dump [out] Dump to fill, anything in it is replaced
+     */
+    void debug_dump(TerrainDump& dump) const;
+
     Urho3D::Model* get_model() { return m_model; }
 
+    /**
+     * Get snapshots of the terrain for reading from other threads, like for
+     * building collision shapes or altitude queries. Read them through
+     * TerrainSnapshots::Reader, which is safe while update is running.
+     */
+    const TerrainSnapshots& get_snapshots() const { return m_snapshots; }
+
+    /**
+     * Publish a TerrainSnapshot of the current chunks. Done automatically at
+     * the end of update.
+     */
+    void publish_snapshot();
+
+    /**
+     * Scatter objects over chunks from now on. Chunks that already exist get
+     * objects right away. Call after initialize.
+     * @param pool [in] Pool to fill, set up but not yet initialized
+     */
+    void add_scatter(ScatterPool* pool);
+
+    /**
+     * Set how much the subdivide and chunk thresholds are multiplied by.
+     * Takes effect on the next update.
+     * @param scale [in] Above 1 for less triangles, below 1 for more
+     */
+    void set_threshold_scale(float scale) { m_thresholdScale = scale; }
+
+    float get_threshold_scale() const { return m_thresholdScale; }
+
+    /**
+     * Draw an ocean at a certain height. Call before initialize.
+     * @param height [in] Height of sea level above the planet's radius
+     */
+    void set_sea_level(float height)
+    {
+        m_oceanEnabled = true;
+        m_seaLevel = height;
+    }
+
+    bool has_ocean() const { return m_oceanEnabled; }
+
+    /**
+     * Give every chunk its own copy of its edge vertices, so all chunks can
+     * be drawn with the same triangles. Index data is then made once and
+     * never uploaded again, instead of being written for each new chunk.
+     *
+     * This doesn't save memory, it costs more. Urho3D's Geometry can't draw
+     * with a base vertex, so the template is still repeated for every chunk
+     * slot, as big as the index data without shared topology, and the edge
+     * vertices are stored twice over. Only worth it if uploading index data
+     * is the bottleneck, off by default. Call before initialize.
+     * @param enable [in] true for shared topology
+     */
+    void set_shared_topology(bool enable) { m_sharedTopology = enable; }
+
+    bool has_shared_topology() const { return m_sharedTopology; }
+
+    /**
+     * Store a morph target with every chunk vertex: its position on the
+     * parent's chunk, and the edge length of its triangle. Shaders blend
+     * towards it by distance (see get_morph_parameters), so switching
+     * levels doesn't pop, and the subdivide threshold is raised to use less
+     * triangles. Makes vertices 40 bytes instead of 24. Call before
+     * initialize.
+     * @param enable [in] true to geomorph
+     */
+    void set_geomorph(bool enable) { m_geomorph = enable; }
+
+    bool has_geomorph() const { return m_geomorph; }
+
+    /**
+     * @return Geomorphing shader parameters: x is how far away a chunk is
+     *         subdivided per meter of its edge length, y and z are where
+     *         morphing starts and ends as multiples of x
+     */
+    Urho3D::Vector3 get_morph_parameters() const;
+
+    /**
+     * @return Index of the ocean's geometry in get_model, if has_ocean
+     */
+    static constexpr unsigned get_ocean_geometry() { return 1; }
+
+    /**
+     * Set elevation data to displace terrain with. Only affects chunks made
+     * after this is called, so set it before the first update.
+     * @param heights [in] Height data, or nullptr for a perfect sphere
+     */
+    void set_height_data(HeightPyramid* heights) { m_heights = heights; }
+
+    /**
+     * Displace vertices with an equirectangular height map, exactly like
+     * the DISPLACE shader does, so the shader doesn't have to. Only used
+     * without height data. Like set_height_data, only affects chunks made
+     * after this is called.
+     * @param heightMap [in] Height map with heights in the red channel, or
+     *                       nullptr for none
+     * @param scale [in] Height in meters of a red value of 1.0, same as the
+     *                   material's TerrainDeformAmount
+     */
+    void set_height_map(Urho3D::Image* heightMap, float scale)
+    {
+        m_heightMap = heightMap;
+        m_heightMapScale = scale;
+    }
+
+    /**
+     * Set stamps to apply on top of the height data. Like set_height_data,
+     * only affects chunks made after this is called. Call invalidate after
+     * adding stamps to remake the chunks they touch.
+     * @param modifiers [in] Stamps, or nullptr for none
+     */
+    void set_modifiers(TerrainModifiers* modifiers)
+    {
+        m_modifiers = modifiers;
+    }
+
+    /**
+     * Remake every chunk that overlaps an area, after the terrain there was
+     * changed. Chunks are removed and added again without subdividing or
+     * unsubdividing anything, which also remakes their snapshots, scatter,
+     * ocean chunks and morph targets. Publishes a snapshot if anything was
+     * remade.
+     * @param direction [in] Normalized direction to the middle of the area
+     * @param reach [in] Radius of the area, as a distance between normalized
+     *                   directions. See TerrainModifiers::get_reach
+     * @return Number of chunks remade
+     */
+    unsigned invalidate(const Urho3D::Vector3& direction, float reach);
+
+    /**
+     * @return Number of triangles currently drawn, from all chunks and
+     *         ocean chunks
+     */
+    unsigned get_triangle_count() const
+    {
+        return (m_chunkCount + m_oceanCount) * m_chunkSizeInd;
+    }
+
+    /**
+     * @return How full the chunk buffers are, 1.0 when no more chunks fit
+     */
+    float get_chunk_load() const
+    {
+        if (m_sharedTopology)
+        {
+            // No shared vertices to run out of
+            return float(m_chunkCount) / float(m_maxChunks);
+        }
+
+        return Urho3D::Max(float(m_chunkCount) / float(m_maxChunks),
+                           float(m_chunkVertCountShared)
+                                / float(m_chunkMaxVertShared));
+    }
+
 protected:
 
     /**
@@ -315,9 +703,27 @@ protected:
      *
      * @param t [in] Index of triangle to add chunk to
      * @param gpuIgnore
+     * @param vertices [in] Vertex data from chunk_vertices, or nullptr to
+     *                      work it out here
      */
     void chunk_add(trindex t, UpdateRange* gpuVertChunk = nullptr,
-                   UpdateRange* gpuVertInd = nullptr);
+                   UpdateRange* gpuVertInd = nullptr,
+                   const float* vertices = nullptr);
+
+    /**
+     * Add every chunk in m_chunkQueue, working out their vertices on the
+     * WorkQueue's threads first
+     */
+    void chunk_add_queued();
+
+    /**
+     * Work out the position, normal, morph target and edge length of every
+     * vertex of a chunk, sc_chunkVertFloats floats each in get_index order.
+     * Vertices shared with neighbours are worked out too, and just not used.
+     * @param t [in] Triangle to make vertices for
+     * @param vertData [out] m_chunkSize * sc_chunkVertFloats floats
+     */
+    void chunk_vertices(trindex t, float* vertData) const;
 
     /**
      * @brief chunk_remove
@@ -327,6 +733,13 @@ protected:
     void chunk_remove(trindex t, UpdateRange* gpuVertChunk = nullptr,
                       UpdateRange* gpuVertInd = nullptr);
 
+    /**
+     * Remove chunks from a triangle and all of its descendants. Call before
+     * unsubdividing so that no chunks are left on deleted triangles.
+     * @param t [in] Triangle to start with
+     */
+    void chunk_remove_recurse(trindex t);
+
     /**
      * Convert XY coordinates to a triangular number index
      *
@@ -361,28 +774,89 @@ protected:
     unsigned get_index_ringed(unsigned x, unsigned y) const;
 
     /**
-     * Grab a shared vertex from the side of a triangle.
+     * Grab a shared vertex from the side of a triangle. If tri is subdivided,
+     * then the vertex is taken from whichever child is chunked on that side.
      * @param sharedIndex [out] Set to index to shared vertex when successful
      * @param tri [in] Triangle to grab a
      * @param side [in] 0: bottom, 1: right, 2: left
-     * @param pos [in] float from (usually) 0.0-1.0, position of vertex to grab
+     * @param pos [in] Position of vertex to grab along the side, counting
+     *                 from the side's first corner: 0 to m_chunkVertsPerSide
      * @return true when a shared vertex can be taken from tri
      */
     bool get_shared_from_tri(buindex* sharedIndex, const SubTriangle& tri,
-                             unsigned side, float pos) const;
+                             unsigned side, unsigned pos) const;
 
+    /**
+     * Fill index data that draws every chunk slot the same way, with each
+     * slot's vertices at slot * m_chunkSize in get_index order. Used by the
+     * ocean, and by chunks with shared topology.
+     * @param indData [out] m_maxChunks * m_chunkSizeInd * 3 indices
+     */
+    void fill_template_indices(unsigned* indData) const;
 
     /**
-     * Add up memory usages from most variables associated with this instance.
-     * @return Memory usage in bytes
+     * @param depth [in] Depth of a triangle
+     * @return Approximate length of the triangle's edges
      */
-    uint64_t get_memory_usage() const;
+    float get_edge_length(unsigned depth) const;
+
+    /**
+     * Find where a chunk vertex would be at half the resolution, which is
+     * what the parent's chunk looks like over that part
+     * @param coarse [in] Displaced positions of a chunk's vertices with
+     *                    even x and y, in get_index order
+     * @param x [in]
+     * @param y [in]
+     * @return Morph target of vertex x, y
+     */
+    Urho3D::Vector3 get_morph_target(const Urho3D::Vector3* coarse,
+                                     int x, int y) const;
+
+
+    /**
+     * Make an ocean chunk for a chunk that was just added, unless all of the
+     * chunk is above sea level
+     * @param c [in] Index of chunk
+     */
+    void ocean_add(chindex c);
 
     /**
-     * For debugging only: search for triangles that should have been deleted
-     * @param tri
+     * Remove a chunk's ocean chunk if it has one. The last ocean chunk is
+     * moved into its place.
+     * @param c [in] Index of chunk
      */
-    void find_refs(SubTriangle& tri);
+    void ocean_remove(chindex c);
+
+    /**
+     * Fill a ScatterPool's block for a chunk that was just added
+     * @param pool [in] Pool to fill
+     * @param c [in] Index of chunk
+     */
+    void scatter_add(ScatterPool& pool, chindex c);
+
+    /**
+     * @return true if vertices are moved off of the sphere by displace
+     */
+    bool is_displaced() const
+    {
+        return m_heights.NotNull() || m_heightMap.NotNull()
+                || m_modifiers.NotNull();
+    }
+
+    /**
+     * Move a point onto the surface described by m_heights or m_heightMap,
+     * and m_modifiers
+     * @param pos [in] Point to move, only the direction matters
+     * @param spacing [in] Distance between vertices, see HeightPyramid::sample
+     * @return Position on the surface
+     */
+    Urho3D::Vector3 displace(const Urho3D::Vector3& pos, float spacing) const;
+
+    /**
+     * Add up memory usages from most variables associated with this instance.
+     * @return Memory usage in bytes
+     */
+    uint64_t get_memory_usage() const;
 };
 
 constexpr bool PlanetWrenderer::is_ready() const
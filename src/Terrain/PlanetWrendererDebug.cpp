@@ -0,0 +1,1080 @@
+// Debugging tools for IcoSphereTree and PlanetWrenderer. Nothing in here is
+// needed to draw a planet.
+
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Math/Random.h>
+
+#include "PlanetWrenderer.h"
+#include "TerrainDump.h"
+
+namespace osp
+{
+
+// Stop logging after this many problems, anything after the first few is
+// likely caused by them anyways
+static constexpr unsigned sc_maxLoggedProblems = 16;
+
+// States of triangles and vertices while verifying
+static constexpr uint8_t sc_unseen = 0;
+static constexpr uint8_t sc_free = 1;
+static constexpr uint8_t sc_used = 2;
+
+// A triangle found by debug_dump
+struct DumpKey
+{
+    uint64_t m_path;
+    uint32_t m_depth;
+    trindex m_tri;
+};
+
+/**
+ * Order triangles the same way as TerrainDump, by depth then path
+ */
+static bool dump_key_less(const DumpKey& a, const DumpKey& b)
+{
+    return (a.m_depth != b.m_depth) ? (a.m_depth < b.m_depth)
+                                    : (a.m_path < b.m_path);
+}
+
+/**
+ * Log a problem found while verifying, without flooding the log
+ * @param problems [ref] Number of problems found so far, gets incremented
+ * @param message [in] What went wrong
+ */
+static void report_problem(unsigned& problems, const Urho3D::String& message)
+{
+    if (problems < sc_maxLoggedProblems)
+    {
+        URHO3D_LOGERROR(message);
+    }
+    else if (problems == sc_maxLoggedProblems)
+    {
+        URHO3D_LOGERROR("Too many problems, not logging any more");
+    }
+    problems ++;
+}
+
+/**
+ * Same as IcoSphereTree::neighbour_side, but doesn't assert
+ * @return Side (0 - 2), or -1 if lookingFor isn't a neighbour of tri
+ */
+static int find_side(const SubTriangle& tri, trindex lookingFor)
+{
+    for (int i = 0; i < 3; i ++)
+    {
+        if (tri.m_neighbours[i] == lookingFor)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Check if a triangle index can be the first of a group of 4 children
+ * @param c [in] Index to check
+ * @param triCount [in] Total number of triangles
+ * @return true if c is valid
+ */
+static bool is_child_group(trindex c, trindex triCount)
+{
+    // Children are added in groups of 4 after the first 20 triangles
+    return (c >= trindex(gc_icosahedronFaceCount))
+            && ((c - gc_icosahedronFaceCount) % 4 == 0)
+            && (c + 4 <= triCount);
+}
+
+unsigned IcoSphereTree::find_refs(trindex t) const
+{
+    unsigned refs = 0;
+    const trindex triCount = m_triangles.Size();
+
+    // Skip over everything that is already deleted
+    Urho3D::PODVector<uint8_t> triState(triCount);
+    memset(triState.Buffer(), sc_unseen, triCount);
+
+    for (trindex f : m_trianglesFree)
+    {
+        for (trindex k = f; k < Urho3D::Min(f + 4, triCount); k ++)
+        {
+            triState[k] = sc_free;
+        }
+    }
+
+    for (trindex i = 0; i < triCount; i ++)
+    {
+        if (triState[i] == sc_free)
+        {
+            continue;
+        }
+
+        const SubTriangle& tri = m_triangles[i];
+
+        for (int side = 0; side < 3; side ++)
+        {
+            if (tri.m_neighbours[side] == t)
+            {
+                report_problem(refs, Urho3D::ToString(
+                        "Triangle %u side %i references deleted triangle %u",
+                        i, side, t));
+            }
+        }
+
+        if (tri.m_parent == t)
+        {
+            report_problem(refs, Urho3D::ToString(
+                    "Triangle %u has deleted parent %u", i, t));
+        }
+
+        if ((tri.m_bitmask & gc_triangleMaskSubdivided)
+                && t >= tri.m_children && t < tri.m_children + 4)
+        {
+            report_problem(refs, Urho3D::ToString(
+                    "Triangle %u has deleted child %u", i, t));
+        }
+    }
+
+    return refs;
+}
+
+unsigned IcoSphereTree::debug_verify() const
+{
+    unsigned problems = 0;
+    const trindex triCount = m_triangles.Size();
+
+    Urho3D::PODVector<uint8_t> triState(triCount);
+    memset(triState.Buffer(), sc_unseen, triCount);
+
+    // Mark free triangles
+    for (trindex f : m_trianglesFree)
+    {
+        if (!is_child_group(f, triCount))
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Free triangle group %u is invalid", f));
+            continue;
+        }
+
+        for (trindex k = f; k < f + 4; k ++)
+        {
+            if (triState[k] != sc_unseen)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u is freed twice", k));
+            }
+            triState[k] = sc_free;
+        }
+    }
+
+    // Walk down the tree from the 20 base triangles, checking parents and
+    // children along the way
+    Urho3D::PODVector<trindex> stack;
+
+    for (trindex i = 0; i < trindex(gc_icosahedronFaceCount); i ++)
+    {
+        if (m_triangles[i].m_depth != 0
+                || m_triangles[i].m_parent != gc_invalidTri)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Base triangle %u has a parent or a depth", i));
+        }
+        stack.Push(i);
+    }
+
+    while (!stack.Empty())
+    {
+        const trindex t = stack.Back();
+        stack.Pop();
+
+        if (triState[t] == sc_used)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Triangle %u is the child of more than one triangle", t));
+            continue;
+        }
+        else if (triState[t] == sc_free)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Triangle %u is in use, but also in the free list", t));
+        }
+
+        triState[t] = sc_used;
+
+        const SubTriangle& tri = m_triangles[t];
+
+        if (!(tri.m_bitmask & gc_triangleMaskSubdivided))
+        {
+            continue;
+        }
+
+        const trindex c = tri.m_children;
+
+        if (!is_child_group(c, triCount))
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Triangle %u has invalid children %u", t, c));
+            continue;
+        }
+
+        const SubTriangle* children = m_triangles.Buffer() + c;
+
+        // Same as in subdivide_add
+        const buindex corners[4][3] = {
+            {tri.m_corners[0], tri.m_midVerts[2], tri.m_midVerts[1]},
+            {tri.m_midVerts[2], tri.m_corners[1], tri.m_midVerts[0]},
+            {tri.m_midVerts[1], tri.m_midVerts[0], tri.m_corners[2]},
+            {tri.m_midVerts[0], tri.m_midVerts[1], tri.m_midVerts[2]}
+        };
+
+        for (int k = 0; k < 4; k ++)
+        {
+            const SubTriangle& child = children[k];
+
+            if (child.m_parent != t)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u has parent %u instead of %u",
+                        c + k, child.m_parent, t));
+            }
+
+            if (child.m_depth != tri.m_depth + 1)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u has depth %u, but its parent has %u",
+                        c + k, child.m_depth, tri.m_depth));
+            }
+
+            if (child.m_corners[0] != corners[k][0]
+                    || child.m_corners[1] != corners[k][1]
+                    || child.m_corners[2] != corners[k][2])
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u has the wrong corners", c + k));
+            }
+
+            stack.Push(c + k);
+        }
+
+        // The center child is surrounded by its siblings, which face it
+        for (int k = 0; k < 3; k ++)
+        {
+            if (children[3].m_neighbours[k] != c + k
+                    || children[k].m_neighbours[k] != c + 3)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Children of %u aren't connected to each other", t));
+                break;
+            }
+        }
+    }
+
+    // Anything not reachable from the base triangles should be free
+    for (trindex t = 0; t < triCount; t ++)
+    {
+        if (triState[t] == sc_unseen)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Triangle %u is leaked, not in use or free", t));
+        }
+    }
+
+    if (problems)
+    {
+        // Following checks rely on the tree being intact
+        return problems;
+    }
+
+    // Check neighbours
+    for (trindex t = 0; t < triCount; t ++)
+    {
+        if (triState[t] != sc_used)
+        {
+            continue;
+        }
+
+        const SubTriangle& tri = m_triangles[t];
+
+        for (int i = 0; i < 3; i ++)
+        {
+            const trindex n = tri.m_neighbours[i];
+
+            if (n >= triCount || triState[n] != sc_used)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u side %i has deleted neighbour %u",
+                        t, i, n));
+                continue;
+            }
+
+            const SubTriangle& triB = m_triangles[n];
+
+            if (triB.m_depth == tri.m_depth)
+            {
+                // Neighbours of the same depth point at each other
+                const int sideB = find_side(triB, t);
+
+                if (sideB == -1)
+                {
+                    report_problem(problems, Urho3D::ToString(
+                            "Triangle %u side %i points to %u, which doesn't "
+                            "point back", t, i, n));
+                }
+                else if ((tri.m_bitmask & gc_triangleMaskSubdivided)
+                         && (triB.m_bitmask & gc_triangleMaskSubdivided)
+                         && tri.m_midVerts[i] != triB.m_midVerts[sideB])
+                {
+                    report_problem(problems, Urho3D::ToString(
+                            "Triangle %u and %u are both subdivided, but don't "
+                            "share a middle vertex", t, n));
+                }
+            }
+            else if (triB.m_depth < tri.m_depth)
+            {
+                // A neighbour can only be shallower if there's nothing deeper
+                // on that side. If it's subdivided, tri should be pointing
+                // to one of its children instead.
+                if (triB.m_bitmask & gc_triangleMaskSubdivided)
+                {
+                    report_problem(problems, Urho3D::ToString(
+                            "Triangle %u side %i points to %u, which is "
+                            "subdivided", t, i, n));
+                    continue;
+                }
+
+                // The ancestor with the same depth as triB should be its
+                // neighbour, on the same side
+                trindex a = t;
+                while (m_triangles[a].m_depth > triB.m_depth)
+                {
+                    a = m_triangles[a].m_parent;
+                }
+
+                if (m_triangles[a].m_neighbours[i] != n
+                        || find_side(triB, a) == -1)
+                {
+                    report_problem(problems, Urho3D::ToString(
+                            "Triangle %u side %i points to %u, which isn't "
+                            "beside it", t, i, n));
+                }
+            }
+            else
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u side %i points to %u, which is deeper",
+                        t, i, n));
+            }
+        }
+    }
+
+    // Check vertices
+    Urho3D::PODVector<uint8_t> vertState(m_vertCount);
+    memset(vertState.Buffer(), sc_unseen, m_vertCount);
+
+    if (m_vertCount * m_vertCompCount > m_vertBuf.Size())
+    {
+        report_problem(problems, Urho3D::ToString(
+                "%u vertices don't fit in the vertex buffer", m_vertCount));
+        return problems;
+    }
+
+    for (buindex v : m_vertFree)
+    {
+        if (v >= m_vertCount)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Free vertex %u was never used", v));
+        }
+        else if (vertState[v] != sc_unseen)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Vertex %u is freed twice", v));
+        }
+        else
+        {
+            vertState[v] = sc_free;
+        }
+    }
+
+    for (trindex t = 0; t < triCount; t ++)
+    {
+        if (triState[t] != sc_used)
+        {
+            continue;
+        }
+
+        const SubTriangle& tri = m_triangles[t];
+        const bool subdivided = tri.m_bitmask & gc_triangleMaskSubdivided;
+
+        // Check corners, and middle vertices if subdivided
+        for (int i = 0; i < (subdivided ? 6 : 3); i ++)
+        {
+            const buindex v = (i < 3) ? tri.m_corners[i]
+                                      : tri.m_midVerts[i - 3];
+
+            if (v >= m_vertCount)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u uses vertex %u, which was never made",
+                        t, v));
+            }
+            else if (vertState[v] == sc_free)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u uses vertex %u, which is free", t, v));
+            }
+            else
+            {
+                vertState[v] = sc_used;
+            }
+        }
+    }
+
+    for (buindex v = 0; v < m_vertCount; v ++)
+    {
+        if (vertState[v] == sc_unseen)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Vertex %u is leaked, not in use or free", v));
+        }
+    }
+
+    return problems;
+}
+
+unsigned PlanetWrenderer::debug_verify() const
+{
+    unsigned problems = m_icoTree->debug_verify();
+
+    if (problems)
+    {
+        // Chunks can't be checked if the tree is broken
+        return problems;
+    }
+
+    const Urho3D::PODVector<SubTriangle>& triangles = m_icoTree->m_triangles;
+    const unsigned* indData = reinterpret_cast<const unsigned*>(
+                                m_indBufChunk->GetShadowData());
+    const buindex chunkIndSize = m_chunkSizeInd * 3;
+    const buindex middleSize = m_chunkSize - m_chunkSharedCount;
+
+    // Each chunk points to a triangle, which should point back
+    for (chindex c = 0; c < m_chunkCount; c ++)
+    {
+        const trindex t = m_chunkIndDomain[c];
+
+        if (t >= triangles.Size())
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Chunk %u is on invalid triangle %u", c, t));
+            continue;
+        }
+
+        const SubTriangle& tri = triangles[t];
+
+        if (!(tri.m_bitmask & gc_triangleMaskChunked))
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Chunk %u is on triangle %u, which isn't chunked", c, t));
+        }
+
+        if (tri.m_chunk != c || tri.m_chunkIndex != c * chunkIndSize)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Triangle %u doesn't point back to chunk %u", t, c));
+        }
+
+        if (!m_chunkSnapshots[c] || m_chunkSnapshots[c]->m_triangle != t)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Chunk %u's snapshot isn't from triangle %u", c, t));
+        }
+
+        if (m_oceanEnabled && m_chunkOcean[c] != gc_invalidOcean
+                && (m_chunkOcean[c] >= m_oceanCount
+                    || m_oceanChunks[m_chunkOcean[c]] != c))
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Ocean chunk %u doesn't point back to chunk %u",
+                    m_chunkOcean[c], c));
+        }
+    }
+
+    // Each ocean chunk belongs to a different chunk
+    for (unsigned o = 0; m_oceanEnabled && o < m_oceanCount; o ++)
+    {
+        const chindex c = m_oceanChunks[o];
+
+        if (c >= m_chunkCount || m_chunkOcean[c] != o)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Ocean chunk %u is on invalid chunk %u", o, c));
+        }
+    }
+
+    if (m_geometryChunk->GetIndexCount() != m_chunkCount * chunkIndSize)
+    {
+        report_problem(problems, Urho3D::ToString(
+                "Draw range doesn't cover %u chunks", m_chunkCount));
+    }
+
+    if (m_oceanEnabled
+            && m_geometryOcean->GetIndexCount() != m_oceanCount * chunkIndSize)
+    {
+        report_problem(problems, Urho3D::ToString(
+                "Draw range doesn't cover %u ocean chunks", m_oceanCount));
+    }
+
+    // Walk down the tree to find every chunked triangle
+    chindex chunked = 0;
+    Urho3D::PODVector<trindex> stack;
+
+    for (trindex i = 0; i < trindex(gc_icosahedronFaceCount); i ++)
+    {
+        stack.Push(i);
+    }
+
+    while (!stack.Empty())
+    {
+        const trindex t = stack.Back();
+        stack.Pop();
+
+        const SubTriangle& tri = triangles[t];
+
+        if (tri.m_bitmask & gc_triangleMaskSubdivided)
+        {
+            if (tri.m_bitmask & gc_triangleMaskChunked)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Triangle %u is both subdivided and chunked", t));
+            }
+
+            for (trindex k = 0; k < 4; k ++)
+            {
+                stack.Push(tri.m_children + k);
+            }
+        }
+        else if (tri.m_bitmask & gc_triangleMaskChunked)
+        {
+            chunked ++;
+
+            if (tri.m_chunk >= m_chunkCount
+                    || m_chunkIndDomain[tri.m_chunk] != t)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Chunked triangle %u has no chunk", t));
+            }
+        }
+    }
+
+    if (chunked != m_chunkCount)
+    {
+        report_problem(problems, Urho3D::ToString(
+                "%u triangles are chunked, but there are %u chunks",
+                chunked, m_chunkCount));
+    }
+
+    if (problems)
+    {
+        return problems;
+    }
+
+    if (m_sharedTopology)
+    {
+        // Each chunk's vertices sit in the slot for its chunk index, and the
+        // index data is the template from build_initial
+        for (chindex c = 0; c < m_chunkCount; c ++)
+        {
+            const trindex t = m_chunkIndDomain[c];
+
+            if (triangles[t].m_chunkVerts != c * m_chunkSize)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Chunk %u's vertices %u are out of place",
+                        c, triangles[t].m_chunkVerts));
+            }
+        }
+
+        for (chindex c = 0; c < m_maxChunks; c ++)
+        {
+            const unsigned* chunkInd = indData + c * chunkIndSize;
+
+            for (unsigned i = 0; i < chunkIndSize; i ++)
+            {
+                if (chunkInd[i] / m_chunkSize != c)
+                {
+                    report_problem(problems, Urho3D::ToString(
+                            "Index template for chunk %u points outside it",
+                            c));
+                    break;
+                }
+            }
+        }
+
+        // Chunks beside each other with the same depth have the exact same
+        // copies of the vertices on their edges. Corners are skipped, they
+        // might have been copied from a different neighbour.
+        const unsigned char* vertData = m_chunkVertBuf->GetShadowData();
+        const unsigned vertSize = m_chunkVertBuf->GetVertexSize();
+
+        for (chindex c = 0; c < m_chunkCount; c ++)
+        {
+            const trindex t = m_chunkIndDomain[c];
+            const SubTriangle& tri = triangles[t];
+            const unsigned* chunkInd = indData + tri.m_chunkIndex;
+
+            for (unsigned side = 0; side < 3; side ++)
+            {
+                const SubTriangle& triB = triangles[tri.m_neighbours[side]];
+
+                if (triB.m_depth != tri.m_depth
+                        || !(triB.m_bitmask & gc_triangleMaskChunked))
+                {
+                    continue;
+                }
+
+                const unsigned sideB = unsigned(find_side(triB, t));
+                const unsigned* chunkIndB = indData + triB.m_chunkIndex;
+
+                for (unsigned j = 1; j < m_chunkVertsPerSide; j ++)
+                {
+                    const buindex a = chunkInd[m_chunkSharedIndices[
+                                        side * m_chunkVertsPerSide + j]];
+                    const buindex b = chunkIndB[m_chunkSharedIndices[
+                                        sideB * m_chunkVertsPerSide
+                                        + m_chunkVertsPerSide - j]];
+
+                    if (memcmp(vertData + a * vertSize,
+                               vertData + b * vertSize, vertSize))
+                    {
+                        report_problem(problems, Urho3D::ToString(
+                                "Chunks on triangle %u and %u have different "
+                                "edges", t, tri.m_neighbours[side]));
+                        break;
+                    }
+                }
+            }
+        }
+
+        return problems;
+    }
+
+    // Middle vertices: each chunk takes an equally sized block after the
+    // shared vertices. Blocks are either used by a chunk, or free.
+    const buindex middleBlocks = m_chunkCount + m_chunkVertFree.Size();
+    Urho3D::PODVector<uint8_t> blockState(middleBlocks);
+    memset(blockState.Buffer(), sc_unseen, middleBlocks);
+
+    for (chindex c = 0; c < middleBlocks; c ++)
+    {
+        const bool isFree = (c >= m_chunkCount);
+        const buindex v = isFree
+                ? m_chunkVertFree[c - m_chunkCount]
+                : triangles[m_chunkIndDomain[c]].m_chunkVerts;
+
+        const buindex block = (v - m_chunkMaxVertShared) / middleSize;
+
+        if (v < m_chunkMaxVertShared
+                || (v - m_chunkMaxVertShared) % middleSize
+                || block >= middleBlocks)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Middle vertices %u are out of place", v));
+        }
+        else if (blockState[block] != sc_unseen)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Middle vertices %u are used twice, or used and free", v));
+        }
+        else
+        {
+            blockState[block] = isFree ? sc_free : sc_used;
+        }
+    }
+
+    // Shared vertices: count how many chunks use each one using the index
+    // buffer, then compare with m_chunkVertUsers
+    const buindex sharedMade = m_chunkVertCountShared
+                                + m_chunkVertFreeShared.Size();
+
+    if (sharedMade > m_chunkMaxVertShared)
+    {
+        report_problem(problems, Urho3D::ToString(
+                "%u shared vertices were made, but there's only space for %u",
+                sharedMade, m_chunkMaxVertShared));
+        return problems;
+    }
+
+    Urho3D::PODVector<unsigned> users(sharedMade);
+    memset(users.Buffer(), 0, sharedMade * sizeof(unsigned));
+
+    for (chindex c = 0; c < m_chunkCount; c ++)
+    {
+        const unsigned* chunkInd = indData + c * chunkIndSize;
+
+        for (unsigned i = 0; i < m_chunkSharedCount; i ++)
+        {
+            const buindex v = chunkInd[m_chunkSharedIndices[i]];
+
+            if (v >= sharedMade)
+            {
+                report_problem(problems, Urho3D::ToString(
+                        "Chunk %u uses shared vertex %u, which was never made",
+                        c, v));
+            }
+            else
+            {
+                users[v] ++;
+            }
+        }
+    }
+
+    Urho3D::PODVector<uint8_t> sharedState(sharedMade);
+    memset(sharedState.Buffer(), sc_unseen, sharedMade);
+
+    for (buindex v : m_chunkVertFreeShared)
+    {
+        if (v >= sharedMade || sharedState[v] != sc_unseen)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Free shared vertex %u is invalid or freed twice", v));
+            continue;
+        }
+
+        sharedState[v] = sc_free;
+
+        if (users[v])
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Shared vertex %u is free, but used by %u chunks",
+                    v, users[v]));
+        }
+    }
+
+    for (buindex v = 0; v < sharedMade; v ++)
+    {
+        if (users[v] != m_chunkVertUsers[v])
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Shared vertex %u is used by %u chunks, but has %u users",
+                    v, users[v], unsigned(m_chunkVertUsers[v])));
+        }
+        else if (!users[v] && sharedState[v] != sc_free)
+        {
+            report_problem(problems, Urho3D::ToString(
+                    "Shared vertex %u is leaked, not in use or free", v));
+        }
+    }
+
+    // Chunks beside each other with the same depth share their edges
+    for (chindex c = 0; c < m_chunkCount; c ++)
+    {
+        const trindex t = m_chunkIndDomain[c];
+        const SubTriangle& tri = triangles[t];
+        const unsigned* chunkInd = indData + tri.m_chunkIndex;
+
+        for (unsigned side = 0; side < 3; side ++)
+        {
+            const SubTriangle& triB = triangles[tri.m_neighbours[side]];
+
+            if (triB.m_depth != tri.m_depth
+                    || !(triB.m_bitmask & gc_triangleMaskChunked))
+            {
+                continue;
+            }
+
+            const unsigned sideB = unsigned(find_side(triB, t));
+            const unsigned* chunkIndB = indData + triB.m_chunkIndex;
+
+            // Corners are skipped, they might have been taken from a
+            // different neighbour
+            for (unsigned j = 1; j < m_chunkVertsPerSide; j ++)
+            {
+                const buindex a = chunkInd[m_chunkSharedIndices[
+                                    side * m_chunkVertsPerSide + j]];
+                const buindex b = chunkIndB[m_chunkSharedIndices[
+                                    sideB * m_chunkVertsPerSide
+                                    + m_chunkVertsPerSide - j]];
+                if (a != b)
+                {
+                    report_problem(problems, Urho3D::ToString(
+                            "Chunks on triangle %u and %u don't share vertices",
+                            t, tri.m_neighbours[side]));
+                    break;
+                }
+            }
+        }
+    }
+
+    return problems;
+}
+
+unsigned PlanetWrenderer::debug_stress(unsigned operations, unsigned maxDepth,
+                                       unsigned verifyInterval, unsigned seed)
+{
+    IcoSphereTree& tree = *m_icoTree;
+    tree.m_maxDepth = maxDepth;
+
+    Urho3D::SetRandomSeed(seed);
+
+    // Unsubdivide a whole base triangle if the tree gets bigger than this
+    const unsigned maxTriangles = 1u << 18;
+
+    // Vertex data only goes to the shadow buffer, not the GPU
+    UpdateRange gpuVertChunk;
+
+    // subdivides, unsubdivides, chunk adds, chunk removes
+    unsigned counts[4] = {0, 0, 0, 0};
+    unsigned done = 0;
+    unsigned deepest = 0;
+    unsigned verifies = 0;
+    unsigned problems = 0;
+    unsigned nextVerify = verifyInterval;
+
+    Urho3D::HiresTimer timer;
+    long long verifyTime = 0;
+
+    while (done < operations)
+    {
+        const unsigned liveTriangles = tree.m_triangles.Size()
+                                       - tree.m_trianglesFree.Size() * 4;
+        const int action = (liveTriangles > maxTriangles)
+                            ? -1 : Urho3D::Rand() % 100;
+
+        if (action < 0)
+        {
+            // Too many triangles, clear out a whole base triangle
+            trindex t = Urho3D::Rand() % gc_icosahedronFaceCount;
+            chunk_remove_recurse(t);
+            tree.subdivide_remove(t);
+            counts[1] ++;
+        }
+        else if (action < 75)
+        {
+            // Walk down to a random triangle that isn't subdivided
+            trindex t = Urho3D::Rand() % gc_icosahedronFaceCount;
+            while (tree.m_triangles[t].m_bitmask & gc_triangleMaskSubdivided)
+            {
+                t = tree.m_triangles[t].m_children + Urho3D::Rand() % 4;
+            }
+
+            if (action < 45)
+            {
+                // Subdivide it, and once in a while keep going all the way
+                // down to the maximum depth
+                unsigned levels = (action == 0) ? maxDepth : 1;
+
+                while (levels -- && tree.m_triangles[t].m_depth < maxDepth)
+                {
+                    chunk_remove(t);
+                    tree.subdivide_add(t);
+                    counts[0] ++;
+
+                    deepest = Urho3D::Max(deepest,
+                                          tree.m_triangles[t].m_depth + 1u);
+                    t = tree.m_triangles[t].m_children + Urho3D::Rand() % 4;
+                }
+            }
+            else if (tree.m_triangles[t].m_bitmask & gc_triangleMaskChunked)
+            {
+                chunk_remove(t);
+                counts[3] ++;
+            }
+            else if (m_chunkCount < m_maxChunks
+                     && (m_sharedTopology
+                         || m_chunkVertCountShared + m_chunkSharedCount
+                                <= m_chunkMaxVertShared))
+            {
+                chunk_add(t, &gpuVertChunk);
+                counts[2] ++;
+            }
+            else if (m_chunkCount)
+            {
+                // No space for another chunk, remove a random one instead
+                chunk_remove(m_chunkIndDomain[Urho3D::Rand() % m_chunkCount]);
+                counts[3] ++;
+            }
+        }
+        else
+        {
+            // Walk down to a random subdivided triangle, and unsubdivide it
+            trindex t = Urho3D::Rand() % gc_icosahedronFaceCount;
+
+            if (tree.m_triangles[t].m_bitmask & gc_triangleMaskSubdivided)
+            {
+                while (Urho3D::Rand() % 4)
+                {
+                    const trindex child = tree.m_triangles[t].m_children
+                                            + Urho3D::Rand() % 4;
+                    if (!(tree.m_triangles[child].m_bitmask
+                            & gc_triangleMaskSubdivided))
+                    {
+                        break;
+                    }
+                    t = child;
+                }
+
+                chunk_remove_recurse(t);
+                tree.subdivide_remove(t);
+                counts[1] ++;
+            }
+        }
+
+        done = counts[0] + counts[1] + counts[2] + counts[3];
+
+        if (verifyInterval && (done >= nextVerify))
+        {
+            nextVerify = done + verifyInterval;
+
+            // Also keeps removed chunk snapshots from piling up
+            publish_snapshot();
+
+            const long long start = timer.GetUSec(false);
+            problems = debug_verify();
+            verifyTime += timer.GetUSec(false) - start;
+            verifies ++;
+
+            if (problems)
+            {
+                URHO3D_LOGERRORF("Terrain stress: problems found after %u "
+                                 "operations, seed %u", done, seed);
+                break;
+            }
+        }
+    }
+
+    const long long opTime = timer.GetUSec(false) - verifyTime;
+
+    if (!problems)
+    {
+        problems = debug_verify();
+        verifies ++;
+    }
+
+    URHO3D_LOGINFOF("Terrain stress: %u operations in %.3fs (%.0f ops/s)\n"
+                    " - Subdivides:    %u\n"
+                    " - Unsubdivides:  %u\n"
+                    " - Chunk adds:    %u\n"
+                    " - Chunk removes: %u\n"
+                    " - Deepest:       %u\n"
+                    " - Verifies:      %u\n"
+                    " - Problems:      %u\n"
+                    " - Seed:          %u",
+                    done, double(opTime) / 1000000.0,
+                    double(done) * 1000000.0 / double(Urho3D::Max(opTime, 1ll)),
+                    counts[0], counts[1], counts[2], counts[3], deepest,
+                    verifies, problems, seed);
+
+    log_stats();
+
+    return problems;
+}
+
+void PlanetWrenderer::debug_dump(TerrainDump& dump) const
+{
+    const IcoSphereTree& tree = *m_icoTree;
+
+    dump.m_chunkResolution = m_chunkResolution;
+    dump.m_radius = float(tree.m_radius);
+    dump.m_subdivided.Clear();
+    dump.m_chunks.Clear();
+
+    // Walk down from the base triangles to find everything subdivided or
+    // chunked. Free triangles are never reached.
+    Urho3D::PODVector<DumpKey> subdivided;
+    Urho3D::PODVector<DumpKey> chunked;
+    Urho3D::PODVector<trindex> stack;
+
+    for (trindex t = 0; t < gc_icosahedronFaceCount; t ++)
+    {
+        stack.Push(t);
+    }
+
+    while (!stack.Empty())
+    {
+        const trindex t = stack.Back();
+        stack.Pop();
+
+        const SubTriangle& tri = tree.m_triangles[t];
+        const DumpKey key = {tree.get_path(t), tri.m_depth, t};
+
+        if (tri.m_bitmask & gc_triangleMaskSubdivided)
+        {
+            subdivided.Push(key);
+            for (trindex c = 0; c < 4; c ++)
+            {
+                stack.Push(tri.m_children + c);
+            }
+        }
+
+        if (tri.m_bitmask & gc_triangleMaskChunked)
+        {
+            chunked.Push(key);
+        }
+    }
+
+    // Indices and buffer positions depend on what happened before, so sort
+    // by where the triangles are instead
+    Urho3D::Sort(subdivided.Begin(), subdivided.End(), dump_key_less);
+    Urho3D::Sort(chunked.Begin(), chunked.End(), dump_key_less);
+
+    dump.m_subdivided.Resize(subdivided.Size());
+    for (unsigned i = 0; i < subdivided.Size(); i ++)
+    {
+        dump.m_subdivided[i].m_path = subdivided[i].m_path;
+        dump.m_subdivided[i].m_depth = subdivided[i].m_depth;
+    }
+
+    const unsigned* indData = reinterpret_cast<const unsigned*>(
+                                    m_indBufChunk->GetShadowData());
+    const unsigned char* vertData = m_chunkVertBuf->GetShadowData();
+    const unsigned vertSize = m_chunkVertBuf->GetVertexSize();
+
+    dump.m_chunks.Resize(chunked.Size());
+    for (unsigned c = 0; c < chunked.Size(); c ++)
+    {
+        const SubTriangle& tri = tree.m_triangles[chunked[c].m_tri];
+        const unsigned* chunkInd = indData + tri.m_chunkIndex;
+
+        TerrainDump::Chunk& chunk = dump.m_chunks[c];
+        chunk.m_path = chunked[c].m_path;
+        chunk.m_depth = chunked[c].m_depth;
+        chunk.m_vertices.Resize(m_chunkSize * 2);
+
+        // Same triangles as chunk_add, but going from get_index order to
+        // whatever the index data says
+        unsigned i = 0;
+        for (int y = 0; y < int(m_chunkVertsPerSide); y ++)
+        {
+            for (int x = 0; x < y * 2 + 1; x ++)
+            {
+                unsigned local[3];
+                if (x % 2)
+                {
+                    // upside down triangle
+                    local[0] = get_index(x / 2 + 1, y + 1);
+                    local[1] = get_index(x / 2 + 1, y);
+                    local[2] = get_index(x / 2, y);
+                }
+                else
+                {
+                    // up pointing triangle
+                    local[0] = get_index(x / 2, y);
+                    local[1] = get_index(x / 2, y + 1);
+                    local[2] = get_index(x / 2 + 1, y + 1);
+                }
+
+                // Position and normal
+                for (int j = 0; j < 3; j ++)
+                {
+                    memcpy(&chunk.m_vertices[local[j] * 2],
+                           vertData + chunkInd[i + j] * vertSize,
+                           2 * sizeof(Urho3D::Vector3));
+                }
+                i += 3;
+            }
+        }
+    }
+}
+
+} // namespace osp
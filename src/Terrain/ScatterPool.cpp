@@ -0,0 +1,112 @@
+#include "ScatterPool.h"
+#include "TerrainSnapshot.h"
+#include "../SplitMix.h"
+
+#include <Urho3D/Math/Quaternion.h>
+
+namespace osp
+{
+
+void ScatterPool::initialize(unsigned maxChunks, unsigned cellDepth)
+{
+    m_cellDepth = cellDepth;
+
+    m_transforms.Resize(maxChunks * m_count);
+    m_counts.Resize(maxChunks);
+
+    clear();
+}
+
+void ScatterPool::chunk_add(const ChunkSnapshot& chunk, unsigned resolution,
+                            const Urho3D::Vector3* cellCorners,
+                            uint64_t cellPath)
+{
+    const unsigned block = m_chunkCount;
+    uint16_t count = 0;
+
+    if (cellCorners)
+    {
+        Urho3D::Matrix3x4* transforms = m_transforms.Buffer() + block * m_count;
+
+        // Every chunk in the same cell goes through the same sequence of
+        // objects, and only keeps the ones on itself
+        uint64_t state = cellPath ^ (uint64_t(m_seed) << 32);
+        next_random(state);
+
+        for (unsigned i = 0; i < m_count; i ++)
+        {
+            // Random point on the cell, flipping points outside of the
+            // triangle back in
+            float u = next_random_float(state);
+            float v = next_random_float(state);
+            const float yaw = next_random_float(state) * 360.0f;
+            const float scale = Urho3D::Lerp(m_scaleMin, m_scaleMax,
+                                             next_random_float(state));
+
+            if (u + v > 1.0f)
+            {
+                u = 1.0f - u;
+                v = 1.0f - v;
+            }
+
+            const Urho3D::Vector3 dir = (cellCorners[0]
+                                  + (cellCorners[1] - cellCorners[0]) * u
+                                  + (cellCorners[2] - cellCorners[0]) * v)
+                                        .Normalized();
+
+            if (!chunk.contains(dir))
+            {
+                continue;
+            }
+
+            // Stand up along the direction from the planet's center
+            Urho3D::Quaternion rotation(Urho3D::Vector3::UP, dir);
+            rotation = rotation * Urho3D::Quaternion(yaw,
+                                                     Urho3D::Vector3::UP);
+
+            const float radius = chunk.get_radius(dir, resolution)
+                                    - scale * m_sink;
+
+            transforms[count] = Urho3D::Matrix3x4(dir * radius, rotation,
+                                                  scale);
+            count ++;
+        }
+    }
+
+    m_counts[block] = count;
+    m_instanceCount += count;
+    m_chunkCount ++;
+    m_version ++;
+}
+
+void ScatterPool::chunk_remove(unsigned chunk)
+{
+    m_chunkCount --;
+    m_instanceCount -= m_counts[chunk];
+
+    // Move the last block into the removed one's place, the same way
+    // PlanetWrenderer::chunk_remove moves index data
+    const unsigned last = m_chunkCount;
+    if (chunk != last)
+    {
+        Urho3D::Matrix3x4* transforms = m_transforms.Buffer();
+
+        for (unsigned i = 0; i < m_counts[last]; i ++)
+        {
+            transforms[chunk * m_count + i] = transforms[last * m_count + i];
+        }
+
+        m_counts[chunk] = m_counts[last];
+    }
+
+    m_version ++;
+}
+
+void ScatterPool::clear()
+{
+    m_chunkCount = 0;
+    m_instanceCount = 0;
+    m_version ++;
+}
+
+} // namespace osp
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <Urho3D/Container/RefCounted.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Matrix3x4.h>
+
+#include <cstdint>
+
+namespace osp
+{
+
+struct ChunkSnapshot;
+
+/**
+ * Transforms of small objects scattered over terrain chunks, like rocks and
+ * boulders. A PlanetWrenderer fills it as chunks are added and removed, and a
+ * TerrainScatter draws it.
+ *
+ * Objects are placed in cells, which are triangles of the IcoSphereTree at
+ * a certain depth. Each cell's objects are generated from a seed made from
+ * the cell's path, so the same objects always show up in the same places
+ * no matter how the terrain is chunked. A chunk at or deeper than the cell
+ * depth gets the objects of its cell that land on it. Shallower chunks are
+ * too far away for anything to be seen, and get nothing.
+ *
+ * Transforms are kept in a block for each chunk, in the same order as the
+ * chunk index buffer. Removing a chunk moves the last chunk's block into its
+ * place, so the pool stays compact.
+ */
+class ScatterPool : public Urho3D::RefCounted
+{
+public:
+    ScatterPool() = default;
+    ~ScatterPool() = default;
+
+    /**
+     * Allocate space for blocks. Called by PlanetWrenderer::add_scatter.
+     * @param maxChunks [in] Max number of chunks in the terrain
+     * @param cellDepth [in] IcoSphereTree depth of cells
+     */
+    void initialize(unsigned maxChunks, unsigned cellDepth);
+
+    /**
+     * Set how many objects are placed in each cell. Call before initialize.
+     * @param count [in] Objects per cell
+     */
+    void set_count(unsigned count) { m_count = count; }
+
+    /**
+     * Set preferred size of cells. The cell depth is picked so that cell
+     * edges are about this long. Call before initialize.
+     * @param size [in] Edge length in meters
+     */
+    void set_cell_size(float size) { m_cellSize = size; }
+
+    /**
+     * Set range of random sizes. Call before initialize.
+     * @param min [in] Smallest scale
+     * @param max [in] Largest scale
+     */
+    void set_scale(float min, float max)
+    {
+        m_scaleMin = min;
+        m_scaleMax = max;
+    }
+
+    /**
+     * Set how far objects are pushed into the ground, as a fraction of their
+     * scale. Call before initialize.
+     * @param sink [in] 0.0 for sitting on the surface
+     */
+    void set_sink(float sink) { m_sink = sink; }
+
+    /**
+     * Set a seed to combine with each cell's path, so different pools don't
+     * put their objects in the same places. Call before initialize.
+     * @param seed [in] Any number
+     */
+    void set_seed(uint32_t seed) { m_seed = seed; }
+
+    float get_cell_size() const { return m_cellSize; }
+
+    unsigned get_cell_depth() const { return m_cellDepth; }
+
+    /**
+     * Add a block for a chunk added to the end of the chunk list
+     * @param chunk [in] The new chunk
+     * @param resolution [in] How many vertices wide the chunk is
+     * @param cellCorners [in] Top, left, and right corners of the cell the
+     *                         chunk is in, or nullptr if the chunk is
+     *                         shallower than the cell depth
+     * @param cellPath [in] IcoSphereTree::get_path of the cell
+     */
+    void chunk_add(const ChunkSnapshot& chunk, unsigned resolution,
+                   const Urho3D::Vector3* cellCorners, uint64_t cellPath);
+
+    /**
+     * Remove a chunk's block, replacing it with the last chunk's block
+     * @param chunk [in] Index of chunk removed
+     */
+    void chunk_remove(unsigned chunk);
+
+    /**
+     * Remove every block
+     */
+    void clear();
+
+    unsigned get_chunk_count() const { return m_chunkCount; }
+
+    /**
+     * @return Total number of objects in every block
+     */
+    unsigned get_instance_count() const { return m_instanceCount; }
+
+    /**
+     * @param chunk [in] Index of chunk
+     * @return Number of objects in a chunk's block
+     */
+    unsigned get_block_count(unsigned chunk) const { return m_counts[chunk]; }
+
+    /**
+     * @param chunk [in] Index of chunk
+     * @return Transforms relative to the planet in a chunk's block
+     */
+    const Urho3D::Matrix3x4* get_block(unsigned chunk) const
+    {
+        return m_transforms.Buffer() + chunk * m_count;
+    }
+
+    /**
+     * @return Number that changes every time blocks are added or removed
+     */
+    unsigned get_version() const { return m_version; }
+
+private:
+
+    // Transforms of every object, m_count for each chunk
+    Urho3D::PODVector<Urho3D::Matrix3x4> m_transforms;
+
+    // Number of objects used in each chunk's block
+    Urho3D::PODVector<uint16_t> m_counts;
+
+    unsigned m_chunkCount = 0;
+    unsigned m_instanceCount = 0;
+    unsigned m_version = 0;
+
+    unsigned m_cellDepth = 0;
+
+    unsigned m_count = 16;
+    float m_cellSize = 64.0f;
+    float m_scaleMin = 0.5f;
+    float m_scaleMax = 1.5f;
+    float m_sink = 0.3f;
+    uint32_t m_seed = 0;
+};
+
+} // namespace osp
@@ -0,0 +1,367 @@
+#include <Urho3D/IO/Log.h>
+
+#include "TerrainDump.h"
+
+#include <cstdio>
+#include <cstring>
+
+namespace osp
+{
+
+static constexpr char sc_magic[4] = {'O', 'S', 'P', 'D'};
+static constexpr uint32_t sc_version = 1;
+
+static constexpr unsigned sc_headerSize = 24;
+static constexpr unsigned sc_recordSize = 12;
+
+// Anything more than this can't be a real file
+static constexpr uint32_t sc_maxCount = 1u << 24;
+static constexpr uint32_t sc_maxResolution = 1024;
+
+/**
+ * Order triangles by depth, then by path
+ * @return Negative if A goes first, positive if B goes first, 0 if the same
+ */
+static int compare_key(uint64_t pathA, uint32_t depthA,
+                       uint64_t pathB, uint32_t depthB)
+{
+    if (depthA != depthB)
+    {
+        return (depthA < depthB) ? -1 : 1;
+    }
+    if (pathA != pathB)
+    {
+        return (pathA < pathB) ? -1 : 1;
+    }
+    return 0;
+}
+
+static void write_record(uint8_t* record, uint64_t path, uint32_t depth)
+{
+    memcpy(record + 0, &path, 8);
+    memcpy(record + 8, &depth, 4);
+}
+
+static void read_record(const uint8_t* record, uint64_t& path,
+                        uint32_t& depth)
+{
+    memcpy(&path, record + 0, 8);
+    memcpy(&depth, record + 8, 4);
+}
+
+bool TerrainDump::save(const Urho3D::String& path) const
+{
+    FILE* file = fopen(path.CString(), "wb");
+    if (!file)
+    {
+        URHO3D_LOGERRORF("Can't write terrain dump: %s", path.CString());
+        return false;
+    }
+
+    bool success = true;
+
+    const uint32_t subdividedCount = m_subdivided.Size();
+    const uint32_t chunkCount = m_chunks.Size();
+
+    uint8_t header[sc_headerSize];
+    memcpy(header + 0,  sc_magic,           4);
+    memcpy(header + 4,  &sc_version,        4);
+    memcpy(header + 8,  &m_chunkResolution, 4);
+    memcpy(header + 12, &subdividedCount,   4);
+    memcpy(header + 16, &chunkCount,        4);
+    memcpy(header + 20, &m_radius,          4);
+    success &= fwrite(header, sc_headerSize, 1, file) == 1;
+
+    uint8_t record[sc_recordSize];
+
+    for (const Triangle& tri : m_subdivided)
+    {
+        write_record(record, tri.m_path, tri.m_depth);
+        success &= fwrite(record, sc_recordSize, 1, file) == 1;
+    }
+
+    const unsigned vertexCount = get_chunk_size() * 2;
+
+    for (const Chunk& chunk : m_chunks)
+    {
+        write_record(record, chunk.m_path, chunk.m_depth);
+        success &= fwrite(record, sc_recordSize, 1, file) == 1;
+        success &= fwrite(chunk.m_vertices.Buffer(), sizeof(Urho3D::Vector3),
+                          vertexCount, file) == vertexCount;
+    }
+
+    success &= fclose(file) == 0;
+
+    if (!success)
+    {
+        URHO3D_LOGERRORF("Error writing terrain dump: %s", path.CString());
+    }
+
+    return success;
+}
+
+bool TerrainDump::save_obj(const Urho3D::String& path) const
+{
+    FILE* file = fopen(path.CString(), "w");
+    if (!file)
+    {
+        URHO3D_LOGERRORF("Can't write terrain dump: %s", path.CString());
+        return false;
+    }
+
+    const unsigned chunkSize = get_chunk_size();
+    const int vertsPerSide = int(m_chunkResolution) - 1;
+
+    // OBJ indices start at 1
+    unsigned first = 1;
+
+    for (const Chunk& chunk : m_chunks)
+    {
+        fprintf(file, "o chunk_%u_%llu\n", chunk.m_depth,
+                static_cast<unsigned long long>(chunk.m_path));
+
+        for (unsigned i = 0; i < chunkSize; i ++)
+        {
+            const Urho3D::Vector3& pos = chunk.m_vertices[i * 2 + 0];
+            const Urho3D::Vector3& normal = chunk.m_vertices[i * 2 + 1];
+            fprintf(file, "v %.9g %.9g %.9g\n", pos.x_, pos.y_, pos.z_);
+            fprintf(file, "vn %.9g %.9g %.9g\n",
+                    normal.x_, normal.y_, normal.z_);
+        }
+
+        // Same triangles as PlanetWrenderer::chunk_add, with vertices in
+        // get_index order
+        for (int y = 0; y < vertsPerSide; y ++)
+        {
+            for (int x = 0; x < y * 2 + 1; x ++)
+            {
+                unsigned tri[3];
+                if (x % 2)
+                {
+                    // upside down triangle
+                    tri[0] = unsigned((y + 1) * (y + 2) / 2 + x / 2 + 1);
+                    tri[1] = unsigned(y * (y + 1) / 2 + x / 2 + 1);
+                    tri[2] = unsigned(y * (y + 1) / 2 + x / 2);
+                }
+                else
+                {
+                    // up pointing triangle
+                    tri[0] = unsigned(y * (y + 1) / 2 + x / 2);
+                    tri[1] = unsigned((y + 1) * (y + 2) / 2 + x / 2);
+                    tri[2] = unsigned((y + 1) * (y + 2) / 2 + x / 2 + 1);
+                }
+
+                fprintf(file, "f %u//%u %u//%u %u//%u\n",
+                        first + tri[0], first + tri[0],
+                        first + tri[1], first + tri[1],
+                        first + tri[2], first + tri[2]);
+            }
+        }
+
+        first += chunkSize;
+    }
+
+    bool success = ferror(file) == 0;
+    success &= fclose(file) == 0;
+
+    if (!success)
+    {
+        URHO3D_LOGERRORF("Error writing terrain dump: %s", path.CString());
+    }
+
+    return success;
+}
+
+bool TerrainDump::load(const Urho3D::String& path)
+{
+    m_subdivided.Clear();
+    m_chunks.Clear();
+
+    FILE* file = fopen(path.CString(), "rb");
+    if (!file)
+    {
+        URHO3D_LOGERRORF("Can't open terrain dump: %s", path.CString());
+        return false;
+    }
+
+    uint8_t header[sc_headerSize];
+    uint32_t version = 0;
+    uint32_t subdividedCount = 0;
+    uint32_t chunkCount = 0;
+
+    bool success = fread(header, sc_headerSize, 1, file) == 1
+                    && memcmp(header, sc_magic, 4) == 0;
+
+    if (success)
+    {
+        memcpy(&version,           header + 4,  4);
+        memcpy(&m_chunkResolution, header + 8,  4);
+        memcpy(&subdividedCount,   header + 12, 4);
+        memcpy(&chunkCount,        header + 16, 4);
+        memcpy(&m_radius,          header + 20, 4);
+
+        success = version == sc_version
+                    && m_chunkResolution > 1
+                    && m_chunkResolution <= sc_maxResolution
+                    && subdividedCount <= sc_maxCount
+                    && chunkCount <= sc_maxCount;
+    }
+
+    uint8_t record[sc_recordSize];
+
+    m_subdivided.Resize(success ? subdividedCount : 0);
+    for (unsigned i = 0; success && i < subdividedCount; i ++)
+    {
+        success = fread(record, sc_recordSize, 1, file) == 1;
+        read_record(record, m_subdivided[i].m_path, m_subdivided[i].m_depth);
+    }
+
+    const unsigned vertexCount = get_chunk_size() * 2;
+
+    m_chunks.Resize(success ? chunkCount : 0);
+    for (unsigned i = 0; success && i < chunkCount; i ++)
+    {
+        Chunk& chunk = m_chunks[i];
+        chunk.m_vertices.Resize(vertexCount);
+
+        success = fread(record, sc_recordSize, 1, file) == 1
+                    && fread(chunk.m_vertices.Buffer(),
+                             sizeof(Urho3D::Vector3), vertexCount, file)
+                            == vertexCount;
+        read_record(record, chunk.m_path, chunk.m_depth);
+    }
+
+    fclose(file);
+
+    if (!success)
+    {
+        URHO3D_LOGERRORF("Invalid terrain dump: %s", path.CString());
+        m_subdivided.Clear();
+        m_chunks.Clear();
+    }
+
+    return success;
+}
+
+unsigned TerrainDump::compare(const TerrainDump& a, const TerrainDump& b,
+                              float tolerance)
+{
+    if (a.m_chunkResolution != b.m_chunkResolution)
+    {
+        URHO3D_LOGERRORF("Chunk resolutions are different: %u and %u",
+                         a.m_chunkResolution, b.m_chunkResolution);
+        return Urho3D::Max(a.m_chunks.Size(), b.m_chunks.Size()) + 1;
+    }
+
+    // Both are sorted, so walk through them side by side
+    unsigned subdividedOnlyA = 0;
+    unsigned subdividedOnlyB = 0;
+    {
+        unsigned i = 0;
+        unsigned j = 0;
+        while (i < a.m_subdivided.Size() || j < b.m_subdivided.Size())
+        {
+            const int order
+                    = (i == a.m_subdivided.Size()) ? 1
+                    : (j == b.m_subdivided.Size()) ? -1
+                    : compare_key(a.m_subdivided[i].m_path,
+                                  a.m_subdivided[i].m_depth,
+                                  b.m_subdivided[j].m_path,
+                                  b.m_subdivided[j].m_depth);
+
+            if (order < 0)
+            {
+                subdividedOnlyA ++;
+                i ++;
+            }
+            else if (order > 0)
+            {
+                subdividedOnlyB ++;
+                j ++;
+            }
+            else
+            {
+                i ++;
+                j ++;
+            }
+        }
+    }
+
+    unsigned chunksOnlyA = 0;
+    unsigned chunksOnlyB = 0;
+    unsigned chunksMatched = 0;
+    unsigned vertsOver = 0;
+    float maxError = 0.0f;
+    float maxNormalError = 0.0f;
+    double totalError = 0.0;
+
+    const unsigned chunkSize = a.get_chunk_size();
+    {
+        unsigned i = 0;
+        unsigned j = 0;
+        while (i < a.m_chunks.Size() || j < b.m_chunks.Size())
+        {
+            const int order
+                    = (i == a.m_chunks.Size()) ? 1
+                    : (j == b.m_chunks.Size()) ? -1
+                    : compare_key(a.m_chunks[i].m_path,
+                                  a.m_chunks[i].m_depth,
+                                  b.m_chunks[j].m_path,
+                                  b.m_chunks[j].m_depth);
+
+            if (order < 0)
+            {
+                chunksOnlyA ++;
+                i ++;
+                continue;
+            }
+            if (order > 0)
+            {
+                chunksOnlyB ++;
+                j ++;
+                continue;
+            }
+
+            const Urho3D::Vector3* vertsA = a.m_chunks[i].m_vertices.Buffer();
+            const Urho3D::Vector3* vertsB = b.m_chunks[j].m_vertices.Buffer();
+
+            for (unsigned v = 0; v < chunkSize; v ++)
+            {
+                const float error = (vertsA[v * 2] - vertsB[v * 2]).Length();
+                const float normalError = (vertsA[v * 2 + 1]
+                                           - vertsB[v * 2 + 1]).Length();
+
+                maxError = Urho3D::Max(maxError, error);
+                maxNormalError = Urho3D::Max(maxNormalError, normalError);
+                totalError += error;
+
+                if (error > tolerance)
+                {
+                    vertsOver ++;
+                }
+            }
+
+            chunksMatched ++;
+            i ++;
+            j ++;
+        }
+    }
+
+    const double meanError = chunksMatched
+                    ? totalError / (double(chunksMatched) * chunkSize) : 0.0;
+
+    URHO3D_LOGINFOF("\nTerrain Comparison:\n"
+            " - Subdivided:   %u only in first, %u only in second\n"
+            " - Chunks:       %u matched, %u only in first, %u only in second\n"
+            " - Vertex Error: max %g m, mean %g m, %u over %g m\n"
+            " - Normal Error: max %g",
+            subdividedOnlyA, subdividedOnlyB,
+            chunksMatched, chunksOnlyA, chunksOnlyB,
+            maxError, meanError, vertsOver, tolerance,
+            maxNormalError);
+
+    return subdividedOnlyA + subdividedOnlyB + chunksOnlyA + chunksOnlyB
+            + vertsOver;
+}
+
+} // namespace osp
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include <cstdint>
+
+namespace osp
+{
+
+/**
+ * A copy of a PlanetWrenderer's terrain mesh, for checking that changes to
+ * terrain code still make the same mesh, and for looking at LOD behaviour
+ * without running the game. See PlanetWrenderer::debug_dump.
+ *
+ * Nothing in here depends on the order things happened in, or where they
+ * ended up in buffers. Triangles are identified by IcoSphereTree::get_path
+ * and their depth, and everything is sorted by depth then path. Two planets
+ * with the same shape always make the same dump.
+ *
+ * File layout (little endian):
+ *
+ *     Header [24 bytes]
+ *     Subdivided triangles [12 bytes each: path, depth]
+ *     Chunks [12 bytes each: path, depth, then vertices]
+ *
+ * Each chunk has m_chunkResolution * (m_chunkResolution + 1) / 2 vertices
+ * of position then normal, in PlanetWrenderer::get_index order. Triangles
+ * are the same for every chunk, so they aren't stored.
+ */
+class TerrainDump
+{
+public:
+
+    struct Triangle
+    {
+        uint64_t m_path;
+        uint32_t m_depth;
+    };
+
+    struct Chunk
+    {
+        uint64_t m_path;
+        uint32_t m_depth;
+
+        // Position and normal of each vertex, interleaved
+        Urho3D::PODVector<Urho3D::Vector3> m_vertices;
+    };
+
+    TerrainDump() = default;
+    ~TerrainDump() = default;
+
+    /**
+     * Write to a file in the layout described above
+     * @param path [in] Path to file
+     * @return true if successful, errors are logged
+     */
+    bool save(const Urho3D::String& path) const;
+
+    /**
+     * Write chunks to a Wavefront OBJ file, for looking at in other programs.
+     * Can't be loaded back.
+     * @param path [in] Path to file
+     * @return true if successful, errors are logged
+     */
+    bool save_obj(const Urho3D::String& path) const;
+
+    /**
+     * Read a file written by save
+     * @param path [in] Path to file
+     * @return true if successful, errors are logged
+     */
+    bool load(const Urho3D::String& path);
+
+    /**
+     * Compare two dumps, and log what's different: triangles subdivided in
+     * one but not the other, chunks only in one, and how far apart vertices
+     * of chunks in both are.
+     * @param a [in] First dump
+     * @param b [in] Second dump
+     * @param tolerance [in] Vertices further apart than this in meters count
+     *                       as different
+     * @return Number of differences, 0 if they match
+     */
+    static unsigned compare(const TerrainDump& a, const TerrainDump& b,
+                            float tolerance);
+
+    /**
+     * @return Number of vertices in each chunk
+     */
+    unsigned get_chunk_size() const
+    {
+        return m_chunkResolution * (m_chunkResolution + 1) / 2;
+    }
+
+    uint32_t m_chunkResolution = 0;
+    float m_radius = 0.0f;
+
+    // Sorted by depth then path
+    Urho3D::PODVector<Triangle> m_subdivided;
+    Urho3D::Vector<Chunk> m_chunks;
+};
+
+} // namespace osp
@@ -0,0 +1,75 @@
+#include <Urho3D/Core/CoreEvents.h>
+
+#include "PlanetTerrain.h"
+#include "TerrainManager.h"
+
+namespace osp
+{
+
+TerrainManager::TerrainManager(Context* context) : Object(context)
+{
+    // Planets update themselves in E_UPDATE, check how it went afterwards
+    SubscribeToEvent(E_POSTUPDATE,
+                     URHO3D_HANDLER(TerrainManager, budget_update));
+}
+
+void TerrainManager::add_terrain(PlanetTerrain* terrain)
+{
+    terrain->get_planet()->set_threshold_scale(m_thresholdScale);
+    m_terrains.Push(WeakPtr<PlanetTerrain>(terrain));
+}
+
+void TerrainManager::budget_update(StringHash eventType,
+                                   VariantMap& eventData)
+{
+    m_triangleCount = 0;
+    m_updateTime = 0;
+
+    // Fullest chunk buffer of any planet. Chunks that don't fit leave holes,
+    // so a single full planet is enough to tighten everything.
+    float chunkLoad = 0.0f;
+
+    for (unsigned i = 0; i < m_terrains.Size(); )
+    {
+        if (m_terrains[i].Expired())
+        {
+            // Terrain was destroyed, forget about it
+            m_terrains.EraseSwap(i);
+            continue;
+        }
+
+        m_triangleCount += m_terrains[i]->get_planet()->get_triangle_count();
+        m_updateTime += m_terrains[i]->get_update_time();
+        chunkLoad = Max(chunkLoad,
+                        m_terrains[i]->get_planet()->get_chunk_load());
+        i ++;
+    }
+
+    // 1.0 means exactly on budget
+    const float load = Max(Max(float(m_triangleCount)
+                                    / float(m_triangleBudget),
+                               float(m_updateTime) / float(m_timeBudget)),
+                           chunkLoad / m_maxChunkLoad);
+
+    if (load > 1.0f)
+    {
+        // Over budget, tighten right away. Triangle count is roughly inversely
+        // proportional to the area threshold, so scaling by the load brings
+        // it back to around the budget.
+        m_thresholdScale *= Max(load, 1.1f);
+    }
+    else if (load < 0.75f)
+    {
+        // Well under budget, bring back detail slowly
+        m_thresholdScale *= 0.97f;
+    }
+
+    m_thresholdScale = Clamp(m_thresholdScale, m_minScale, m_maxScale);
+
+    for (WeakPtr<PlanetTerrain> const& terrain : m_terrains)
+    {
+        terrain->get_planet()->set_threshold_scale(m_thresholdScale);
+    }
+}
+
+} // namespace osp
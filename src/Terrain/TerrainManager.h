@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Core/Object.h>
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+class PlanetTerrain;
+
+/**
+ * Subsystem that keeps the total cost of all PlanetTerrains under a budget.
+ *
+ * Every planet refines itself by comparing the screen area of its triangles
+ * against thresholds. Instead of giving each planet a fixed share, the same
+ * threshold scale is given to every planet, so the budget is spent wherever
+ * triangles are largest on screen, no matter which planet they belong to.
+ *
+ * After all planets have updated for the frame, the total triangle count and
+ * time spent updating are compared against the budgets, and each planet's
+ * chunk buffers are checked for space. The threshold scale
+ * is raised right away when over budget, and slowly lowered when well under
+ * it, so detail comes back without oscillating.
+ */
+class TerrainManager : public Object
+{
+    URHO3D_OBJECT(TerrainManager, Object)
+
+public:
+    TerrainManager(Context* context);
+    ~TerrainManager() = default;
+
+    /**
+     * Start managing a terrain. Terrains are forgotten automatically when
+     * they're destroyed.
+     * @param terrain [in] Terrain to add
+     */
+    void add_terrain(PlanetTerrain* terrain);
+
+    /**
+     * @param triangles [in] Total number of terrain triangles to draw
+     */
+    void set_triangle_budget(unsigned triangles)
+    {
+        m_triangleBudget = triangles;
+    }
+
+    /**
+     * @param usec [in] Total time to spend updating terrain each frame
+     */
+    void set_time_budget(long long usec) { m_timeBudget = usec; }
+
+    unsigned get_triangle_count() const { return m_triangleCount; }
+
+    float get_threshold_scale() const { return m_thresholdScale; }
+
+private:
+
+    /**
+     * Compare how much the last frame cost against the budgets, then adjust
+     * and hand out the threshold scale for the next frame
+     */
+    void budget_update(StringHash eventType, VariantMap& eventData);
+
+    Vector< WeakPtr<PlanetTerrain> > m_terrains;
+
+    // Triangles drawn by all terrains last frame
+    unsigned m_triangleCount = 0;
+
+    // Time spent updating all terrains last frame, in microseconds
+    long long m_updateTime = 0;
+
+    unsigned m_triangleBudget = 1000000;
+    long long m_timeBudget = 4000;
+
+    // How full a planet's chunk buffers can get, see get_chunk_load
+    float m_maxChunkLoad = 0.9f;
+
+    // Current scale given to each PlanetWrenderer's thresholds
+    float m_thresholdScale = 1.0f;
+
+    // Limits for m_thresholdScale
+    float m_minScale = 0.25f;
+    float m_maxScale = 256.0f;
+};
+
+} // namespace osp
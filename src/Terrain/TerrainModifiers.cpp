@@ -0,0 +1,339 @@
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/IO/Log.h>
+
+#include "TerrainModifiers.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace osp
+{
+
+static constexpr char sc_magic[4] = {'O', 'S', 'P', 'M'};
+static constexpr uint32_t sc_version = 1;
+
+static constexpr unsigned sc_headerSize = 12;
+static constexpr unsigned sc_recordSize = 28;
+
+// Anything more than this can't be a real file
+static constexpr uint32_t sc_maxCount = 1u << 20;
+
+// Stamps overlapping a single point, any more are ignored. Each level can
+// have lots of stamps in one cell, but a vertex is rarely under more than a
+// few of them.
+static constexpr unsigned sc_maxOverlap = 64;
+
+// Height of a crater's rim compared to its depth
+static constexpr float sc_craterRim = 0.2f;
+
+TerrainModifiers::TerrainModifiers(float planetRadius) :
+        m_planetRadius(planetRadius),
+        m_levelMask(0)
+{
+
+}
+
+bool TerrainModifiers::cell_less(const Cell& a, const Cell& b)
+{
+    return (a.m_key != b.m_key) ? (a.m_key < b.m_key)
+                                : (a.m_stamp < b.m_stamp);
+}
+
+uint64_t TerrainModifiers::make_key(unsigned level, unsigned x, unsigned y,
+                                    unsigned z)
+{
+    // 19 bits for each axis, up to 2^sc_maxLevel cells, and the level on top
+    return (uint64_t(level) << 57) | (uint64_t(z) << 38)
+            | (uint64_t(y) << 19) | uint64_t(x);
+}
+
+unsigned TerrainModifiers::get_cell(unsigned level, float coord)
+{
+    const unsigned cells = 1u << level;
+    const float cell = std::floor((coord + 1.0f) * 0.5f * float(cells));
+    return unsigned(Urho3D::Clamp(cell, 0.0f, float(cells - 1)));
+}
+
+float TerrainModifiers::get_reach(const TerrainStamp& stamp) const
+{
+    return (stamp.m_radius + stamp.m_falloff) / m_planetRadius;
+}
+
+unsigned TerrainModifiers::add(const TerrainStamp& stamp)
+{
+    const unsigned index = m_stamps.Size();
+    m_stamps.Push(stamp);
+    insert(index);
+
+    Urho3D::Sort(m_cells.Begin(), m_cells.End(), cell_less);
+
+    return index;
+}
+
+void TerrainModifiers::insert(unsigned index)
+{
+    const TerrainStamp& stamp = m_stamps[index];
+
+    // Deepest level with cells at least twice as wide as the reach, so the
+    // stamp covers at most two cells on each axis. Cells at level L are
+    // 2 / 2^L wide, as directions go from -1 to 1.
+    const float reach = Urho3D::Max(get_reach(stamp), 1e-9f);
+    const float level = std::floor(-std::log2(reach));
+    const unsigned l = unsigned(Urho3D::Clamp(level, 0.0f,
+                                              float(sc_maxLevel)));
+
+    const Urho3D::Vector3& dir = stamp.m_direction;
+    const unsigned minX = get_cell(l, dir.x_ - reach);
+    const unsigned minY = get_cell(l, dir.y_ - reach);
+    const unsigned minZ = get_cell(l, dir.z_ - reach);
+    const unsigned maxX = get_cell(l, dir.x_ + reach);
+    const unsigned maxY = get_cell(l, dir.y_ + reach);
+    const unsigned maxZ = get_cell(l, dir.z_ + reach);
+
+    for (unsigned z = minZ; z <= maxZ; z ++)
+    {
+        for (unsigned y = minY; y <= maxY; y ++)
+        {
+            for (unsigned x = minX; x <= maxX; x ++)
+            {
+                m_cells.Push({make_key(l, x, y, z), index});
+            }
+        }
+    }
+
+    m_levelMask |= 1u << l;
+}
+
+void TerrainModifiers::clear()
+{
+    m_stamps.Clear();
+    m_cells.Clear();
+    m_levelMask = 0;
+}
+
+float TerrainModifiers::apply(const Urho3D::Vector3& normal,
+                              float height) const
+{
+    if (m_stamps.Empty())
+    {
+        return height;
+    }
+
+    unsigned found[sc_maxOverlap];
+    unsigned foundCount = 0;
+
+    for (unsigned l = 0; l <= sc_maxLevel; l ++)
+    {
+        if (!(m_levelMask & (1u << l)))
+        {
+            continue;
+        }
+
+        const uint64_t key = make_key(l, get_cell(l, normal.x_),
+                                      get_cell(l, normal.y_),
+                                      get_cell(l, normal.z_));
+
+        // Binary search for the first entry of this cell
+        unsigned first = 0;
+        unsigned last = m_cells.Size();
+        while (first < last)
+        {
+            const unsigned middle = (first + last) / 2;
+            if (m_cells[middle].m_key < key)
+            {
+                first = middle + 1;
+            }
+            else
+            {
+                last = middle;
+            }
+        }
+
+        for (unsigned i = first; i < m_cells.Size()
+                                    && m_cells[i].m_key == key; i ++)
+        {
+            if (foundCount == sc_maxOverlap)
+            {
+                break;
+            }
+
+            // Insertion sort, stamps have to be applied in order
+            unsigned j = foundCount ++;
+            while (j > 0 && found[j - 1] > m_cells[i].m_stamp)
+            {
+                found[j] = found[j - 1];
+                j --;
+            }
+            found[j] = m_cells[i].m_stamp;
+        }
+    }
+
+    for (unsigned i = 0; i < foundCount; i ++)
+    {
+        height = apply_stamp(m_stamps[found[i]], normal, height);
+    }
+
+    return height;
+}
+
+float TerrainModifiers::apply_stamp(const TerrainStamp& stamp,
+                                    const Urho3D::Vector3& normal,
+                                    float height) const
+{
+    // Straight line distance, close enough to the distance along the surface
+    // for anything small enough to be a stamp
+    const float distance = (normal - stamp.m_direction).Length()
+                                * m_planetRadius;
+
+    if (distance >= stamp.m_radius + stamp.m_falloff)
+    {
+        return height;
+    }
+
+    switch (stamp.m_type)
+    {
+    case StampType::FLATTEN:
+    {
+        float weight = 1.0f;
+        if (distance > stamp.m_radius)
+        {
+            // Smoothstep from 1 at the radius to 0 at the end of the falloff
+            const float s = 1.0f - (distance - stamp.m_radius)
+                                        / stamp.m_falloff;
+            weight = s * s * (3.0f - 2.0f * s);
+        }
+        return Urho3D::Lerp(height, stamp.m_height, weight);
+    }
+    case StampType::CRATER:
+    {
+        if (distance <= stamp.m_radius)
+        {
+            // Bowl from -depth in the middle up to the top of the rim
+            const float t = distance / stamp.m_radius;
+            return height + stamp.m_height
+                                * ((1.0f + sc_craterRim) * t * t - 1.0f);
+        }
+
+        // Rim falling off back down to the original terrain
+        const float s = (distance - stamp.m_radius) / stamp.m_falloff;
+        return height + stamp.m_height * sc_craterRim * (1.0f - s)
+                                                      * (1.0f - s);
+    }
+    }
+
+    return height;
+}
+
+bool TerrainModifiers::save(const Urho3D::String& path) const
+{
+    FILE* file = fopen(path.CString(), "wb");
+    if (!file)
+    {
+        URHO3D_LOGERRORF("Can't write terrain stamps: %s", path.CString());
+        return false;
+    }
+
+    bool success = true;
+
+    const uint32_t count = m_stamps.Size();
+
+    uint8_t header[sc_headerSize];
+    memcpy(header + 0, sc_magic,    4);
+    memcpy(header + 4, &sc_version, 4);
+    memcpy(header + 8, &count,      4);
+    success &= fwrite(header, sc_headerSize, 1, file) == 1;
+
+    uint8_t record[sc_recordSize];
+
+    for (const TerrainStamp& stamp : m_stamps)
+    {
+        const uint32_t type = uint32_t(stamp.m_type);
+        memcpy(record + 0,  stamp.m_direction.Data(), 12);
+        memcpy(record + 12, &stamp.m_radius,          4);
+        memcpy(record + 16, &stamp.m_falloff,         4);
+        memcpy(record + 20, &stamp.m_height,          4);
+        memcpy(record + 24, &type,                    4);
+        success &= fwrite(record, sc_recordSize, 1, file) == 1;
+    }
+
+    success &= fclose(file) == 0;
+
+    if (!success)
+    {
+        URHO3D_LOGERRORF("Error writing terrain stamps: %s", path.CString());
+    }
+
+    return success;
+}
+
+bool TerrainModifiers::load(const Urho3D::String& path)
+{
+    clear();
+
+    FILE* file = fopen(path.CString(), "rb");
+    if (!file)
+    {
+        URHO3D_LOGERRORF("Can't open terrain stamps: %s", path.CString());
+        return false;
+    }
+
+    uint8_t header[sc_headerSize];
+    uint32_t version = 0;
+    uint32_t count = 0;
+
+    bool success = fread(header, sc_headerSize, 1, file) == 1
+                    && memcmp(header, sc_magic, 4) == 0;
+
+    if (success)
+    {
+        memcpy(&version, header + 4, 4);
+        memcpy(&count,   header + 8, 4);
+
+        success = version == sc_version && count <= sc_maxCount;
+    }
+
+    uint8_t record[sc_recordSize];
+
+    for (unsigned i = 0; success && i < count; i ++)
+    {
+        success = fread(record, sc_recordSize, 1, file) == 1;
+
+        TerrainStamp stamp;
+        uint32_t type = 0;
+        float direction[3];
+        memcpy(direction,      record + 0,  12);
+        memcpy(&stamp.m_radius,  record + 12, 4);
+        memcpy(&stamp.m_falloff, record + 16, 4);
+        memcpy(&stamp.m_height,  record + 20, 4);
+        memcpy(&type,            record + 24, 4);
+        stamp.m_direction = Urho3D::Vector3(direction);
+        stamp.m_type = StampType(type);
+
+        success = success
+                    && type <= uint32_t(StampType::CRATER)
+                    && stamp.m_radius >= 0.0f
+                    && stamp.m_falloff >= 0.0f;
+
+        if (success)
+        {
+            m_stamps.Push(stamp);
+            insert(i);
+        }
+    }
+
+    fclose(file);
+
+    // Sorted once at the end instead of after every stamp
+    Urho3D::Sort(m_cells.Begin(), m_cells.End(), cell_less);
+
+    if (!success)
+    {
+        URHO3D_LOGERRORF("Invalid terrain stamps: %s", path.CString());
+        clear();
+    }
+
+    return success;
+}
+
+} // namespace osp
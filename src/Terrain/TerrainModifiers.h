@@ -0,0 +1,178 @@
+#pragma once
+
+#include <Urho3D/Container/RefCounted.h>
+#include <Urho3D/Container/Str.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include <cstdint>
+
+namespace osp
+{
+
+enum class StampType : uint32_t
+{
+    // Blend the terrain towards a single height, for launch pads and
+    // landing sites
+    FLATTEN,
+
+    // Dig a bowl with a raised rim
+    CRATER
+};
+
+/**
+ * A change to a planet's terrain around a point on its surface
+ */
+struct TerrainStamp
+{
+    // Direction from the planet's center to the middle of the stamp,
+    // normalized
+    Urho3D::Vector3 m_direction;
+
+    // Meters from the middle that are fully affected
+    float m_radius;
+
+    // Meters past m_radius to blend back into the original terrain. For
+    // craters, this is the width of the rim.
+    float m_falloff;
+
+    // FLATTEN: height to flatten to, relative to the planet's radius
+    // CRATER: depth of the middle, the rim is a fifth as high
+    float m_height;
+
+    StampType m_type;
+};
+
+/**
+ * Stamps layered over a planet's height data, applied by PlanetWrenderer
+ * when it displaces chunk vertices. Later stamps are applied on top of
+ * earlier ones.
+ *
+ * Every vertex looks up the stamps under it, so they're kept in a loose
+ * grid over directions from the planet's center. Each stamp goes in the
+ * level where cells are at least as big as it is, so it never touches more
+ * than 8 cells, and looking up a point only checks one cell for each level
+ * that has stamps. Cells are kept as a sorted list of keys instead of a
+ * hash map, as stamps are added rarely and looked up constantly.
+ *
+ * After adding a stamp, call PlanetWrenderer::invalidate with get_reach to
+ * make the chunks it touches again.
+ *
+ * File layout (little endian):
+ *
+ *     Header [12 bytes: magic, version, count]
+ *     Stamps [28 bytes each: direction, radius, falloff, height, type]
+ */
+class TerrainModifiers : public Urho3D::RefCounted
+{
+public:
+
+    // Cells at this level are 2^-sc_maxLevel wide, anything smaller goes in
+    // here too
+    static constexpr unsigned sc_maxLevel = 18;
+
+    TerrainModifiers(float planetRadius);
+    ~TerrainModifiers() = default;
+
+    /**
+     * Add a stamp on top of the others
+     * @param stamp [in] Stamp to add, m_direction is normalized
+     * @return Index of the new stamp
+     */
+    unsigned add(const TerrainStamp& stamp);
+
+    /**
+     * Remove all stamps
+     */
+    void clear();
+
+    /**
+     * Apply every stamp under a point to its height
+     * @param normal [in] Normalized direction from the planet's center
+     * @param height [in] Height from the height data, relative to the
+     *                    planet's radius
+     * @return Modified height
+     */
+    float apply(const Urho3D::Vector3& normal, float height) const;
+
+    /**
+     * @param stamp [in] Any stamp
+     * @return Distance between normalized directions past which the stamp
+     *         doesn't change anything
+     */
+    float get_reach(const TerrainStamp& stamp) const;
+
+    const Urho3D::PODVector<TerrainStamp>& get_stamps() const
+    {
+        return m_stamps;
+    }
+
+    /**
+     * Write all stamps to a file in the layout described above
+     * @param path [in] Path to file
+     * @return true if successful, errors are logged
+     */
+    bool save(const Urho3D::String& path) const;
+
+    /**
+     * Replace all stamps with the ones in a file written by save
+     * @param path [in] Path to file
+     * @return true if successful, errors are logged
+     */
+    bool load(const Urho3D::String& path);
+
+private:
+
+    struct Cell
+    {
+        uint64_t m_key;
+        unsigned m_stamp;
+    };
+
+    static bool cell_less(const Cell& a, const Cell& b);
+
+    /**
+     * Put a stamp in every cell it overlaps, without sorting m_cells
+     * @param index [in] Index of stamp in m_stamps
+     */
+    void insert(unsigned index);
+
+    /**
+     * @param level [in] Grid level, 0 to sc_maxLevel
+     * @param x [in] Cell coordinates at that level
+     * @param y [in]
+     * @param z [in]
+     * @return Key for m_cells
+     */
+    static uint64_t make_key(unsigned level, unsigned x, unsigned y,
+                             unsigned z);
+
+    /**
+     * @param level [in] Grid level, 0 to sc_maxLevel
+     * @param coord [in] Component of a direction, -1.0 to 1.0
+     * @return Cell coordinate on one axis
+     */
+    static unsigned get_cell(unsigned level, float coord);
+
+    /**
+     * @param stamp [in] Stamp to measure
+     * @param normal [in] Normalized direction
+     * @param height [in] Height before the stamp
+     * @return Height after the stamp
+     */
+    float apply_stamp(const TerrainStamp& stamp,
+                      const Urho3D::Vector3& normal, float height) const;
+
+    float m_planetRadius;
+
+    // In the order they were added
+    Urho3D::PODVector<TerrainStamp> m_stamps;
+
+    // Every cell each stamp is in, sorted by key then stamp
+    Urho3D::PODVector<Cell> m_cells;
+
+    // Bit for each level that has at least one stamp
+    uint32_t m_levelMask;
+};
+
+} // namespace osp
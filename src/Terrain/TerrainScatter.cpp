@@ -0,0 +1,50 @@
+#include <Urho3D/Core/Context.h>
+
+#include "TerrainScatter.h"
+
+namespace osp
+{
+
+TerrainScatter::TerrainScatter(Context* context) : InstanceGroup(context),
+                                                      m_poolVersion(0)
+{
+}
+
+void TerrainScatter::RegisterObject(Context* context)
+{
+    context->RegisterFactory<TerrainScatter>("TerrainScatter");
+}
+
+void TerrainScatter::set_pool(ScatterPool* pool)
+{
+    m_pool = pool;
+
+    // Make sure update_instances notices
+    m_poolVersion = pool ? pool->get_version() - 1 : 0;
+    update_instances();
+}
+
+void TerrainScatter::update_instances()
+{
+    if (m_pool && m_pool->get_version() == m_poolVersion)
+    {
+        return;
+    }
+
+    m_poolVersion = m_pool ? m_pool->get_version() : 0;
+    resize_instances(m_pool ? m_pool->get_instance_count() : 0);
+}
+
+unsigned TerrainScatter::get_block_count() const
+{
+    return m_pool ? m_pool->get_chunk_count() : 0;
+}
+
+const Matrix3x4* TerrainScatter::get_block(unsigned block,
+                                           unsigned& count) const
+{
+    count = m_pool->get_block_count(block);
+    return m_pool->get_block(block);
+}
+
+} // namespace osp
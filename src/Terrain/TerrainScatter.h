@@ -0,0 +1,60 @@
+#pragma once
+
+#include "../InstanceGroup.h"
+#include "ScatterPool.h"
+
+namespace osp
+{
+
+using namespace Urho3D;
+
+/**
+ * A component for drawing every object in a ScatterPool with a single model
+ * and material. Each of the pool's blocks is a block of instances, see
+ * InstanceGroup.
+ *
+ * Put it on the same Node as the PlanetTerrain the pool belongs to, and call
+ * update_instances after each terrain update.
+ */
+class TerrainScatter : public InstanceGroup
+{
+    URHO3D_OBJECT(TerrainScatter, InstanceGroup)
+
+public:
+    // For Urho3D
+    static void RegisterObject(Context* context);
+
+    TerrainScatter(Context* context);
+    ~TerrainScatter() = default;
+
+    /**
+     * Set which pool to draw
+     * @param pool [in] Pool filled by a PlanetWrenderer
+     */
+    void set_pool(ScatterPool* pool);
+
+    ScatterPool* get_pool() const { return m_pool; }
+
+    /**
+     * Make room for the pool's current instances if they changed. Only call
+     * from the main thread, as the world transforms can't be resized while
+     * they're being updated in worker threads.
+     */
+    void update_instances();
+
+protected:
+
+    unsigned get_block_count() const override;
+
+    const Matrix3x4* get_block(unsigned block,
+                               unsigned& count) const override;
+
+private:
+
+    SharedPtr<ScatterPool> m_pool;
+
+    // Pool version that m_worldTransforms was sized for
+    unsigned m_poolVersion;
+};
+
+} // namespace osp
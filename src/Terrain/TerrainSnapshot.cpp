@@ -0,0 +1,237 @@
+#include "TerrainSnapshot.h"
+
+#include <Urho3D/Math/MathDefs.h>
+
+#include <thread>
+
+namespace osp
+{
+
+bool ChunkSnapshot::contains(const Urho3D::Vector3& dir) const
+{
+    // dir is inside the chunk if it's on the same side of all three planes
+    // made by each edge and the planet's center. Corners are wound the same
+    // way for every triangle, but checking against the third corner doesn't
+    // rely on that.
+    for (int i = 0; i < 3; i ++)
+    {
+        const Urho3D::Vector3 edgeNormal
+                = m_corners[i].CrossProduct(m_corners[(i + 1) % 3]);
+        const float side = edgeNormal.DotProduct(m_corners[(i + 2) % 3]);
+
+        if (edgeNormal.DotProduct(dir) * side < 0.0f)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+float ChunkSnapshot::get_radius(const Urho3D::Vector3& dir,
+                                unsigned resolution) const
+{
+    const Urho3D::Vector3* c = m_corners;
+    const int vertsPerSide = int(resolution) - 1;
+
+    // Same as in PlanetWrenderer::chunk_add
+    const Urho3D::Vector3 dirRight = (c[2] - c[1]) / float(vertsPerSide);
+    const Urho3D::Vector3 dirDown = (c[1] - c[0]) / float(vertsPerSide);
+
+    // Project dir onto the flat triangle between the corners
+    const Urho3D::Vector3 normal = dirRight.CrossProduct(dirDown);
+    const Urho3D::Vector3 onPlane = dir * (normal.DotProduct(c[0])
+                                           / normal.DotProduct(dir));
+    const Urho3D::Vector3 rel = onPlane - c[0];
+
+    // Solve rel = dirRight * x + dirDown * y for vertex coordinates x and y
+    const float rr = dirRight.DotProduct(dirRight);
+    const float rd = dirRight.DotProduct(dirDown);
+    const float dd = dirDown.DotProduct(dirDown);
+    const float pr = rel.DotProduct(dirRight);
+    const float pd = rel.DotProduct(dirDown);
+    const float det = rr * dd - rd * rd;
+
+    float y = Urho3D::Clamp((rr * pd - rd * pr) / det,
+                            0.0f, float(vertsPerSide));
+    float x = Urho3D::Clamp((dd * pr - rd * pd) / det, 0.0f, y);
+
+    // Find which two rows and columns of vertices x and y are between
+    const int cellY = Urho3D::Min(int(y), vertsPerSide - 1);
+    const int cellX = Urho3D::Min(int(x), cellY);
+    const float fracX = x - float(cellX);
+    const float fracY = y - float(cellY);
+
+    const Urho3D::Vector3* pos = m_positions.Buffer();
+    const int top = cellY * (cellY + 1) / 2 + cellX;
+    const int bottom = (cellY + 1) * (cellY + 2) / 2 + cellX;
+
+    const float r00 = pos[top].Length();
+    const float r01 = pos[bottom].Length();
+    const float r11 = pos[bottom + 1].Length();
+
+    if (fracX <= fracY)
+    {
+        // Up pointing triangle: (x, y), (x, y + 1), (x + 1, y + 1)
+        return r00 + fracY * (r01 - r00) + fracX * (r11 - r01);
+    }
+    else
+    {
+        // Upside down triangle: (x, y), (x + 1, y), (x + 1, y + 1)
+        const float r10 = pos[top + 1].Length();
+        return r00 + fracX * (r10 - r00) + fracY * (r11 - r10);
+    }
+}
+
+TerrainSnapshot::~TerrainSnapshot()
+{
+    for (ChunkSnapshot* chunk : m_orphans)
+    {
+        delete chunk;
+    }
+}
+
+const ChunkSnapshot* TerrainSnapshot::find_chunk(
+        const Urho3D::Vector3& dir) const
+{
+    for (const ChunkSnapshot* chunk : m_chunks)
+    {
+        if (chunk->contains(dir))
+        {
+            return chunk;
+        }
+    }
+
+    return nullptr;
+}
+
+bool TerrainSnapshot::get_surface_radius(const Urho3D::Vector3& dir,
+                                         float& radius) const
+{
+    const ChunkSnapshot* chunk = find_chunk(dir);
+
+    if (!chunk)
+    {
+        return false;
+    }
+
+    radius = chunk->get_radius(dir, m_chunkResolution);
+    return true;
+}
+
+TerrainSnapshots::Reader::Reader(const TerrainSnapshots& snapshots)
+ : m_snapshots(snapshots)
+{
+    while (true)
+    {
+        for (unsigned i = 0; i < m_maxReaders; i ++)
+        {
+            // The epoch has to be written down before the current snapshot
+            // is read, so that the snapshot can't be deleted in between
+            uint64_t expected = 0;
+            const uint64_t epoch = snapshots.m_epoch.load();
+
+            if (snapshots.m_readers[i].compare_exchange_strong(expected,
+                                                                epoch))
+            {
+                m_slot = i;
+                m_snapshot = snapshots.m_current.load();
+                return;
+            }
+        }
+
+        // Every slot is taken. Readers only hold on for a short while, so
+        // just wait for one to finish.
+        std::this_thread::yield();
+    }
+}
+
+TerrainSnapshots::Reader::~Reader()
+{
+    m_snapshots.m_readers[m_slot].store(0);
+}
+
+TerrainSnapshots::TerrainSnapshots() : m_current(nullptr), m_epoch(1)
+{
+    for (std::atomic<uint64_t>& reader : m_readers)
+    {
+        reader.store(0);
+    }
+}
+
+TerrainSnapshots::~TerrainSnapshots()
+{
+    // There shouldn't be any readers left at this point
+    for (Retired& retired : m_retired)
+    {
+        delete retired.m_snapshot;
+    }
+
+    for (ChunkSnapshot* chunk : m_pendingChunks)
+    {
+        delete chunk;
+    }
+
+    delete m_current.load();
+}
+
+void TerrainSnapshots::publish(TerrainSnapshot* snapshot)
+{
+    TerrainSnapshot* previous = m_current.exchange(snapshot);
+
+    if (previous)
+    {
+        // Chunks removed since the previous snapshot might still be read
+        // through it, so they go with it
+        previous->m_orphans = m_pendingChunks;
+
+        // Readers that started before the epoch advances might have the
+        // previous snapshot
+        m_retired.Push({m_epoch.fetch_add(1), previous});
+    }
+    else
+    {
+        // Nothing was ever published, so nothing could have seen them
+        for (ChunkSnapshot* chunk : m_pendingChunks)
+        {
+            delete chunk;
+        }
+    }
+
+    m_pendingChunks.Clear();
+
+    collect();
+}
+
+void TerrainSnapshots::retire(ChunkSnapshot* chunk)
+{
+    m_pendingChunks.Push(chunk);
+}
+
+void TerrainSnapshots::collect()
+{
+    uint64_t oldestReader = UINT64_MAX;
+
+    for (const std::atomic<uint64_t>& reader : m_readers)
+    {
+        const uint64_t epoch = reader.load();
+        if (epoch != 0)
+        {
+            oldestReader = Urho3D::Min(oldestReader, epoch);
+        }
+    }
+
+    // Snapshots are retired in order, so stop at the first one that might
+    // still be in use
+    unsigned count = 0;
+    while (count < m_retired.Size()
+           && m_retired[count].m_epoch < oldestReader)
+    {
+        delete m_retired[count].m_snapshot;
+        count ++;
+    }
+
+    m_retired.Erase(0, count);
+}
+
+} // namespace osp
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Math/Vector3.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace osp
+{
+
+/**
+ * Read-only copy of a single chunk's surface, made when the chunk is added.
+ * Chunks never change once made, so unchanged chunks are shared between every
+ * TerrainSnapshot they're part of.
+ */
+struct ChunkSnapshot
+{
+    // Triangle in the IcoSphereTree the chunk was made on. May be reused by
+    // another triangle after the chunk is removed, so only use this for
+    // telling chunks apart.
+    uint32_t m_triangle;
+    uint8_t m_depth;
+
+    // Top, left, and right corners of the triangle, on the undisplaced sphere
+    Urho3D::Vector3 m_corners[3];
+
+    // Positions of every vertex, row by row from the top corner:
+    //
+    // 0
+    // 1  2
+    // 3  4  5
+    //
+    // Vertex (x, y) is at y * (y + 1) / 2 + x, same as
+    // PlanetWrenderer::get_index
+    Urho3D::PODVector<Urho3D::Vector3> m_positions;
+
+    /**
+     * @param dir [in] Direction from the planet's center, doesn't need to be
+     *                 normalized
+     * @return true if dir points somewhere on this chunk
+     */
+    bool contains(const Urho3D::Vector3& dir) const;
+
+    /**
+     * Get the distance from the planet's center to this chunk's surface,
+     * interpolated between the vertices around dir
+     * @param dir [in] Direction from the planet's center, should be a
+     *                 direction that this chunk contains
+     * @param resolution [in] How many vertices wide the chunk is
+     * @return Distance to surface
+     */
+    float get_radius(const Urho3D::Vector3& dir, unsigned resolution) const;
+};
+
+/**
+ * A consistent version of a planet's terrain, published by PlanetWrenderer
+ * after each update. Never modified after being published, so any number of
+ * threads can read it at the same time without locking.
+ *
+ * Get one through TerrainSnapshots::Reader.
+ */
+class TerrainSnapshot
+{
+public:
+    TerrainSnapshot() = default;
+    ~TerrainSnapshot();
+
+    /**
+     * Find the chunk under a direction from the planet's center
+     * @param dir [in] Direction, doesn't need to be normalized
+     * @return Chunk under dir, or nullptr if there isn't one
+     */
+    const ChunkSnapshot* find_chunk(const Urho3D::Vector3& dir) const;
+
+    /**
+     * Get the distance from the planet's center to the terrain's surface,
+     * interpolated between the vertices of whichever chunk is under dir.
+     * @param dir [in] Direction, doesn't need to be normalized
+     * @param radius [out] Set to distance to surface if successful
+     * @return false if there is no chunk under dir
+     */
+    bool get_surface_radius(const Urho3D::Vector3& dir, float& radius) const;
+
+    // Increases by one for each snapshot published by the same terrain
+    uint64_t m_version = 0;
+
+    // How many vertices wide each chunk is
+    unsigned m_chunkResolution = 0;
+
+    // Every chunk in the terrain at the time. Owned by the terrain, not by
+    // the snapshot.
+    Urho3D::PODVector<const ChunkSnapshot*> m_chunks;
+
+    // Chunks removed after this snapshot was published, that no newer
+    // snapshot uses. Deleted along with this snapshot.
+    Urho3D::PODVector<ChunkSnapshot*> m_orphans;
+};
+
+/**
+ * Publishes TerrainSnapshots from a single updating thread to any number of
+ * reader threads, without locks.
+ *
+ * Old snapshots are freed using epochs: each publish advances a global epoch,
+ * and readers write down which epoch they started reading in. A snapshot
+ * replaced in epoch E can only be seen by readers that started in epoch E or
+ * earlier, so it's deleted once every active reader has started after E.
+ *
+ * Readers should hold on to a snapshot briefly, like for a single query or
+ * building a single collision shape. A reader that never lets go keeps every
+ * snapshot published after it started from being deleted.
+ */
+class TerrainSnapshots
+{
+public:
+
+    // Maximum number of readers at the same time
+    static constexpr unsigned m_maxReaders = 32;
+
+    /**
+     * Pins the current snapshot for as long as it exists. Create one on the
+     * stack around each read.
+     */
+    class Reader
+    {
+    public:
+        Reader(const TerrainSnapshots& snapshots);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        /**
+         * @return Current snapshot at the time the Reader was made, or
+         *         nullptr if nothing was published yet
+         */
+        const TerrainSnapshot* get() const { return m_snapshot; }
+
+    private:
+        const TerrainSnapshots& m_snapshots;
+        const TerrainSnapshot* m_snapshot;
+        unsigned m_slot;
+    };
+
+    TerrainSnapshots();
+    ~TerrainSnapshots();
+
+    TerrainSnapshots(const TerrainSnapshots&) = delete;
+    TerrainSnapshots& operator=(const TerrainSnapshots&) = delete;
+
+    /**
+     * Make a snapshot the current one, and delete old snapshots that no
+     * reader can be using anymore. Only call from the updating thread.
+     * @param snapshot [in] New snapshot, ownership is taken
+     */
+    void publish(TerrainSnapshot* snapshot);
+
+    /**
+     * Delete a chunk once no snapshot uses it anymore. Only call from the
+     * updating thread.
+     * @param chunk [in] Chunk that was removed, ownership is taken
+     */
+    void retire(ChunkSnapshot* chunk);
+
+    /**
+     * @return Number of old snapshots waiting for readers to finish
+     */
+    unsigned get_retired_count() const { return m_retired.Size(); }
+
+private:
+
+    struct Retired
+    {
+        uint64_t m_epoch;
+        TerrainSnapshot* m_snapshot;
+    };
+
+    /**
+     * Delete retired snapshots that are older than every active reader
+     */
+    void collect();
+
+    std::atomic<TerrainSnapshot*> m_current;
+
+    // Starts at 1, so that 0 can mean a reader slot is free
+    std::atomic<uint64_t> m_epoch;
+
+    // Epoch each active reader started in, or 0 if the slot is free
+    mutable std::atomic<uint64_t> m_readers[m_maxReaders];
+
+    // Only touched by the updating thread
+
+    // Oldest first
+    Urho3D::PODVector<Retired> m_retired;
+
+    // Chunks removed since the last publish
+    Urho3D::PODVector<ChunkSnapshot*> m_pendingChunks;
+};
+
+} // namespace osp
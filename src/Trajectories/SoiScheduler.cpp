@@ -0,0 +1,500 @@
+#include <Urho3D/IO/Log.h>
+
+#include "../Satellites/Satellite.h"
+#include "SoiScheduler.h"
+#include "TrajectoryKepler.h"
+
+#include <cmath>
+
+namespace osp
+{
+
+// Orbits are looked ahead for one period at most, as the moons will have
+// moved on by then. Orbits that don't repeat look ahead a year.
+static constexpr double sc_maxLookahead = 3.15576e7;
+
+// Passes through a sphere of influence quicker than this fraction of the
+// time it takes to cross its radius might be missed
+static constexpr double sc_minStepFraction = 0.01;
+
+// Steps looking for a crossing into any single moon before giving up and
+// looking again later
+static constexpr unsigned sc_maxSteps = 4096;
+
+// Crossings are found to within this many seconds
+static constexpr double sc_timeTolerance = 1e-3;
+
+// Looking again takes at least this many seconds, so nothing can keep
+// rescheduling itself at the same time
+static constexpr double sc_minRecheck = 1.0;
+
+/**
+ * A moon whose sphere of influence an orbit might cross into
+ */
+struct SoiTarget
+{
+    // Orbit of the moon, if it's on one
+    KeplerElements m_orbit;
+    bool m_moving;
+
+    // Position of the moon if it's not moving, in meters
+    double m_x, m_y, m_z;
+
+    double m_radius;
+};
+
+/**
+ * @param orbit [in] Orbit looking for a crossing
+ * @param target [in] Moon to cross into
+ * @param time [in] Seconds since the universe was created
+ * @return Distance from the moon's sphere of influence, negative inside
+ */
+static double get_gap(const KeplerElements& orbit, const SoiTarget& target,
+                      double time)
+{
+    const KeplerState state = orbit.get_state(time);
+    double x = target.m_x, y = target.m_y, z = target.m_z;
+
+    if (target.m_moving)
+    {
+        const KeplerState moon = target.m_orbit.get_state(time);
+        x = moon.m_x;
+        y = moon.m_y;
+        z = moon.m_z;
+    }
+
+    const double dx = state.m_x - x;
+    const double dy = state.m_y - y;
+    const double dz = state.m_z - z;
+
+    return std::sqrt(dx * dx + dy * dy + dz * dz) - target.m_radius;
+}
+
+/**
+ * Find the first time an orbit crosses into a moon's sphere of influence.
+ * Steps forward by the distance left over the fastest the two can close
+ * in, so it can't step over a crossing, then bisects down to it.
+ * @param orbit [in] Orbit looking for a crossing
+ * @param target [in] Moon to cross into
+ * @param after [in] Time to start looking from
+ * @param before [ref] Time to look up to. Set to the time of the crossing
+ *                     if there is one, or earlier if looking that far took
+ *                     too many steps.
+ * @return true if a crossing was found
+ */
+static bool first_contact(const KeplerElements& orbit,
+                          const SoiTarget& target, double after,
+                          double& before)
+{
+    const double speed = orbit.get_max_speed()
+            + (target.m_moving ? target.m_orbit.get_max_speed() : 0.0);
+    const double minStep = sc_minStepFraction * target.m_radius / speed;
+
+    double t = after;
+    double gap = get_gap(orbit, target, t);
+    unsigned steps = 0;
+
+    // Starting inside, like right after leaving it. Doesn't count as
+    // crossing in until it's out again.
+    while (gap <= 0.0 && t < before && steps < sc_maxSteps)
+    {
+        t += minStep;
+        gap = get_gap(orbit, target, t);
+        steps ++;
+    }
+
+    while (t < before && steps < sc_maxSteps)
+    {
+        const double next = Min(t + Max(gap / speed, minStep), before);
+        const double nextGap = get_gap(orbit, target, next);
+        steps ++;
+
+        if (nextGap <= 0.0)
+        {
+            // End up just inside, so it doesn't count as starting inside
+            // once it's moved over
+            double outside = t;
+            double inside = next;
+
+            while (inside - outside > sc_timeTolerance)
+            {
+                const double middle = 0.5 * (outside + inside);
+
+                if (get_gap(orbit, target, middle) <= 0.0)
+                {
+                    inside = middle;
+                }
+                else
+                {
+                    outside = middle;
+                }
+            }
+
+            before = inside;
+            return true;
+        }
+
+        t = next;
+        gap = nextGap;
+    }
+
+    before = Min(before, t);
+    return false;
+}
+
+/**
+ * Get where a body is relative to a Trajectory's center
+ * @param trajectory [in] Trajectory with the center
+ * @param body [in] Child of the center, on an orbit in trajectory or not
+ *                  moving at all
+ * @param time [in] Seconds since the universe was created
+ * @return Position and velocity of body
+ */
+static KeplerState get_body_state(const TrajectoryKepler* trajectory,
+                                  const Satellite* body, double time)
+{
+    KeplerElements orbit;
+
+    if (trajectory->get_elements(body, orbit))
+    {
+        return orbit.get_state(time);
+    }
+
+    // Units to meters
+    const double scale = std::ldexp(
+                1.0, -trajectory->get_center()->get_precision());
+    const LongVector3 pos = body->get_position();
+
+    KeplerState state;
+    state.m_x = pos.x_ * scale;
+    state.m_y = pos.y_ * scale;
+    state.m_z = pos.z_ * scale;
+    state.m_vx = state.m_vy = state.m_vz = 0.0;
+    return state;
+}
+
+SoiScheduler::SoiScheduler(Context* context) : Object(context),
+        m_time(0.0)
+{
+
+}
+
+void SoiScheduler::add_trajectory(TrajectoryKepler* trajectory)
+{
+    m_trajectories.Push(WeakPtr<TrajectoryKepler>(trajectory));
+}
+
+void SoiScheduler::clear()
+{
+    m_trajectories.Clear();
+    m_events.Clear();
+    m_serials.Clear();
+}
+
+void SoiScheduler::schedule(TrajectoryKepler* trajectory, Satellite* sat)
+{
+    KeplerElements orbit;
+
+    if (!sat || !trajectory->get_elements(sat, orbit))
+    {
+        return;
+    }
+
+    SoiEvent event;
+    event.m_satellite = sat;
+    event.m_key = sat;
+    event.m_serial = ++ m_serials[sat];
+    event.m_from = trajectory;
+
+    // Leaving the center's sphere of influence for its parent's
+    const Satellite* center = trajectory->get_center();
+    TrajectoryKepler* parent = center
+            ? find_trajectory(center->get_parent()) : nullptr;
+    const double exitTime = parent
+            ? orbit.get_exit_time(trajectory->get_sphere_of_influence(),
+                                  m_time)
+            : INFINITY;
+
+    double before = Min(exitTime, m_time + Min(orbit.get_period(),
+                                               sc_maxLookahead));
+    bool reachable = false;
+    TrajectoryKepler* moon = find_entry(trajectory, sat, orbit, before,
+                                        reachable);
+
+    if (moon)
+    {
+        event.m_time = before;
+        event.m_to = moon;
+    }
+    else if (before >= exitTime || (!reachable && exitTime < INFINITY))
+    {
+        // Leaves before getting to any moon, or can't get to any at all
+        event.m_time = exitTime;
+        event.m_to = parent;
+    }
+    else if (reachable)
+    {
+        // Nothing for now, but the moons will be somewhere else next time
+        // around
+        event.m_time = Max(before, m_time + sc_minRecheck);
+    }
+    else
+    {
+        // Stays put until something else moves it
+        m_serials.Erase(sat);
+        return;
+    }
+
+    push_event(event);
+}
+
+void SoiScheduler::update(double time)
+{
+    while (!m_events.Empty() && m_events.Front().m_time <= time)
+    {
+        const SoiEvent event = m_events.Front();
+        pop_event();
+
+        HashMap<Satellite*, unsigned>::Iterator serial
+                = m_serials.Find(event.m_key);
+
+        if (serial == m_serials.End() || serial->second_ != event.m_serial)
+        {
+            // Scheduled again since
+            continue;
+        }
+
+        Satellite* sat = event.m_satellite;
+        TrajectoryKepler* from = event.m_from;
+        KeplerElements orbit;
+
+        if (!sat || !from || sat->get_parent() != from->get_center()
+                || !from->get_elements(sat, orbit))
+        {
+            // Deleted, or moved some other way since
+            m_serials.Erase(serial);
+            continue;
+        }
+
+        m_time = Max(m_time, event.m_time);
+
+        if (event.m_to.NotNull())
+        {
+            transfer(event);
+        }
+        else
+        {
+            schedule(from, sat);
+        }
+    }
+
+    m_time = Max(m_time, time);
+}
+
+TrajectoryKepler* SoiScheduler::find_trajectory(const Satellite* center) const
+{
+    if (!center)
+    {
+        return nullptr;
+    }
+
+    for (const WeakPtr<TrajectoryKepler>& trajectory : m_trajectories)
+    {
+        if (trajectory.NotNull() && trajectory->get_center() == center)
+        {
+            return trajectory;
+        }
+    }
+
+    return nullptr;
+}
+
+TrajectoryKepler* SoiScheduler::find_entry(TrajectoryKepler* trajectory,
+                                           const Satellite* sat,
+                                           const KeplerElements& orbit,
+                                           double& before,
+                                           bool& reachable) const
+{
+    const Satellite* center = trajectory->get_center();
+    TrajectoryKepler* entered = nullptr;
+
+    // Time of the crossing into entered
+    double enteredTime = INFINITY;
+
+    for (const WeakPtr<TrajectoryKepler>& other : m_trajectories)
+    {
+        if (other.Null() || other == trajectory)
+        {
+            continue;
+        }
+
+        const Satellite* moon = other->get_center();
+        const double radius = other->get_sphere_of_influence();
+
+        if (!moon || moon == sat || moon->get_parent() != center
+                || radius <= 0.0)
+        {
+            continue;
+        }
+
+        SoiTarget target;
+        target.m_radius = radius;
+        target.m_moving = trajectory->get_elements(moon, target.m_orbit);
+
+        double nearest, furthest;
+
+        if (target.m_moving)
+        {
+            target.m_x = target.m_y = target.m_z = 0.0;
+            nearest = target.m_orbit.get_periapsis();
+            furthest = target.m_orbit.get_apoapsis();
+        }
+        else
+        {
+            const KeplerState state = get_body_state(trajectory, moon,
+                                                     m_time);
+            target.m_x = state.m_x;
+            target.m_y = state.m_y;
+            target.m_z = state.m_z;
+            nearest = furthest = std::sqrt(state.m_x * state.m_x
+                                           + state.m_y * state.m_y
+                                           + state.m_z * state.m_z);
+        }
+
+        // Never gets as close or as far from the center as the sphere of
+        // influence does, no matter where along their orbits they are
+        if (orbit.get_periapsis() > furthest + radius
+                || orbit.get_apoapsis() < nearest - radius)
+        {
+            continue;
+        }
+
+        reachable = true;
+
+        // Shortens before to each crossing found, so the earliest wins
+        if (first_contact(orbit, target, m_time, before))
+        {
+            entered = other;
+            enteredTime = before;
+        }
+        else if (before < enteredTime)
+        {
+            // Gave up on this moon before the crossing found so far, so
+            // there might be an earlier one. Only safe to look again then.
+            entered = nullptr;
+            enteredTime = INFINITY;
+        }
+    }
+
+    return entered;
+}
+
+void SoiScheduler::transfer(const SoiEvent& event)
+{
+    Satellite* sat = event.m_satellite;
+    TrajectoryKepler* from = event.m_from;
+    TrajectoryKepler* to = event.m_to;
+    Satellite* fromCenter = from->get_center();
+    Satellite* toCenter = to->get_center();
+
+    KeplerElements orbit;
+    from->get_elements(sat, orbit);
+    KeplerState state = orbit.get_state(m_time);
+
+    // Relative to the new center, which is either the old center's parent
+    // or one of its moons
+    KeplerState offset;
+    double sign;
+
+    if (toCenter == fromCenter->get_parent())
+    {
+        offset = get_body_state(to, fromCenter, m_time);
+        sign = 1.0;
+    }
+    else
+    {
+        offset = get_body_state(from, toCenter, m_time);
+        sign = -1.0;
+    }
+
+    state.m_x += offset.m_x * sign;
+    state.m_y += offset.m_y * sign;
+    state.m_z += offset.m_z * sign;
+    state.m_vx += offset.m_vx * sign;
+    state.m_vy += offset.m_vy * sign;
+    state.m_vz += offset.m_vz * sign;
+
+    KeplerElements next;
+
+    if (!KeplerElements::from_state(state, to->get_gravity(), m_time, next))
+    {
+        URHO3D_LOGWARNING("SoiScheduler: Satellite can't continue on a "
+                          "Kepler orbit, staying where it is");
+        m_serials.Erase(event.m_key);
+        return;
+    }
+
+    from->remove_orbit(sat);
+
+    // Reparents it, and schedules it again
+    to->add_orbit(sat, next);
+}
+
+void SoiScheduler::push_event(const SoiEvent& event)
+{
+    m_events.Push(event);
+
+    // Sift up
+    unsigned i = m_events.Size() - 1;
+
+    while (i > 0)
+    {
+        const unsigned parent = (i - 1) / 2;
+
+        if (m_events[parent].m_time <= m_events[i].m_time)
+        {
+            break;
+        }
+
+        Swap(m_events[parent], m_events[i]);
+        i = parent;
+    }
+}
+
+void SoiScheduler::pop_event()
+{
+    m_events.Front() = m_events.Back();
+    m_events.Pop();
+
+    // Sift down
+    const unsigned count = m_events.Size();
+    unsigned i = 0;
+
+    while (true)
+    {
+        const unsigned left = i * 2 + 1;
+        const unsigned right = left + 1;
+        unsigned earliest = i;
+
+        if (left < count && m_events[left].m_time < m_events[earliest].m_time)
+        {
+            earliest = left;
+        }
+
+        if (right < count
+                && m_events[right].m_time < m_events[earliest].m_time)
+        {
+            earliest = right;
+        }
+
+        if (earliest == i)
+        {
+            break;
+        }
+
+        Swap(m_events[earliest], m_events[i]);
+        i = earliest;
+    }
+}
+
+} // namespace osp
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Core/Object.h>
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+class Satellite;
+class TrajectoryKepler;
+struct KeplerElements;
+
+/**
+ * A Satellite leaving one sphere of influence for another, or a time to
+ * look again for when it will
+ */
+struct SoiEvent
+{
+    // Seconds since the universe was created
+    double m_time;
+
+    WeakPtr<Satellite> m_satellite;
+
+    // Key of m_satellite in SoiScheduler::m_serials, still usable after
+    // it's deleted
+    Satellite* m_key;
+
+    // Matches SoiScheduler::m_serials unless the Satellite was scheduled
+    // again since
+    unsigned m_serial;
+
+    // Trajectory moving the Satellite when this was scheduled
+    WeakPtr<TrajectoryKepler> m_from;
+
+    // Trajectory to move it to, null to only schedule it again
+    WeakPtr<TrajectoryKepler> m_to;
+};
+
+/**
+ * Moves Satellites on TrajectoryKepler orbits between spheres of influence
+ * exactly when they cross into or out of them.
+ *
+ * The next crossing of each orbit is worked out once when the orbit is
+ * added, and kept in a priority queue by time. Satellites that don't cross
+ * anything soon cost nothing until then, and no crossing is missed at high
+ * time warp, as events are fired in order however many fit in a frame.
+ *
+ * Every TrajectoryKepler with a sphere of influence is added with
+ * add_trajectory, each one is the sphere of influence of its center.
+ * Moons are found by their centers being children of another center.
+ * Registered as a subsystem, and updated by OspUniverse at the start of
+ * each frame before any Trajectory.
+ */
+class SoiScheduler : public Object
+{
+    URHO3D_OBJECT(SoiScheduler, Object)
+
+public:
+
+    SoiScheduler(Context* context);
+    ~SoiScheduler() = default;
+
+    /**
+     * Let Satellites cross into or out of a Trajectory's sphere of
+     * influence. Only orbits added after this can cross into it.
+     * @param trajectory [in] Trajectory to add
+     */
+    void add_trajectory(TrajectoryKepler* trajectory);
+
+    /**
+     * Forget every Trajectory and event, for when the universe is
+     * destroyed. The time is kept, it's the same clock as OspUniverse's.
+     */
+    void clear();
+
+    /**
+     * Work out the next time a Satellite crosses into or out of a sphere of
+     * influence, replacing any event it already has. Called by
+     * TrajectoryKepler::add_orbit.
+     * @param trajectory [in] Trajectory moving sat
+     * @param sat [in] Satellite to schedule
+     */
+    void schedule(TrajectoryKepler* trajectory, Satellite* sat);
+
+    /**
+     * Fire every event up to a time, in order
+     * @param time [in] Seconds since the universe was created
+     */
+    void update(double time);
+
+    /**
+     * @return Time of the last update, or of the event being fired
+     */
+    double get_time() const { return m_time; }
+
+    /**
+     * @return Number of events waiting, including ones that were replaced
+     */
+    unsigned get_pending() const { return m_events.Size(); }
+
+private:
+
+    /**
+     * @param center [in] Center to look for
+     * @return Trajectory added with center as its center, or null
+     */
+    TrajectoryKepler* find_trajectory(const Satellite* center) const;
+
+    /**
+     * Find the first time an orbit crosses into the sphere of influence of
+     * any of the moons of its center
+     * @param trajectory [in] Trajectory with the orbit
+     * @param sat [in] Satellite on the orbit
+     * @param orbit [in] Orbit to check
+     * @param before [ref] Latest time to look up to. Set to the time of the
+     *                     crossing if there is one, or earlier if looking
+     *                     that far took too long.
+     * @param reachable [out] Set to true if the orbit gets anywhere near
+     *                        any moon's orbit, left as is otherwise
+     * @return Trajectory of the moon crossed into at before, or null if
+     *         none was found up to before
+     */
+    TrajectoryKepler* find_entry(TrajectoryKepler* trajectory,
+                                 const Satellite* sat,
+                                 const KeplerElements& orbit,
+                                 double& before, bool& reachable) const;
+
+    /**
+     * Move a Satellite over to another Trajectory, with the orbit that
+     * continues from where it is now
+     * @param event [in] Event being fired
+     */
+    void transfer(const SoiEvent& event);
+
+    /**
+     * Add an event, keeping m_events a heap
+     * @param event [in] Event to add
+     */
+    void push_event(const SoiEvent& event);
+
+    /**
+     * Remove the earliest event, keeping m_events a heap
+     */
+    void pop_event();
+
+    // Every Trajectory with a sphere of influence
+    Vector< WeakPtr<TrajectoryKepler> > m_trajectories;
+
+    // Binary min-heap by m_time, earliest first
+    Vector<SoiEvent> m_events;
+
+    // Latest serial of each Satellite with an event
+    HashMap<Satellite*, unsigned> m_serials;
+
+    double m_time;
+};
+
+} // namespace osp
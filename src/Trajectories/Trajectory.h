@@ -11,6 +11,10 @@ namespace osp {
 /**
  * Base class for any strategy that describes a path a Satellite can take
  * eg. TrajectoryKeplerOrbit, TrajectoryLanded, etc...
+ *
+ * A Trajectory can move any number of Satellites at once. OspUniverse
+ * updates every Trajectory at the start of each frame, before positions are
+ * calculated by SatellitePositions.
  */
 class Trajectory : public Urho3D::Object
 {
@@ -22,6 +26,14 @@ public:
     using Urho3D::Object::Object;
     ~Trajectory() = default;
 
+    /**
+     * Move every Satellite that follows this Trajectory to where it should
+     * be. Satellites loaded into an ActiveArea are left to the physics
+     * engine, unless their m_trajectoryOverride is set.
+     * @param time [in] Seconds since the universe was created
+     */
+    virtual void update(double time) = 0;
+
 protected:
 
     // put stuff here
@@ -0,0 +1,1071 @@
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Math/Random.h>
+
+#include "../Satellites/Satellite.h"
+#include "SoiScheduler.h"
+#include "TrajectoryKepler.h"
+
+#include <cmath>
+
+namespace osp
+{
+
+// Urho3D's M_PI is a float, not nearly precise enough here
+static constexpr double sc_pi = 3.14159265358979323846;
+static constexpr double sc_twoPi = 2.0 * sc_pi;
+
+// Stop iterating an orbit once the error left in its anomaly is less than
+// this many radians
+static constexpr double sc_tolerance = 1e-12;
+
+// Steps bigger than this always get another iteration
+static constexpr double sc_bigStep = 1e-3;
+
+// Newton's method from the starting guesses below takes under 10
+// iterations at worst, this is only to stop if something goes wrong
+static constexpr unsigned sc_maxIterations = 16;
+
+// Newton iterations every orbit gets, in loops straight over the arrays
+// with nothing to branch on so they vectorise. Only orbits still off after
+// these are picked out to iterate further. From a warm start, one is
+// usually all it takes, and a second pass costs more than picking out the
+// orbits that need it.
+static constexpr unsigned sc_firstPasses = 1;
+
+// Orbits worked on at once in each pass, few enough to stay in L1 cache
+static constexpr unsigned sc_passBlock = 64;
+
+// Start from the last solution if the first Newton step from it would
+// change the anomaly by less than this many radians. Further than that,
+// nearly parabolic orbits can overshoot.
+static constexpr double sc_warmStart = 0.1;
+
+void KeplerOrbits::push(Satellite* sat, const KeplerElements& elements)
+{
+    if (sat)
+    {
+        m_indices[sat] = size();
+    }
+
+    m_satellites.Push(WeakPtr<Satellite>(sat));
+    m_keys.Push(sat);
+    m_semiMajor.Push(elements.m_semiMajor);
+    m_semiMinor.Push(elements.m_semiMinor);
+    m_eccentricity.Push(elements.m_eccentricity);
+    m_meanMotion.Push(elements.m_meanMotion);
+    m_meanAnomaly.Push(elements.m_meanAnomaly);
+    m_px.Push(elements.m_px);
+    m_py.Push(elements.m_py);
+    m_pz.Push(elements.m_pz);
+    m_qx.Push(elements.m_qx);
+    m_qy.Push(elements.m_qy);
+    m_qz.Push(elements.m_qz);
+
+    // Never solved, so there's nothing to start from
+    m_mean.Push(NAN);
+    m_anomaly.Push(0.0);
+    m_sin.Push(0.0);
+    m_cos.Push(1.0);
+    m_x.Push(0.0);
+    m_y.Push(0.0);
+    m_z.Push(0.0);
+}
+
+bool KeplerOrbits::find(const Satellite* sat, unsigned& index) const
+{
+    if (!sat)
+    {
+        return false;
+    }
+
+    HashMap<const Satellite*, unsigned>::ConstIterator it
+            = m_indices.Find(sat);
+
+    if (it == m_indices.End())
+    {
+        return false;
+    }
+
+    index = it->second_;
+    return true;
+}
+
+void KeplerOrbits::erase(unsigned index)
+{
+    // Only if it's this orbit's entry, a Satellite added again or a new one
+    // where a deleted one used to be could have replaced it
+    HashMap<const Satellite*, unsigned>::Iterator it
+            = m_indices.Find(m_keys[index]);
+
+    if (it != m_indices.End() && it->second_ == index)
+    {
+        m_indices.Erase(it);
+    }
+
+    // The last orbit is about to be moved into index
+    const unsigned last = size() - 1;
+    it = m_indices.Find(m_keys[last]);
+
+    if (index != last && it != m_indices.End() && it->second_ == last)
+    {
+        it->second_ = index;
+    }
+
+    m_satellites.EraseSwap(index);
+    m_keys.EraseSwap(index);
+    m_semiMajor.EraseSwap(index);
+    m_semiMinor.EraseSwap(index);
+    m_eccentricity.EraseSwap(index);
+    m_meanMotion.EraseSwap(index);
+    m_meanAnomaly.EraseSwap(index);
+    m_px.EraseSwap(index);
+    m_py.EraseSwap(index);
+    m_pz.EraseSwap(index);
+    m_qx.EraseSwap(index);
+    m_qy.EraseSwap(index);
+    m_qz.EraseSwap(index);
+    m_mean.EraseSwap(index);
+    m_anomaly.EraseSwap(index);
+    m_sin.EraseSwap(index);
+    m_cos.EraseSwap(index);
+    m_x.EraseSwap(index);
+    m_y.EraseSwap(index);
+    m_z.EraseSwap(index);
+}
+
+void KeplerOrbits::clear()
+{
+    m_satellites.Clear();
+    m_keys.Clear();
+    m_indices.Clear();
+    m_semiMajor.Clear();
+    m_semiMinor.Clear();
+    m_eccentricity.Clear();
+    m_meanMotion.Clear();
+    m_meanAnomaly.Clear();
+    m_px.Clear();
+    m_py.Clear();
+    m_pz.Clear();
+    m_qx.Clear();
+    m_qy.Clear();
+    m_qz.Clear();
+    m_mean.Clear();
+    m_anomaly.Clear();
+    m_sin.Clear();
+    m_cos.Clear();
+    m_x.Clear();
+    m_y.Clear();
+    m_z.Clear();
+}
+
+/**
+ * Positions of orbits in the perifocal frame, rotated into the reference
+ * frame with the P and Q vectors
+ * @param orbits [ref] Orbits with m_x, m_y and m_z to write to
+ * @param i [in] Index of orbit
+ * @param xp [in] Distance along P
+ * @param yp [in] Distance along Q
+ */
+static void to_reference_frame(KeplerOrbits& orbits, unsigned i, double xp,
+                               double yp)
+{
+    orbits.m_x[i] = orbits.m_px[i] * xp + orbits.m_qx[i] * yp;
+    orbits.m_y[i] = orbits.m_py[i] * xp + orbits.m_qy[i] * yp;
+    orbits.m_z[i] = orbits.m_pz[i] * xp + orbits.m_qz[i] * yp;
+}
+
+/**
+ * @param angle [in] Any angle in radians
+ * @return Same angle wrapped to [-pi, pi)
+ */
+static double wrap_angle(double angle)
+{
+    return angle - sc_twoPi * std::floor((angle + sc_pi) / sc_twoPi);
+}
+
+/**
+ * One Newton iteration of M = E - e*sin(E). sin and cos of the new anomaly
+ * are calculated from the old ones, the step is small by the time it
+ * matters so second order is plenty.
+ * @param e [in] Eccentricity
+ * @param mean [in] Mean anomaly
+ * @param anomaly [ref] Eccentric anomaly, replaced with the next guess
+ * @param sine [ref] sin of anomaly, replaced with sin of the next guess
+ * @param cosine [ref] cos of anomaly, replaced with cos of the next guess
+ * @return Positive if another iteration is needed
+ */
+static double newton_elliptic(double e, double mean, double& anomaly,
+                              double& sine, double& cosine)
+{
+    const double x = anomaly;
+    const double s = sine;
+    const double c = cosine;
+    const double slope = 1.0 - e * c;
+    const double step = (x - e * s - mean) / slope;
+
+    const double half = 0.5 * step * step;
+    sine = s * (1.0 - half) - c * step;
+    cosine = c * (1.0 - half) + s * step;
+    anomaly = x - step;
+
+    // Newton's method converges quadratically, the error left after this
+    // step is about step^2 * f'' / 2f'. Big steps are taken again anyways,
+    // in case f'' happened to be near zero.
+    return Max(step * step * std::fabs(e * s) - sc_tolerance * slope,
+               std::fabs(step) - sc_bigStep);
+}
+
+/**
+ * One Newton iteration of M = e*sinh(F) - F, see newton_elliptic
+ * @param e [in] Eccentricity
+ * @param mean [in] Mean anomaly
+ * @param anomaly [ref] Hyperbolic anomaly, replaced with the next guess
+ * @param sine [out] sinh of the next guess
+ * @param cosine [out] cosh of the next guess
+ * @return Positive if another iteration is needed
+ */
+static double newton_hyperbolic(double e, double mean, double& anomaly,
+                                double& sine, double& cosine)
+{
+    const double x = anomaly;
+
+    // One exp instead of separate sinh and cosh
+    const double ex = std::exp(x);
+    const double s = 0.5 * (ex - 1.0 / ex);
+    const double c = 0.5 * (ex + 1.0 / ex);
+    const double slope = e * c - 1.0;
+    const double step = (e * s - x - mean) / slope;
+
+    const double half = 0.5 * step * step;
+    sine = s * (1.0 + half) - c * step;
+    cosine = c * (1.0 + half) - s * step;
+    anomaly = x - step;
+
+    return Max(step * step * std::fabs(e * s) - sc_tolerance * slope,
+               std::fabs(step) - sc_bigStep);
+}
+
+/**
+ * One Newton iteration for every elliptic orbit, in loops with nothing to
+ * branch on so the compiler can vectorise them
+ * @param orbits [ref] Orbits with m_mean and m_anomaly set. m_anomaly is
+ *                     replaced with the next guess, m_sin and m_cos are
+ *                     set to match it, and m_error is set.
+ */
+static void pass_elliptic(KeplerOrbits& orbits)
+{
+    const unsigned count = orbits.size();
+    const double* ecc = orbits.m_eccentricity.Buffer();
+    const double* mean = orbits.m_mean.Buffer();
+    double* anomaly = orbits.m_anomaly.Buffer();
+    double* sine = orbits.m_sin.Buffer();
+    double* cosine = orbits.m_cos.Buffer();
+    double* error = orbits.m_error.Buffer();
+
+    for (unsigned first = 0; first < count; first += sc_passBlock)
+    {
+        const unsigned n = Min(sc_passBlock, count - first);
+
+        // Worked on in local arrays, which the compiler knows can't overlap
+        // anything else
+        double x[sc_passBlock], s[sc_passBlock], c[sc_passBlock];
+        double e[sc_passBlock];
+
+        for (unsigned i = 0; i < n; i ++)
+        {
+            x[i] = anomaly[first + i];
+        }
+
+        // Separate loops, or sin and cos are merged into a sincos call that
+        // can't be vectorised
+        for (unsigned i = 0; i < n; i ++)
+        {
+            s[i] = std::sin(x[i]);
+        }
+
+        for (unsigned i = 0; i < n; i ++)
+        {
+            c[i] = std::cos(x[i]);
+        }
+
+        for (unsigned i = 0; i < n; i ++)
+        {
+            e[i] = newton_elliptic(ecc[first + i], mean[first + i], x[i],
+                                   s[i], c[i]);
+        }
+
+        for (unsigned i = 0; i < n; i ++)
+        {
+            anomaly[first + i] = x[i];
+            sine[first + i] = s[i];
+            cosine[first + i] = c[i];
+            error[first + i] = e[i];
+        }
+    }
+}
+
+/**
+ * One Newton iteration for every hyperbolic orbit, see pass_elliptic
+ * @param orbits [ref] Orbits with m_mean and m_anomaly set
+ */
+static void pass_hyperbolic(KeplerOrbits& orbits)
+{
+    const unsigned count = orbits.size();
+    const double* ecc = orbits.m_eccentricity.Buffer();
+    const double* mean = orbits.m_mean.Buffer();
+    double* anomaly = orbits.m_anomaly.Buffer();
+    double* sine = orbits.m_sin.Buffer();
+    double* cosine = orbits.m_cos.Buffer();
+    double* error = orbits.m_error.Buffer();
+
+    for (unsigned first = 0; first < count; first += sc_passBlock)
+    {
+        const unsigned n = Min(sc_passBlock, count - first);
+        double x[sc_passBlock], s[sc_passBlock], c[sc_passBlock];
+        double e[sc_passBlock];
+
+        for (unsigned i = 0; i < n; i ++)
+        {
+            x[i] = anomaly[first + i];
+        }
+
+        for (unsigned i = 0; i < n; i ++)
+        {
+            e[i] = newton_hyperbolic(ecc[first + i], mean[first + i], x[i],
+                                     s[i], c[i]);
+        }
+
+        for (unsigned i = 0; i < n; i ++)
+        {
+            anomaly[first + i] = x[i];
+            sine[first + i] = s[i];
+            cosine[first + i] = c[i];
+            error[first + i] = e[i];
+        }
+    }
+}
+
+/**
+ * Collect the orbits the last pass left unconverged into m_unsolved
+ * @param orbits [ref] Orbits with m_error set by the last pass
+ * @return Number of orbits in m_unsolved
+ */
+static unsigned gather_unsolved(KeplerOrbits& orbits)
+{
+    const unsigned count = orbits.size();
+    const double* error = orbits.m_error.Buffer();
+
+    orbits.m_unsolved.Resize(count);
+    unsigned* unsolved = orbits.m_unsolved.Buffer();
+    unsigned left = 0;
+
+    // Every index is written, but only kept if it needs another iteration
+    for (unsigned i = 0; i < count; i ++)
+    {
+        unsolved[left] = i;
+        left += unsigned(error[i] > 0.0);
+    }
+
+    return left;
+}
+
+/**
+ * Newton iterations for every elliptic orbit. Every orbit gets the first
+ * sc_firstPasses, then only the few still unconverged are iterated further.
+ * @param orbits [ref] Orbits with m_mean and m_anomaly set. m_anomaly is
+ *                     replaced with the solution, and m_sin and m_cos are
+ *                     set to match it.
+ * @return Number of iterations the slowest orbit got
+ */
+static unsigned iterate_elliptic(KeplerOrbits& orbits)
+{
+    const unsigned count = orbits.size();
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    orbits.m_error.Resize(count);
+
+    const double* ecc = orbits.m_eccentricity.Buffer();
+    const double* mean = orbits.m_mean.Buffer();
+    double* anomaly = orbits.m_anomaly.Buffer();
+    double* sine = orbits.m_sin.Buffer();
+    double* cosine = orbits.m_cos.Buffer();
+
+    for (unsigned pass = 0; pass < sc_firstPasses; pass ++)
+    {
+        pass_elliptic(orbits);
+    }
+
+    unsigned left = gather_unsolved(orbits);
+    unsigned* unsolved = orbits.m_unsolved.Buffer();
+    unsigned iterations = sc_firstPasses;
+
+    while (left != 0 && iterations < sc_maxIterations)
+    {
+        unsigned kept = 0;
+
+        for (unsigned k = 0; k < left; k ++)
+        {
+            const unsigned i = unsolved[k];
+            sine[i] = std::sin(anomaly[i]);
+            cosine[i] = std::cos(anomaly[i]);
+
+            unsolved[kept] = i;
+            kept += unsigned(newton_elliptic(ecc[i], mean[i], anomaly[i],
+                                             sine[i], cosine[i]) > 0.0);
+        }
+
+        left = kept;
+        iterations ++;
+    }
+
+    return iterations;
+}
+
+/**
+ * Newton iterations for every hyperbolic orbit, see iterate_elliptic
+ * @param orbits [ref] Orbits with m_mean and m_anomaly set. m_anomaly is
+ *                     replaced with the solution, and m_sin and m_cos are
+ *                     set to sinh and cosh of it.
+ * @return Number of iterations the slowest orbit got
+ */
+static unsigned iterate_hyperbolic(KeplerOrbits& orbits)
+{
+    const unsigned count = orbits.size();
+
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    orbits.m_error.Resize(count);
+
+    const double* ecc = orbits.m_eccentricity.Buffer();
+    const double* mean = orbits.m_mean.Buffer();
+    double* anomaly = orbits.m_anomaly.Buffer();
+    double* sine = orbits.m_sin.Buffer();
+    double* cosine = orbits.m_cos.Buffer();
+
+    for (unsigned pass = 0; pass < sc_firstPasses; pass ++)
+    {
+        pass_hyperbolic(orbits);
+    }
+
+    unsigned left = gather_unsolved(orbits);
+    unsigned* unsolved = orbits.m_unsolved.Buffer();
+    unsigned iterations = sc_firstPasses;
+
+    while (left != 0 && iterations < sc_maxIterations)
+    {
+        unsigned kept = 0;
+
+        for (unsigned k = 0; k < left; k ++)
+        {
+            const unsigned i = unsolved[k];
+            unsolved[kept] = i;
+            kept += unsigned(newton_hyperbolic(ecc[i], mean[i], anomaly[i],
+                                               sine[i], cosine[i]) > 0.0);
+        }
+
+        left = kept;
+        iterations ++;
+    }
+
+    return iterations;
+}
+
+/**
+ * Solve Kepler's equation M = E - e*sin(E) for every elliptic orbit, then
+ * calculate their positions
+ * @param orbits [ref] Elliptic orbits
+ * @param time [in] Seconds since time 0
+ * @return Number of Newton iterations the slowest orbit needed
+ */
+static unsigned solve_elliptic(KeplerOrbits& orbits, double time)
+{
+    const unsigned count = orbits.size();
+    const double* ecc = orbits.m_eccentricity.Buffer();
+    double* mean = orbits.m_mean.Buffer();
+    double* anomaly = orbits.m_anomaly.Buffer();
+    const double* sine = orbits.m_sin.Buffer();
+    const double* cosine = orbits.m_cos.Buffer();
+
+    for (unsigned i = 0; i < count; i ++)
+    {
+        // Wrapped to [-pi, pi), so it stays accurate long after time 0. E
+        // is in the same range, they're equal at -pi and pi.
+        const double m = wrap_angle(orbits.m_meanAnomaly[i]
+                                    + orbits.m_meanMotion[i] * time);
+        const double e = ecc[i];
+
+        // Change since the last solve, the shortest way around. NaN for
+        // orbits that were never solved.
+        const double change = wrap_angle(m - mean[i]);
+        const double slope = 1.0 - e * cosine[i];
+
+        if (std::fabs(change) < sc_warmStart * slope)
+        {
+            // Barely moved since the last solve, a Newton step from the
+            // last answer is closer than any guess
+            anomaly[i] = wrap_angle(anomaly[i] + change / slope);
+        }
+        else
+        {
+            // Danby's starting guess, M + 0.85e*sign(sin(M)). Newton's
+            // method converges from here for any eccentricity below 1
+            anomaly[i] = m + std::copysign(0.85 * e, m);
+        }
+
+        mean[i] = m;
+    }
+
+    const unsigned iterations = iterate_elliptic(orbits);
+
+    for (unsigned i = 0; i < count; i ++)
+    {
+        to_reference_frame(orbits, i,
+                           orbits.m_semiMajor[i] * (cosine[i] - ecc[i]),
+                           orbits.m_semiMinor[i] * sine[i]);
+    }
+
+    return iterations;
+}
+
+/**
+ * Solve Kepler's equation M = e*sinh(F) - F for every hyperbolic orbit,
+ * then calculate their positions
+ * @param orbits [ref] Hyperbolic orbits
+ * @param time [in] Seconds since time 0
+ * @return Number of Newton iterations the slowest orbit needed
+ */
+static unsigned solve_hyperbolic(KeplerOrbits& orbits, double time)
+{
+    const unsigned count = orbits.size();
+    const double* ecc = orbits.m_eccentricity.Buffer();
+    double* mean = orbits.m_mean.Buffer();
+    double* anomaly = orbits.m_anomaly.Buffer();
+    const double* sine = orbits.m_sin.Buffer();
+    const double* cosine = orbits.m_cos.Buffer();
+
+    for (unsigned i = 0; i < count; i ++)
+    {
+        // Doesn't repeat, nothing to wrap
+        const double m = orbits.m_meanAnomaly[i]
+                            + orbits.m_meanMotion[i] * time;
+        const double e = ecc[i];
+
+        const double change = m - mean[i];
+        const double slope = e * cosine[i] - 1.0;
+
+        if (std::fabs(change) < sc_warmStart * slope)
+        {
+            anomaly[i] += change / slope;
+        }
+        else
+        {
+            // Close to the actual answer for large M, where e*sinh(F) is
+            // about e*e^F/2, and still converges for small ones
+            anomaly[i] = std::copysign(
+                        std::log(2.0 * std::fabs(m) / e + 1.8), m);
+        }
+
+        mean[i] = m;
+    }
+
+    const unsigned iterations = iterate_hyperbolic(orbits);
+
+    for (unsigned i = 0; i < count; i ++)
+    {
+        to_reference_frame(orbits, i,
+                           orbits.m_semiMajor[i] * (ecc[i] - cosine[i]),
+                           orbits.m_semiMinor[i] * sine[i]);
+    }
+
+    return iterations;
+}
+
+/**
+ * Solve Kepler's equation for a single orbit, for when only one is needed
+ * @param e [in] Eccentricity
+ * @param m [in] Mean anomaly, wrapped to [-pi, pi) for elliptic orbits
+ * @param hyperbolic [in] Solve M = e*sinh(F) - F instead of
+ *                        M = E - e*sin(E)
+ * @return Eccentric (or hyperbolic) anomaly
+ */
+static double solve_anomaly(double e, double m, bool hyperbolic)
+{
+    // Same starting guesses as solve_elliptic and solve_hyperbolic
+    double x = hyperbolic
+            ? std::copysign(std::log(2.0 * std::fabs(m) / e + 1.8), m)
+            : m + std::copysign(0.85 * e, m);
+
+    for (unsigned i = 0; i < sc_maxIterations; i ++)
+    {
+        const double step = hyperbolic
+                ? (e * std::sinh(x) - x - m) / (e * std::cosh(x) - 1.0)
+                : (x - e * std::sin(x) - m) / (1.0 - e * std::cos(x));
+        x -= step;
+
+        if (std::fabs(step) < sc_tolerance)
+        {
+            break;
+        }
+    }
+
+    return x;
+}
+
+double KeplerElements::get_periapsis() const
+{
+    return m_semiMajor * Abs(1.0 - m_eccentricity);
+}
+
+double KeplerElements::get_apoapsis() const
+{
+    return is_hyperbolic() ? INFINITY
+                           : m_semiMajor * (1.0 + m_eccentricity);
+}
+
+double KeplerElements::get_period() const
+{
+    return is_hyperbolic() ? INFINITY : sc_twoPi / m_meanMotion;
+}
+
+double KeplerElements::get_max_speed() const
+{
+    // Vis-viva, 1/a is negative for hyperbolic orbits
+    const double inverseA = is_hyperbolic() ? -1.0 / m_semiMajor
+                                            : 1.0 / m_semiMajor;
+    return std::sqrt(m_gravParam * (2.0 / get_periapsis() - inverseA));
+}
+
+KeplerState KeplerElements::get_state(double time) const
+{
+    const double e = m_eccentricity;
+    const double a = m_semiMajor;
+    const double b = m_semiMinor;
+    const double m = m_meanAnomaly + m_meanMotion * time;
+
+    double xp, yp, rate, s, c;
+
+    if (is_hyperbolic())
+    {
+        const double f = solve_anomaly(e, m, true);
+        s = std::sinh(f);
+        c = std::cosh(f);
+        xp = a * (e - c);
+        rate = m_meanMotion / (e * c - 1.0);
+    }
+    else
+    {
+        const double f = solve_anomaly(e, wrap_angle(m), false);
+        s = std::sin(f);
+        c = std::cos(f);
+        xp = a * (c - e);
+        rate = m_meanMotion / (1.0 - e * c);
+    }
+
+    yp = b * s;
+
+    // Derivatives of xp and yp over the anomaly are the same for both, and
+    // the anomaly changes by rate each second
+    const double vxp = -a * s * rate;
+    const double vyp = b * c * rate;
+
+    KeplerState state;
+    state.m_x = m_px * xp + m_qx * yp;
+    state.m_y = m_py * xp + m_qy * yp;
+    state.m_z = m_pz * xp + m_qz * yp;
+    state.m_vx = m_px * vxp + m_qx * vyp;
+    state.m_vy = m_py * vxp + m_qy * vyp;
+    state.m_vz = m_pz * vxp + m_qz * vyp;
+    return state;
+}
+
+double KeplerElements::get_exit_time(double radius, double after) const
+{
+    const double e = m_eccentricity;
+    const double a = m_semiMajor;
+
+    if (radius <= 0.0 || get_apoapsis() <= radius)
+    {
+        // Never gets that far
+        return INFINITY;
+    }
+
+    if (get_periapsis() >= radius)
+    {
+        // Out past it the whole way around
+        return after;
+    }
+
+    if (is_hyperbolic())
+    {
+        // r = a(e*cosh(F) - 1), going outwards where F is positive
+        const double f = std::acosh((radius / a + 1.0) / e);
+        const double m = e * std::sinh(f) - f;
+
+        return Max((m - m_meanAnomaly) / m_meanMotion, after);
+    }
+
+    // r = a(1 - e*cos(E)), going outwards where E is in [0, pi]
+    const double f = std::acos(Clamp((1.0 - radius / a) / e, -1.0, 1.0));
+    const double m = f - e * std::sin(f);
+
+    // Mean anomaly left to go until then, the next time around
+    double left = m - (m_meanAnomaly + m_meanMotion * after);
+    left -= sc_twoPi * std::floor(left / sc_twoPi);
+
+    return after + left / m_meanMotion;
+}
+
+bool KeplerElements::from_state(const KeplerState& state, double gravParam,
+                                double time, KeplerElements& elements)
+{
+    const double x = state.m_x, y = state.m_y, z = state.m_z;
+    const double vx = state.m_vx, vy = state.m_vy, vz = state.m_vz;
+    const double r = std::sqrt(x * x + y * y + z * z);
+    const double v2 = vx * vx + vy * vy + vz * vz;
+    const double rv = x * vx + y * vy + z * vz;
+
+    // Angular momentum, zero if falling straight at the center
+    const double hx = y * vz - z * vy;
+    const double hy = z * vx - x * vz;
+    const double hz = x * vy - y * vx;
+    const double h = std::sqrt(hx * hx + hy * hy + hz * hz);
+
+    const double energy = 0.5 * v2 - gravParam / r;
+
+    if (gravParam <= 0.0 || r == 0.0 || h == 0.0 || energy == 0.0)
+    {
+        return false;
+    }
+
+    const bool hyperbolic = energy > 0.0;
+    const double a = gravParam / (2.0 * Abs(energy));
+
+    // Eccentricity vector points towards periapsis
+    const double k = v2 - gravParam / r;
+    const double ex = (k * x - rv * vx) / gravParam;
+    const double ey = (k * y - rv * vy) / gravParam;
+    const double ez = (k * z - rv * vz) / gravParam;
+    double e = std::sqrt(ex * ex + ey * ey + ez * ez);
+
+    // Periapsis is anywhere on a circle, so start from where it is now
+    const bool circular = e < 1e-10;
+    const double px = circular ? x / r : ex / e;
+    const double py = circular ? y / r : ey / e;
+    const double pz = circular ? z / r : ez / e;
+
+    // Energy decides the kind of orbit, e can be a hair to the other side
+    // of 1 from rounding
+    e = hyperbolic ? Max(e, 1.0 + 1e-12) : Min(e, 1.0 - 1e-12);
+
+    elements.m_semiMajor = a;
+    elements.m_semiMinor = a * std::sqrt(Abs(1.0 - e * e));
+    elements.m_eccentricity = e;
+    elements.m_meanMotion = std::sqrt(gravParam / (a * a * a));
+    elements.m_gravParam = gravParam;
+    elements.m_px = px;
+    elements.m_py = py;
+    elements.m_pz = pz;
+
+    // Q = h x P / |h|, works out the same in left handed coordinates as
+    // both cross products flip
+    elements.m_qx = (hy * pz - hz * py) / h;
+    elements.m_qy = (hz * px - hx * pz) / h;
+    elements.m_qz = (hx * py - hy * px) / h;
+
+    // Anomaly from where the position is along P and Q, which stays
+    // accurate for nearly circular orbits
+    const double xp = x * px + y * py + z * pz;
+    const double yp = x * elements.m_qx + y * elements.m_qy
+                        + z * elements.m_qz;
+    double m;
+
+    if (hyperbolic)
+    {
+        const double f = std::asinh(yp / elements.m_semiMinor);
+        m = e * std::sinh(f) - f;
+    }
+    else
+    {
+        const double f = std::atan2(yp / elements.m_semiMinor, xp / a + e);
+        m = f - e * std::sin(f);
+    }
+
+    // Back to time 0
+    m -= elements.m_meanMotion * time;
+    elements.m_meanAnomaly = hyperbolic ? m : wrap_angle(m);
+
+    return true;
+}
+
+/**
+ * @param value [in] Position component in units
+ * @return value clamped to what fits in a LongVector3
+ */
+static int64_t to_long(double value)
+{
+    // Just under 2^63, doubles that close to it might round up past it
+    return int64_t(Clamp(value, -9.2e18, 9.2e18));
+}
+
+TrajectoryKepler::TrajectoryKepler(Context* context) : Trajectory(context),
+        m_gravParam(0.0),
+        m_soiRadius(0.0)
+{
+
+}
+
+void TrajectoryKepler::set_center(Satellite* center, double gravParam)
+{
+    m_center = center;
+    m_gravParam = gravParam;
+}
+
+bool TrajectoryKepler::add_orbit(Satellite* sat, double semiMajor,
+                                 double eccentricity, double inclination,
+                                 double ascendingNode, double argPeriapsis,
+                                 double meanAnomaly)
+{
+    const double a = Abs(semiMajor);
+
+    if (m_gravParam <= 0.0 || a == 0.0 || eccentricity < 0.0
+            || eccentricity == 1.0)
+    {
+        URHO3D_LOGERRORF("TrajectoryKepler: Can't add orbit with a = %f, "
+                         "e = %f, GM = %f", semiMajor, eccentricity,
+                         m_gravParam);
+        return false;
+    }
+
+    KeplerElements elements;
+    elements.m_semiMajor = a;
+    elements.m_semiMinor = a * std::sqrt(Abs(1.0 - eccentricity
+                                                   * eccentricity));
+    elements.m_eccentricity = eccentricity;
+    elements.m_meanMotion = std::sqrt(m_gravParam / (a * a * a));
+    elements.m_meanAnomaly = meanAnomaly;
+    elements.m_gravParam = m_gravParam;
+
+    const double cosO = std::cos(ascendingNode);
+    const double sinO = std::sin(ascendingNode);
+    const double cosW = std::cos(argPeriapsis);
+    const double sinW = std::sin(argPeriapsis);
+    const double cosI = std::cos(inclination);
+    const double sinI = std::sin(inclination);
+
+    // P and Q in the usual right handed Z up frame, with Y and Z swapped to
+    // turn them into Urho3D's left handed Y up
+    elements.m_px = cosO * cosW - sinO * sinW * cosI;
+    elements.m_py = sinW * sinI;
+    elements.m_pz = sinO * cosW + cosO * sinW * cosI;
+
+    elements.m_qx = -cosO * sinW - sinO * cosW * cosI;
+    elements.m_qy = cosW * sinI;
+    elements.m_qz = -sinO * sinW + cosO * cosW * cosI;
+
+    return add_orbit(sat, elements);
+}
+
+bool TrajectoryKepler::add_orbit(Satellite* sat,
+                                 const KeplerElements& elements)
+{
+    const double e = elements.m_eccentricity;
+
+    if (m_gravParam <= 0.0 || elements.m_semiMajor <= 0.0 || e < 0.0
+            || e == 1.0)
+    {
+        URHO3D_LOGERRORF("TrajectoryKepler: Can't add orbit with a = %f, "
+                         "e = %f, GM = %f", elements.m_semiMajor, e,
+                         m_gravParam);
+        return false;
+    }
+
+    // Only one orbit per Satellite, the new one replaces it
+    remove_orbit(sat);
+
+    KeplerOrbits& orbits = (e < 1.0) ? m_elliptic : m_hyperbolic;
+    orbits.push(sat, elements);
+
+    if (!sat)
+    {
+        return true;
+    }
+
+    if (m_center.NotNull() && sat->get_parent() != m_center)
+    {
+        m_center->add_child(sat);
+    }
+
+    // Work out when it leaves for another sphere of influence
+    if (SoiScheduler* scheduler = GetSubsystem<SoiScheduler>())
+    {
+        scheduler->schedule(this, sat);
+    }
+
+    return true;
+}
+
+void TrajectoryKepler::remove_orbit(const Satellite* sat)
+{
+    unsigned i;
+
+    if (m_elliptic.find(sat, i))
+    {
+        m_elliptic.erase(i);
+    }
+    else if (m_hyperbolic.find(sat, i))
+    {
+        m_hyperbolic.erase(i);
+    }
+}
+
+bool TrajectoryKepler::get_elements(const Satellite* sat,
+                                    KeplerElements& elements) const
+{
+    const KeplerOrbits* orbits = &m_elliptic;
+    unsigned i;
+
+    if (!m_elliptic.find(sat, i))
+    {
+        orbits = &m_hyperbolic;
+
+        if (!m_hyperbolic.find(sat, i))
+        {
+            return false;
+        }
+    }
+
+    elements.m_semiMajor = orbits->m_semiMajor[i];
+    elements.m_semiMinor = orbits->m_semiMinor[i];
+    elements.m_eccentricity = orbits->m_eccentricity[i];
+    elements.m_meanMotion = orbits->m_meanMotion[i];
+    elements.m_meanAnomaly = orbits->m_meanAnomaly[i];
+    elements.m_px = orbits->m_px[i];
+    elements.m_py = orbits->m_py[i];
+    elements.m_pz = orbits->m_pz[i];
+    elements.m_qx = orbits->m_qx[i];
+    elements.m_qy = orbits->m_qy[i];
+    elements.m_qz = orbits->m_qz[i];
+    elements.m_gravParam = m_gravParam;
+    return true;
+}
+
+unsigned TrajectoryKepler::size() const
+{
+    return m_elliptic.size() + m_hyperbolic.size();
+}
+
+unsigned TrajectoryKepler::propagate(double time)
+{
+    return Max(solve_elliptic(m_elliptic, time),
+               solve_hyperbolic(m_hyperbolic, time));
+}
+
+void TrajectoryKepler::update(double time)
+{
+    if (m_center.Null())
+    {
+        return;
+    }
+
+    remove_stale(m_elliptic);
+    remove_stale(m_hyperbolic);
+
+    propagate(time);
+
+    apply(m_elliptic);
+    apply(m_hyperbolic);
+}
+
+void TrajectoryKepler::remove_stale(KeplerOrbits& orbits)
+{
+    // Backwards, as the last orbit is moved into removed ones' places
+    for (unsigned i = orbits.size(); i -- > 0; )
+    {
+        const Satellite* sat = orbits.m_satellites[i];
+
+        if (!sat || sat->get_parent() != m_center)
+        {
+            orbits.erase(i);
+        }
+    }
+}
+
+void TrajectoryKepler::apply(const KeplerOrbits& orbits)
+{
+    // Meters to the center's units
+    const double scale = std::ldexp(1.0, m_center->get_precision());
+
+    for (unsigned i = 0; i < orbits.size(); i ++)
+    {
+        Satellite* sat = orbits.m_satellites[i];
+
+        // The physics engine is in charge of loaded Satellites
+        if (sat->is_loaded() && !sat->m_trajectoryOverride)
+        {
+            continue;
+        }
+
+        sat->set_position(LongVector3(to_long(orbits.m_x[i] * scale),
+                                      to_long(orbits.m_y[i] * scale),
+                                      to_long(orbits.m_z[i] * scale)));
+    }
+}
+
+void TrajectoryKepler::debug_benchmark(unsigned count, unsigned repeats)
+{
+    m_elliptic.clear();
+    m_hyperbolic.clear();
+
+    if (m_gravParam <= 0.0)
+    {
+        // Earth's
+        m_gravParam = 3.986004418e14;
+    }
+
+    // Low orbits to geostationary, plus every tenth one escaping
+    for (unsigned i = 0; i < count; i ++)
+    {
+        const bool hyperbolic = (i % 10 == 9);
+        add_orbit(nullptr, Random(7.0e6f, 4.2e7f),
+                  hyperbolic ? Random(1.05f, 3.0f) : Random(0.0f, 0.99f),
+                  Random(0.0f, float(sc_pi)), Random(0.0f, float(sc_twoPi)),
+                  Random(0.0f, float(sc_twoPi)),
+                  Random(-float(sc_pi), float(sc_pi)));
+    }
+
+    // First solve has nothing to start from, like right after loading
+    HiresTimer timer;
+    const unsigned coldIterations = propagate(0.0);
+    const long long coldTime = timer.GetUSec(true);
+
+    unsigned iterations = 0;
+
+    for (unsigned i = 0; i < repeats; i ++)
+    {
+        // A minute apart, like updating every frame on high time warp
+        iterations = Max(iterations, propagate(60.0 * (i + 1)));
+    }
+
+    const long long time = timer.GetUSec(false);
+
+    URHO3D_LOGINFOF("TrajectoryKepler: %u orbits (%u hyperbolic), "
+                    "%.1fns each, %.1fus per propagate, at most %u "
+                    "iterations. First propagate: %.1fus, %u iterations",
+                    size(), m_hyperbolic.size(),
+                    double(time) * 1000.0 / (double(size()) * repeats),
+                    double(time) / repeats, iterations, double(coldTime),
+                    coldIterations);
+
+    m_elliptic.clear();
+    m_hyperbolic.clear();
+}
+
+} // namespace osp
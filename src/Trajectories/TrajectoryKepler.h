@@ -0,0 +1,313 @@
+#pragma once
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+
+#include "Trajectory.h"
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+class Satellite;
+struct KeplerElements;
+
+/**
+ * Orbits of the same kind, elliptic or hyperbolic, stored as one array per
+ * element (structure of arrays) so they can all be solved in the same
+ * tight loops. Every array is parallel to m_satellites.
+ */
+struct KeplerOrbits
+{
+    // Satellites moved by these orbits. Null for orbits that are only
+    // calculated, like in the benchmark
+    Vector< WeakPtr<Satellite> > m_satellites;
+
+    // Same as m_satellites, but still usable as keys of m_indices after
+    // they're deleted
+    PODVector<const Satellite*> m_keys;
+
+    // Index of each Satellite's orbit, so finding one doesn't need a search
+    HashMap<const Satellite*, unsigned> m_indices;
+
+    // Semi-major axis a in meters, positive for hyperbolic orbits too
+    PODVector<double> m_semiMajor;
+
+    // Semi-minor axis b in meters. a*sqrt(1-e^2) for elliptic orbits,
+    // a*sqrt(e^2-1) for hyperbolic
+    PODVector<double> m_semiMinor;
+
+    PODVector<double> m_eccentricity;
+
+    // Radians per second
+    PODVector<double> m_meanMotion;
+
+    // Mean anomaly at time 0, in radians
+    PODVector<double> m_meanAnomaly;
+
+    // Unit vectors towards periapsis (P), and 90 degrees ahead of it in the
+    // direction of motion (Q). Calculated from the inclination, longitude of
+    // the ascending node and argument of periapsis when added.
+    PODVector<double> m_px, m_py, m_pz;
+    PODVector<double> m_qx, m_qy, m_qz;
+
+    // Mean anomaly at the time last solved for, and the eccentric (or
+    // hyperbolic) anomaly solved. The next solve starts from these if the
+    // orbit barely moved since.
+    PODVector<double> m_mean;
+    PODVector<double> m_anomaly;
+
+    // sin and cos of m_anomaly, or sinh and cosh for hyperbolic orbits
+    PODVector<double> m_sin;
+    PODVector<double> m_cos;
+
+    // How far each orbit was from converging after the last pass over all
+    // of them, positive if it needs another iteration
+    PODVector<double> m_error;
+
+    // Orbits still being iterated, not parallel to anything
+    PODVector<unsigned> m_unsolved;
+
+    // Positions relative to the center in meters, from the last propagate
+    PODVector<double> m_x, m_y, m_z;
+
+    unsigned size() const { return m_eccentricity.Size(); }
+
+    /**
+     * Add an orbit to the end
+     * @param sat [in] Satellite to move, can be null
+     * @param elements [in] Orbit to add, already checked to be this kind
+     */
+    void push(Satellite* sat, const KeplerElements& elements);
+
+    /**
+     * @param sat [in] Satellite to look for
+     * @param index [out] Index of sat's orbit, if found
+     * @return false if sat has no orbit here
+     */
+    bool find(const Satellite* sat, unsigned& index) const;
+
+    /**
+     * Remove an orbit, the last one is moved into its place
+     * @param index [in] Index of orbit to remove
+     */
+    void erase(unsigned index);
+
+    void clear();
+};
+
+/**
+ * Position and velocity relative to the center of an orbit, in meters and
+ * m/s
+ */
+struct KeplerState
+{
+    double m_x, m_y, m_z;
+    double m_vx, m_vy, m_vz;
+};
+
+/**
+ * A single Keplerian orbit, for working out where one Satellite will be
+ * at any time without solving every other orbit along with it
+ */
+struct KeplerElements
+{
+    // Same as the arrays in KeplerOrbits
+    double m_semiMajor;
+    double m_semiMinor;
+    double m_eccentricity;
+    double m_meanMotion;
+    double m_meanAnomaly;
+    double m_px, m_py, m_pz;
+    double m_qx, m_qy, m_qz;
+
+    // G*M of the center, m^3/s^2
+    double m_gravParam;
+
+    bool is_hyperbolic() const { return m_eccentricity > 1.0; }
+
+    /**
+     * @return Closest distance to the center in meters
+     */
+    double get_periapsis() const;
+
+    /**
+     * @return Furthest distance from the center in meters, infinite for
+     *         hyperbolic orbits
+     */
+    double get_apoapsis() const;
+
+    /**
+     * @return Seconds per orbit, infinite for hyperbolic orbits
+     */
+    double get_period() const;
+
+    /**
+     * @return Speed at periapsis, the fastest along the orbit, in m/s
+     */
+    double get_max_speed() const;
+
+    /**
+     * @param time [in] Seconds since the universe was created
+     * @return Position and velocity at time
+     */
+    KeplerState get_state(double time) const;
+
+    /**
+     * Find when the orbit next goes out past a distance from the center
+     * @param radius [in] Distance in meters
+     * @param after [in] Earliest time to look from
+     * @return Time of the crossing, after if it's already out past radius,
+     *         or infinity if it never gets that far
+     */
+    double get_exit_time(double radius, double after) const;
+
+    /**
+     * Calculate the orbit that passes through a position and velocity
+     * @param state [in] Position and velocity relative to the center
+     * @param gravParam [in] G*M of the center
+     * @param time [in] Time of state
+     * @param elements [out] Orbit calculated
+     * @return false for orbits that can't be represented: parabolic, or
+     *         falling straight at the center
+     */
+    static bool from_state(const KeplerState& state, double gravParam,
+                           double time, KeplerElements& elements);
+};
+
+/**
+ * Keplerian orbits, on rails, of any number of Satellites around the same
+ * center. Every orbit is solved at once each update.
+ *
+ * Positions are in a left handed, Y up frame like Urho3D's. The reference
+ * plane of inclination is XZ, and the longitude of the ascending node is
+ * measured from +X.
+ */
+class TrajectoryKepler : public Trajectory
+{
+    URHO3D_OBJECT(TrajectoryKepler, Trajectory)
+
+public:
+
+    TrajectoryKepler(Context* context);
+    ~TrajectoryKepler() = default;
+
+    /**
+     * Set the body that everything orbits around
+     * @param center [in] Satellite to orbit, parent of the orbiting ones
+     * @param gravParam [in] Standard gravitational parameter of center,
+     *                       G*M in m^3/s^2
+     */
+    void set_center(Satellite* center, double gravParam);
+
+    Satellite* get_center() const { return m_center; }
+
+    /**
+     * Put a Satellite on an orbit around the center, and add it to the
+     * center's children if it isn't already. Replaces any orbit it already
+     * has here.
+     * @param sat [in] Satellite to move, can be null to only calculate the
+     *                 orbit
+     * @param semiMajor [in] Semi-major axis in meters, sign is ignored
+     * @param eccentricity [in] Below 1 for elliptic orbits, above 1 for
+     *                          hyperbolic. Exactly 1 isn't supported.
+     * @param inclination [in] Radians
+     * @param ascendingNode [in] Longitude of the ascending node in radians
+     * @param argPeriapsis [in] Argument of periapsis in radians
+     * @param meanAnomaly [in] Mean anomaly at time 0 in radians
+     * @return false if the orbit couldn't be added
+     */
+    bool add_orbit(Satellite* sat, double semiMajor, double eccentricity,
+                   double inclination, double ascendingNode,
+                   double argPeriapsis, double meanAnomaly);
+
+    /**
+     * Put a Satellite on an orbit around the center, and add it to the
+     * center's children if it isn't already. Replaces any orbit it already
+     * has here.
+     * @param sat [in] Satellite to move, can be null to only calculate the
+     *                 orbit
+     * @param elements [in] Orbit, m_gravParam is ignored
+     * @return false if the orbit couldn't be added
+     */
+    bool add_orbit(Satellite* sat, const KeplerElements& elements);
+
+    /**
+     * Stop moving a Satellite. Its orbit is removed by the next update
+     * anyways if it's moved to a different parent.
+     * @param sat [in] Satellite to stop moving
+     */
+    void remove_orbit(const Satellite* sat);
+
+    /**
+     * Get the orbit of a Satellite moved by this
+     * @param sat [in] Satellite to look for
+     * @param elements [out] Orbit of sat
+     * @return false if sat isn't moved by this
+     */
+    bool get_elements(const Satellite* sat, KeplerElements& elements) const;
+
+    /**
+     * @param radius [in] Radius of the center's sphere of influence in
+     *                    meters. Orbits leave it for the center's parent
+     *                    when they go past it. 0 for infinite, the default.
+     */
+    void set_sphere_of_influence(double radius) { m_soiRadius = radius; }
+
+    double get_sphere_of_influence() const { return m_soiRadius; }
+
+    double get_gravity() const { return m_gravParam; }
+
+    /**
+     * @return Number of orbits, both elliptic and hyperbolic
+     */
+    unsigned size() const;
+
+    /**
+     * Solve every orbit for positions at a given time, without moving any
+     * Satellites. Results are left in m_elliptic and m_hyperbolic.
+     * @param time [in] Seconds since the universe was created
+     * @return Most Newton iterations needed by either kind of orbit
+     */
+    unsigned propagate(double time);
+
+    void update(double time) override;
+
+    /**
+     * Time propagate on a number of random orbits without Satellites, and
+     * log the results. Orbits already added are removed.
+     * @param count [in] Number of orbits to time
+     * @param repeats [in] Number of times to propagate them
+     */
+    void debug_benchmark(unsigned count, unsigned repeats);
+
+private:
+
+    /**
+     * Remove orbits of Satellites that were deleted, or moved to a
+     * different parent
+     * @param orbits [ref] Orbits to look through
+     */
+    void remove_stale(KeplerOrbits& orbits);
+
+    /**
+     * Set the positions of Satellites from the results of propagate
+     * @param orbits [in] Orbits with results
+     */
+    void apply(const KeplerOrbits& orbits);
+
+    WeakPtr<Satellite> m_center;
+
+    // G*M of m_center, m^3/s^2
+    double m_gravParam;
+
+    // Sphere of influence of m_center in meters, 0 for infinite
+    double m_soiRadius;
+
+    KeplerOrbits m_elliptic;
+    KeplerOrbits m_hyperbolic;
+};
+
+} // namespace osp
@@ -0,0 +1,784 @@
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Math/Random.h>
+
+#include "../Satellites/Satellite.h"
+#include "../ParallelWork.h"
+#include "TrajectoryNBody.h"
+
+#include <cmath>
+
+namespace osp
+{
+
+// Bits per axis of the Z-order codes, 3 * 21 fits in a uint64_t. Also the
+// deepest the octree can go.
+static constexpr int sc_codeBits = 21;
+
+// Nodes with this many bodies or less aren't split any further
+static constexpr unsigned sc_leafBodies = 8;
+
+// Below this many bodies, the worker threads aren't worth waking up
+static constexpr unsigned sc_parallelBodies = 512;
+
+// Steps taken per update at most. Past this, the step is doubled instead of
+// falling behind at high time warp.
+static constexpr unsigned sc_maxSteps = 64;
+
+// Added to every distance, in meters, so bodies that end up in the same
+// place don't pull each other at infinite acceleration
+static constexpr double sc_softening = 1.0;
+
+// Sorting that needs more moves than this per body gives up and sorts from
+// scratch instead
+static constexpr unsigned sc_maxSortMoves = 8;
+
+/**
+ * @param value [in] Coordinate in cells, at most 21 bits
+ * @return value with two zero bits after each of its bits
+ */
+static uint64_t spread_bits(uint64_t value)
+{
+    value &= 0x1fffff;
+    value = (value | value << 32) & 0x1f00000000ffffULL;
+    value = (value | value << 16) & 0x1f0000ff0000ffULL;
+    value = (value | value << 8) & 0x100f00f00f00f00fULL;
+    value = (value | value << 4) & 0x10c30c30c30c30c3ULL;
+    value = (value | value << 2) & 0x1249249249249249ULL;
+    return value;
+}
+
+/**
+ * @param value [in] Distance from the corner of the octree
+ * @param toCells [in] Cells per unit
+ * @return Cell the distance is in, clamped to the octree
+ */
+static uint64_t to_cell(double value, double toCells)
+{
+    const double cell = value * toCells;
+    const double last = double((1 << sc_codeBits) - 1);
+    return uint64_t(Clamp(cell, 0.0, last));
+}
+
+static bool key_less(const NBodyKey& lhs, const NBodyKey& rhs)
+{
+    return lhs.m_code < rhs.m_code;
+}
+
+/**
+ * Move one axis of a body, keeping what doesn't make a whole unit
+ * @param pos [ref] Whole units
+ * @param fraction [ref] Fraction of a unit, kept in [0, 1)
+ * @param distance [in] Units to move
+ */
+static void drift(int64_t& pos, double& fraction, double distance)
+{
+    fraction += distance;
+    const double whole = std::floor(fraction);
+    pos += int64_t(whole);
+    fraction -= whole;
+}
+
+/**
+ * Work function for calculating accelerations of part of the bodies
+ * @param item [in] Item with a TrajectoryNBody as aux_, and a range of its
+ *                  sorted bodies as start_ and end_
+ * @param threadIndex [in] Unused
+ */
+static void acceleration_work(const WorkItem* item, unsigned threadIndex)
+{
+    static_cast<TrajectoryNBody*>(item->aux_)->calculate_accelerations(
+                static_cast<const NBodyKey*>(item->start_),
+                static_cast<const NBodyKey*>(item->end_));
+}
+
+TrajectoryNBody::TrajectoryNBody(Context* context) : Trajectory(context),
+        m_rootMass(0.0),
+        m_scale(1.0),
+        m_time(-1.0),
+        m_timeStep(1.0),
+        m_step(1.0),
+        m_updated(0.0),
+        m_theta(0.5),
+        m_dirty(true),
+        m_unsorted(true),
+        m_minX(0.0),
+        m_minY(0.0),
+        m_minZ(0.0),
+        m_size(1.0)
+{
+
+}
+
+void TrajectoryNBody::set_root(Satellite* root, double gravParam)
+{
+    clear();
+
+    m_root = root;
+    m_scale = root ? std::ldexp(1.0, root->get_precision()) : 1.0;
+    m_rootMass = gravParam * m_scale * m_scale * m_scale;
+    m_time = -1.0;
+}
+
+bool TrajectoryNBody::add_body(Satellite* sat, double gravParam,
+                               const Vector3& velocity)
+{
+    if (m_root.Null() || !sat)
+    {
+        URHO3D_LOGERROR("TrajectoryNBody: Can't add body without a root");
+        return false;
+    }
+
+    // Stays in the same place, only relative to the root now
+    m_root->add_child(sat);
+
+    push_body(sat, sat->get_position(), gravParam, velocity);
+
+    return true;
+}
+
+void TrajectoryNBody::set_time_step(double seconds)
+{
+    if (seconds > 0.0)
+    {
+        m_timeStep = seconds;
+        m_step = seconds;
+    }
+}
+
+void TrajectoryNBody::push_body(Satellite* sat, const LongVector3& pos,
+                                double gravParam, const Vector3& velocity)
+{
+    m_satellites.Push(WeakPtr<Satellite>(sat));
+    m_position.Push(pos);
+    m_fx.Push(0.0);
+    m_fy.Push(0.0);
+    m_fz.Push(0.0);
+    m_x.Push(double(pos.x_));
+    m_y.Push(double(pos.y_));
+    m_z.Push(double(pos.z_));
+    m_vx.Push(velocity.x_ * m_scale);
+    m_vy.Push(velocity.y_ * m_scale);
+    m_vz.Push(velocity.z_ * m_scale);
+    m_ax.Push(0.0);
+    m_ay.Push(0.0);
+    m_az.Push(0.0);
+    m_mass.Push(gravParam * m_scale * m_scale * m_scale);
+    m_pinned.Push(false);
+
+    m_dirty = true;
+    m_unsorted = true;
+}
+
+void TrajectoryNBody::erase_body(unsigned index)
+{
+    m_satellites.EraseSwap(index);
+    m_position.EraseSwap(index);
+    m_fx.EraseSwap(index);
+    m_fy.EraseSwap(index);
+    m_fz.EraseSwap(index);
+    m_x.EraseSwap(index);
+    m_y.EraseSwap(index);
+    m_z.EraseSwap(index);
+    m_vx.EraseSwap(index);
+    m_vy.EraseSwap(index);
+    m_vz.EraseSwap(index);
+    m_ax.EraseSwap(index);
+    m_ay.EraseSwap(index);
+    m_az.EraseSwap(index);
+    m_mass.EraseSwap(index);
+    m_pinned.EraseSwap(index);
+
+    m_dirty = true;
+    m_unsorted = true;
+}
+
+void TrajectoryNBody::remove_stale()
+{
+    // Backwards, as the last body is moved into removed ones' places
+    for (unsigned i = size(); i -- > 0; )
+    {
+        const Satellite* sat = m_satellites[i];
+
+        if (!sat || sat->get_parent() != m_root)
+        {
+            erase_body(i);
+        }
+    }
+}
+
+void TrajectoryNBody::clear()
+{
+    m_satellites.Clear();
+    m_position.Clear();
+    m_fx.Clear();
+    m_fy.Clear();
+    m_fz.Clear();
+    m_x.Clear();
+    m_y.Clear();
+    m_z.Clear();
+    m_vx.Clear();
+    m_vy.Clear();
+    m_vz.Clear();
+    m_ax.Clear();
+    m_ay.Clear();
+    m_az.Clear();
+    m_mass.Clear();
+    m_pinned.Clear();
+    m_sorted.Clear();
+    m_nodes.Clear();
+
+    m_dirty = true;
+    m_unsorted = true;
+}
+
+void TrajectoryNBody::update(double time)
+{
+    if (m_root.Null())
+    {
+        return;
+    }
+
+    remove_stale();
+
+    // Seconds since loaded bodies were last read
+    const double sincePinned = time - m_updated;
+    m_updated = time;
+
+    // The physics engine is in charge of loaded Satellites. They still
+    // pull on everything else from wherever it put them.
+    for (unsigned i = 0; i < size(); i ++)
+    {
+        Satellite* sat = m_satellites[i];
+        const bool wasPinned = m_pinned[i];
+        m_pinned[i] = sat->is_loaded() && !sat->m_trajectoryOverride;
+
+        if (!m_pinned[i])
+        {
+            if (wasPinned)
+            {
+                // Unloaded, carry on from where physics left it, with the
+                // velocity it had since the last update
+                m_position[i] = sat->get_position();
+            }
+            continue;
+        }
+
+        const LongVector3 pos = sat->calculate_position();
+
+        if (wasPinned && sincePinned > 0.0)
+        {
+            m_vx[i] = double(pos.x_ - m_position[i].x_) / sincePinned;
+            m_vy[i] = double(pos.y_ - m_position[i].y_) / sincePinned;
+            m_vz[i] = double(pos.z_ - m_position[i].z_) / sincePinned;
+        }
+
+        m_position[i] = pos;
+        m_fx[i] = m_fy[i] = m_fz[i] = 0.0;
+    }
+
+    if (m_time < 0.0)
+    {
+        // First update, start integrating from now
+        m_time = time;
+    }
+
+    if (m_dirty)
+    {
+        // The first kick needs accelerations from before stepping
+        update_accelerations();
+        m_dirty = false;
+    }
+
+    const double behind = time - m_time;
+
+    if (behind <= 0.0 || size() == 0)
+    {
+        m_time = Max(m_time, time);
+        return;
+    }
+
+    // Leapfrog only conserves energy with steps that are all the same
+    // length, so only whole steps are taken and the rest is left for the
+    // next update. When time warp goes up too far to keep up, the step is
+    // doubled, and halved again once the warp goes back down. Frame times
+    // moving around don't change it.
+    while (behind > m_step * sc_maxSteps)
+    {
+        m_step *= 2.0;
+    }
+
+    while (m_step > m_timeStep && behind < m_step * sc_maxSteps / 8.0)
+    {
+        m_step *= 0.5;
+    }
+
+    const unsigned steps = unsigned(behind / m_step);
+
+    for (unsigned i = 0; i < steps; i ++)
+    {
+        step(m_step);
+    }
+
+    m_time += steps * m_step;
+
+    // Satellites are shown where they'd be by now, less than a step ahead
+    // of what's integrated
+    const double ahead = time - m_time;
+
+    for (unsigned i = 0; i < size(); i ++)
+    {
+        if (m_pinned[i])
+        {
+            continue;
+        }
+
+        LongVector3 pos = m_position[i];
+        double fx = m_fx[i], fy = m_fy[i], fz = m_fz[i];
+        drift(pos.x_, fx, m_vx[i] * ahead);
+        drift(pos.y_, fy, m_vy[i] * ahead);
+        drift(pos.z_, fz, m_vz[i] * ahead);
+
+        m_satellites[i]->set_position(pos);
+    }
+}
+
+void TrajectoryNBody::step(double delta)
+{
+    const double half = 0.5 * delta;
+    const unsigned count = size();
+
+    // Kick, then drift
+    for (unsigned i = 0; i < count; i ++)
+    {
+        if (m_pinned[i])
+        {
+            continue;
+        }
+
+        m_vx[i] += m_ax[i] * half;
+        m_vy[i] += m_ay[i] * half;
+        m_vz[i] += m_az[i] * half;
+
+        LongVector3& pos = m_position[i];
+        drift(pos.x_, m_fx[i], m_vx[i] * delta);
+        drift(pos.y_, m_fy[i], m_vy[i] * delta);
+        drift(pos.z_, m_fz[i], m_vz[i] * delta);
+    }
+
+    update_accelerations();
+
+    // Kick again with accelerations at the new positions
+    for (unsigned i = 0; i < count; i ++)
+    {
+        if (m_pinned[i])
+        {
+            continue;
+        }
+
+        m_vx[i] += m_ax[i] * half;
+        m_vy[i] += m_ay[i] * half;
+        m_vz[i] += m_az[i] * half;
+    }
+}
+
+void TrajectoryNBody::update_accelerations()
+{
+    const unsigned count = size();
+
+    for (unsigned i = 0; i < count; i ++)
+    {
+        m_x[i] = double(m_position[i].x_) + m_fx[i];
+        m_y[i] = double(m_position[i].y_) + m_fy[i];
+        m_z[i] = double(m_position[i].z_) + m_fz[i];
+    }
+
+    sort_bodies();
+
+    m_nodes.Clear();
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    build_node(0, count, sc_codeBits, m_size);
+
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    NBodyKey* keys = m_sorted.Buffer();
+
+    const unsigned slices = (queue && count >= sc_parallelBodies)
+                                ? queue->GetNumThreads() + 1 : 1;
+    const unsigned perSlice = (count + slices - 1) / slices;
+
+    if (slices == 1)
+    {
+        calculate_accelerations(keys, keys + count);
+        return;
+    }
+
+    // Neighbours along the curve are near each other, so each thread walks
+    // mostly the same part of the octree from one body to the next
+    for (unsigned i = 0; i < slices; i ++)
+    {
+        const unsigned first = Min(i * perSlice, count);
+
+        SharedPtr<WorkItem> item(new WorkItem());
+        item->workFunction_ = acceleration_work;
+        item->aux_ = this;
+        item->start_ = keys + first;
+        item->end_ = keys + Min(first + perSlice, count);
+
+        m_items.Push(item);
+    }
+
+    complete_work(queue, m_items);
+}
+
+void TrajectoryNBody::sort_bodies()
+{
+    const unsigned count = size();
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Smallest cube around every body
+    double minX = m_x[0], minY = m_y[0], minZ = m_z[0];
+    double maxX = minX, maxY = minY, maxZ = minZ;
+
+    for (unsigned i = 1; i < count; i ++)
+    {
+        minX = Min(minX, m_x[i]);
+        minY = Min(minY, m_y[i]);
+        minZ = Min(minZ, m_z[i]);
+        maxX = Max(maxX, m_x[i]);
+        maxY = Max(maxY, m_y[i]);
+        maxZ = Max(maxZ, m_z[i]);
+    }
+
+    m_minX = minX;
+    m_minY = minY;
+    m_minZ = minZ;
+    m_size = Max(Max(maxX - minX, maxY - minY), Max(maxZ - minZ, 1.0));
+
+    const double toCells = double(1 << sc_codeBits) / m_size;
+
+    if (m_unsorted)
+    {
+        m_sorted.Resize(count);
+
+        for (unsigned i = 0; i < count; i ++)
+        {
+            m_sorted[i].m_body = i;
+        }
+    }
+
+    for (NBodyKey& key : m_sorted)
+    {
+        const unsigned i = key.m_body;
+        key.m_code = spread_bits(to_cell(m_x[i] - minX, toCells))
+                        | spread_bits(to_cell(m_y[i] - minY, toCells)) << 1
+                        | spread_bits(to_cell(m_z[i] - minZ, toCells)) << 2;
+    }
+
+    // Insertion sort, as bodies barely move along the curve each step. It
+    // gives up if they do, say when the cube suddenly grows.
+    unsigned moves = m_unsorted ? M_MAX_UNSIGNED : 0;
+    const unsigned maxMoves = sc_maxSortMoves * count;
+
+    for (unsigned i = 1; i < count && moves <= maxMoves; i ++)
+    {
+        const NBodyKey key = m_sorted[i];
+        unsigned j = i;
+
+        while (j > 0 && m_sorted[j - 1].m_code > key.m_code)
+        {
+            m_sorted[j] = m_sorted[j - 1];
+            j --;
+        }
+
+        m_sorted[j] = key;
+        moves += i - j;
+    }
+
+    if (moves > maxMoves)
+    {
+        Urho3D::Sort(m_sorted.Begin(), m_sorted.End(), key_less);
+    }
+
+    m_unsorted = false;
+}
+
+unsigned TrajectoryNBody::build_node(unsigned first, unsigned count,
+                                     int level, double size)
+{
+    const unsigned index = m_nodes.Size();
+    m_nodes.Push(NBodyNode());
+
+    double mass = 0.0;
+    double x = 0.0, y = 0.0, z = 0.0;
+
+    if (count <= sc_leafBodies || level == 0)
+    {
+        for (unsigned i = first; i < first + count; i ++)
+        {
+            const unsigned body = m_sorted[i].m_body;
+            const double m = m_mass[body];
+            mass += m;
+            x += m_x[body] * m;
+            y += m_y[body] * m;
+            z += m_z[body] * m;
+        }
+    }
+    else
+    {
+        // Sorted, so the bodies in each child are all next to each other
+        const int shift = (level - 1) * 3;
+        const unsigned end = first + count;
+        unsigned childFirst = first;
+
+        while (childFirst < end)
+        {
+            const uint64_t octant = (m_sorted[childFirst].m_code >> shift) & 7;
+            unsigned childEnd = childFirst + 1;
+
+            while (childEnd < end
+                   && ((m_sorted[childEnd].m_code >> shift) & 7) == octant)
+            {
+                childEnd ++;
+            }
+
+            // By index, pushing children can reallocate m_nodes
+            const unsigned childIndex = build_node(childFirst,
+                                                   childEnd - childFirst,
+                                                   level - 1, size * 0.5);
+            const NBodyNode& child = m_nodes[childIndex];
+            mass += child.m_mass;
+            x += child.m_x * child.m_mass;
+            y += child.m_y * child.m_mass;
+            z += child.m_z * child.m_mass;
+
+            childFirst = childEnd;
+        }
+    }
+
+    NBodyNode& node = m_nodes[index];
+    node.m_mass = mass;
+
+    if (mass > 0.0)
+    {
+        node.m_x = x / mass;
+        node.m_y = y / mass;
+        node.m_z = z / mass;
+    }
+    else
+    {
+        // Nothing to pull with, it doesn't matter where
+        const unsigned body = m_sorted[first].m_body;
+        node.m_x = m_x[body];
+        node.m_y = m_y[body];
+        node.m_z = m_z[body];
+    }
+
+    node.m_size = size;
+    node.m_first = first;
+    node.m_count = count;
+    node.m_next = m_nodes.Size();
+
+    return index;
+}
+
+void TrajectoryNBody::calculate_accelerations(const NBodyKey* first,
+                                              const NBodyKey* last)
+{
+    const NBodyNode* nodes = m_nodes.Buffer();
+    const NBodyKey* sorted = m_sorted.Buffer();
+    const unsigned nodeCount = m_nodes.Size();
+    const double theta2 = m_theta * m_theta;
+    const double soft2 = sc_softening * sc_softening * m_scale * m_scale;
+
+    for (const NBodyKey* key = first; key != last; key ++)
+    {
+        const unsigned body = key->m_body;
+        const unsigned rank = unsigned(key - sorted);
+        const double x = m_x[body];
+        const double y = m_y[body];
+        const double z = m_z[body];
+        double ax = 0.0, ay = 0.0, az = 0.0;
+
+        if (m_rootMass > 0.0)
+        {
+            const double d2 = x * x + y * y + z * z + soft2;
+            const double pull = m_rootMass / (d2 * std::sqrt(d2));
+            ax -= x * pull;
+            ay -= y * pull;
+            az -= z * pull;
+        }
+
+        // Depth first without a stack, m_next skips a whole subtree
+        unsigned i = 0;
+
+        while (i < nodeCount)
+        {
+            const NBodyNode& node = nodes[i];
+
+            if (node.m_mass == 0.0)
+            {
+                i = node.m_next;
+                continue;
+            }
+
+            const double dx = node.m_x - x;
+            const double dy = node.m_y - y;
+            const double dz = node.m_z - z;
+            const double d2 = dx * dx + dy * dy + dz * dz + soft2;
+
+            // A node with this body inside is never far enough away, as
+            // the body would be pulling on itself
+            const bool inside = rank - node.m_first < node.m_count;
+
+            if (!inside && node.m_size * node.m_size < theta2 * d2)
+            {
+                // Far enough to pull as one body
+                const double pull = node.m_mass / (d2 * std::sqrt(d2));
+                ax += dx * pull;
+                ay += dy * pull;
+                az += dz * pull;
+                i = node.m_next;
+            }
+            else if (node.m_next == i + 1)
+            {
+                // Leaf, every body pulls on its own
+                for (unsigned k = node.m_first;
+                     k < node.m_first + node.m_count; k ++)
+                {
+                    const unsigned other = sorted[k].m_body;
+
+                    if (other == body)
+                    {
+                        continue;
+                    }
+
+                    const double ox = m_x[other] - x;
+                    const double oy = m_y[other] - y;
+                    const double oz = m_z[other] - z;
+                    const double o2 = ox * ox + oy * oy + oz * oz + soft2;
+                    const double pull = m_mass[other] / (o2 * std::sqrt(o2));
+                    ax += ox * pull;
+                    ay += oy * pull;
+                    az += oz * pull;
+                }
+
+                i = node.m_next;
+            }
+            else
+            {
+                // Too close, look at its children instead
+                i ++;
+            }
+        }
+
+        m_ax[body] = ax;
+        m_ay[body] = ay;
+        m_az[body] = az;
+    }
+}
+
+void TrajectoryNBody::debug_benchmark(unsigned count)
+{
+    clear();
+
+    // Direct summation is compared against without the root's pull
+    const double rootMass = m_rootMass;
+    const double scale = m_scale;
+    m_rootMass = 0.0;
+
+    if (m_root.Null())
+    {
+        m_scale = std::ldexp(1.0, 10);
+    }
+
+    // Moons and asteroids up to Ceres' mass, scattered over a few million
+    // kilometers
+    for (unsigned i = 0; i < count; i ++)
+    {
+        const LongVector3 pos(int64_t(Random(-2.0e9f, 2.0e9f) * m_scale),
+                              int64_t(Random(-2.0e8f, 2.0e8f) * m_scale),
+                              int64_t(Random(-2.0e9f, 2.0e9f) * m_scale));
+        push_body(nullptr, pos, Random(1.0e5f, 6.3e10f), Vector3::ZERO);
+    }
+
+    // First build sorts from scratch, like right after adding everything
+    HiresTimer timer;
+    update_accelerations();
+    const long long coldTime = timer.GetUSec(true);
+
+    // Then the same positions again, the usual case of barely moving
+    static constexpr unsigned c_repeats = 10;
+
+    for (unsigned i = 0; i < c_repeats; i ++)
+    {
+        update_accelerations();
+    }
+
+    const long long time = timer.GetUSec(true);
+
+    // Sum directly for a sample, and see how far off the octree was
+    const unsigned samples = Min(count, 100u);
+    const double soft2 = sc_softening * sc_softening * m_scale * m_scale;
+    double sumError = 0.0;
+    double maxError = 0.0;
+
+    timer.Reset();
+
+    for (unsigned s = 0; s < samples; s ++)
+    {
+        const unsigned i = s * count / samples;
+        double ax = 0.0, ay = 0.0, az = 0.0;
+
+        for (unsigned j = 0; j < count; j ++)
+        {
+            if (j == i)
+            {
+                continue;
+            }
+
+            const double dx = m_x[j] - m_x[i];
+            const double dy = m_y[j] - m_y[i];
+            const double dz = m_z[j] - m_z[i];
+            const double d2 = dx * dx + dy * dy + dz * dz + soft2;
+            const double pull = m_mass[j] / (d2 * std::sqrt(d2));
+            ax += dx * pull;
+            ay += dy * pull;
+            az += dz * pull;
+        }
+
+        const double ex = m_ax[i] - ax;
+        const double ey = m_ay[i] - ay;
+        const double ez = m_az[i] - az;
+        const double error = std::sqrt((ex * ex + ey * ey + ez * ez)
+                                       / (ax * ax + ay * ay + az * az));
+        sumError += error;
+        maxError = Max(maxError, error);
+    }
+
+    const long long directTime = timer.GetUSec(false);
+
+    URHO3D_LOGINFOF("TrajectoryNBody: %u bodies, %u nodes, %.2fms per "
+                    "step, %.2fms first step, direct sum would be about "
+                    "%.2fms. Relative error: %.2e mean, %.2e max",
+                    count, m_nodes.Size(), double(time) / 1000.0 / c_repeats,
+                    double(coldTime) / 1000.0,
+                    double(directTime) / 1000.0 * count / Max(samples, 1u),
+                    sumError / Max(samples, 1u), maxError);
+
+    m_rootMass = rootMass;
+    m_scale = scale;
+
+    clear();
+}
+
+} // namespace osp
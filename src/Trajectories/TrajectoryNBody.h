@@ -0,0 +1,264 @@
+#pragma once
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Core/WorkQueue.h>
+
+#include "Trajectory.h"
+
+using namespace Urho3D;
+
+namespace osp
+{
+
+class Satellite;
+
+/**
+ * A cube of the Barnes-Hut octree. Nodes are stored depth first, so the
+ * first child of a node that has any is right after it, and m_next skips
+ * over all of its descendants.
+ */
+struct NBodyNode
+{
+    // Center of mass in the root's units
+    double m_x, m_y, m_z;
+
+    // Sum of the gravitational parameters inside, units^3/s^2
+    double m_mass;
+
+    // Width of the cube in the root's units
+    double m_size;
+
+    // Range of m_sorted with the bodies inside
+    unsigned m_first;
+    unsigned m_count;
+
+    // Index of the next node that isn't a descendant. m_next == index + 1
+    // for leaves.
+    unsigned m_next;
+};
+
+/**
+ * A body, sorted along a Z-order curve by its position in the octree
+ */
+struct NBodyKey
+{
+    uint64_t m_code;
+    unsigned m_body;
+};
+
+/**
+ * Satellites pulling on each other with gravity, instead of each following
+ * a fixed orbit. Integrated with leapfrog (kick-drift-kick) at a fixed time
+ * step, and forces are approximated with a Barnes-Hut octree so it stays
+ * O(n log n). The octree is built again from scratch every step, only the
+ * order of the bodies along its Z-order curve is kept between steps.
+ *
+ * Each TrajectoryNBody integrates the children of one Satellite, the root,
+ * which doesn't move. Their descendants move along with them, so only the
+ * subtrees that need it pay for N-body. A Satellite shouldn't be in this
+ * and any other Trajectory at once.
+ */
+class TrajectoryNBody : public Trajectory
+{
+    URHO3D_OBJECT(TrajectoryNBody, Trajectory)
+
+public:
+
+    TrajectoryNBody(Context* context);
+    ~TrajectoryNBody() = default;
+
+    /**
+     * Set the Satellite whose children are integrated. Bodies already added
+     * are removed.
+     * @param root [in] Frame of reference, parent of every body
+     * @param gravParam [in] G*M in m^3/s^2 of the root itself, which pulls
+     *                       from the origin but is never moved. Use 0 and
+     *                       add the heavy body as a child for a system
+     *                       where it should wobble too.
+     */
+    void set_root(Satellite* root, double gravParam);
+
+    Satellite* get_root() const { return m_root; }
+
+    /**
+     * Start integrating a Satellite from where it is now, and add it to the
+     * root's children if it isn't already
+     * @param sat [in] Satellite to move
+     * @param gravParam [in] G*M in m^3/s^2, 0 for spacecraft and other
+     *                       bodies too light to pull on anything
+     * @param velocity [in] Velocity relative to the root in m/s
+     * @return false if there's no root to add to
+     */
+    bool add_body(Satellite* sat, double gravParam, const Vector3& velocity);
+
+    /**
+     * @param seconds [in] Length of each step. Smaller is more accurate,
+     *                     but slower at high time warp. Doubled while the
+     *                     warp is too high to keep up with.
+     */
+    void set_time_step(double seconds);
+
+    /**
+     * @param theta [in] Barnes-Hut opening angle. Cubes narrower than this
+     *                   times their distance are treated as one body. 0 is
+     *                   exact, about 0.5 is the usual tradeoff.
+     */
+    void set_accuracy(double theta) { m_theta = Max(theta, 0.0); }
+
+    /**
+     * @return Number of bodies being integrated
+     */
+    unsigned size() const { return m_mass.Size(); }
+
+    void update(double time) override;
+
+    /**
+     * Calculate accelerations for part of m_sorted from the current octree.
+     * Only reads everything else, so ranges can be done on any thread.
+     * @param first [in] First body to calculate
+     * @param last [in] One past the last body to calculate
+     */
+    void calculate_accelerations(const NBodyKey* first,
+                                 const NBodyKey* last);
+
+    /**
+     * Time building the octree and calculating accelerations for a number
+     * of random bodies without Satellites, then compare against direct
+     * summation and log the results. Bodies already added are removed.
+     * @param count [in] Number of bodies
+     */
+    void debug_benchmark(unsigned count);
+
+private:
+
+    /**
+     * Add a body without touching the Satellite tree
+     * @param sat [in] Satellite to move, can be null
+     * @param pos [in] Position in the root's units
+     * @param gravParam [in] G*M in m^3/s^2
+     * @param velocity [in] Velocity in m/s
+     */
+    void push_body(Satellite* sat, const LongVector3& pos, double gravParam,
+                   const Vector3& velocity);
+
+    /**
+     * Remove a body, the last one is moved into its place
+     * @param index [in] Index of body to remove
+     */
+    void erase_body(unsigned index);
+
+    /**
+     * Remove bodies of Satellites that were deleted, or moved to a
+     * different parent
+     */
+    void remove_stale();
+
+    void clear();
+
+    /**
+     * Integrate every body that isn't pinned forward
+     * @param delta [in] Seconds to step
+     */
+    void step(double delta);
+
+    /**
+     * Build the octree from the current positions, then calculate every
+     * acceleration from it, spread over the WorkQueue's threads
+     */
+    void update_accelerations();
+
+    /**
+     * Sort bodies along a Z-order curve through a cube around them
+     */
+    void sort_bodies();
+
+    /**
+     * Add a node and all of its descendants to m_nodes
+     * @param first [in] First body of m_sorted inside
+     * @param count [in] Number of bodies inside
+     * @param level [in] Number of code bits per axis below this node
+     * @param size [in] Width of the node
+     * @return Index of the node added
+     */
+    unsigned build_node(unsigned first, unsigned count, int level,
+                        double size);
+
+    WeakPtr<Satellite> m_root;
+
+    // G*M of m_root in units^3/s^2
+    double m_rootMass;
+
+    // Meters to the root's units
+    double m_scale;
+
+    // Seconds integrated up to
+    double m_time;
+
+    // Step set with set_time_step, seconds
+    double m_timeStep;
+
+    // Step being taken, m_timeStep doubled as many times as time warp
+    // needs, seconds
+    double m_step;
+
+    // Time of the last update, when loaded bodies were last read
+    double m_updated;
+
+    // Barnes-Hut opening angle
+    double m_theta;
+
+    // Accelerations are out of date, as bodies were added or removed
+    bool m_dirty;
+
+    // Bodies were added or removed since sorting, so m_sorted has to be
+    // sorted from scratch instead of just touched up
+    bool m_unsorted;
+
+    // Bodies, structure of arrays. Every array is parallel to
+    // m_satellites
+
+    // Satellites being moved. Null for bodies that are only calculated,
+    // like in the benchmark
+    Vector< WeakPtr<Satellite> > m_satellites;
+
+    // Whole units of each position, relative to the root. Same as each
+    // Satellite's m_position.
+    PODVector<LongVector3> m_position;
+
+    // Fractions of a unit left over from drifting, so slow bodies still
+    // move at all
+    PODVector<double> m_fx, m_fy, m_fz;
+
+    // m_position plus the fractions, in doubles for the octree
+    PODVector<double> m_x, m_y, m_z;
+
+    // units/s
+    PODVector<double> m_vx, m_vy, m_vz;
+
+    // units/s^2
+    PODVector<double> m_ax, m_ay, m_az;
+
+    // G*M in units^3/s^2
+    PODVector<double> m_mass;
+
+    // Loaded Satellites only pull, the physics engine moves them. Their
+    // velocities are worked out from how far it moved them, for when
+    // they're unloaded.
+    PODVector<bool> m_pinned;
+
+    // Every body along the Z-order curve. Kept between steps, bodies
+    // barely move along it so sorting again is quick.
+    PODVector<NBodyKey> m_sorted;
+
+    PODVector<NBodyNode> m_nodes;
+
+    // Corner and width of the octree's root cube
+    double m_minX, m_minY, m_minZ;
+    double m_size;
+
+    // Work items for calculating accelerations on worker threads
+    Vector< SharedPtr<WorkItem> > m_items;
+};
+
+} // namespace osp
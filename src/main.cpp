@@ -6,6 +6,8 @@
 #include <Urho3D/AngelScript/ScriptFile.h>
 #include <Urho3D/Container/Vector.h>
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
 #include <Urho3D/Core/WorkQueue.h>
 #include <Urho3D/Engine/Application.h>
 #include <Urho3D/Engine/Engine.h>
@@ -25,6 +27,7 @@
 #include <Urho3D/Graphics/Texture2D.h>
 #include <Urho3D/Input/InputEvents.h>
 #include <Urho3D/Input/Input.h>
+#include <Urho3D/IO/File.h>
 #include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/IO/Log.h>
 #include <Urho3D/Math/MathDefs.h>
@@ -54,7 +57,15 @@
 #include "Machines/MachineControl.h"
 #include "OspUniverse.h"
 #include "Resource/GLTFFile.h"
+#include "Satellites/AsteroidField.h"
+#include "Satellites/SatellitePositions.h"
+#include "Satellites/SatellitePreviews.h"
+#include "Terrain/HeightPyramid.h"
 #include "Terrain/PlanetTerrain.h"
+#include "Terrain/TerrainDump.h"
+#include "Terrain/TerrainManager.h"
+#include "Terrain/TerrainScatter.h"
+#include "Trajectories/SoiScheduler.h"
 
 namespace osp
 {
@@ -69,6 +80,11 @@ public:
     Urho3D::SharedPtr<OspUniverse> m_osp;
     Vector<String> m_runImmediately;
 
+    // Tool to run instead of playing, such as -convertdem, and the
+    // arguments after it
+    String m_tool;
+    Vector<String> m_toolArguments;
+
     /**
      * This happens before the engine has been initialized
      * so it's usually minimal code setting defaults for
@@ -85,6 +101,9 @@ public:
         //Entity::RegisterObject(context);
         GLTFFile::RegisterObject(context);
         PlanetTerrain::RegisterObject(context);
+        TerrainScatter::RegisterObject(context);
+        SatellitePreviews::RegisterObject(context);
+        AsteroidField::RegisterObject(context);
 
         MachineControl::RegisterObject(context);
         MachineRocket::RegisterObject(context);
@@ -115,10 +134,57 @@ public:
         engineParameters_["WindowResizable"] = true;
         engineParameters_["WindowTitle"] = "OpenSpaceProgram Urho3D";
         engineParameters_["ResourcePaths"] = "Data;CoreData;OSPData";
+
+        // Tools that run instead of starting the game:
+        //
+        // Convert a DEM into a height pyramid
+        // OSP -convertdem <input> <output> <width> <height>
+        //                 <int16|uint16|float32> [bigendian] [scale]
+        //
+        // Move a camera along a path over a planet, then dump the terrain
+        // OSP -terraindump <output(.obj)> [camera path] [height pyramid]
+        //                  [radius]
+        //
+        // Compare two terrain dumps, fails if they're different
+        // OSP -terraincompare <first> <second> [tolerance]
+        const Vector<String>& arguments = GetArguments();
+        for (unsigned i = 0; i < arguments.Size(); i ++)
+        {
+            if (arguments[i] == "-convertdem"
+                    || arguments[i] == "-terraindump"
+                    || arguments[i] == "-terraincompare")
+            {
+                m_tool = arguments[i];
+                for (unsigned j = i + 1; j < arguments.Size(); j ++)
+                {
+                    m_toolArguments.Push(arguments[j]);
+                }
+                engineParameters_["Headless"] = true;
+                break;
+            }
+        }
     }
 
     void Start() override final
     {
+        if (!m_tool.Empty())
+        {
+            if (m_tool == "-convertdem")
+            {
+                convert_dem();
+            }
+            else if (m_tool == "-terraindump")
+            {
+                terrain_dump();
+            }
+            else if (m_tool == "-terraincompare")
+            {
+                terrain_compare();
+            }
+            engine_->Exit();
+            return;
+        }
+
         // Get the subsystem that is used to load resources
         ResourceCache* cache = GetSubsystem<ResourceCache>();
 
@@ -140,6 +206,15 @@ public:
         // Initialize OSP system
         m_osp = new OspUniverse(context_);
 
+        // Shares a triangle budget between all planets
+        context_->RegisterSubsystem(new TerrainManager(context_));
+
+        // Positions of every Satellite, shared by all ActiveAreas
+        context_->RegisterSubsystem(new SatellitePositions(context_));
+
+        // Moves Satellites on rails between spheres of influence
+        context_->RegisterSubsystem(new SoiScheduler(context_));
+
         // Create empty scene
         m_scene = new Scene(context_);
 
@@ -231,6 +306,212 @@ public:
     { }
 
 
+    /**
+     * Convert a raw DEM to a HeightPyramid using the arguments in
+     * m_toolArguments. Sets exit code to failure if anything goes wrong.
+     */
+    void convert_dem()
+    {
+        if (m_toolArguments.Size() < 5)
+        {
+            URHO3D_LOGERROR("Usage: -convertdem <input> <output> <width> "
+                            "<height> <int16|uint16|float32> "
+                            "[bigendian] [scale]");
+            exitCode_ = EXIT_FAILURE;
+            return;
+        }
+
+        HeightPyramid::RawFormat format;
+        if (m_toolArguments[4] == "int16")
+        {
+            format = HeightPyramid::RawFormat::INT16;
+        }
+        else if (m_toolArguments[4] == "uint16")
+        {
+            format = HeightPyramid::RawFormat::UINT16;
+        }
+        else if (m_toolArguments[4] == "float32")
+        {
+            format = HeightPyramid::RawFormat::FLOAT32;
+        }
+        else
+        {
+            URHO3D_LOGERRORF("Unknown DEM format: %s",
+                             m_toolArguments[4].CString());
+            exitCode_ = EXIT_FAILURE;
+            return;
+        }
+
+        const bool bigEndian = m_toolArguments.Size() > 5
+                                && m_toolArguments[5] == "bigendian";
+        const float scale = (m_toolArguments.Size() > 6)
+                                ? ToFloat(m_toolArguments[6]) : 1.0f;
+
+        if (!HeightPyramid::convert_raw(m_toolArguments[0],
+                                        m_toolArguments[1],
+                                        ToUInt(m_toolArguments[2]),
+                                        ToUInt(m_toolArguments[3]),
+                                        format, bigEndian, scale))
+        {
+            exitCode_ = EXIT_FAILURE;
+        }
+    }
+
+    /**
+     * Run a PlanetWrenderer along a camera path without drawing anything,
+     * then dump its terrain using the arguments in m_toolArguments. Sets
+     * exit code to failure if anything goes wrong.
+     *
+     * The camera path is a text file of "x y z" positions relative to the
+     * planet's center, one for each update at 60 updates per second. Without
+     * one, the camera spirals down from orbit to the surface.
+     */
+    void terrain_dump()
+    {
+        if (m_toolArguments.Empty())
+        {
+            URHO3D_LOGERROR("Usage: -terraindump <output(.obj)> "
+                            "[camera path] [height pyramid] [radius]");
+            exitCode_ = EXIT_FAILURE;
+            return;
+        }
+
+        const String& output = m_toolArguments[0];
+        const String pathFile = (m_toolArguments.Size() > 1)
+                                    ? m_toolArguments[1] : String::EMPTY;
+        const String heightFile = (m_toolArguments.Size() > 2)
+                                    ? m_toolArguments[2] : String::EMPTY;
+        const float radius = (m_toolArguments.Size() > 3)
+                                    ? ToFloat(m_toolArguments[3]) : 4000.0f;
+        const float updateRate = 60.0f;
+
+        PODVector<Vector3> path;
+
+        if (!pathFile.Empty())
+        {
+            File file(context_);
+            if (!file.Open(pathFile, FILE_READ))
+            {
+                exitCode_ = EXIT_FAILURE;
+                return;
+            }
+
+            while (!file.IsEof())
+            {
+                const String line = file.ReadLine().Trimmed();
+                if (line.Empty() || line.StartsWith("#"))
+                {
+                    continue;
+                }
+
+                const Vector<String> parts = line.Split(' ');
+                if (parts.Size() != 3)
+                {
+                    URHO3D_LOGERRORF("Bad camera position: %s",
+                                     line.CString());
+                    exitCode_ = EXIT_FAILURE;
+                    return;
+                }
+
+                path.Push(Vector3(ToFloat(parts[0]), ToFloat(parts[1]),
+                                  ToFloat(parts[2])));
+            }
+        }
+        else
+        {
+            // Two turns around the planet over 20 seconds, from 4 radii
+            // down to just above the surface
+            const unsigned steps = unsigned(updateRate * 20.0f);
+            for (unsigned i = 0; i < steps; i ++)
+            {
+                const float t = float(i) / float(steps - 1);
+                const float angle = t * 720.0f;
+                const Vector3 dir(Cos(angle), Sin(angle * 0.5f) * 0.5f,
+                                  Sin(angle));
+                path.Push(dir.Normalized() * radius * Lerp(4.0f, 1.01f, t));
+            }
+        }
+
+        PlanetWrenderer planet;
+
+        if (!heightFile.Empty())
+        {
+            SharedPtr<HeightPyramid> heights(new HeightPyramid);
+            if (!heights->open(heightFile))
+            {
+                exitCode_ = EXIT_FAILURE;
+                return;
+            }
+            planet.set_height_data(heights);
+        }
+
+        HiresTimer timer;
+        planet.initialize(context_, nullptr, radius);
+        const long long initTime = timer.GetUSec(true);
+
+        long long totalTime = 0;
+        long long maxTime = 0;
+        for (unsigned i = 0; i < path.Size(); i ++)
+        {
+            // Velocity is only used for prefetching, so guess it from the
+            // next position
+            const Vector3 velocity = (i + 1 < path.Size())
+                            ? (path[i + 1] - path[i]) * updateRate
+                            : Vector3::ZERO;
+
+            planet.update(path[i], velocity);
+
+            const long long time = timer.GetUSec(true);
+            totalTime += time;
+            maxTime = Max(maxTime, time);
+        }
+
+        TerrainDump dump;
+        planet.debug_dump(dump);
+
+        URHO3D_LOGINFOF("\nTerrain Dump:\n"
+                " - Initialize:   %lld us\n"
+                " - Updates:      %u, %lld us total, %lld us slowest\n"
+                " - Triangles:    %u\n"
+                " - Chunks:       %u, %u subdivided",
+                initTime, path.Size(), totalTime, maxTime, planet.get_triangle_count(),
+                dump.m_chunks.Size(), dump.m_subdivided.Size());
+        planet.log_stats();
+
+        const bool success = output.EndsWith(".obj", false)
+                                ? dump.save_obj(output) : dump.save(output);
+        if (!success)
+        {
+            exitCode_ = EXIT_FAILURE;
+        }
+    }
+
+    /**
+     * Compare two terrain dumps using the arguments in m_toolArguments. Sets
+     * exit code to failure if they're different, or anything goes wrong.
+     */
+    void terrain_compare()
+    {
+        if (m_toolArguments.Size() < 2)
+        {
+            URHO3D_LOGERROR("Usage: -terraincompare <first> <second> "
+                            "[tolerance]");
+            exitCode_ = EXIT_FAILURE;
+            return;
+        }
+
+        const float tolerance = (m_toolArguments.Size() > 2)
+                                    ? ToFloat(m_toolArguments[2]) : 0.0f;
+
+        TerrainDump a;
+        TerrainDump b;
+        if (!a.load(m_toolArguments[0]) || !b.load(m_toolArguments[1])
+                || TerrainDump::compare(a, b, tolerance) != 0)
+        {
+            exitCode_ = EXIT_FAILURE;
+        }
+    }
+
     /**
      * Urho3D Handler called each time a key is pressed
      * Most of this should be debug code, maybe open a console some day?